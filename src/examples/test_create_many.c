@@ -0,0 +1,221 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * This tests plc_tag_create_many() with a batch that has bad names in the
+ * middle.  The tags before and after the bad names must still be created
+ * and work, and each bad name must get its own error.
+ *
+ * Run it against the ab_server simulator:
+ *
+ *    ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[100]
+ */
+
+#define REQUIRED_VERSION 2,1,21
+#define TAG_BASE "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1"
+#define ARRAY_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_size=4&elem_count=100&name=TestBigArray"
+#define DATA_TIMEOUT (5000)
+
+#define NUM_TAGS (20)
+#define MISSING_TAG_INDEX (10)
+#define EMPTY_NAME_INDEX (15)
+
+
+static int test_partial_failure(void)
+{
+    const char *names[NUM_TAGS];
+    char name_buf[NUM_TAGS][32];
+    int32_t tag_ids[NUM_TAGS];
+    int32_t array_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+    int i;
+
+    fprintf(stderr, "Testing plc_tag_create_many() with bad names in the middle of the batch.\n");
+
+    for(i=0; i < NUM_TAGS; i++) {
+        snprintf_platform(name_buf[i], sizeof(name_buf[i]), "TestBigArray[%d]", i);
+        names[i] = name_buf[i];
+    }
+
+    names[MISSING_TAG_INDEX] = "NoSuchTag";
+    names[EMPTY_NAME_INDEX] = "";
+
+    rc = plc_tag_create_many(TAG_BASE, names, NUM_TAGS, tag_ids, DATA_TIMEOUT);
+
+    /* the first error, in name order, is returned. */
+    if(rc == PLCTAG_STATUS_OK || rc != tag_ids[MISSING_TAG_INDEX]) {
+        fprintf(stderr, "ERROR: expected the error for the missing tag, got %s!\n", plc_tag_decode_error(rc));
+        errors++;
+    }
+
+    if(tag_ids[EMPTY_NAME_INDEX] != PLCTAG_ERR_BAD_PARAM) {
+        fprintf(stderr, "ERROR: expected PLCTAG_ERR_BAD_PARAM for the empty name, got %s!\n", plc_tag_decode_error(tag_ids[EMPTY_NAME_INDEX]));
+        errors++;
+    }
+
+    /* every other tag must work. */
+    for(i=0; i < NUM_TAGS; i++) {
+        if(i == MISSING_TAG_INDEX || i == EMPTY_NAME_INDEX) {
+            continue;
+        }
+
+        if(tag_ids[i] < 0) {
+            fprintf(stderr, "ERROR: tag %d, %s, was not created, %s!\n", i, names[i], plc_tag_decode_error(tag_ids[i]));
+            errors++;
+            continue;
+        }
+
+        plc_tag_set_int32(tag_ids[i], 0, 1000 + i);
+
+        rc = plc_tag_write(tag_ids[i], DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s writing tag %d!\n", plc_tag_decode_error(rc), i);
+            errors++;
+        }
+    }
+
+    /* check the values from one tag over the whole array. */
+    array_tag = plc_tag_create(ARRAY_ATTRIBS, DATA_TIMEOUT);
+    if(array_tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create the array tag!\n", plc_tag_decode_error(array_tag));
+        errors++;
+    } else {
+        rc = plc_tag_read(array_tag, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s reading the array tag!\n", plc_tag_decode_error(rc));
+            errors++;
+        } else {
+            for(i=0; i < NUM_TAGS; i++) {
+                if(tag_ids[i] >= 0 && plc_tag_get_int32(array_tag, i*4) != 1000 + i) {
+                    fprintf(stderr, "ERROR: element %d is %d, expected %d!\n", i, plc_tag_get_int32(array_tag, i*4), 1000 + i);
+                    errors++;
+                }
+            }
+        }
+
+        plc_tag_destroy(array_tag);
+    }
+
+    for(i=0; i < NUM_TAGS; i++) {
+        if(tag_ids[i] >= 0) {
+            plc_tag_destroy(tag_ids[i]);
+        }
+    }
+
+    return errors;
+}
+
+
+static int test_no_wait(void)
+{
+    const char *names[] = { "TestBigArray[0]", "NoSuchTag", "TestBigArray[1]" };
+    int32_t tag_ids[3];
+    int64_t timeout_time = 0;
+    int errors = 0;
+    int pending = 0;
+    int i;
+
+    fprintf(stderr, "Testing plc_tag_create_many() without waiting.\n");
+
+    plc_tag_create_many(TAG_BASE, names, 3, tag_ids, 0);
+
+    /* the handles are valid now, the tags finish in the background. */
+    timeout_time = util_time_ms() + DATA_TIMEOUT;
+
+    do {
+        pending = 0;
+
+        for(i=0; i < 3; i++) {
+            if(tag_ids[i] >= 0 && plc_tag_status(tag_ids[i]) == PLCTAG_STATUS_PENDING) {
+                pending++;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    } while(pending && timeout_time > util_time_ms());
+
+    if(pending) {
+        fprintf(stderr, "ERROR: %d tags are still pending!\n", pending);
+        errors++;
+    }
+
+    for(i=0; i < 3; i++) {
+        int status = (tag_ids[i] >= 0 ? plc_tag_status(tag_ids[i]) : tag_ids[i]);
+        int expect_ok = (i != 1);
+
+        if(expect_ok != (status == PLCTAG_STATUS_OK)) {
+            fprintf(stderr, "ERROR: tag %d, %s, has status %s!\n", i, names[i], plc_tag_decode_error(status));
+            errors++;
+        }
+
+        if(tag_ids[i] >= 0) {
+            plc_tag_destroy(tag_ids[i]);
+        }
+    }
+
+    return errors;
+}
+
+
+int main()
+{
+    int errors = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    errors += test_partial_failure();
+    errors += test_no_wait();
+
+    if(errors) {
+        fprintf(stderr, "FAILED %d tests.\n", errors);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
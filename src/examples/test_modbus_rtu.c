@@ -0,0 +1,618 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+/* for posix_openpt() and friends. */
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <termios.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * This tests Modbus RTU against a responder on a pseudo terminal, so no
+ * serial hardware is needed.  The library opens the terminal side as if
+ * it were a serial port.  A thread answers on the other side for two
+ * servers on the same line, units 1 and 2.
+ *
+ * The responder always sends a reply in two pieces so that the library
+ * has to put the frame back together.  It can also corrupt the CRC of a
+ * reply or send a stray reply from the other unit first.
+ *
+ * POSIX only.
+ */
+
+#define REQUIRED_VERSION 2,1,21
+#define DATA_TIMEOUT (3000)
+#define RESPONSE_TIMEOUT (200)
+#define TAG_ATTRIBS "protocol=modbus-rtu&gateway=%s&path=%d&name=hr%d&elem_count=%d&baud_rate=115200&response_timeout_ms=%d"
+
+#define NUM_UNITS (2)
+#define NUM_REGISTERS (1000)
+#define MAX_FRAME (256)
+
+#define MODE_NORMAL (0)
+#define MODE_BAD_CRC (1)
+#define MODE_STRAY_FRAME (2)
+
+static int pty_fd = -1;
+static char pty_name[128];
+static pthread_mutex_t responder_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint16_t registers[NUM_UNITS + 1][NUM_REGISTERS];
+static int responder_mode = MODE_NORMAL;
+static int responder_done = 0;
+static int frames_seen[NUM_UNITS + 2];
+
+
+
+static uint16_t crc16(uint8_t *data, int size)
+{
+    uint16_t crc = 0xFFFF;
+
+    for(int i=0; i < size; i++) {
+        crc ^= data[i];
+
+        for(int bit=0; bit < 8; bit++) {
+            crc = (uint16_t)((crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1));
+        }
+    }
+
+    return crc;
+}
+
+
+static int get_uint16(uint8_t *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+
+static void set_mode(int mode)
+{
+    pthread_mutex_lock(&responder_mutex);
+    responder_mode = mode;
+    pthread_mutex_unlock(&responder_mutex);
+}
+
+
+static int get_register(int unit, int addr)
+{
+    int val;
+
+    pthread_mutex_lock(&responder_mutex);
+    val = registers[unit][addr];
+    pthread_mutex_unlock(&responder_mutex);
+
+    return val;
+}
+
+
+static int get_frames_seen(int unit)
+{
+    int count;
+
+    pthread_mutex_lock(&responder_mutex);
+    count = frames_seen[unit];
+    pthread_mutex_unlock(&responder_mutex);
+
+    return count;
+}
+
+
+/* the size of the request frame, 0 if we need more bytes, -1 if we cannot tell. */
+static int request_size(uint8_t *frame, int len)
+{
+    if(len < 2) {
+        return 0;
+    }
+
+    switch(frame[1]) {
+        case 3:
+        case 4:
+        case 6:
+            return 8;
+
+        case 16:
+            return (len < 7 ? 0 : 9 + frame[6]);
+
+        default:
+            return -1;
+    }
+}
+
+
+static void send_reply(uint8_t *reply, int size, int bad_crc)
+{
+    uint16_t crc = crc16(reply, size);
+
+    reply[size++] = (uint8_t)(crc & 0xFF);
+    reply[size++] = (uint8_t)(crc >> 8);
+
+    if(bad_crc) {
+        reply[size - 1] ^= 0xFF;
+    }
+
+    /* a real server takes a moment to answer. */
+    util_sleep_ms(2);
+
+    if(write(pty_fd, reply, 3) != 3) {
+        fprintf(stderr, "Responder unable to write the start of a reply!\n");
+        return;
+    }
+
+    /* the pause is well inside the 3.5 character frame gap. */
+    util_sleep_ms(1);
+
+    if(write(pty_fd, reply + 3, (size_t)(size - 3)) != size - 3) {
+        fprintf(stderr, "Responder unable to write the rest of a reply!\n");
+    }
+}
+
+
+static void handle_request(uint8_t *frame, int size)
+{
+    uint8_t reply[MAX_FRAME + 2];
+    int unit = frame[0];
+    int fc = frame[1];
+    int addr = get_uint16(frame + 2);
+    int count = (fc == 6 ? 1 : get_uint16(frame + 4));
+    int reply_size = 0;
+    int mode;
+
+    if(crc16(frame, size - 2) != (uint16_t)(frame[size - 2] | (frame[size - 1] << 8))) {
+        fprintf(stderr, "Responder got a request with a bad CRC!\n");
+        return;
+    }
+
+    pthread_mutex_lock(&responder_mutex);
+
+    mode = responder_mode;
+
+    /* units that are not on the line stay quiet. */
+    frames_seen[unit > NUM_UNITS ? NUM_UNITS + 1 : unit]++;
+
+    reply[0] = (uint8_t)unit;
+    reply[1] = (uint8_t)fc;
+
+    if(unit > NUM_UNITS) {
+        reply_size = 0;
+    } else if(addr + count > NUM_REGISTERS) {
+        reply[1] = (uint8_t)(fc | 0x80);
+        reply[2] = 2; /* illegal data address */
+        reply_size = 3;
+    } else if(fc == 3 || fc == 4) {
+        reply[2] = (uint8_t)(count * 2);
+
+        for(int i=0; i < count; i++) {
+            reply[3 + i*2] = (uint8_t)(registers[unit][addr + i] >> 8);
+            reply[4 + i*2] = (uint8_t)(registers[unit][addr + i] & 0xFF);
+        }
+
+        reply_size = 3 + count * 2;
+    } else if(fc == 6 || fc == 16) {
+        uint8_t *values = frame + (fc == 6 ? 4 : 7);
+
+        /* unit 0 is a broadcast to every unit. */
+        for(int u = (unit ? unit : 1); u <= (unit ? unit : NUM_UNITS); u++) {
+            for(int i=0; i < count; i++) {
+                registers[u][addr + i] = (uint16_t)get_uint16(values + i*2);
+            }
+        }
+
+        memcpy(reply, frame, 6);
+        reply_size = 6;
+    } else {
+        reply[1] = (uint8_t)(fc | 0x80);
+        reply[2] = 1; /* illegal function */
+        reply_size = 3;
+    }
+
+    pthread_mutex_unlock(&responder_mutex);
+
+    /* nobody answers a broadcast. */
+    if(unit == 0 || reply_size == 0) {
+        return;
+    }
+
+    if(mode == MODE_STRAY_FRAME) {
+        uint8_t stray[MAX_FRAME + 2];
+
+        /* a reply from the wrong unit must be dropped by the master. */
+        memcpy(stray, reply, (size_t)reply_size);
+        stray[0] = (uint8_t)(unit == 1 ? 2 : 1);
+        send_reply(stray, reply_size, 0);
+    }
+
+    send_reply(reply, reply_size, (mode == MODE_BAD_CRC));
+}
+
+
+static void *responder(void *arg)
+{
+    uint8_t buf[MAX_FRAME * 2];
+    int len = 0;
+
+    (void)arg;
+
+    while(1) {
+        fd_set fds;
+        struct timeval tv;
+        int rc;
+        int done;
+
+        pthread_mutex_lock(&responder_mutex);
+        done = responder_done;
+        pthread_mutex_unlock(&responder_mutex);
+
+        if(done) {
+            break;
+        }
+
+        FD_ZERO(&fds);
+        FD_SET(pty_fd, &fds);
+        tv.tv_sec = 0;
+        tv.tv_usec = 20000;
+
+        rc = select(pty_fd + 1, &fds, NULL, NULL, &tv);
+        if(rc <= 0) {
+            /* a quiet line ends any partial frame. */
+            len = 0;
+            continue;
+        }
+
+        rc = (int)read(pty_fd, buf + len, sizeof(buf) - (size_t)len);
+        if(rc <= 0) {
+            len = 0;
+            continue;
+        }
+
+        len += rc;
+
+        while(len > 0) {
+            int size = request_size(buf, len);
+
+            if(size < 0) {
+                fprintf(stderr, "Responder got an unsupported function code %d!\n", buf[1]);
+                len = 0;
+                break;
+            }
+
+            if(size == 0 || len < size) {
+                break;
+            }
+
+            handle_request(buf, size);
+
+            memmove(buf, buf + size, (size_t)(len - size));
+            len -= size;
+        }
+    }
+
+    return NULL;
+}
+
+
+static int open_pty(void)
+{
+    struct termios tio;
+    int slave_fd;
+
+    pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(pty_fd < 0 || grantpt(pty_fd) != 0 || unlockpt(pty_fd) != 0 || !ptsname(pty_fd)) {
+        fprintf(stderr, "Unable to set up a pseudo terminal!\n");
+        return -1;
+    }
+
+    snprintf_platform(pty_name, sizeof(pty_name), "%s", ptsname(pty_fd));
+
+    /* keep the terminal side open so the line stays up when the library closes it. */
+    slave_fd = open(pty_name, O_RDWR | O_NOCTTY);
+    if(slave_fd < 0 || tcgetattr(slave_fd, &tio) != 0) {
+        fprintf(stderr, "Unable to open %s!\n", pty_name);
+        return -1;
+    }
+
+    tio.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+    tio.c_oflag &= (tcflag_t)~OPOST;
+    tio.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+
+    if(tcsetattr(slave_fd, TCSANOW, &tio) != 0) {
+        fprintf(stderr, "Unable to set %s to raw mode!\n", pty_name);
+        return -1;
+    }
+
+    return slave_fd;
+}
+
+
+static int32_t create_tag(int unit, int reg, int count)
+{
+    char attribs[256];
+
+    snprintf_platform(attribs, sizeof(attribs), TAG_ATTRIBS, pty_name, unit, reg, count, RESPONSE_TIMEOUT);
+
+    return plc_tag_create(attribs, DATA_TIMEOUT);
+}
+
+
+static int test_units(void)
+{
+    int32_t tags[NUM_UNITS + 1];
+    int32_t broadcast = 0;
+    int64_t timeout_time = 0;
+    int errors = 0;
+    int rc;
+
+    fprintf(stderr, "Testing two units on one line.\n");
+
+    for(int unit=1; unit <= NUM_UNITS; unit++) {
+        tags[unit] = create_tag(unit, 100, 10);
+        if(tags[unit] < 0) {
+            fprintf(stderr, "ERROR %s: Could not create tag for unit %d!\n", plc_tag_decode_error(tags[unit]), unit);
+            return 1;
+        }
+
+        for(int i=0; i < 10; i++) {
+            if(plc_tag_get_uint16(tags[unit], i*2) != (uint16_t)((100 + i) * unit)) {
+                fprintf(stderr, "ERROR: unit %d register %d is %u, expected %d!\n", unit, 100 + i, plc_tag_get_uint16(tags[unit], i*2), (100 + i) * unit);
+                errors++;
+            }
+        }
+    }
+
+    /* a write to one unit must not reach the other. */
+    plc_tag_set_uint16(tags[1], 0, 4321);
+    rc = plc_tag_write(tags[1], DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s writing unit 1!\n", plc_tag_decode_error(rc));
+        errors++;
+    }
+
+    if(get_register(1, 100) != 4321 || get_register(2, 100) != 200) {
+        fprintf(stderr, "ERROR: after the write unit 1 has %d and unit 2 has %d!\n", get_register(1, 100), get_register(2, 100));
+        errors++;
+    }
+
+    /* a broadcast reaches every unit and gets no reply. */
+    broadcast = create_tag(0, 500, 1);
+    if(broadcast < 0) {
+        fprintf(stderr, "ERROR %s: Could not create broadcast tag!\n", plc_tag_decode_error(broadcast));
+        errors++;
+    } else {
+        plc_tag_set_uint16(broadcast, 0, 777);
+        rc = plc_tag_write(broadcast, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s writing the broadcast tag!\n", plc_tag_decode_error(rc));
+            errors++;
+        }
+
+        timeout_time = util_time_ms() + DATA_TIMEOUT;
+        while((get_register(1, 500) != 777 || get_register(2, 500) != 777) && timeout_time > util_time_ms()) {
+            util_sleep_ms(1);
+        }
+
+        if(get_register(1, 500) != 777 || get_register(2, 500) != 777) {
+            fprintf(stderr, "ERROR: broadcast did not reach both units!\n");
+            errors++;
+        }
+
+        plc_tag_destroy(broadcast);
+    }
+
+    for(int unit=1; unit <= NUM_UNITS; unit++) {
+        plc_tag_destroy(tags[unit]);
+    }
+
+    return errors;
+}
+
+
+static int test_bad_crc(void)
+{
+    int32_t tag;
+    int errors = 0;
+    int rc;
+
+    fprintf(stderr, "Testing replies with a bad CRC.\n");
+
+    tag = create_tag(2, 300, 4);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    /* the reply is dropped, so the read fails when the response timeout runs out. */
+    set_mode(MODE_BAD_CRC);
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc == PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: read with a bad CRC succeeded!\n");
+        errors++;
+    }
+
+    set_mode(MODE_NORMAL);
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK || plc_tag_get_uint16(tag, 0) != 600) {
+        fprintf(stderr, "ERROR: %s reading after the bad CRC!\n", plc_tag_decode_error(rc));
+        errors++;
+    }
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+static int test_stray_frame(void)
+{
+    int32_t tag;
+    int errors = 0;
+    int rc;
+
+    fprintf(stderr, "Testing a stray reply from the wrong unit.\n");
+
+    tag = create_tag(1, 400, 8);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    set_mode(MODE_STRAY_FRAME);
+
+    for(int i=0; i < 8; i++) {
+        plc_tag_set_uint16(tag, i*2, 0);
+    }
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading with a stray reply on the line!\n", plc_tag_decode_error(rc));
+        errors++;
+    } else {
+        for(int i=0; i < 8; i++) {
+            if(plc_tag_get_uint16(tag, i*2) != 400 + i) {
+                fprintf(stderr, "ERROR: register %d is %u, expected %d!\n", 400 + i, plc_tag_get_uint16(tag, i*2), 400 + i);
+                errors++;
+            }
+        }
+    }
+
+    set_mode(MODE_NORMAL);
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+static int test_timeout(void)
+{
+    int32_t tag;
+    int64_t start = 0;
+    int64_t elapsed = 0;
+    int errors = 0;
+    int seen = get_frames_seen(NUM_UNITS + 1);
+
+    fprintf(stderr, "Testing a unit that does not answer.\n");
+
+    start = util_time_ms();
+    tag = create_tag(NUM_UNITS + 1, 100, 1);
+    elapsed = util_time_ms() - start;
+
+    if(tag >= 0) {
+        fprintf(stderr, "ERROR: tag for a missing unit was created!\n");
+        plc_tag_destroy(tag);
+        errors++;
+    }
+
+    if(get_frames_seen(NUM_UNITS + 1) == seen) {
+        fprintf(stderr, "ERROR: the request for the missing unit never reached the line!\n");
+        errors++;
+    }
+
+    if(elapsed < RESPONSE_TIMEOUT || elapsed >= DATA_TIMEOUT) {
+        fprintf(stderr, "ERROR: giving up took %dms, expected the %dms response timeout!\n", (int)elapsed, RESPONSE_TIMEOUT);
+        errors++;
+    }
+
+    /* the line must still work. */
+    tag = create_tag(1, 100, 1);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag after the timeout!\n", plc_tag_decode_error(tag));
+        errors++;
+    } else {
+        plc_tag_destroy(tag);
+    }
+
+    return errors;
+}
+
+
+int main()
+{
+    pthread_t responder_thread;
+    int slave_fd;
+    int errors = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    for(int unit=1; unit <= NUM_UNITS; unit++) {
+        for(int i=0; i < NUM_REGISTERS; i++) {
+            registers[unit][i] = (uint16_t)(i * unit);
+        }
+    }
+
+    slave_fd = open_pty();
+    if(slave_fd < 0) {
+        exit(1);
+    }
+
+    fprintf(stderr, "Responding on %s.\n", pty_name);
+
+    pthread_create(&responder_thread, NULL, responder, NULL);
+
+    errors += test_units();
+    errors += test_bad_crc();
+    errors += test_stray_frame();
+    errors += test_timeout();
+
+    pthread_mutex_lock(&responder_mutex);
+    responder_done = 1;
+    pthread_mutex_unlock(&responder_mutex);
+
+    pthread_join(responder_thread, NULL);
+
+    plc_tag_shutdown();
+
+    close(slave_fd);
+    close(pty_fd);
+
+    if(errors) {
+        fprintf(stderr, "FAILED %d tests.\n", errors);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
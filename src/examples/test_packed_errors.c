@@ -0,0 +1,289 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * This tests what callers see when one request in a packed set fails.
+ * Reads and writes of several tags are started at once, so that the
+ * library packs them into one Multiple Service Packet, and one of the
+ * tags does not exist in the PLC.  That tag gets its own error.  The
+ * others, including a write big enough to be split into fragments,
+ * complete normally.  Nothing is rolled back for the tags that worked.
+ *
+ * Run it against the ab_server simulator:
+ *
+ *    ab_server --plc=ControlLogix --path=1,0 --tag=TestDINT:DINT[10] --tag=TestBigArray:DINT[1000]
+ */
+
+#define REQUIRED_VERSION 2,1,21
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix"
+#define SMALL_TAG_ATTRIBS TAG_ATTRIBS "&elem_size=4&elem_count=1&name=TestDINT[%d]"
+#define CHECK_TAG_ATTRIBS TAG_ATTRIBS "&elem_size=4&elem_count=4&name=TestDINT"
+#define BIG_TAG_ATTRIBS TAG_ATTRIBS "&elem_size=4&elem_count=1000&name=TestBigArray"
+#define MISSING_TAG_ATTRIBS TAG_ATTRIBS "&elem_type=dint&elem_count=1&name=NoSuchTag&lazy=1"
+#define NUM_SMALL_TAGS (4)
+#define BIG_ELEM_COUNT (1000)
+#define NUM_TAGS (NUM_SMALL_TAGS + 2)
+#define MISSING_TAG_INDEX (2)
+#define DATA_TIMEOUT (5000)
+
+
+static int wait_for_tags(int32_t *tags, int num_tags)
+{
+    int64_t end_time = util_time_ms() + DATA_TIMEOUT;
+    int pending = 1;
+
+    while(pending && util_time_ms() < end_time) {
+        pending = 0;
+
+        for(int i=0; i < num_tags; i++) {
+            if(plc_tag_status(tags[i]) == PLCTAG_STATUS_PENDING) {
+                pending = 1;
+            }
+        }
+
+        if(pending) {
+            util_sleep_ms(1);
+        }
+    }
+
+    if(pending) {
+        fprintf(stderr, "ERROR: timed out waiting for the tags!\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int check_statuses(int32_t *tags, int num_tags, const char *what)
+{
+    int errors = 0;
+
+    for(int i=0; i < num_tags; i++) {
+        int rc = plc_tag_status(tags[i]);
+
+        if(i == MISSING_TAG_INDEX) {
+            if(rc == PLCTAG_STATUS_OK) {
+                fprintf(stderr, "ERROR: %s of the missing tag succeeded!\n", what);
+                errors++;
+            } else {
+                fprintf(stderr, "The %s of the missing tag failed with %s.\n", what, plc_tag_decode_error(rc));
+            }
+        } else if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s of tag %d failed with %s!\n", what, i, plc_tag_decode_error(rc));
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+static int check_plc_values(int32_t small_check_tag, int32_t big_check_tag, int32_t base)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    if((rc = plc_tag_read(small_check_tag, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading back TestDINT!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    if((rc = plc_tag_read(big_check_tag, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading back TestBigArray!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(int i=0; i < NUM_SMALL_TAGS; i++) {
+        if(plc_tag_get_int32(small_check_tag, i * 4) != base + i) {
+            fprintf(stderr, "ERROR: TestDINT[%d] is %d, expected %d!\n", i, plc_tag_get_int32(small_check_tag, i * 4), base + i);
+            errors++;
+        }
+    }
+
+    for(int i=0; i < BIG_ELEM_COUNT; i++) {
+        if(plc_tag_get_int32(big_check_tag, i * 4) != base + i) {
+            fprintf(stderr, "ERROR: TestBigArray[%d] is %d, expected %d!\n", i, plc_tag_get_int32(big_check_tag, i * 4), base + i);
+            errors++;
+            break;
+        }
+    }
+
+    return errors;
+}
+
+
+static int test_packed_writes(int32_t *tags, int32_t small_check_tag, int32_t big_check_tag, int32_t base)
+{
+    int small_index = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing packed writes with one missing tag.\n");
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(i == MISSING_TAG_INDEX) {
+            plc_tag_set_int32(tags[i], 0, base);
+        } else if(i == NUM_TAGS - 1) {
+            for(int j=0; j < BIG_ELEM_COUNT; j++) {
+                plc_tag_set_int32(tags[i], j * 4, base + j);
+            }
+        } else {
+            plc_tag_set_int32(tags[i], 0, base + small_index);
+            small_index++;
+        }
+    }
+
+    /* start them all before waiting so that they go out together. */
+    for(int i=0; i < NUM_TAGS; i++) {
+        rc = plc_tag_write(tags[i], 0);
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s starting the write of tag %d!\n", plc_tag_decode_error(rc), i);
+            errors++;
+        }
+    }
+
+    if(wait_for_tags(tags, NUM_TAGS)) {
+        return errors + 1;
+    }
+
+    errors += check_statuses(tags, NUM_TAGS, "write");
+
+    /* the writes that worked stay written. */
+    errors += check_plc_values(small_check_tag, big_check_tag, base);
+
+    return errors;
+}
+
+
+static int test_packed_reads(int32_t *tags, int32_t base)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing packed reads with one missing tag.\n");
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        rc = plc_tag_read(tags[i], 0);
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s starting the read of tag %d!\n", plc_tag_decode_error(rc), i);
+            errors++;
+        }
+    }
+
+    if(wait_for_tags(tags, NUM_TAGS)) {
+        return errors + 1;
+    }
+
+    errors += check_statuses(tags, NUM_TAGS, "read");
+
+    /* the first small tag holds the base value from the writes. */
+    if(plc_tag_get_int32(tags[0], 0) != base) {
+        fprintf(stderr, "ERROR: read of tag 0 got %d, expected %d!\n", plc_tag_get_int32(tags[0], 0), base);
+        errors++;
+    }
+
+    return errors;
+}
+
+
+int main()
+{
+    int32_t tags[NUM_TAGS] = {0};
+    int32_t small_check_tag = 0;
+    int32_t big_check_tag = 0;
+    int small_index = 0;
+    char attribs[256];
+    int errors = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    /* the missing tag sits between good ones, the big tag is last. */
+    for(int i=0; i < NUM_TAGS; i++) {
+        if(i == MISSING_TAG_INDEX) {
+            /* a lazy tag with a known type is not read when it is created. */
+            tags[i] = plc_tag_create(MISSING_TAG_ATTRIBS, DATA_TIMEOUT);
+        } else if(i == NUM_TAGS - 1) {
+            tags[i] = plc_tag_create(BIG_TAG_ATTRIBS, DATA_TIMEOUT);
+        } else {
+            snprintf(attribs, sizeof(attribs), SMALL_TAG_ATTRIBS, small_index);
+            tags[i] = plc_tag_create(attribs, DATA_TIMEOUT);
+            small_index++;
+        }
+
+        if(tags[i] < 0) {
+            fprintf(stderr, "ERROR %s: Could not create tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            return 1;
+        }
+    }
+
+    /* separate tags to read back what is in the PLC. */
+    small_check_tag = plc_tag_create(CHECK_TAG_ATTRIBS, DATA_TIMEOUT);
+    big_check_tag = plc_tag_create(BIG_TAG_ATTRIBS, DATA_TIMEOUT);
+    if(small_check_tag < 0 || big_check_tag < 0) {
+        fprintf(stderr, "ERROR: Could not create the check tags!\n");
+        return 1;
+    }
+
+    errors += test_packed_writes(tags, small_check_tag, big_check_tag, 100);
+    errors += test_packed_writes(tags, small_check_tag, big_check_tag, 2000);
+    errors += test_packed_reads(tags, 2000);
+
+    for(int i=0; i < NUM_TAGS; i++) {
+        plc_tag_destroy(tags[i]);
+    }
+
+    plc_tag_destroy(small_check_tag);
+    plc_tag_destroy(big_check_tag);
+
+    if(errors) {
+        fprintf(stderr, "FAILED %d tests.\n", errors);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * This tests partial array reads and writes with plc_tag_read_range() and
+ * plc_tag_write_range().  Only the elements in the range may change, both
+ * in the tag buffer and in the PLC.  The tests are run with connected and
+ * with unconnected messaging as the two build their requests separately.
+ *
+ * Run it against the ab_server simulator:
+ *
+ *    ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[1000]
+ */
+
+#define REQUIRED_VERSION 2,1,21
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_size=4&elem_count=1000&name=TestBigArray&use_connected_msg=%d"
+#define ELEM_COUNT (1000)
+#define DATA_TIMEOUT (5000)
+
+#define FILL_VALUE (-1)
+#define OTHER_VALUE (7)
+
+
+static int check_elements(int32_t tag, int first, int count, int in_range_offset, int other_value)
+{
+    int errors = 0;
+    int i;
+
+    for(i=0; i < ELEM_COUNT; i++) {
+        int32_t val = plc_tag_get_int32(tag, i*4);
+        int32_t expected = ((i >= first && i < first + count) ? (i + in_range_offset) : other_value);
+
+        if(val != expected) {
+            if(errors < 5) {
+                fprintf(stderr, "Element %d is %d, expected %d!\n", i, val, expected);
+            }
+
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+
+static int test_read_range(int32_t tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int i;
+
+    fprintf(stderr, "Testing plc_tag_read_range().\n");
+
+    /* put a known value in every element of the PLC. */
+    for(i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(tag, i*4, i);
+    }
+
+    rc = plc_tag_write(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s writing the tag!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    /* clear the local buffer, the range read must fill in exactly the range. */
+    for(i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(tag, i*4, FILL_VALUE);
+    }
+
+    rc = plc_tag_read_range(tag, 500, 100, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading elements 500 to 599!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    if(check_elements(tag, 500, 100, 0, FILL_VALUE)) {
+        fprintf(stderr, "ERROR: range read changed elements outside of the range!\n");
+        return 1;
+    }
+
+    /* a range at the start of the tag. */
+    rc = plc_tag_read_range(tag, 0, 3, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK || plc_tag_get_int32(tag, 2*4) != 2 || plc_tag_get_int32(tag, 3*4) != FILL_VALUE) {
+        fprintf(stderr, "ERROR: %s reading elements 0 to 2!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int test_write_range(int32_t tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int i;
+
+    fprintf(stderr, "Testing plc_tag_write_range().\n");
+
+    /* only the last 10 elements should go to the PLC. */
+    for(i=0; i < ELEM_COUNT; i++) {
+        plc_tag_set_int32(tag, i*4, (i >= 990 ? i + 1 : OTHER_VALUE));
+    }
+
+    rc = plc_tag_write_range(tag, 990, 10, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s writing elements 990 to 999!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading the tag!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(i=0; i < ELEM_COUNT; i++) {
+        int32_t val = plc_tag_get_int32(tag, i*4);
+        int32_t expected = (i >= 990 ? i + 1 : i);
+
+        if(val != expected) {
+            fprintf(stderr, "ERROR: element %d is %d after the range write, expected %d!\n", i, val, expected);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int test_bad_range(int32_t tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    fprintf(stderr, "Testing ranges outside the tag.\n");
+
+    rc = plc_tag_read_range(tag, 990, 11, DATA_TIMEOUT);
+    if(rc != PLCTAG_ERR_OUT_OF_BOUNDS) {
+        fprintf(stderr, "ERROR: expected PLCTAG_ERR_OUT_OF_BOUNDS reading past the end, got %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    rc = plc_tag_write_range(tag, -1, 2, DATA_TIMEOUT);
+    if(rc != PLCTAG_ERR_BAD_PARAM) {
+        fprintf(stderr, "ERROR: expected PLCTAG_ERR_BAD_PARAM writing before the start, got %s!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    return 0;
+}
+
+
+static int test_ranges(int use_connected_msg)
+{
+    char attribs[200];
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing with %s messaging.\n", (use_connected_msg ? "connected" : "unconnected"));
+
+    snprintf(attribs, sizeof(attribs), TAG_ATTRIBS, use_connected_msg);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    /* ranges need the element size from a completed read. */
+    rc = plc_tag_read(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s doing the first read!\n", plc_tag_decode_error(rc));
+        plc_tag_destroy(tag);
+        return 1;
+    }
+
+    errors += test_read_range(tag);
+    errors += test_write_range(tag);
+    errors += test_bad_range(tag);
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+int main()
+{
+    int errors = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    errors += test_ranges(1);
+    errors += test_ranges(0);
+
+    if(errors) {
+        fprintf(stderr, "FAILED %d tests.\n", errors);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
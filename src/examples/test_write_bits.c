@@ -0,0 +1,257 @@
+/***************************************************************************
+ *   Copyright (C) 2021 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../lib/libplctag.h"
+#include "utils.h"
+
+/*
+ * This tests plc_tag_write_bits() and that the writes after it are normal
+ * writes of the whole element, both from plc_tag_write() and from the
+ * automatic write of a tag with auto_sync_write_ms set.  It also checks
+ * that the tag buffer is only changed by a bit write that succeeds.
+ *
+ * Run it against the ab_server simulator:
+ *
+ *    ab_server --plc=ControlLogix --path=1,0 --tag=TestDINT:DINT[10]
+ */
+
+#define REQUIRED_VERSION 2,1,21
+#define TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_size=4&elem_count=10&name=TestDINT"
+#define AUTO_SYNC_TAG_ATTRIBS TAG_ATTRIBS "&auto_sync_write_ms=50"
+#define MISSING_TAG_ATTRIBS "protocol=ab_eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_type=dint&elem_count=1&name=NoSuchTag&lazy=1"
+#define DATA_TIMEOUT (5000)
+#define AUTO_SYNC_WAIT_MS (500)
+
+
+static int write_value(int32_t tag, int32_t value)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    plc_tag_set_int32(tag, 0, value);
+
+    rc = plc_tag_write(tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s writing value %08x!\n", plc_tag_decode_error(rc), (unsigned int)value);
+    }
+
+    return rc;
+}
+
+
+static int check_value(int32_t check_tag, uint32_t expected, const char *what)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint32_t val = 0;
+
+    rc = plc_tag_read(check_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: %s reading the tag after %s!\n", plc_tag_decode_error(rc), what);
+        return 1;
+    }
+
+    val = plc_tag_get_uint32(check_tag, 0);
+    if(val != expected) {
+        fprintf(stderr, "ERROR: value after %s is %08x, expected %08x!\n", what, val, expected);
+        return 1;
+    }
+
+    fprintf(stderr, "Value after %s is %08x.\n", what, val);
+
+    return 0;
+}
+
+
+static int test_bits_then_write(int32_t check_tag)
+{
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing plc_tag_write_bits() followed by plc_tag_write().\n");
+
+    tag = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    do {
+        if(write_value(tag, (int32_t)0x0F0F0F0F) != PLCTAG_STATUS_OK) {
+            errors++;
+            break;
+        }
+
+        /* set bit 4 and clear bit 0, the other bits must not change. */
+        rc = plc_tag_write_bits(tag, 0x10, 0x01, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s writing bits!\n", plc_tag_decode_error(rc));
+            errors++;
+            break;
+        }
+
+        errors += check_value(check_tag, 0x0F0F0F1E, "the bit write");
+
+        if(plc_tag_get_uint32(tag, 0) != 0x0F0F0F1E) {
+            fprintf(stderr, "ERROR: tag buffer is %08x after the bit write, expected 0F0F0F1E!\n", plc_tag_get_uint32(tag, 0));
+            errors++;
+        }
+
+        /* a normal write must send the whole value, not the old masks. */
+        if(write_value(tag, (int32_t)0x12345678) != PLCTAG_STATUS_OK) {
+            errors++;
+            break;
+        }
+
+        errors += check_value(check_tag, 0x12345678, "the normal write");
+    } while(0);
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+static int test_bits_then_auto_sync(int32_t check_tag)
+{
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing plc_tag_write_bits() followed by an automatic write.\n");
+
+    tag = plc_tag_create(AUTO_SYNC_TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    do {
+        if(write_value(tag, 0) != PLCTAG_STATUS_OK) {
+            errors++;
+            break;
+        }
+
+        rc = plc_tag_write_bits(tag, 0x80000001, 0, DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            fprintf(stderr, "ERROR: %s writing bits!\n", plc_tag_decode_error(rc));
+            errors++;
+            break;
+        }
+
+        errors += check_value(check_tag, 0x80000001, "the bit write");
+
+        /* changing the data starts an automatic write of the whole value. */
+        plc_tag_set_uint32(tag, 0, 0x00ABCDEF);
+
+        util_sleep_ms(AUTO_SYNC_WAIT_MS);
+
+        errors += check_value(check_tag, 0x00ABCDEF, "the automatic write");
+    } while(0);
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+static int test_failed_bits(void)
+{
+    int32_t tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int errors = 0;
+
+    fprintf(stderr, "Testing that a failed plc_tag_write_bits() leaves the tag buffer alone.\n");
+
+    /* a lazy tag with a known type does not read first, so the masked write itself fails. */
+    tag = plc_tag_create(MISSING_TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    plc_tag_set_uint32(tag, 0, 0x0000FF00);
+
+    rc = plc_tag_write_bits(tag, 0x01, 0x100, DATA_TIMEOUT);
+    if(rc == PLCTAG_STATUS_OK) {
+        fprintf(stderr, "ERROR: writing bits of a missing tag succeeded!\n");
+        errors++;
+    } else if(plc_tag_get_uint32(tag, 0) != 0x0000FF00) {
+        fprintf(stderr, "ERROR: tag buffer is %08x after a failed bit write, expected 0000FF00!\n", plc_tag_get_uint32(tag, 0));
+        errors++;
+    } else {
+        fprintf(stderr, "Bit write failed with %s and the tag buffer is unchanged.\n", plc_tag_decode_error(rc));
+    }
+
+    plc_tag_destroy(tag);
+
+    return errors;
+}
+
+
+int main()
+{
+    int32_t check_tag = 0;
+    int errors = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    /* a separate tag to read back what is in the PLC. */
+    check_tag = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    if(check_tag < 0) {
+        fprintf(stderr, "ERROR %s: Could not create tag!\n", plc_tag_decode_error(check_tag));
+        return 1;
+    }
+
+    errors += test_bits_then_write(check_tag);
+    errors += test_bits_then_auto_sync(check_tag);
+    errors += test_failed_bits();
+
+    plc_tag_destroy(check_tag);
+
+    if(errors) {
+        fprintf(stderr, "FAILED %d tests.\n", errors);
+        return 1;
+    }
+
+    fprintf(stderr, "All tests passed.\n");
+
+    return 0;
+}
@@ -46,7 +46,8 @@
 
 
 /*
- * The following maps attributes to the tag creation functions.
+ * The following maps attributes to the tag creation functions and,
+ * for protocols with shared sessions, the session prewarm and release functions.
  */
 
 
@@ -56,14 +57,18 @@ struct {
     const char *family;
     const char *model;
     const tag_create_function tag_constructor;
+    const session_prewarm_function session_prewarm;
+    const session_release_function session_release;
 } tag_type_map[] = {
     /* System tags */
-    {NULL, "system", "library", NULL, system_tag_create},
+    {NULL, "system", "library", NULL, system_tag_create, NULL, NULL},
     /* Allen-Bradley PLCs */
-    {"ab-eip", NULL, NULL, NULL, ab_tag_create},
-    {"ab_eip", NULL, NULL, NULL, ab_tag_create},
-    {"modbus-tcp", NULL, NULL, NULL, mb_tag_create},
-    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create}
+    {"ab-eip", NULL, NULL, NULL, ab_tag_create, ab_session_prewarm, ab_session_release},
+    {"ab_eip", NULL, NULL, NULL, ab_tag_create, ab_session_prewarm, ab_session_release},
+    {"modbus-tcp", NULL, NULL, NULL, mb_tag_create, NULL, NULL},
+    {"modbus_tcp", NULL, NULL, NULL, mb_tag_create, NULL, NULL},
+    {"modbus-rtu", NULL, NULL, NULL, mb_tag_create, NULL, NULL},
+    {"modbus_rtu", NULL, NULL, NULL, mb_tag_create, NULL, NULL}
 };
 
 static lock_t library_initialization_lock = LOCK_INIT;
@@ -72,10 +77,11 @@ static volatile mutex_p lib_mutex = NULL;
 
 
 /*
- * find_tag_create_func()
+ * find_tag_type_entry()
  *
- * Find an appropriate tag creation function.  This scans through the array
- * above to find a matching tag creation type.  The first match is returned.
+ * Find an appropriate tag type entry.  This scans through the array
+ * above to find a matching tag type.  The index of the first match is returned,
+ * or -1 if nothing matches.
  * A passed set of options will match when all non-null entries in the list
  * match.  This means that matches must be ordered from most to least general.
  *
@@ -83,7 +89,7 @@ static volatile mutex_p lib_mutex = NULL;
  * model will be used.
  */
 
-tag_create_function find_tag_create_func(attr attributes)
+static int find_tag_type_entry(attr attributes)
 {
     int i = 0;
     const char *protocol = attr_get_str(attributes, "protocol", NULL);
@@ -97,7 +103,7 @@ tag_create_function find_tag_create_func(attr attributes)
         for(i=0; i < num_entries; i++) {
             if(tag_type_map[i].protocol && str_cmp(tag_type_map[i].protocol, protocol) == 0) {
                 pdebug(DEBUG_INFO,"Matched protocol=%s", protocol);
-                return tag_type_map[i].tag_constructor;
+                return i;
             }
         }
     } else {
@@ -111,25 +117,52 @@ tag_create_function find_tag_create_func(attr attributes)
                         if(tag_type_map[i].model) {
                             if(model && str_cmp_i(tag_type_map[i].model, model) == 0) {
                                 pdebug(DEBUG_INFO, "Matched make=%s family=%s model=%s", make, family, model);
-                                return tag_type_map[i].tag_constructor;
+                                return i;
                             }
                         } else {
                             /* matches until a NULL */
                             pdebug(DEBUG_INFO, "Matched make=%s family=%s model=NULL", make, family);
-                            return tag_type_map[i].tag_constructor;
+                            return i;
                         }
                     }
                 } else {
                     /* matched until a NULL, so we matched */
                     pdebug(DEBUG_INFO, "Matched make=%s family=NULL model=NULL", make);
-                    return tag_type_map[i].tag_constructor;
+                    return i;
                 }
             }
         }
     }
 
     /* no match */
-    return NULL;
+    return -1;
+}
+
+
+
+tag_create_function find_tag_create_func(attr attributes)
+{
+    int entry = find_tag_type_entry(attributes);
+
+    return (entry >= 0 ? tag_type_map[entry].tag_constructor : NULL);
+}
+
+
+
+session_prewarm_function find_session_prewarm_func(attr attributes)
+{
+    int entry = find_tag_type_entry(attributes);
+
+    return (entry >= 0 ? tag_type_map[entry].session_prewarm : NULL);
+}
+
+
+
+session_release_function find_session_release_func(attr attributes)
+{
+    int entry = find_tag_type_entry(attributes);
+
+    return (entry >= 0 ? tag_type_map[entry].session_release : NULL);
 }
 
 
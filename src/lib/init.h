@@ -39,6 +39,10 @@
 extern int initialize_modules(void);
 typedef plc_tag_p (*tag_create_function)(attr attributes);
 extern tag_create_function find_tag_create_func(attr attributes);
+typedef int (*session_prewarm_function)(attr attributes);
+extern session_prewarm_function find_session_prewarm_func(attr attributes);
+typedef int (*session_release_function)(attr attributes);
+extern session_release_function find_session_release_func(attr attributes);
 extern void destroy_modules(void);
 
 #endif
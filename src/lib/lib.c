@@ -74,6 +74,14 @@ static thread_p tag_tickler_thread = NULL;
 static plc_tag_p lookup_tag(int32_t id);
 static int add_tag_lookup(plc_tag_p tag);
 static int tag_id_inc(int id);
+static int tag_read_common(int32_t id, int start_elem, int elem_count, int timeout);
+static int tag_write_common(int32_t id, int start_elem, int elem_count, uint64_t set_mask, uint64_t clear_mask, int timeout);
+static int tag_set_range(plc_tag_p tag, int start_elem, int elem_count);
+static int tag_set_write_mask(plc_tag_p tag, uint64_t set_mask, uint64_t clear_mask);
+static int tag_create_from_attribs(attr attribs, plc_tag_p *tag_out);
+static int tag_create_poll(plc_tag_p tag);
+static int tag_create_finish(plc_tag_p tag, int rc);
+static int tag_map(plc_tag_p tag);
 static THREAD_FUNC(tag_tickler_func);
 //static int to_tag_index(int id);
 
@@ -552,8 +560,6 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
     int id = PLCTAG_ERR_OUT_OF_BOUNDS;
     attr attribs = NULL;
     int rc = PLCTAG_STATUS_OK;
-    int read_cache_ms = 0;
-    tag_create_function tag_constructor;
 	int debug_level = -1;
 
     pdebug(DEBUG_INFO,"Starting");
@@ -585,6 +591,209 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
 		set_debug_level(debug_level);
 	}
 
+    rc = tag_create_from_attribs(attribs, &tag);
+
+    /*
+     * Release memory for attributes
+     */
+    attr_destroy(attribs);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /*
+    * if there is a timeout, then loop until we get
+    * an error or we timeout.
+    */
+    if(timeout) {
+        int64_t timeout_time = timeout + time_ms();
+        int64_t start_time = time_ms();
+
+        /* get the tag status. */
+        rc = tag->vtable->status(tag);
+
+        while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
+            /* give some time to the tickler function. */
+            rc = tag_create_poll(tag);
+
+            /*
+             * terminate early and do not wait again if the
+             * IO is done.
+             */
+            if(rc != PLCTAG_STATUS_PENDING) {
+                break;
+            }
+
+            sleep_ms(1); /* MAGIC */
+        }
+
+        rc = tag_create_finish(tag, rc);
+        if(rc != PLCTAG_STATUS_OK) {
+            return rc;
+        }
+
+        pdebug(DEBUG_INFO,"tag set up elapsed time %" PRId64 "ms",(time_ms()-start_time));
+    }
+
+    /* map the tag to a tag ID */
+    id = tag_map(tag);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return id;
+}
+
+
+
+/*
+ * plc_tag_create_many()
+ *
+ * Create a set of tags that differ only by name.  The tags are all started
+ * first and then waited for together.  That way the protocol layer has all
+ * of the initial reads queued at once and can pack them.
+ */
+
+LIB_EXPORT int plc_tag_create_many(const char *attrib_base, const char **names, int num_names, int32_t *tag_ids, int timeout)
+{
+    plc_tag_p *new_tags = NULL;
+    attr attribs = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int first_error = PLCTAG_STATUS_OK;
+    int num_pending = 0;
+	int debug_level = -1;
+    int64_t start_time = time_ms();
+
+    pdebug(DEBUG_INFO,"Starting with %d names.", num_names);
+
+    if(timeout < 0) {
+        pdebug(DEBUG_WARN, "Timeout must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(!names || !tag_ids || num_names <= 0) {
+        pdebug(DEBUG_WARN, "Need a list of names and somewhere to put the tag handles!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    if(!attrib_base || str_length(attrib_base) == 0) {
+        pdebug(DEBUG_WARN,"Tag attribute string is null or zero length!");
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    attribs = attr_create_from_str(attrib_base);
+    if(!attribs) {
+        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(attr_get_str(attribs, "name", NULL)) {
+        pdebug(DEBUG_WARN, "The base attribute string must not contain a name!");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+	debug_level = attr_get_int(attribs, "debug", -1);
+	if (debug_level > DEBUG_NONE) {
+		set_debug_level(debug_level);
+	}
+
+    new_tags = (plc_tag_p *)mem_alloc((int)sizeof(plc_tag_p) * num_names);
+    if(!new_tags) {
+        pdebug(DEBUG_ERROR, "Unable to allocate memory for the new tags!");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* start all the tags.  Only the name changes from one to the next. */
+    for(int i=0; i < num_names; i++) {
+        if(!names[i] || str_length(names[i]) == 0) {
+            pdebug(DEBUG_WARN, "Tag name %d is null or zero length!", i);
+            tag_ids[i] = PLCTAG_ERR_BAD_PARAM;
+            continue;
+        }
+
+        rc = attr_set_str(attribs, "name", names[i]);
+        if(rc == PLCTAG_STATUS_OK) {
+            rc = tag_create_from_attribs(attribs, &new_tags[i]);
+        }
+
+        tag_ids[i] = (rc == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : rc);
+    }
+
+    attr_destroy(attribs);
+
+    /* wait for all of them together. */
+    if(timeout) {
+        int64_t timeout_time = timeout + start_time;
+
+        do {
+            num_pending = 0;
+
+            for(int i=0; i < num_names; i++) {
+                if(new_tags[i] && tag_ids[i] == PLCTAG_STATUS_PENDING) {
+                    tag_ids[i] = tag_create_poll(new_tags[i]);
+
+                    if(tag_ids[i] == PLCTAG_STATUS_PENDING) {
+                        num_pending++;
+                    }
+                }
+            }
+
+            if(num_pending) {
+                sleep_ms(1); /* MAGIC */
+            }
+        } while(num_pending && timeout_time > time_ms());
+    }
+
+    /* map the tags or clean up the ones that failed. */
+    for(int i=0; i < num_names; i++) {
+        if(new_tags[i]) {
+            if(timeout) {
+                rc = tag_create_finish(new_tags[i], tag_ids[i]);
+            } else {
+                rc = PLCTAG_STATUS_OK;
+            }
+
+            tag_ids[i] = (rc == PLCTAG_STATUS_OK ? tag_map(new_tags[i]) : rc);
+            new_tags[i] = NULL;
+        }
+
+        if(tag_ids[i] < 0 && first_error == PLCTAG_STATUS_OK) {
+            first_error = tag_ids[i];
+        }
+    }
+
+    mem_free(new_tags);
+
+    pdebug(DEBUG_INFO,"Done creating %d tags in %" PRId64 "ms.", num_names, (time_ms() - start_time));
+
+    return first_error;
+}
+
+
+
+/*
+ * tag_create_from_attribs()
+ *
+ * Find the protocol's constructor and do the generic tag set up.  The
+ * attributes are not changed except by the protocol and are not kept.
+ */
+
+int tag_create_from_attribs(attr attribs, plc_tag_p *tag_out)
+{
+    plc_tag_p tag = PLC_TAG_P_NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int read_cache_ms = 0;
+    tag_create_function tag_constructor;
+
+    *tag_out = PLC_TAG_P_NULL;
+
     /*
      * create the tag, this is protocol specific.
      *
@@ -595,7 +804,6 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
 
     if(!tag_constructor) {
         pdebug(DEBUG_WARN,"Tag creation failed, no tag constructor found for tag type!");
-        attr_destroy(attribs);
         return PLCTAG_ERR_BAD_PARAM;
     }
 
@@ -603,7 +811,6 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
 
     if(!tag) {
         pdebug(DEBUG_WARN, "Tag creation failed, skipping mutex creation and other generic setup.");
-        attr_destroy(attribs);
         return PLCTAG_ERR_CREATE;
     }
 
@@ -652,69 +859,70 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
         tag->auto_sync_next_write = 0;
     }
 
-    /*
-     * Release memory for attributes
-     */
-    attr_destroy(attribs);
+    *tag_out = tag;
 
-    /*
-    * if there is a timeout, then loop until we get
-    * an error or we timeout.
-    */
-    if(timeout) {
-        int64_t timeout_time = timeout + time_ms();
-        int64_t start_time = time_ms();
+    return PLCTAG_STATUS_OK;
+}
 
-        /* get the tag status. */
-        rc = tag->vtable->status(tag);
 
-        while(rc == PLCTAG_STATUS_PENDING && timeout_time > time_ms()) {
-            /* give some time to the tickler function. */
-            if(tag->vtable->tickler) {
-                tag->vtable->tickler(tag);
-            }
 
-            rc = tag->vtable->status(tag);
+/*
+ * Give a tag that is not mapped yet some time to finish being created.
+ */
 
-            /*
-             * terminate early and do not wait again if the
-             * IO is done.
-             */
-            if(rc != PLCTAG_STATUS_PENDING) {
-                break;
-            }
+int tag_create_poll(plc_tag_p tag)
+{
+    if(tag->vtable->tickler) {
+        tag->vtable->tickler(tag);
+    }
 
-            sleep_ms(1); /* MAGIC */
-        }
+    return tag->vtable->status(tag);
+}
 
-        /*
-         * if we dropped out of the while loop but the status is
-         * still pending, then we timed out.
-         *
-         * Abort the operation and set the status to show the timeout.
-         */
-        if(rc == PLCTAG_STATUS_PENDING) {
-            pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
-            tag->vtable->abort(tag);
-            rc = PLCTAG_ERR_TIMEOUT;
-        }
 
-        /* check to see if there was an error during tag creation. */
-        if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
-            rc_dec(tag);
-            return rc;
-        }
 
-        /* clear up any remaining flags.  This should be refactored. */
-        tag->read_in_flight = 0;
-        tag->write_in_flight = 0;
+/*
+ * Finish waiting for a new tag.  A tag that is still pending has timed out
+ * and is aborted.  On any error the tag is released.
+ */
 
-        pdebug(DEBUG_INFO,"tag set up elapsed time %" PRId64 "ms",(time_ms()-start_time));
+int tag_create_finish(plc_tag_p tag, int rc)
+{
+    /*
+     * if we dropped out of the while loop but the status is
+     * still pending, then we timed out.
+     *
+     * Abort the operation and set the status to show the timeout.
+     */
+    if(rc == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN,"Timeout waiting for tag to be ready!");
+        tag->vtable->abort(tag);
+        rc = PLCTAG_ERR_TIMEOUT;
     }
 
-    /* map the tag to a tag ID */
-    id = add_tag_lookup(tag);
+    /* check to see if there was an error during tag creation. */
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s while trying to create tag!", plc_tag_decode_error(rc));
+        rc_dec(tag);
+        return rc;
+    }
+
+    /* clear up any remaining flags.  This should be refactored. */
+    tag->read_in_flight = 0;
+    tag->write_in_flight = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Map a new tag to a tag ID.  The tag is released if that fails.
+ */
+
+int tag_map(plc_tag_p tag)
+{
+    int id = add_tag_lookup(tag);
 
     /* if the mapping failed, then punt */
     if(id < 0) {
@@ -730,9 +938,128 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout)
 
     pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
 
+    return id;
+}
+
+
+
+
+/*
+ * session_attribs_from_str
+ *
+ * Parse the attributes for the session calls below.  They must be for a
+ * protocol we know.
+ */
+
+static int session_attribs_from_str(const char *attrib_str, attr *attribs)
+{
+    int debug_level = -1;
+    int rc = PLCTAG_STATUS_OK;
+
+    *attribs = NULL;
+
+    if((rc = initialize_modules()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR,"Unable to initialize the internal library state!");
+        return rc;
+    }
+
+    if(!attrib_str || str_length(attrib_str) == 0) {
+        pdebug(DEBUG_WARN,"Attribute string is null or zero length!");
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    *attribs = attr_create_from_str(attrib_str);
+    if(!*attribs) {
+        pdebug(DEBUG_WARN,"Unable to parse attribute string!");
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    debug_level = attr_get_int(*attribs, "debug", -1);
+    if (debug_level > DEBUG_NONE) {
+        set_debug_level(debug_level);
+    }
+
+    if(!find_tag_create_func(*attribs)) {
+        pdebug(DEBUG_WARN,"No protocol found for the attributes!");
+        attr_destroy(*attribs);
+        *attribs = NULL;
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * plc_tag_session_prewarm
+ *
+ * Open the connection to the PLC ahead of the first tag.  This is dispatched
+ * to the protocol the same way tag creation is.
+ */
+
+LIB_EXPORT int plc_tag_session_prewarm(const char *attrib_str)
+{
+    attr attribs = NULL;
+    session_prewarm_function session_prewarm;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    if((rc = session_attribs_from_str(attrib_str, &attribs)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    session_prewarm = find_session_prewarm_func(attribs);
+    if(!session_prewarm) {
+        pdebug(DEBUG_WARN,"Protocol does not support session prewarming.");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rc = session_prewarm(attribs);
+
+    attr_destroy(attribs);
+
     pdebug(DEBUG_INFO,"Done.");
 
-    return id;
+    return rc;
+}
+
+
+
+/*
+ * plc_tag_session_release
+ *
+ * Drop the library's hold on a prewarmed connection.
+ */
+
+LIB_EXPORT int plc_tag_session_release(const char *attrib_str)
+{
+    attr attribs = NULL;
+    session_release_function session_release;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO,"Starting");
+
+    if((rc = session_attribs_from_str(attrib_str, &attribs)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    session_release = find_session_release_func(attribs);
+    if(!session_release) {
+        pdebug(DEBUG_WARN,"Protocol does not support session prewarming.");
+        attr_destroy(attribs);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    rc = session_release(attribs);
+
+    attr_destroy(attribs);
+
+    pdebug(DEBUG_INFO,"Done.");
+
+    return rc;
 }
 
 
@@ -1123,6 +1450,39 @@ LIB_EXPORT int plc_tag_destroy(int32_t tag_id)
  */
 
 LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
+{
+    return tag_read_common(id, 0, 0, timeout);
+}
+
+
+
+/*
+ * plc_tag_read_range()
+ *
+ * Read only part of an array tag.  The elements are placed where
+ * a full read would put them in the tag data buffer.
+ */
+
+LIB_EXPORT int plc_tag_read_range(int32_t id, int start_elem, int elem_count, int timeout)
+{
+    if(start_elem < 0 || elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Start element must not be negative and element count must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return tag_read_common(id, start_elem, elem_count, timeout);
+}
+
+
+
+/*
+ * tag_read_common()
+ *
+ * Shared implementation of the read API functions.  An element count
+ * of zero reads the whole tag.
+ */
+
+int tag_read_common(int32_t id, int start_elem, int elem_count, int timeout)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1169,6 +1529,13 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
             break;
         }
 
+        /* set up or clear any element range before starting. */
+        rc = tag_set_range(tag, start_elem, elem_count);
+        if(rc != PLCTAG_STATUS_OK) {
+            is_done = 1;
+            break;
+        }
+
         tag->read_in_flight = 1;
         tag->status = PLCTAG_STATUS_PENDING;
 
@@ -1247,7 +1614,8 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout)
         }
     } /* end of api mutex block */
 
-    if(rc == PLCTAG_STATUS_OK) {
+    /* a partial read does not refresh the whole buffer, so it cannot be cached. */
+    if(rc == PLCTAG_STATUS_OK && elem_count == 0) {
         /* set up the cache time.  This works when read_cache_ms is zero as it is already expired. */
         tag->read_cache_expire = time_ms() + tag->read_cache_ms;
     }
@@ -1337,6 +1705,63 @@ LIB_EXPORT int plc_tag_status(int32_t id)
  */
 
 LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
+{
+    return tag_write_common(id, 0, 0, 0, 0, timeout);
+}
+
+
+
+/*
+ * plc_tag_write_range()
+ *
+ * Write only part of an array tag.  The elements are taken from
+ * the same place in the tag data buffer as a full write would use.
+ */
+
+LIB_EXPORT int plc_tag_write_range(int32_t id, int start_elem, int elem_count, int timeout)
+{
+    if(start_elem < 0 || elem_count <= 0) {
+        pdebug(DEBUG_WARN, "Start element must not be negative and element count must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return tag_write_common(id, start_elem, elem_count, 0, 0, timeout);
+}
+
+
+
+/*
+ * plc_tag_write_bits()
+ *
+ * Change some of the bits of the first element of a tag in one
+ * masked write.  Bits in neither mask are not touched in the PLC.
+ */
+
+LIB_EXPORT int plc_tag_write_bits(int32_t id, uint64_t set_mask, uint64_t clear_mask, int timeout)
+{
+    if(!set_mask && !clear_mask) {
+        pdebug(DEBUG_WARN, "At least one bit must be set or cleared!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(set_mask & clear_mask) {
+        pdebug(DEBUG_WARN, "A bit cannot be both set and cleared!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    return tag_write_common(id, 0, 0, set_mask, clear_mask, timeout);
+}
+
+
+
+/*
+ * tag_write_common()
+ *
+ * Shared implementation of the write API functions.  An element count
+ * of zero writes the whole tag.  Non-zero masks write only those bits.
+ */
+
+int tag_write_common(int32_t id, int start_elem, int elem_count, uint64_t set_mask, uint64_t clear_mask, int timeout)
 {
     int rc = PLCTAG_STATUS_OK;
     plc_tag_p tag = lookup_tag(id);
@@ -1368,6 +1793,20 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout)
             break;
         }
 
+        /* set up or clear any element range before starting. */
+        rc = tag_set_range(tag, start_elem, elem_count);
+        if(rc != PLCTAG_STATUS_OK) {
+            is_done = 1;
+            break;
+        }
+
+        /* likewise for any bit masks. */
+        rc = tag_set_write_mask(tag, set_mask, clear_mask);
+        if(rc != PLCTAG_STATUS_OK) {
+            is_done = 1;
+            break;
+        }
+
         /* a write is now in flight. */
         tag->write_in_flight = 1;
         tag->status = PLCTAG_STATUS_OK;
@@ -2873,6 +3312,46 @@ plc_tag_p lookup_tag(int32_t tag_id)
 
 
 
+/*
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_set_range(plc_tag_p tag, int start_elem, int elem_count)
+{
+    if(tag->vtable->set_range) {
+        return tag->vtable->set_range(tag, start_elem, elem_count);
+    }
+
+    if(elem_count > 0) {
+        pdebug(DEBUG_WARN, "Tag does not support partial reads or writes!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Must be called with the tag API mutex held.
+ */
+
+int tag_set_write_mask(plc_tag_p tag, uint64_t set_mask, uint64_t clear_mask)
+{
+    if(tag->vtable->set_write_mask) {
+        return tag->vtable->set_write_mask(tag, set_mask, clear_mask);
+    }
+
+    if(set_mask || clear_mask) {
+        pdebug(DEBUG_WARN, "Tag does not support masked writes!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int tag_id_inc(int id)
 {
     if(id <= 0) {
@@ -193,6 +193,58 @@ LIB_EXPORT int32_t plc_tag_create(const char *attrib_str, int timeout);
 
 
 
+/*
+ * plc_tag_create_many
+ *
+ * Create one tag for each of the num_names names in names.  All the tags use
+ * the attributes in attrib_base, which must not contain a name.  The attribute
+ * string is only parsed once and all the tags are started before any are
+ * waited for, so their initial reads can be packed together.
+ *
+ * The tag handle or error for each name is put in the matching entry of
+ * tag_ids.  The timeout is for the whole set of tags, and zero does not wait
+ * as with plc_tag_create.
+ *
+ * Returns PLCTAG_STATUS_OK if all the tags were created, otherwise the first
+ * error found.  Tags that were created are kept even if others failed.
+ */
+
+LIB_EXPORT int plc_tag_create_many(const char *attrib_base, const char **names, int num_names, int32_t *tag_ids, int timeout);
+
+
+
+/*
+ * plc_tag_session_prewarm
+ *
+ * Open the connection to a PLC before any tags are created.  The attribute
+ * string is the same as the one for plc_tag_create, but the name and element
+ * attributes are not used.  The connection is started in the background and
+ * this returns as soon as that has begun.
+ *
+ * The library holds the connection until plc_tag_session_release is called or
+ * the library shuts down.  Without a keepalive_ms attribute, an idle connection
+ * will still be closed and reopened on the next tag operation.
+ *
+ * Protocols without shared connections return PLCTAG_ERR_UNSUPPORTED.
+ */
+
+LIB_EXPORT int plc_tag_session_prewarm(const char *attrib_str);
+
+
+
+/*
+ * plc_tag_session_release
+ *
+ * Let go of a connection opened by plc_tag_session_prewarm.  Use the same
+ * attribute string.  The connection is closed once no tags are using it.
+ * PLCTAG_ERR_NOT_FOUND is returned if there is no prewarmed connection for
+ * these attributes.
+ */
+
+LIB_EXPORT int plc_tag_session_release(const char *attrib_str);
+
+
+
 /*
  * plc_tag_shutdown
  *
@@ -397,6 +449,21 @@ LIB_EXPORT int plc_tag_read(int32_t tag, int timeout);
 
 
 
+/*
+ * plc_tag_read_range
+ *
+ * Like plc_tag_read, but only fetch elem_count elements starting at element
+ * start_elem.  The data lands at the same place in the tag buffer that a full
+ * read would put it, so the normal accessors work with the usual offsets.  The
+ * rest of the buffer is left untouched.
+ *
+ * The tag must have completed at least one read so that the element size is known.
+ * Protocols that do not support partial reads return PLCTAG_ERR_UNSUPPORTED.
+ */
+LIB_EXPORT int plc_tag_read_range(int32_t tag, int start_elem, int elem_count, int timeout);
+
+
+
 
 /*
  * plc_tag_status
@@ -423,12 +490,47 @@ LIB_EXPORT int plc_tag_status(int32_t tag);
  * PLCTAG_STATUS_PENDING.  The write is considered done
  * when it has been written to the socket.
  *
+ * A tag too large for one packet is written in several pieces.  The write is
+ * not atomic: if it fails part way, the pieces already written stay written
+ * in the PLC and the PLC holds a mix of old and new data.  Read the tag
+ * back to see what is there.  This is the same for Logix tags and for the
+ * PCCC data files of PLC/5, SLC 500 and MicroLogix PLCs.
+ *
  * This is a function provided by the underlying protocol implementation.
  */
 LIB_EXPORT int plc_tag_write(int32_t tag, int timeout);
 
 
 
+/*
+ * plc_tag_write_range
+ *
+ * Like plc_tag_write, but only send elem_count elements starting at element
+ * start_elem from the tag buffer.  The other elements in the PLC are not changed.
+ *
+ * The same restrictions apply as for plc_tag_read_range.  As with plc_tag_write,
+ * a range too large for one packet is not written atomically.
+ */
+LIB_EXPORT int plc_tag_write_range(int32_t tag, int start_elem, int elem_count, int timeout);
+
+
+
+/*
+ * plc_tag_write_bits
+ *
+ * Set the bits in set_mask and clear the bits in clear_mask in the first
+ * element of the tag, leaving all other bits in the PLC unchanged.  Bit 0
+ * is the same bit as offset 0 in plc_tag_set_bit.  The change is sent as
+ * one masked write that the PLC applies atomically.  The tag data buffer
+ * is updated to match.
+ *
+ * The masks must not overlap and must fit within one element of the tag.
+ * Only supported by Logix-class PLCs.  Other tags return PLCTAG_ERR_UNSUPPORTED.
+ */
+LIB_EXPORT int plc_tag_write_bits(int32_t tag, uint64_t set_mask, uint64_t clear_mask, int timeout);
+
+
+
 
 /*
  * Tag data accessors.
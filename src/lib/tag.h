@@ -61,6 +61,12 @@ struct tag_vtable_t {
     /* attribute accessors. */
     int (*get_int_attrib)(plc_tag_p tag, const char *attrib_name, int default_value);
     int (*set_int_attrib)(plc_tag_p tag, const char *attrib_name, int new_value);
+
+    /* restrict the next read or write to part of the tag.  A zero count means the whole tag. */
+    int (*set_range)(plc_tag_p tag, int start_elem, int elem_count);
+
+    /* make the next write only set and clear bits in the first element.  Zero masks mean a normal write. */
+    int (*set_write_mask)(plc_tag_p tag, uint64_t set_mask, uint64_t clear_mask);
 };
 
 typedef struct tag_vtable_t *tag_vtable_p;
@@ -42,10 +42,10 @@
  * checking them against a dynamically linked library.
  */
 
-#define LIB_VER_STRING "2.1.11"
+#define LIB_VER_STRING "2.1.21"
 #define LIB_VER_MAJOR (2)
 #define LIB_VER_MINOR (1)
-#define LIB_VER_PATCH (11)
+#define LIB_VER_PATCH (21)
 
 extern const char *VERSION;
 extern const uint64_t version_major;
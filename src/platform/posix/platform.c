@@ -47,10 +47,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <time.h>
+#include <termios.h>
 
 #include <lib/libplctag.h>
 #include <util/debug.h>
@@ -1035,6 +1037,15 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
+    /* packets are written whole, do not hold back requests sent without waiting for a reply. */
+    sock_opt = 1;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
+        close(fd);
+        pdebug(DEBUG_ERROR,"Error setting socket no delay option, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
     /* figure out what address we are connecting to. */
 
     /* try a numeric IP address conversion first. */
@@ -1141,6 +1152,138 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a non-blocking UDP socket on any free local port and connect it to
+ * the remote host and port.  Only datagrams from that host and port are
+ * received and socket_write() sends one datagram per call.
+ */
+
+extern int socket_connect_udp(sock_p s, const char *host, int port)
+{
+    struct in_addr ip;
+    struct sockaddr_in remote_addr;
+    struct sockaddr_in local_addr;
+    int fd;
+    int flags;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s || !host) {
+        pdebug(DEBUG_WARN, "Null socket or host pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &ip) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res_head = NULL;
+        int rc = 0;
+
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0 || !res_head) {
+            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        ip.s_addr = ((struct sockaddr_in *)(res_head->ai_addr))->sin_addr.s_addr;
+
+        freeaddrinfo(res_head);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd < 0) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, errno: %d", errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* bind to any free port on all interfaces. */
+    mem_set(&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = 0;
+
+    if(bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr))) {
+        pdebug(DEBUG_ERROR, "Unable to bind UDP socket, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    mem_set(&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons((uint16_t)port);
+    remote_addr.sin_addr.s_addr = ip.s_addr;
+
+    if(connect(fd, (struct sockaddr *)&remote_addr, sizeof(remote_addr))) {
+        pdebug(DEBUG_ERROR, "Unable to connect UDP socket to %s, errno: %d", host, errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, errno: %d", errno);
+        close(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_get_local_addr
+ *
+ * Get the local IPv4 address and port of a connected socket, both in host
+ * byte order.
+ */
+
+extern int socket_get_local_addr(sock_p s, uint32_t *ip_addr, int *port)
+{
+    struct sockaddr_in local_addr;
+    socklen_t addr_len = (socklen_t)sizeof(local_addr);
+
+    if(!s || !ip_addr || !port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    mem_set(&local_addr, 0, sizeof(local_addr));
+
+    if(getsockname(s->fd, (struct sockaddr *)&local_addr, &addr_len)) {
+        pdebug(DEBUG_WARN, "Unable to get local socket address, errno: %d", errno);
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    *ip_addr = ntohl(local_addr.sin_addr.s_addr);
+    *port = (int)ntohs(local_addr.sin_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 extern int socket_read(sock_p s, uint8_t *buf, int size)
 {
@@ -1249,6 +1392,210 @@ extern int socket_destroy(sock_p *s)
 
 
 
+/***************************************************************************
+ ****************************** Serial Port ********************************
+ **************************************************************************/
+
+
+struct serial_port_t {
+    int fd;
+    struct termios old_tio;
+};
+
+
+serial_port_p plc_lib_open_serial_port(const char *path, int baud_rate, int data_bits, int stop_bits, int parity_type)
+{
+    serial_port_p serial_port = NULL;
+    struct termios tio;
+    speed_t speed;
+    tcflag_t size_flag;
+    int fd;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    switch(baud_rate) {
+        case 110: speed = B110; break;
+        case 300: speed = B300; break;
+        case 600: speed = B600; break;
+        case 1200: speed = B1200; break;
+        case 2400: speed = B2400; break;
+        case 4800: speed = B4800; break;
+        case 9600: speed = B9600; break;
+        case 19200: speed = B19200; break;
+        case 38400: speed = B38400; break;
+#ifdef B57600
+        case 57600: speed = B57600; break;
+#endif
+#ifdef B115200
+        case 115200: speed = B115200; break;
+#endif
+        default:
+            pdebug(DEBUG_WARN, "Unsupported baud rate %d!", baud_rate);
+            return NULL;
+    }
+
+    switch(data_bits) {
+        case 5: size_flag = CS5; break;
+        case 6: size_flag = CS6; break;
+        case 7: size_flag = CS7; break;
+        case 8: size_flag = CS8; break;
+        default:
+            pdebug(DEBUG_WARN, "Unsupported number of data bits %d, use 5-8!", data_bits);
+            return NULL;
+    }
+
+    if(stop_bits != 1 && stop_bits != 2) {
+        pdebug(DEBUG_WARN, "Unsupported number of stop bits %d, must be 1 or 2!", stop_bits);
+        return NULL;
+    }
+
+    if(parity_type < 0 || parity_type > 2) {
+        pdebug(DEBUG_WARN, "Unsupported parity type, must be none (0), odd (1) or even (2)!");
+        return NULL;
+    }
+
+    serial_port = (serial_port_p)mem_alloc((int)(unsigned int)sizeof(struct serial_port_t));
+    if(!serial_port) {
+        pdebug(DEBUG_ERROR, "Unable to allocate serial port struct!");
+        return NULL;
+    }
+
+    /* the port is used non-blocking, like the sockets. */
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if(fd < 0) {
+        pdebug(DEBUG_WARN, "Error %d opening serial device %s!", errno, path);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    /* save the old settings so that they can be put back on close. */
+    if(tcgetattr(fd, &serial_port->old_tio) != 0) {
+        pdebug(DEBUG_WARN, "Error %d getting serial port configuration for %s!", errno, path);
+        close(fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    tio = serial_port->old_tio;
+
+    /* raw mode, no echo, no translation and no flow control. */
+    tio.c_iflag &= (tcflag_t)~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY | INPCK);
+    tio.c_oflag &= (tcflag_t)~OPOST;
+    tio.c_lflag &= (tcflag_t)~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+    tio.c_cflag &= (tcflag_t)~(CSIZE | PARENB | PARODD | CSTOPB);
+#ifdef CRTSCTS
+    tio.c_cflag &= (tcflag_t)~CRTSCTS;
+#endif
+    tio.c_cflag |= (tcflag_t)(CLOCAL | CREAD | size_flag);
+
+    if(stop_bits == 2) {
+        tio.c_cflag |= CSTOPB;
+    }
+
+    if(parity_type != 0) {
+        tio.c_cflag |= PARENB;
+        tio.c_iflag |= INPCK;
+
+        if(parity_type == 1) {
+            tio.c_cflag |= PARODD;
+        }
+    }
+
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if(cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0 || tcsetattr(fd, TCSANOW, &tio) != 0) {
+        pdebug(DEBUG_WARN, "Error %d setting serial port configuration for %s!", errno, path);
+        close(fd);
+        mem_free(serial_port);
+        return NULL;
+    }
+
+    /* throw away anything left over from before. */
+    tcflush(fd, TCIOFLUSH);
+
+    serial_port->fd = fd;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return serial_port;
+}
+
+
+
+int plc_lib_close_serial_port(serial_port_p serial_port)
+{
+    if(!serial_port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* put back the old settings */
+    tcsetattr(serial_port->fd, TCSANOW, &serial_port->old_tio);
+    close(serial_port->fd);
+
+    mem_free(serial_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Returns the number of bytes read, zero if there was nothing to read or
+ * a negative value on error.
+ */
+
+int plc_lib_serial_port_read(serial_port_p serial_port, uint8_t *data, int size)
+{
+    int rc;
+
+    if(!serial_port || !data) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = (int)read(serial_port->fd, data, (size_t)size);
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port read error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_READ;
+    }
+
+    return rc;
+}
+
+
+
+int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, int size)
+{
+    int rc;
+
+    if(!serial_port || !data) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    rc = (int)write(serial_port->fd, data, (size_t)size);
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+
+        pdebug(DEBUG_WARN, "Serial port write error: rc=%d, errno=%d", rc, errno);
+        return PLCTAG_ERR_WRITE;
+    }
+
+    return rc;
+}
+
+
+
+
+
+
+
+
 /***************************************************************************
  ***************************** Miscellaneous *******************************
  **************************************************************************/
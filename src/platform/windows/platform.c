@@ -1094,6 +1094,15 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
         return PLCTAG_ERR_OPEN;
     }
 
+    /* packets are written whole, do not hold back requests sent without waiting for a reply. */
+    sock_opt = 1;
+
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
+        closesocket(fd);
+        pdebug(DEBUG_ERROR,"Error setting socket no delay option, errno: %d",errno);
+        return PLCTAG_ERR_OPEN;
+    }
+
     /* figure out what address we are connecting to. */
 
     /* try a numeric IP address conversion first. */
@@ -1198,6 +1207,138 @@ extern int socket_connect_tcp(sock_p s, const char *host, int port)
 
 
 
+/*
+ * socket_connect_udp
+ *
+ * Open a non-blocking UDP socket on any free local port and connect it to
+ * the remote host and port.  Only datagrams from that host and port are
+ * received and socket_write() sends one datagram per call.
+ */
+
+extern int socket_connect_udp(sock_p s, const char *host, int port)
+{
+    IN_ADDR ip;
+    struct sockaddr_in remote_addr;
+    struct sockaddr_in local_addr;
+    u_long non_blocking=1;
+    SOCKET fd;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!s || !host) {
+        pdebug(DEBUG_WARN, "Null socket or host pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    /* try a numeric IP address conversion first. */
+    if(inet_pton(AF_INET, host, &ip) <= 0) {
+        struct addrinfo hints;
+        struct addrinfo *res_head = NULL;
+        int rc = 0;
+
+        mem_set(&hints, 0, sizeof(hints));
+
+        hints.ai_socktype = SOCK_DGRAM; /* UDP */
+        hints.ai_family = AF_INET; /* IP V4 only */
+
+        if((rc = getaddrinfo(host, NULL, &hints, &res_head)) != 0 || !res_head) {
+            pdebug(DEBUG_WARN, "Error looking up PLC IP address %s, error = %d\n", host, rc);
+
+            if(res_head) {
+                freeaddrinfo(res_head);
+            }
+
+            return PLCTAG_ERR_BAD_GATEWAY;
+        }
+
+        ip.s_addr = ((struct sockaddr_in *)(res_head->ai_addr))->sin_addr.s_addr;
+
+        freeaddrinfo(res_head);
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(fd == INVALID_SOCKET) {
+        pdebug(DEBUG_ERROR, "Socket creation failed, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_OPEN;
+    }
+
+    /* bind to any free port on all interfaces. */
+    memset((void *)&local_addr, 0, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    local_addr.sin_port = 0;
+
+    if(bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr))) {
+        pdebug(DEBUG_ERROR, "Unable to bind UDP socket, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    memset((void *)&remote_addr, 0, sizeof(remote_addr));
+    remote_addr.sin_family = AF_INET;
+    remote_addr.sin_port = htons((u_short)port);
+    remote_addr.sin_addr.s_addr = ip.s_addr;
+
+    if(connect(fd, (struct sockaddr *)&remote_addr, sizeof(remote_addr))) {
+        pdebug(DEBUG_ERROR, "Unable to connect UDP socket to %s, error: %d", host, WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(ioctlsocket(fd,FIONBIO,&non_blocking)) {
+        pdebug(DEBUG_ERROR, "Error setting socket to non-blocking, error: %d", WSAGetLastError());
+        closesocket(fd);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    s->fd = fd;
+    s->port = port;
+    s->is_open = 1;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * socket_get_local_addr
+ *
+ * Get the local IPv4 address and port of a connected socket, both in host
+ * byte order.
+ */
+
+extern int socket_get_local_addr(sock_p s, uint32_t *ip_addr, int *port)
+{
+    struct sockaddr_in local_addr;
+    int addr_len = (int)sizeof(local_addr);
+
+    if(!s || !ip_addr || !port) {
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(!s->is_open) {
+        pdebug(DEBUG_WARN, "Socket is not open!");
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    memset((void *)&local_addr, 0, sizeof(local_addr));
+
+    if(getsockname(s->fd, (struct sockaddr *)&local_addr, &addr_len)) {
+        pdebug(DEBUG_WARN, "Unable to get local socket address, error: %d", WSAGetLastError());
+        return PLCTAG_ERR_BAD_STATUS;
+    }
+
+    *ip_addr = ntohl(local_addr.sin_addr.s_addr);
+    *port = (int)ntohs(local_addr.sin_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 
 
 
@@ -1340,6 +1481,12 @@ serial_port_p plc_lib_open_serial_port(/*plc_lib lib,*/ const char *path, int ba
      */
 
     switch (baud_rate) {
+    case 115200:
+        BAUD = CBR_115200;
+        break;
+    case 57600:
+        BAUD = CBR_57600;
+        break;
     case 38400:
         BAUD = CBR_38400;
         break;
@@ -1511,6 +1658,8 @@ serial_port_p plc_lib_open_serial_port(/*plc_lib lib,*/ const char *path, int ba
         return NULL;
     }
 
+    serial_port->hSerialPort = hSerialPort;
+
     return serial_port;
 }
 
@@ -240,6 +240,8 @@ extern void lock_release(lock_t *lock);
 typedef struct sock_t *sock_p;
 extern int socket_create(sock_p *s);
 extern int socket_connect_tcp(sock_p s, const char *host, int port);
+extern int socket_connect_udp(sock_p s, const char *host, int port);
+extern int socket_get_local_addr(sock_p s, uint32_t *ip_addr, int *port);
 extern int socket_read(sock_p s, uint8_t *buf, int size);
 extern int socket_write(sock_p s, uint8_t *buf, int size);
 extern int socket_close(sock_p s);
@@ -42,6 +42,8 @@
 void ab_teardown(void);
 int ab_init();
 plc_tag_p ab_tag_create(attr attribs);
+int ab_session_prewarm(attr attribs);
+int ab_session_release(attr attribs);
 
 
 #endif
@@ -42,6 +42,7 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/eip_cip.h>
+#include <ab/eip_cip_io.h>
 #include <ab/eip_lgx_pccc.h>
 #include <ab/eip_plc5_pccc.h>
 #include <ab/eip_plc5_dhp.h>
@@ -83,9 +84,43 @@ volatile int ab_protocol_terminating = 0;
 #define DEFAULT_RETRY_INTERVAL (300)
 
 
+/*
+ * The element types that can be given with elem_type on Logix-class PLCs.
+ * The CIP type is what a read returns for an atomic type, zero otherwise.
+ */
+struct logix_elem_type_t {
+    const char *name;
+    const char *description;
+    int elem_size;
+    elem_type_t elem_type;
+    uint8_t cip_type;
+};
+
+static const struct logix_elem_type_t logix_elem_types[] = {
+    { "lint", "64-bit integer", 8, AB_TYPE_INT64, AB_CIP_DATA_LINT },
+    { "ulint", "64-bit integer", 8, AB_TYPE_INT64, AB_CIP_DATA_ULINT },
+    { "dint", "32-bit integer", 4, AB_TYPE_INT32, AB_CIP_DATA_DINT },
+    { "udint", "32-bit integer", 4, AB_TYPE_INT32, AB_CIP_DATA_UDINT },
+    { "int", "16-bit integer", 2, AB_TYPE_INT16, AB_CIP_DATA_INT },
+    { "uint", "16-bit integer", 2, AB_TYPE_INT16, AB_CIP_DATA_UINT },
+    { "sint", "8-bit integer", 1, AB_TYPE_INT8, AB_CIP_DATA_SINT },
+    { "usint", "8-bit integer", 1, AB_TYPE_INT8, AB_CIP_DATA_USINT },
+    { "bool", "bit", 1, AB_TYPE_BOOL, AB_CIP_DATA_BIT },
+    { "bool array", "bit array", 4, AB_TYPE_BOOL_ARRAY, AB_CIP_DATA_DWORD },
+    { "real", "32-bit float", 4, AB_TYPE_FLOAT32, AB_CIP_DATA_REAL },
+    { "lreal", "64-bit float", 8, AB_TYPE_FLOAT64, AB_CIP_DATA_LREAL },
+    { "string", "string", 88, AB_TYPE_STRING, 0 },
+    { "short string", "short string", 256, AB_TYPE_SHORT_STRING, 0 } /* FIXME - size */
+};
+
+
 /* forward declarations*/
 static int get_tag_data_type(ab_tag_p tag, attr attribs);
+static int get_atomic_type_info(ab_tag_p tag, attr attribs);
+static const struct logix_elem_type_t *find_logix_elem_type(const char *name);
 static void set_tag_byte_order(ab_tag_p tag);
+static int session_use_connected_msg(plc_type_t plc_type, attr attribs);
+static int session_attribs(attr attribs);
 
 static void ab_tag_destroy(ab_tag_p tag);
 static int default_abort(plc_tag_p tag);
@@ -105,7 +140,11 @@ struct tag_vtable_t default_vtable = {
 
     /* attribute accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
 };
 
 
@@ -125,6 +164,11 @@ int ab_init(void)
         return rc;
     }
 
+    if((rc = pccc_startup()) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to initialize PCCC address cache!");
+        return rc;
+    }
+
     pdebug(DEBUG_INFO,"Finished initializing AB protocol library.");
 
     return rc;
@@ -149,6 +193,8 @@ void ab_teardown(void)
 
     session_teardown();
 
+    pccc_teardown();
+
     ab_protocol_terminating = 0;
 
     pdebug(DEBUG_INFO,"Done.");
@@ -156,6 +202,67 @@ void ab_teardown(void)
 
 
 
+/*
+ * ab_session_prewarm
+ *
+ * Start up the session a tag with these attributes would use and keep it
+ * around until ab_session_release().  The session thread connects in the
+ * background.
+ */
+
+int ab_session_prewarm(attr attribs)
+{
+    ab_session_p session = AB_SESSION_NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if((rc = session_attribs(attribs)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    rc = session_find_or_create(&session, attribs);
+    if(rc != PLCTAG_STATUS_OK || !session) {
+        pdebug(DEBUG_WARN, "Unable to create session!");
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    /* the library keeps our reference. */
+    session_hold(session);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * ab_session_release
+ *
+ * Let go of a session kept by ab_session_prewarm().  It closes once no
+ * tags use it.
+ */
+
+int ab_session_release(attr attribs)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if((rc = session_attribs(attribs)) != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    rc = session_release(attribs);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
 plc_tag_p ab_tag_create(attr attribs)
 {
     ab_tag_p tag = AB_TAG_NULL;
@@ -197,46 +304,35 @@ plc_tag_p ab_tag_create(attr attribs)
         return (plc_tag_p)NULL;
     }
 
+    tag->use_connected_msg = session_use_connected_msg(tag->plc_type, attribs);
+
     /* set up any required settings based on the cpu type. */
     switch(tag->plc_type) {
     case AB_PLC_PLC5:
-        tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
-        break;
-
     case AB_PLC_SLC:
-        tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
-        break;
-
     case AB_PLC_MLGX:
-        tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
+        /* reads of nearby data file elements are merged unless turned off. */
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         break;
 
     case AB_PLC_LGX_PCCC:
-        tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
+        /* Execute PCCC services can share a Multiple Service Packet. */
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         break;
 
     case AB_PLC_LGX:
-        /* default to requiring a connection and allowing packing. */
-        tag->use_connected_msg = attr_get_int(attribs,"use_connected_msg", 1);
+        /* default to allowing packing. */
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         break;
 
     case AB_PLC_MLGX800:
-        /* we must use connected messaging here. */
-        pdebug(DEBUG_DETAIL, "Micro800 needs connected messaging.");
-        tag->use_connected_msg = 1;
-
         /* Micro800 cannot pack requests. */
         tag->allow_packing = 0;
         break;
 
     case AB_PLC_OMRON_NJNX:
-        tag->use_connected_msg = 1;
-        tag->allow_packing = 0;
+        /* packing is off by default as not all NJ/NX firmware supports it. */
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
         break;
 
     default:
@@ -265,10 +361,12 @@ plc_tag_p ab_tag_create(attr attribs)
 
     pdebug(DEBUG_DETAIL, "using session=%p", tag->session);
 
+    tag->dhp_dest = (uint16_t)attr_get_int(attribs, "dhp_dest", 0);
+
     /* set up PLC-specific information. */
     switch(tag->plc_type) {
     case AB_PLC_PLC5:
-        if(!tag->session->dhp_dest) {
+        if(!tag->dhp_dest) {
             pdebug(DEBUG_DETAIL, "Setting up PLC/5 tag.");
 
             if(str_length(path)) {
@@ -280,15 +378,15 @@ plc_tag_p ab_tag_create(attr attribs)
         } else {
             pdebug(DEBUG_DETAIL, "Setting up PLC/5 via DH+ bridge tag.");
             tag->use_connected_msg = 1;
+            tag->allow_packing = 0;
             tag->vtable = &eip_plc5_dhp_vtable;
         }
 
-        tag->allow_packing = 0;
         break;
 
     case AB_PLC_SLC:
     case AB_PLC_MLGX:
-        if(!tag->session->dhp_dest) {
+        if(!tag->dhp_dest) {
 
             if(str_length(path)) {
                 pdebug(DEBUG_WARN, "A path is not supported for this PLC type if it is not for a DH+ bridge.");
@@ -300,16 +398,15 @@ plc_tag_p ab_tag_create(attr attribs)
         } else {
             pdebug(DEBUG_DETAIL, "Setting up SLC/MicroLogix via DH+ bridge tag.");
             tag->use_connected_msg = 1;
+            tag->allow_packing = 0;
             tag->vtable = &eip_slc_dhp_vtable;
         }
 
-        tag->allow_packing = 0;
         break;
 
     case AB_PLC_LGX_PCCC:
         pdebug(DEBUG_DETAIL, "Setting up PCCC-mapped Logix tag.");
         tag->use_connected_msg = 0;
-        tag->allow_packing = 0;
         tag->vtable = &lgx_pccc_vtable;
         break;
 
@@ -335,6 +432,20 @@ plc_tag_p ab_tag_create(attr attribs)
         tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
         tag->vtable = &eip_cip_vtable;
 
+        /* a produced tag can be consumed over a class 1 connection instead. */
+        tag->rpi_ms = attr_get_int(attribs, "rpi_ms", 0);
+        if(tag->rpi_ms < 0) {
+            pdebug(DEBUG_WARN, "RPI must not be negative!");
+            tag->status = PLCTAG_ERR_BAD_PARAM;
+            return (plc_tag_p)tag;
+        }
+
+        if(tag->rpi_ms > 0) {
+            pdebug(DEBUG_DETAIL, "Consuming produced tag with RPI %dms.", tag->rpi_ms);
+            tag->allow_packing = 0;
+            tag->vtable = &eip_cip_io_vtable;
+        }
+
         break;
 
     case AB_PLC_MLGX800:
@@ -359,7 +470,7 @@ plc_tag_p ab_tag_create(attr attribs)
         }
 
         tag->use_connected_msg = 1;
-        tag->allow_packing = 0;
+        tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
         tag->vtable = &eip_cip_vtable;
         break;
 
@@ -380,17 +491,53 @@ plc_tag_p ab_tag_create(attr attribs)
 
 
     switch(tag->plc_type) {
+    case AB_PLC_LGX:
+    case AB_PLC_MLGX800:
     case AB_PLC_OMRON_NJNX:
-        if (tag->elem_count != 1) {
-            tag->elem_count = 1;
-            pdebug(DEBUG_WARN,"Attribute elem_count should be 1!");
+        /* the data of a consumed tag comes in one packet of a size fixed when connecting. */
+        if(tag->rpi_ms > 0) {
+            if(!tag->elem_size) {
+                tag->elem_size = attr_get_int(attribs, "elem_size", 0);
+            }
+
+            tag->size = tag->elem_count * tag->elem_size;
+            if(tag->tag_list || tag->size <= 0 || tag->size + (int)sizeof(uint16_t) > AB_EIP_IO_MAX_SIZE) {
+                pdebug(DEBUG_WARN, "Consumed tag size %d must be known and fit in one packet!", tag->size);
+                tag->status = PLCTAG_ERR_BAD_PARAM;
+                return (plc_tag_p)tag;
+            }
+
+            tag->data = (uint8_t*)mem_alloc(tag->size);
+            if(tag->data == NULL) {
+                pdebug(DEBUG_WARN,"Unable to allocate tag data!");
+                tag->status = PLCTAG_ERR_NO_MEM;
+                return (plc_tag_p)tag;
+            }
+
+            break;
         }
 
-        /* from here is the same as a AB_PLC_MLGX800. */
+        /*
+         * a lazy tag of a known atomic type can be set up without asking the PLC.
+         * Any other lazy tag finds out its type and size on its first read or write.
+         */
+        if(attr_get_int(attribs, "lazy", 0)) {
+            if(tag->elem_size > 0 && get_atomic_type_info(tag, attribs) == PLCTAG_STATUS_OK) {
+                tag->size = tag->elem_count * tag->elem_size;
+                tag->data = (uint8_t*)mem_alloc(tag->size);
+
+                if(tag->data == NULL) {
+                    pdebug(DEBUG_WARN,"Unable to allocate tag data!");
+                    tag->status = PLCTAG_ERR_NO_MEM;
+                    return (plc_tag_p)tag;
+                }
+
+                break;
+            }
+
+            pdebug(DEBUG_DETAIL, "Lazy tag does not have an atomic elem_type, the type and size will come from the PLC.");
+        }
 
-        /* fall through */
-    case AB_PLC_LGX:
-    case AB_PLC_MLGX800:
         /* fill this in when we read the tag. */
         tag->elem_size = 0;
         tag->size = 0;
@@ -434,11 +581,37 @@ plc_tag_p ab_tag_create(attr attribs)
         return (plc_tag_p)tag;
     }
 
+    /*
+     * Omron arrays are read in element ranges.  A name with more than one
+     * index cannot be stepped, so it can only be read one element at a time.
+     */
+    if(tag->plc_type == AB_PLC_OMRON_NJNX && !tag->tag_list && tag->elem_count > 1) {
+        uint8_t range_name[MAX_TAG_NAME];
+        int range_name_size = 0;
+
+        if(omron_range_name(tag, 0, range_name, &range_name_size) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN,"Attribute elem_count should be 1 for this tag name!");
+            tag->elem_count = 1;
+
+            if(tag->data) {
+                tag->size = tag->elem_size;
+            }
+        }
+    }
+
     /* trigger the first read. */
     tag->first_read = 1;
 
-    /* kick off a read to get the tag type and size. */
-    if(tag->vtable->read) {
+    /* lazy tags wait for the first real read or write to talk to the PLC. */
+    if(attr_get_int(attribs, "lazy", 0)) {
+        pdebug(DEBUG_DETAIL, "Lazy tag, skipping the initial read.");
+
+        /* another tag may already have found out what this one is. */
+        if(tag->vtable == &eip_cip_vtable) {
+            use_cached_type_info(tag);
+        }
+    } else if(tag->vtable->read) {
+        /* kick off a read to get the tag type and size. */
         tag->read_in_flight = 1;
         tag->vtable->read((plc_tag_p)tag);
     }
@@ -547,46 +720,12 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
         /* look for the elem_type attribute. */
         elem_type = attr_get_str(attribs, "elem_type", NULL);
         if(elem_type) {
-            if(str_cmp_i(elem_type,"lint") == 0 || str_cmp_i(elem_type, "ulint") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 64-bit integer.");
-                tag->elem_size = 8;
-                tag->elem_type = AB_TYPE_INT64;
-            } else if(str_cmp_i(elem_type,"dint") == 0 || str_cmp_i(elem_type,"udint") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 32-bit integer.");
-                tag->elem_size = 4;
-                tag->elem_type = AB_TYPE_INT32;
-            } else if(str_cmp_i(elem_type,"int") == 0 || str_cmp_i(elem_type,"uint") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 16-bit integer.");
-                tag->elem_size = 2;
-                tag->elem_type = AB_TYPE_INT16;
-            } else if(str_cmp_i(elem_type,"sint") == 0 || str_cmp_i(elem_type,"usint") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 8-bit integer.");
-                tag->elem_size = 1;
-                tag->elem_type = AB_TYPE_INT8;
-            } else if(str_cmp_i(elem_type,"bool") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of bit.");
-                tag->elem_size = 1;
-                tag->elem_type = AB_TYPE_BOOL;
-            } else if(str_cmp_i(elem_type,"bool array") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of bit array.");
-                tag->elem_size = 4;
-                tag->elem_type = AB_TYPE_BOOL_ARRAY;
-            } else if(str_cmp_i(elem_type,"real") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 32-bit float.");
-                tag->elem_size = 4;
-                tag->elem_type = AB_TYPE_FLOAT32;
-            } else if(str_cmp_i(elem_type,"lreal") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of 64-bit float.");
-                tag->elem_size = 8;
-                tag->elem_type = AB_TYPE_FLOAT64;
-            } else if(str_cmp_i(elem_type,"string") == 0) {
-                pdebug(DEBUG_DETAIL,"Fount tag element type of string.");
-                tag->elem_size = 88;
-                tag->elem_type = AB_TYPE_STRING;
-            } else if(str_cmp_i(elem_type,"short string") == 0) {
-                pdebug(DEBUG_DETAIL,"Found tag element type of short string.");
-                tag->elem_size = 256; /* FIXME */
-                tag->elem_type = AB_TYPE_SHORT_STRING;
+            const struct logix_elem_type_t *type = find_logix_elem_type(elem_type);
+
+            if(type) {
+                pdebug(DEBUG_DETAIL,"Found tag element type of %s.", type->description);
+                tag->elem_size = type->elem_size;
+                tag->elem_type = type->elem_type;
             } else {
                 pdebug(DEBUG_DETAIL, "Unknown tag type %s", elem_type);
             }
@@ -618,6 +757,50 @@ int get_tag_data_type(ab_tag_p tag, attr attribs)
 
 
 
+/*
+ * Set the CIP type of a Logix tag from the elem_type attribute.  This is
+ * what a read would have returned, so a write can be done without a read
+ * first.  Only atomic types can be done this way.
+ */
+
+int get_atomic_type_info(ab_tag_p tag, attr attribs)
+{
+    const char *elem_type = attr_get_str(attribs, "elem_type", NULL);
+    const struct logix_elem_type_t *type = NULL;
+
+    if(!elem_type) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    type = find_logix_elem_type(elem_type);
+    if(!type || !type->cip_type) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    pdebug(DEBUG_DETAIL, "Using CIP type %x for element type %s.", type->cip_type, elem_type);
+
+    tag->encoded_type_info[0] = type->cip_type;
+    tag->encoded_type_info[1] = 0;
+    tag->encoded_type_info_size = 2;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+const struct logix_elem_type_t *find_logix_elem_type(const char *name)
+{
+    for(size_t i=0; i < sizeof(logix_elem_types)/sizeof(logix_elem_types[0]); i++) {
+        if(str_cmp_i(name, logix_elem_types[i].name) == 0) {
+            return &logix_elem_types[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+
 void set_tag_byte_order(ab_tag_p tag)
 {
     /* 16-bit ints. */
@@ -742,9 +925,27 @@ int ab_tag_abort(ab_tag_p tag)
         pdebug(DEBUG_DETAIL, "Called without a request in flight.");
     }
 
+    /* clean up any fragments of a split read. */
+    for(int i=0; i < tag->frag_count; i++) {
+        if(tag->frag_req[i]) {
+            spin_block(&tag->frag_req[i]->lock) {
+                tag->frag_req[i]->abort_request = 1;
+            }
+
+            tag->frag_req[i] = rc_dec(tag->frag_req[i]);
+        }
+    }
+
+    tag->frag_count = 0;
+    tag->size_probe = 0;
+
     tag->read_in_progress = 0;
     tag->write_in_progress = 0;
     tag->offset = 0;
+    tag->range_start = 0;
+    tag->range_end = 0;
+    tag->write_set_mask = 0;
+    tag->write_clear_mask = 0;
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -809,6 +1010,11 @@ void ab_tag_destroy(ab_tag_p tag)
 
     session = tag->session;
 
+    /* close any class 1 connection while we still have the session. */
+    if(tag->rpi_ms > 0) {
+        eip_cip_io_close(tag);
+    }
+
     /* tags should always have a session.  Release it. */
     pdebug(DEBUG_DETAIL,"Getting ready to release tag session %p",tag->session);
     if(session) {
@@ -834,6 +1040,11 @@ void ab_tag_destroy(ab_tag_p tag)
         tag->data = NULL;
     }
 
+    if(tag->symbolic_name) {
+        mem_free(tag->symbolic_name);
+        tag->symbolic_name = NULL;
+    }
+
     pdebug(DEBUG_INFO,"Finished releasing all tag resources.");
 
     pdebug(DEBUG_INFO, "done");
@@ -916,6 +1127,59 @@ plc_type_t get_plc_type(attr attribs)
 
 
 
+/*
+ * session_use_connected_msg
+ *
+ * Whether the session for this PLC type uses a CIP connection.  Only
+ * Logix PLCs let the caller choose.  DH+ bridged tags change this after
+ * they have their session.
+ */
+
+int session_use_connected_msg(plc_type_t plc_type, attr attribs)
+{
+    switch(plc_type) {
+    case AB_PLC_LGX:
+        return attr_get_int(attribs, "use_connected_msg", 1);
+
+    case AB_PLC_MLGX800:
+    case AB_PLC_OMRON_NJNX:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+
+
+/*
+ * session_attribs
+ *
+ * Check the attributes for a session without a tag and set the
+ * connection choice a tag would make, so that both find the same session.
+ */
+
+int session_attribs(attr attribs)
+{
+    plc_type_t plc_type = get_plc_type(attribs);
+
+    if(plc_type == AB_PLC_NONE) {
+        pdebug(DEBUG_WARN, "CPU type not valid or missing.");
+        return PLCTAG_ERR_BAD_DEVICE;
+    }
+
+    if(plc_type == AB_PLC_LGX && !attr_get_str(attribs, "path", NULL)) {
+        pdebug(DEBUG_WARN, "A path is required for Logix-class PLCs!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    attr_set_int(attribs, "use_connected_msg", session_use_connected_msg(plc_type, attribs));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int check_cpu(ab_tag_p tag, attr attribs)
 {
     plc_type_t result = get_plc_type(attribs);
@@ -181,6 +181,12 @@
 
 /* transport class */
 #define AB_EIP_TRANSPORT_CLASS_T3   ((uint8_t)0xA3)
+#define AB_EIP_TRANSPORT_CLASS_T1   ((uint8_t)0x01) /* client, cyclic trigger, class 1 */
+
+/* class 1 I/O connections */
+#define AB_EIP_IO_PORT              (2222)
+#define AB_EIP_IO_CONN_PARAM        ((uint16_t)0x4800) /* point to point, scheduled, fixed size */
+#define AB_EIP_IO_MAX_SIZE          (0x1FF)
 
 
 #define AB_EIP_SECS_PER_TICK 0x0A
@@ -198,6 +204,8 @@
 #define AB_EIP_ITEM_CAI ((uint16_t)0x00A1) /* connected address item */
 #define AB_EIP_ITEM_CDI ((uint16_t)0x00B1) /* connected data item */
 #define AB_EIP_ITEM_UDI ((uint16_t)0x00B2) /* Unconnected data item */
+#define AB_EIP_ITEM_SOCKADDR_T2O ((uint16_t)0x8001) /* T->O socket address info item */
+#define AB_EIP_ITEM_SAI ((uint16_t)0x8002) /* sequenced address item */
 
 
 /* Types of AB protocols */
@@ -433,6 +441,32 @@ START_PACK typedef struct {
 
 
 
+/* Socket address info item, the address fields are big-endian. */
+START_PACK typedef struct {
+    uint16_le item_type;            /* 0x8001 for T->O */
+    uint16_le item_length;          /* ALWAYS 16 */
+    uint8_t sin_family[2];          /* AF_INET, 2 */
+    uint8_t sin_port[2];
+    uint8_t sin_addr[4];
+    uint8_t sin_zero[8];
+} END_PACK eip_sockaddr_item_t;
+
+
+/* Class 1 I/O packet, sent over UDP with no encapsulation header. */
+START_PACK typedef struct {
+    uint16_le cpf_item_count;        /* ALWAYS 2 */
+    uint16_le cpf_sai_item_type;     /* ALWAYS 0x8002 Sequenced Address Item */
+    uint16_le cpf_sai_item_length;   /* ALWAYS 8 */
+    uint32_le cpf_conn_id;           /* ID of the connection in the direction sent */
+    uint32_le cpf_seq_num;           /* encapsulation sequence number */
+    uint16_le cpf_cdi_item_type;     /* ALWAYS 0x00B1 Connected Data Item */
+    uint16_le cpf_cdi_item_length;   /* data size plus the sequence count */
+    uint16_le cip_seq_count;         /* changes when the data is new */
+    //uint8_t data[ZLA_SIZE];
+} END_PACK eip_io_packet_t;
+
+
+
 /* Forward Close Request */
 START_PACK typedef struct {
     /* encap header */
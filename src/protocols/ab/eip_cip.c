@@ -129,22 +129,45 @@ START_PACK typedef struct {
 
 
 static int build_read_request_connected(ab_tag_p tag, int byte_offset);
+static int build_read_fragment_connected(ab_tag_p tag, int byte_offset, int elem_count, int allow_packing, ab_request_p *req_out);
+static int build_split_read_requests_connected(ab_tag_p tag, int chunk_size);
+static int split_read_chunk_size(ab_tag_p tag);
+static int omron_finish_size_probe(ab_tag_p tag);
 static int build_tag_list_request_connected(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
+static int build_write_fragment_connected(ab_tag_p tag, int multiple_requests, ab_request_p *req_out);
+static int build_split_write_requests_connected(ab_tag_p tag);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
 static int build_write_bit_request_unconnected(ab_tag_p tag);
+static int is_rmw_write(ab_tag_p tag);
+static uint8_t *encode_rmw_masks(ab_tag_p tag, uint8_t *data);
+static void apply_rmw_masks(ab_tag_p tag);
+static int decode_read_response_connected(ab_tag_p tag, ab_request_p req, int *partial_data);
 static int check_read_status_connected(ab_tag_p tag);
+static int check_split_read_status_connected(ab_tag_p tag);
 static int check_read_tag_list_status_connected(ab_tag_p tag);
 static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
+static int check_split_write_status_connected(ab_tag_p tag);
+static int decode_write_response_connected(ab_request_p req);
 static int check_write_status_unconnected(ab_tag_p tag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
+static int tag_data_end(ab_tag_p tag);
+static int symbol_key(ab_tag_p tag, uint8_t *key, int *key_len, int *scope_end, int *symbol_end);
+static void use_symbol_instance(ab_tag_p tag);
+static int restore_symbolic_name(ab_tag_p tag);
+static void remember_listed_symbol(ab_tag_p tag, uint32_t instance_id, uint8_t *name, int name_len);
+static void remember_type_info(ab_tag_p tag);
+static void check_type_info(ab_tag_p tag, uint8_t *type_info, int type_info_size);
+static void forget_type_info(ab_tag_p tag);
 
 static int tag_read_start(ab_tag_p tag);
 static int tag_tickler(ab_tag_p tag);
 static int tag_write_start(ab_tag_p tag);
+static int tag_set_range(plc_tag_p raw_tag, int start_elem, int elem_count);
+static int tag_set_write_mask(plc_tag_p raw_tag, uint64_t set_mask, uint64_t clear_mask);
 
 /* define the exported vtable for this tag type. */
 struct tag_vtable_t eip_cip_vtable = {
@@ -156,7 +179,13 @@ struct tag_vtable_t eip_cip_vtable = {
 
     /* attribute accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* partial array access */
+    tag_set_range,
+
+    /* masked bit writes */
+    tag_set_write_mask
 };
 
 
@@ -169,6 +198,10 @@ struct tag_vtable_t eip_cip_vtable = {
 int tag_tickler(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int range_start = tag->range_start;
+    int range_end = tag->range_end;
+    uint64_t write_set_mask = tag->write_set_mask;
+    uint64_t write_clear_mask = tag->write_clear_mask;
 
     pdebug(DEBUG_SPEW,"Starting.");
 
@@ -176,6 +209,8 @@ int tag_tickler(ab_tag_p tag)
         if(tag->use_connected_msg) {
             if(tag->tag_list) {
                 rc = check_read_tag_list_status_connected(tag);
+            } else if(tag->frag_count > 0) {
+                rc = check_split_read_status_connected(tag);
             } else {
                 rc = check_read_status_connected(tag);
             }
@@ -183,11 +218,21 @@ int tag_tickler(ab_tag_p tag)
             rc = check_read_status_unconnected(tag);
         }
 
+        /* a stale instance ID, try again with the name. */
+        if(!tag->read_in_progress && (rc == PLCTAG_ERR_NOT_FOUND || rc == PLCTAG_ERR_BAD_PARAM) && restore_symbolic_name(tag)) {
+            /* an abort clears the range, put it back. */
+            tag->range_start = range_start;
+            tag->range_end = range_end;
+            tag->offset = range_start;
+            rc = tag_read_start(tag);
+        }
+
         tag->status = (int8_t)rc;
 
         /* if the operation completed, make a note so that the callback will be called. */
         if(!tag->read_in_progress) {
             tag->read_complete = 1;
+            tag->range_start = tag->range_end = 0;
         }
 
         pdebug(DEBUG_SPEW,"Done.  Read in progress.");
@@ -197,16 +242,35 @@ int tag_tickler(ab_tag_p tag)
 
     if (tag->write_in_progress) {
         if(tag->use_connected_msg) {
-            rc = check_write_status_connected(tag);
+            if(tag->frag_count > 0) {
+                rc = check_split_write_status_connected(tag);
+            } else {
+                rc = check_write_status_connected(tag);
+            }
         } else {
             rc = check_write_status_unconnected(tag);
         }
 
+        if(!tag->write_in_progress && (rc == PLCTAG_ERR_NOT_FOUND || rc == PLCTAG_ERR_BAD_PARAM) && restore_symbolic_name(tag)) {
+            tag->range_start = range_start;
+            tag->range_end = range_end;
+            tag->offset = range_start;
+            tag->write_set_mask = write_set_mask;
+            tag->write_clear_mask = write_clear_mask;
+            rc = tag_write_start(tag);
+        }
+
         tag->status = (int8_t)rc;
 
         /* if the operation completed, make a note so that the callback will be called. */
         if(!tag->write_in_progress) {
+            if(rc == PLCTAG_STATUS_OK) {
+                apply_rmw_masks(tag);
+            }
+
             tag->write_complete = 1;
+            tag->range_start = tag->range_end = 0;
+            tag->write_set_mask = tag->write_clear_mask = 0;
         }
 
         pdebug(DEBUG_SPEW, "Done. Write in progress.");
@@ -235,6 +299,7 @@ int tag_tickler(ab_tag_p tag)
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
+    int chunk_size = 0;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -243,6 +308,8 @@ int tag_read_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    use_symbol_instance(tag);
+
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
@@ -250,6 +317,8 @@ int tag_read_start(ab_tag_p tag)
     if(tag->use_connected_msg) {
         if(tag->tag_list) {
             rc = build_tag_list_request_connected(tag);
+        } else if((chunk_size = split_read_chunk_size(tag)) > 0) {
+            rc = build_split_read_requests_connected(tag, chunk_size);
         } else {
             rc = build_read_request_connected(tag, tag->offset);
         }
@@ -300,6 +369,8 @@ int tag_write_start(ab_tag_p tag)
         return PLCTAG_ERR_BUSY;
     }
 
+    use_symbol_instance(tag);
+
     /* the write is now in flight */
     tag->write_in_progress = 1;
 
@@ -307,10 +378,16 @@ int tag_write_start(ab_tag_p tag)
      * if the tag has not been read yet, read it.
      *
      * This gets the type data and sets up the request
-     * buffers.
+     * buffers.  A lazy tag created with an atomic type
+     * already has both.  A Read-Modify-Write only needs
+     * the buffer and the element size.
      */
 
-    if (tag->first_read) {
+    if (tag->first_read && !tag->encoded_type_info_size) {
+        use_cached_type_info(tag);
+    }
+
+    if (tag->first_read && !(tag->data && (tag->encoded_type_info_size || (is_rmw_write(tag) && tag->elem_size > 0)))) {
         pdebug(DEBUG_DETAIL, "No read has completed yet, doing pre-read to get type information.");
 
         tag->pre_write_read = 1;
@@ -346,16 +423,166 @@ int tag_write_start(ab_tag_p tag)
 
 
 
+
+/*
+ * tag_set_range
+ *
+ * Limit the next read or write to a run of elements.  This uses the byte
+ * offset of the fragmented services, so the start offset is where the first
+ * request begins and the operation stops once the end of the range is passed.
+ *
+ * Must be called with the tag mutex held and no operation in flight.
+ */
+
+int tag_set_range(plc_tag_p raw_tag, int start_elem, int elem_count)
+{
+    ab_tag_p tag = (ab_tag_p)raw_tag;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->read_in_progress || tag->write_in_progress) {
+        pdebug(DEBUG_WARN, "Read or write operation already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    tag->range_start = 0;
+    tag->range_end = 0;
+    tag->offset = 0;
+
+    /* no range, or a range covering the whole tag, is a normal operation. */
+    if(elem_count == 0 || (start_elem == 0 && elem_count == tag->elem_count)) {
+        pdebug(DEBUG_DETAIL, "Done.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(tag->tag_list || tag->is_bit || tag->plc_type == AB_PLC_OMRON_NJNX) {
+        pdebug(DEBUG_WARN, "Partial reads and writes are not supported on this tag!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* we need the element size and the type info from a completed read. */
+    if(tag->first_read || tag->elem_size <= 0) {
+        pdebug(DEBUG_WARN, "Tag must be read before partial reads or writes can be done!");
+        return PLCTAG_ERR_NO_DATA;
+    }
+
+    if(start_elem < 0 || elem_count < 0 || start_elem + elem_count > tag->elem_count) {
+        pdebug(DEBUG_WARN, "Range of %d elements starting at %d is outside the %d elements of the tag!", elem_count, start_elem, tag->elem_count);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    tag->range_start = start_elem * tag->elem_size;
+    tag->range_end = (start_elem + elem_count) * tag->elem_size;
+    tag->offset = tag->range_start;
+
+    pdebug(DEBUG_DETAIL, "Done with byte range %d to %d.", tag->range_start, tag->range_end);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * tag_set_write_mask
+ *
+ * Make the next write a Read-Modify-Write of the first element that only
+ * touches the masked bits.  The element size is not known until the tag
+ * has been read, so the masks are checked when the request is built.
+ *
+ * Must be called with the tag mutex held and no operation in flight.
+ */
+
+int tag_set_write_mask(plc_tag_p raw_tag, uint64_t set_mask, uint64_t clear_mask)
+{
+    ab_tag_p tag = (ab_tag_p)raw_tag;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->read_in_progress || tag->write_in_progress) {
+        pdebug(DEBUG_WARN, "Read or write operation already in flight!");
+        return PLCTAG_ERR_BUSY;
+    }
+
+    if((set_mask || clear_mask) && (tag->tag_list || tag->is_bit || tag->plc_type == AB_PLC_OMRON_NJNX)) {
+        pdebug(DEBUG_WARN, "Masked writes are not supported on this tag!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    tag->write_set_mask = set_mask;
+    tag->write_clear_mask = clear_mask;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int build_read_request_connected(ab_tag_p tag, int byte_offset)
+{
+    uint8_t name[MAX_TAG_NAME];
+    int name_size = 0;
+
+    /*
+     * Omron arrays are read in element ranges, which needs the element
+     * size.  If we do not know it yet, read one element to find it.
+     */
+    tag->size_probe = (tag->plc_type == AB_PLC_OMRON_NJNX && tag->elem_count > 1 && tag->elem_size <= 0
+                       && omron_range_name(tag, 0, name, &name_size) == PLCTAG_STATUS_OK);
+
+    if(tag->size_probe) {
+        pdebug(DEBUG_DETAIL, "Reading one element to get the element size.");
+        return build_read_fragment_connected(tag, 0, 1, tag->allow_packing, &tag->req);
+    }
+
+    /* a partial read must not get elements past the end of the range. */
+    if(tag->range_end > 0 && tag->elem_size > 0) {
+        return build_read_fragment_connected(tag, byte_offset, tag->range_end / tag->elem_size, tag->allow_packing, &tag->req);
+    }
+
+    return build_read_fragment_connected(tag, byte_offset, tag->elem_count, tag->allow_packing, &tag->req);
+}
+
+
+
+/*
+ * build_read_fragment_connected
+ *
+ * Queue a read of the tag starting at the passed byte offset.  The element
+ * count limits how far the PLC will return data, so a fragment can be
+ * bounded at both ends.  The new request is stored in *req_out.
+ *
+ * Omron PLCs do not have the fragmented read service, so an Omron array
+ * is read by naming the first element of the range instead.
+ */
+
+int build_read_fragment_connected(ab_tag_p tag, int byte_offset, int elem_count, int allow_packing, ab_request_p *req_out)
 {
     eip_cip_co_req* cip = NULL;
     uint8_t* data = NULL;
     ab_request_p req = NULL;
     int rc = PLCTAG_STATUS_OK;
     uint8_t read_cmd = AB_EIP_CMD_CIP_READ_FRAG;
+    uint8_t *name = tag->encoded_name;
+    int name_size = tag->encoded_name_size;
+    uint8_t range_name[MAX_TAG_NAME];
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    if(tag->plc_type == AB_PLC_OMRON_NJNX && tag->elem_count > 1) {
+        int first_elem = (tag->elem_size > 0 ? byte_offset / tag->elem_size : 0);
+
+        /* ab_tag_create() only allows more than one element for names we can step. */
+        rc = omron_range_name(tag, first_elem, range_name, &name_size);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to read part of the array with this tag name!");
+            return rc;
+        }
+
+        name = range_name;
+        elem_count -= first_elem;
+    }
+
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if (rc != PLCTAG_STATUS_OK) {
@@ -391,11 +618,11 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     data++;
 
     /* copy the tag name into the request */
-    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    mem_copy(data, name, name_size);
+    data += name_size;
 
     /* add the count of elements to read. */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    *((uint16_le*)data) = h2le16((uint16_t)(elem_count));
     data += sizeof(uint16_le);
 
     if (read_cmd == AB_EIP_CMD_CIP_READ_FRAG) {
@@ -425,19 +652,19 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
     /* set the session so that we know what session the request is aiming at */
     //req->session = tag->session;
 
-    req->allow_packing = tag->allow_packing;
+    req->allow_packing = allow_packing;
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        *req_out = rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -445,6 +672,236 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset)
 }
 
 
+/*
+ * split_read_chunk_size
+ *
+ * Once a read has told us the size and type of the tag, a large read does
+ * not need to wait for each fragment before asking for the next one.  Return
+ * the number of bytes to ask for in each fragment, or zero if the read should
+ * be done the normal way.
+ */
+
+int split_read_chunk_size(ab_tag_p tag)
+{
+    int chunk_size = 0;
+
+    if(tag->pre_write_read) {
+        return 0;
+    }
+
+    /* Omron reads are split by element, which only needs the element size. */
+    if(tag->plc_type == AB_PLC_OMRON_NJNX) {
+        uint8_t name[MAX_TAG_NAME];
+        int name_size = 0;
+
+        if(omron_range_name(tag, 0, name, &name_size) != PLCTAG_STATUS_OK) {
+            return 0;
+        }
+    } else if(tag->first_read) {
+        return 0;
+    }
+
+    /* fragments are bounded by element count, so the elements must tile the buffer. */
+    if(tag->elem_count <= 1 || tag->elem_size <= 0 || tag->size != tag->elem_count * tag->elem_size) {
+        return 0;
+    }
+
+    if(tag->encoded_type_info_size == 0) {
+        return 0;
+    }
+
+    chunk_size = session_get_max_payload(tag->session)
+                 - 4                             /* reply service, reserved, status and extended status size */
+                 - tag->encoded_type_info_size   /* type info in front of the data */
+                 - 8;                            /* MAGIC fudge factor */
+
+    /* the PLC may have told us it sends less than that. */
+    if(tag->frag_size > 0 && tag->frag_size < chunk_size) {
+        chunk_size = tag->frag_size;
+    }
+
+    /* round down to whole elements. */
+    chunk_size = (chunk_size / tag->elem_size) * tag->elem_size;
+
+    if(chunk_size <= 0 || tag_data_end(tag) - tag->offset <= chunk_size) {
+        return 0;
+    }
+
+    return chunk_size;
+}
+
+
+
+/*
+ * omron_range_name
+ *
+ * Build the encoded name of the element first_elem elements past the one
+ * the tag names.  The name may have at most one index after the last
+ * symbolic segment as we cannot step across the dimensions of a
+ * multidimensional array.
+ */
+
+int omron_range_name(ab_tag_p tag, int first_elem, uint8_t *name, int *name_size)
+{
+    uint8_t *encoded = tag->encoded_name;
+    int size = tag->encoded_name_size;
+    int index = 1;
+    int num_indexes = 0;
+    int index_start = size;
+    uint32_t elem_index = 0;
+
+    while(index < size) {
+        switch(encoded[index]) {
+            case 0x91:
+                num_indexes = 0;
+                index_start = size;
+                elem_index = 0;
+                index += 2 + encoded[index + 1] + (encoded[index + 1] & 0x01);
+                break;
+
+            case 0x28:
+                num_indexes++;
+                index_start = index;
+                elem_index = encoded[index + 1];
+                index += 2;
+                break;
+
+            case 0x29:
+                num_indexes++;
+                index_start = index;
+                elem_index = (uint32_t)encoded[index + 2] | ((uint32_t)encoded[index + 3] << 8);
+                index += 4;
+                break;
+
+            case 0x2A:
+                num_indexes++;
+                index_start = index;
+                elem_index = (uint32_t)encoded[index + 2] | ((uint32_t)encoded[index + 3] << 8)
+                             | ((uint32_t)encoded[index + 4] << 16) | ((uint32_t)encoded[index + 5] << 24);
+                index += 6;
+                break;
+
+            default:
+                return PLCTAG_ERR_UNSUPPORTED;
+        }
+    }
+
+    if(index != size || num_indexes > 1 || first_elem < 0 || index_start + 6 > MAX_TAG_NAME) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    elem_index += (uint32_t)first_elem;
+
+    mem_copy(name, encoded, index_start);
+    index = index_start;
+
+    if(elem_index > 0xFFFF) {
+        name[index++] = 0x2A;
+        name[index++] = 0;
+        name[index++] = (uint8_t)(elem_index & 0xFF);
+        name[index++] = (uint8_t)((elem_index >> 8) & 0xFF);
+        name[index++] = (uint8_t)((elem_index >> 16) & 0xFF);
+        name[index++] = (uint8_t)((elem_index >> 24) & 0xFF);
+    } else if(elem_index > 0xFF) {
+        name[index++] = 0x29;
+        name[index++] = 0;
+        name[index++] = (uint8_t)(elem_index & 0xFF);
+        name[index++] = (uint8_t)((elem_index >> 8) & 0xFF);
+    } else {
+        name[index++] = 0x28;
+        name[index++] = (uint8_t)elem_index;
+    }
+
+    /* the first byte is the size in 16-bit words. */
+    name[0] = (uint8_t)((index - 1) / 2);
+    *name_size = index;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * omron_finish_size_probe
+ *
+ * The first element of an Omron array has come back.  Now that we know the
+ * element size, make the tag buffer big enough for all of them.
+ */
+
+int omron_finish_size_probe(ab_tag_p tag)
+{
+    tag->size_probe = 0;
+
+    if(tag->offset <= 0) {
+        pdebug(DEBUG_WARN, "No data returned for the first element!");
+        return PLCTAG_ERR_BAD_REPLY;
+    }
+
+    tag->elem_size = tag->offset;
+    tag->size = tag->elem_count * tag->elem_size;
+
+    pdebug(DEBUG_DETAIL, "Element size is %d, increasing tag buffer size to %d bytes.", tag->elem_size, tag->size);
+
+    tag->data = (uint8_t*)mem_realloc(tag->data, tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to reallocate tag data memory!");
+        tag->size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    mem_set(tag->data + tag->elem_size, 0, tag->size - tag->elem_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * build_split_read_requests_connected
+ *
+ * Queue up to MAX_FRAG_REQUESTS fragment reads covering the data from the
+ * current offset.  The fragments are not packable as each response already
+ * fills a packet.  The session sends as many of them as the
+ * max_requests_in_flight attribute allows before waiting for the replies.
+ */
+
+int build_split_read_requests_connected(ab_tag_p tag, int chunk_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int byte_offset = tag->offset;
+    int end_offset = tag_data_end(tag);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    tag->frag_count = 0;
+
+    while(byte_offset < end_offset && tag->frag_count < MAX_FRAG_REQUESTS) {
+        int frag_end = byte_offset + chunk_size;
+
+        if(frag_end > end_offset) {
+            frag_end = end_offset;
+        }
+
+        rc = build_read_fragment_connected(tag, byte_offset, frag_end / tag->elem_size, 0, &tag->frag_req[tag->frag_count]);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build fragment read request at offset %d!", byte_offset);
+            ab_tag_abort(tag);
+            return rc;
+        }
+
+        tag->frag_offset[tag->frag_count] = byte_offset;
+        tag->frag_count++;
+
+        byte_offset = frag_end;
+    }
+
+    pdebug(DEBUG_INFO, "Done with %d fragments queued.", tag->frag_count);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int build_tag_list_request_connected(ab_tag_p tag)
 {
     eip_cip_co_req* cip = NULL;
@@ -633,7 +1090,12 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 
     /* add the count of elements to read. */
     /* FIXME BUG - this may not work on some processors! */
-    *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    /* a partial read must not get elements past the end of the range. */
+    if(tag->range_end > 0 && tag->elem_size > 0) {
+        *((uint16_le*)data) = h2le16((uint16_t)(tag->range_end / tag->elem_size));
+    } else {
+        *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
+    }
     data += sizeof(uint16_le);
 
     /* add the byte offset for this request */
@@ -716,112 +1178,162 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset)
 }
 
 
-int build_write_bit_request_connected(ab_tag_p tag)
+/*
+ * Bit tags and writes from plc_tag_write_bits() both use Read-Modify-Write.
+ */
+
+int is_rmw_write(ab_tag_p tag)
 {
-    int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_req* cip = NULL;
-    uint8_t* data = NULL;
-    ab_request_p req = NULL;
-    int i;
+    return tag->is_bit || tag->write_set_mask || tag->write_clear_mask;
+}
 
-    pdebug(DEBUG_INFO, "Starting.");
 
-    /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
-        return rc;
-    }
 
-    rc = calculate_write_data_per_packet(tag);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to calculate valid write data per packet!.  rc=%s", plc_tag_decode_error(rc));
-        return rc;
-    }
+/*
+ * encode_rmw_masks
+ *
+ * Write the mask size and the OR and AND masks for a Read-Modify-Write
+ * of the first element.  A bit tag changes only its own bit to match the
+ * tag buffer.  Otherwise the masks are the ones from plc_tag_write_bits().
+ * The tag buffer is not touched here as the write could still fail, see
+ * apply_rmw_masks().
+ *
+ * Returns a pointer past the masks or NULL if the masks do not fit the
+ * element.
+ */
 
-    if(tag->write_data_per_packet < (tag->size * 2) + 2) {  /* 2 masks plus a count word. */
-        pdebug(DEBUG_ERROR,"Insufficient space to write bit masks!");
-        return PLCTAG_ERR_TOO_SMALL;
+uint8_t *encode_rmw_masks(ab_tag_p tag, uint8_t *data)
+{
+    uint8_t *or_mask = NULL;
+    uint8_t *and_mask = NULL;
+    int i = 0;
+
+    if(!tag->is_bit) {
+        if(tag->elem_size <= 0 || tag->elem_size > (int)sizeof(uint64_t)) {
+            pdebug(DEBUG_WARN, "Masked writes need an element of 1 to 8 bytes, not %d!", tag->elem_size);
+            return NULL;
+        }
+
+        if(tag->elem_size < (int)sizeof(uint64_t) && ((tag->write_set_mask | tag->write_clear_mask) >> (tag->elem_size * 8))) {
+            pdebug(DEBUG_WARN, "Bit masks do not fit in an element of %d bytes!", tag->elem_size);
+            return NULL;
+        }
     }
 
-    cip = (eip_cip_co_req*)(req->data);
+    /* write an INT of the mask size. */
+    *data = (uint8_t)(tag->elem_size & 0xFF); data++;
+    *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
 
-    /* point to the end of the struct */
-    data = (req->data) + sizeof(eip_cip_co_req);
+    or_mask = data;
+    and_mask = data + tag->elem_size;
 
-    /*
-     * set up the embedded CIP read packet
-     * The format is:
-     *
-     * uint8_t cmd
-     * LLA formatted name
-     * uint16_t # size of a mask element
-     * OR mask
-     * AND mask
-     */
+    for(i=0; i < tag->elem_size; i++) {
+        if(tag->is_bit) {
+            uint8_t mask = (uint8_t)((tag->bit / 8) == i ? (1 << (tag->bit % 8)) : 0);
 
-    /*
-     * set up the CIP Read-Modify-Write request type.
-     */
-    *data = AB_EIP_CMD_CIP_RMW;
-    data++;
+            /* if the bit is set, then we want to mask it on, otherwise mask it off. */
+            if(tag->data[tag->bit / 8] & mask) {
+                or_mask[i] = mask;
+                and_mask[i] = (uint8_t)0xFF;
+            } else {
+                or_mask[i] = (uint8_t)0;
+                and_mask[i] = (uint8_t)(~mask);
+            }
+        } else {
+            or_mask[i] = (uint8_t)((tag->write_set_mask >> (i * 8)) & 0xFF);
+            and_mask[i] = (uint8_t)(~((tag->write_clear_mask >> (i * 8)) & 0xFF));
+        }
 
-    /* copy the tag name into the request */
-    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
-    data += tag->encoded_name_size;
+        pdebug(DEBUG_DETAIL, "adding mask byte %d: OR %x AND %x", i, or_mask[i], and_mask[i]);
+    }
 
-    /* write an INT of the mask size. */
-    *data = (uint8_t)(tag->elem_size & 0xFF); data++;
-    *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
+    return and_mask + tag->elem_size;
+}
 
-    /* write the OR mask */
-    for(i=0; i < tag->elem_size; i++) {
-        if((tag->bit/8) == i) {
-            uint8_t mask = (uint8_t)(1 << (tag->bit % 8));
 
-            /* if the bit is set, then we want to mask it on. */
-            if(tag->data[tag->bit / 8] & mask) {
-                *data = mask;
-            } else {
-                *data = (uint8_t)0;
-            }
 
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
+/*
+ * apply_rmw_masks
+ *
+ * Once a write from plc_tag_write_bits() has succeeded, make the first
+ * element of the tag buffer match what the PLC now has.
+ */
 
-            data++;
-        } else {
-            /* this is not the data we care about. */
-            *data = (uint8_t)0;
+void apply_rmw_masks(ab_tag_p tag)
+{
+    if(tag->is_bit || !(tag->write_set_mask || tag->write_clear_mask) || !tag->data) {
+        return;
+    }
 
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
+    for(int i=0; i < tag->elem_size && i < (int)sizeof(uint64_t) && i < tag->size; i++) {
+        uint8_t or_mask = (uint8_t)((tag->write_set_mask >> (i * 8)) & 0xFF);
+        uint8_t and_mask = (uint8_t)(~((tag->write_clear_mask >> (i * 8)) & 0xFF));
 
-            data++;
-        }
+        tag->data[i] = (uint8_t)((tag->data[i] & and_mask) | or_mask);
     }
+}
 
-    /* write the AND mask */
-    for(i=0; i < tag->elem_size; i++) {
-        if((tag->bit / 8) == i) {
-            uint8_t mask = (uint8_t)(1 << (tag->bit % 8));
 
-            /* if the bit is set, then we want to _not_ mask it off. */
-            if(tag->data[tag->bit / 8] & mask) {
-                *data = (uint8_t)0xFF;
-            } else {
-                *data = (uint8_t)(~mask);
-            }
 
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
+int build_write_bit_request_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_req* cip = NULL;
+    uint8_t* data = NULL;
+    ab_request_p req = NULL;
 
-            data++;
-        } else {
-            /* this is not the data we care about. */
-            *data = (uint8_t)0xFF;
+    pdebug(DEBUG_INFO, "Starting.");
 
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
 
-            data++;
-        }
+    rc = calculate_write_data_per_packet(tag);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to calculate valid write data per packet!.  rc=%s", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if(tag->write_data_per_packet < (tag->elem_size * 2) + 2) {  /* 2 masks plus a count word. */
+        pdebug(DEBUG_ERROR,"Insufficient space to write bit masks!");
+        rc_dec(req);
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    cip = (eip_cip_co_req*)(req->data);
+
+    /* point to the end of the struct */
+    data = (req->data) + sizeof(eip_cip_co_req);
+
+    /*
+     * set up the embedded CIP read packet
+     * The format is:
+     *
+     * uint8_t cmd
+     * LLA formatted name
+     * uint16_t # size of a mask element
+     * OR mask
+     * AND mask
+     */
+
+    /*
+     * set up the CIP Read-Modify-Write request type.
+     */
+    *data = AB_EIP_CMD_CIP_RMW;
+    data++;
+
+    /* copy the tag name into the request */
+    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
+    data += tag->encoded_name_size;
+
+    /* write the mask size and the OR and AND masks. */
+    data = encode_rmw_masks(tag, data);
+    if(!data) {
+        rc_dec(req);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
     /* let the rest of the system know that the write is complete after this. */
@@ -876,7 +1388,6 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
     uint8_t *embed_start = NULL;
     uint8_t *embed_end = NULL;
     ab_request_p req = NULL;
-    int i = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -893,8 +1404,9 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
         return rc;
     }
 
-    if(tag->write_data_per_packet < (tag->size * 2) + 2) {  /* 2 masks plus a count word. */
+    if(tag->write_data_per_packet < (tag->elem_size * 2) + 2) {  /* 2 masks plus a count word. */
         pdebug(DEBUG_ERROR,"Insufficient space to write bit masks!");
+        rc_dec(req);
         return PLCTAG_ERR_TOO_SMALL;
     }
 
@@ -926,58 +1438,11 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
     mem_copy(data, tag->encoded_name, tag->encoded_name_size);
     data += tag->encoded_name_size;
 
-    /* write an INT of the mask size. */
-    *data = (uint8_t)(tag->elem_size & 0xFF); data++;
-    *data = (uint8_t)((tag->elem_size >> 8) & 0xFF); data++;
-
-    /* write the OR mask */
-    for(i=0; i < tag->elem_size; i++) {
-        if((tag->bit/8) == i) {
-            uint8_t mask = (uint8_t)(1 << (tag->bit % 8));
-
-            /* if the bit is set, then we want to mask it on. */
-            if(tag->data[tag->bit / 8] & mask) {
-                *data = mask;
-            } else {
-                *data = (uint8_t)0;
-            }
-
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
-
-            data++;
-        } else {
-            /* this is not the data we care about. */
-            *data = (uint8_t)0;
-
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
-
-            data++;
-        }
-    }
-
-    /* write the AND mask */
-    for(i=0; i < tag->elem_size; i++) {
-        if((tag->bit / 8) == i) {
-            uint8_t mask = (uint8_t)(1 << (tag->bit % 8));
-
-            /* if the bit is set, then we want to _not_ mask it off. */
-            if(tag->data[tag->bit / 8] & mask) {
-                *data = (uint8_t)0xFF;
-            } else {
-                *data = (uint8_t)(~mask);
-            }
-
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
-
-            data++;
-        } else {
-            /* this is not the data we care about. */
-            *data = (uint8_t)0xFF;
-
-            pdebug(DEBUG_DETAIL, "adding OR mask byte %d: %x", i, *data);
-
-            data++;
-        }
+    /* write the mask size and the OR and AND masks. */
+    data = encode_rmw_masks(tag, data);
+    if(!data) {
+        rc_dec(req);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
     /* let the rest of the system know that the write is complete after this. */
@@ -1062,32 +1527,22 @@ int build_write_bit_request_unconnected(ab_tag_p tag)
 int build_write_request_connected(ab_tag_p tag, int byte_offset)
 {
     int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_req* cip = NULL;
-    uint8_t* data = NULL;
-    ab_request_p req = NULL;
     int multiple_requests = 0;
-    int write_size = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    if(tag->is_bit) {
+    if(is_rmw_write(tag)) {
         return build_write_bit_request_connected(tag);
     }
 
-    /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &req);
-    if (rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
-        return rc;
-    }
-
     rc = calculate_write_data_per_packet(tag);
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to calculate valid write data per packet!.  rc=%s", plc_tag_decode_error(rc));
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* partial writes need the byte offset of the fragmented service. */
+    if(tag->write_data_per_packet < tag->size || tag->range_end) {
         multiple_requests = 1;
     }
 
@@ -1096,6 +1551,49 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
         return PLCTAG_ERR_TOO_LARGE;
     }
 
+    /* the fragments go from the current offset. */
+    tag->offset = byte_offset;
+
+    /* more than one packet left, queue them all now. */
+    if(multiple_requests && (tag_data_end(tag) - tag->offset) > tag->write_data_per_packet) {
+        return build_split_write_requests_connected(tag);
+    }
+
+    return build_write_fragment_connected(tag, multiple_requests, &tag->req);
+}
+
+
+
+/*
+ * build_write_fragment_connected
+ *
+ * Queue a write of the next packet's worth of data from the current offset
+ * and move the offset past it.  The new request is stored in *req_out.
+ */
+
+int build_write_fragment_connected(ab_tag_p tag, int multiple_requests, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    eip_cip_co_req* cip = NULL;
+    uint8_t* data = NULL;
+    ab_request_p req = NULL;
+    int byte_offset = tag->offset;
+    int write_size = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if (!tag->encoded_type_info_size) {
+        pdebug(DEBUG_WARN,"Data type unsupported!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    /* get a request buffer */
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if (rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
     cip = (eip_cip_co_req*)(req->data);
 
     /* point to the end of the struct */
@@ -1127,13 +1625,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     data += tag->encoded_name_size;
 
     /* copy encoded type info */
-    if (tag->encoded_type_info_size) {
-        mem_copy(data, tag->encoded_type_info, tag->encoded_type_info_size);
-        data += tag->encoded_type_info_size;
-    } else {
-        pdebug(DEBUG_WARN,"Data type unsupported!");
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    mem_copy(data, tag->encoded_type_info, tag->encoded_type_info_size);
+    data += tag->encoded_type_info_size;
 
     /* copy the item count, little endian */
     *((uint16_le*)data) = h2le16((uint16_t)(tag->elem_count));
@@ -1146,16 +1639,16 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = tag_data_end(tag) - byte_offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
     }
 
     /* now copy the data to write */
-    mem_copy(data, tag->data + tag->offset, write_size);
+    mem_copy(data, tag->data + byte_offset, write_size);
     data += write_size;
-    tag->offset += write_size;
+    tag->offset = byte_offset + write_size;
 
     /* need to pad data to multiple of 16-bits */
     if (write_size & 0x01) {
@@ -1189,12 +1682,12 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
 
     if (rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-        tag->req = rc_dec(req);
+        *req_out = rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
+    *req_out = req;
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -1203,6 +1696,44 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset)
 
 
 
+/*
+ * build_split_write_requests_connected
+ *
+ * Queue up to MAX_FRAG_REQUESTS write fragments from the current offset so
+ * that the session can send them back to back, up to the max_requests_in_flight
+ * attribute, instead of waiting for the tag to see each reply.  A short last
+ * fragment can still be packed with other requests.
+ */
+
+int build_split_write_requests_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int end_offset = tag_data_end(tag);
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    tag->frag_count = 0;
+
+    while(tag->offset < end_offset && tag->frag_count < MAX_FRAG_REQUESTS) {
+        tag->frag_offset[tag->frag_count] = tag->offset;
+
+        rc = build_write_fragment_connected(tag, 1, &tag->frag_req[tag->frag_count]);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build fragment write request at offset %d!", tag->frag_offset[tag->frag_count]);
+            ab_tag_abort(tag);
+            return rc;
+        }
+
+        tag->frag_count++;
+    }
+
+    pdebug(DEBUG_INFO, "Done with %d fragments queued.", tag->frag_count);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 
 int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 {
@@ -1217,7 +1748,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 
     pdebug(DEBUG_INFO, "Starting.");
 
-    if(tag->is_bit) {
+    if(is_rmw_write(tag)) {
         return build_write_bit_request_unconnected(tag);
     }
 
@@ -1234,7 +1765,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) {
+    /* partial writes need the byte offset of the fragmented service. */
+    if(tag->write_data_per_packet < tag->size || tag->range_end) {
         multiple_requests = 1;
     }
 
@@ -1295,7 +1827,7 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
     }
 
     /* how much data to write? */
-    write_size = tag->size - tag->offset;
+    write_size = tag_data_end(tag) - tag->offset;
 
     if(write_size > tag->write_data_per_packet) {
         write_size = tag->write_data_per_packet;
@@ -1384,85 +1916,30 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset)
 
 
 
-
-
 /*
- * check_read_status_connected
+ * decode_read_response_connected
  *
- * This routine checks for any outstanding requests and copies in data
- * that has arrived.  At the end of the request, it will clean up the request
- * buffers.  This is not thread-safe!  It should be called with the tag mutex
- * locked!
+ * Check a connected read response and copy the data in it into the tag
+ * buffer at the current offset.  The offset is bumped past the data.
  */
 
-static int check_read_status_connected(ab_tag_p tag)
+static int decode_read_response_connected(ab_tag_p tag, ab_request_p req, int *partial_data)
 {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_resp* cip_resp;
     uint8_t* data;
     uint8_t* data_end;
-    int partial_data = 0;
-
-    pdebug(DEBUG_SPEW, "Starting.");
-
-    if(!tag) {
-        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
-    if (!tag->req) {
-        tag->read_in_progress = 0;
-        tag->offset = 0;
-
-        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
-
-        return PLCTAG_ERR_READ;
-    }
-
-    /* request can be used by two threads at once. */
-    spin_block(&tag->req->lock) {
-        if(!tag->req->resp_received) {
-            rc = PLCTAG_STATUS_PENDING;
-            break;
-        }
-
-        /* check to see if it was an abort on the session side. */
-        if(tag->req->status != PLCTAG_STATUS_OK) {
-            rc = tag->req->status;
-            tag->req->abort_request = 1;
 
-            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
-
-            tag->read_in_progress = 0;
-            tag->offset = 0;
-            tag->size = tag->elem_count * tag->elem_size;
-
-            break;
-        }
-    }
-
-    if(rc != PLCTAG_STATUS_OK) {
-        if(rc_is_error(rc)) {
-            /* the request is dead, from session side. */
-            tag->read_in_progress = 0;
-            tag->offset = 0;
-
-            tag->req = rc_dec(tag->req);
-        }
-
-        return rc;
-    }
-
-    /* the request is ours exclusively. */
+    *partial_data = 0;
 
     /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
+    cip_resp = (eip_cip_co_resp*)(req->data);
 
     /* point to the start of the data */
-    data = (tag->req->data) + sizeof(eip_cip_co_resp);
+    data = (req->data) + sizeof(eip_cip_co_resp);
 
     /* point the end of the data */
-    data_end = (tag->req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
+    data_end = (req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap));
 
     /* check the status */
     do {
@@ -1504,7 +1981,7 @@ static int check_read_status_connected(ab_tag_p tag)
         }
 
         /* check to see if this is a partial response. */
-        partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
+        *partial_data = (cip_resp->status == AB_CIP_STATUS_FRAG);
 
         /*
          * check to see if there is any data to process.  If this is a packed
@@ -1520,10 +1997,7 @@ static int check_read_status_connected(ab_tag_p tag)
             /* check for a simple/base type */
             if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
                 /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = 2;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
+                check_type_info(tag, data, 2);
 
                 /* skip the type byte and zero length byte */
                 data += 2;
@@ -1544,10 +2018,7 @@ static int check_read_status_connected(ab_tag_p tag)
                 }
 
                 /* copy the type info for later. */
-                if (tag->encoded_type_info_size == 0) {
-                    tag->encoded_type_info_size = type_length;
-                    mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-                }
+                check_type_info(tag, data, type_length);
 
                 data += type_length;
             } else {
@@ -1561,6 +2032,9 @@ static int check_read_status_connected(ab_tag_p tag)
 
             /* copy the data into the tag and realloc if we need more space. */
             if(payload_size + tag->offset > tag->size) {
+                /* the element size we had, possibly from the cache, was wrong. */
+                forget_type_info(tag);
+
                 tag->size = (int)payload_size + tag->offset;
                 tag->elem_size = tag->size / tag->elem_count;
 
@@ -1588,6 +2062,11 @@ static int check_read_status_connected(ab_tag_p tag)
 
             /* bump the byte offset */
             tag->offset += (int)(payload_size);
+
+            /* a fragment tells us how much the PLC will send at once. */
+            if(*partial_data) {
+                tag->frag_size = (int)payload_size;
+            }
         } else {
             pdebug(DEBUG_DETAIL, "Response returned no data and no error.");
         }
@@ -1596,22 +2075,114 @@ static int check_read_status_connected(ab_tag_p tag)
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
+    return rc;
+}
+
+
+
+/*
+ * check_read_status_connected
+ *
+ * This routine checks for any outstanding requests and copies in data
+ * that has arrived.  At the end of the request, it will clean up the request
+ * buffers.  This is not thread-safe!  It should be called with the tag mutex
+ * locked!
+ */
+
+static int check_read_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int partial_data = 0;
+    int start_offset = tag->offset;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!tag) {
+        pdebug(DEBUG_ERROR,"Null tag pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if (!tag->req) {
+        tag->read_in_progress = 0;
+        tag->offset = 0;
+
+        pdebug(DEBUG_WARN,"Read in progress, but no request in flight!");
+
+        return PLCTAG_ERR_READ;
+    }
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        /* check to see if it was an abort on the session side. */
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+            tag->size = tag->elem_count * tag->elem_size;
+
+            break;
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc_is_error(rc)) {
+            /* the request is dead, from session side. */
+            tag->read_in_progress = 0;
+            tag->offset = 0;
+
+            tag->req = rc_dec(tag->req);
+        }
+
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+
+    rc = decode_read_response_connected(tag, tag->req, &partial_data);
+
     /* clean up the request */
     tag->req->abort_request = 1;
     tag->req = rc_dec(tag->req);
 
+    if(rc == PLCTAG_STATUS_OK && tag->size_probe) {
+        rc = omron_finish_size_probe(tag);
+    }
+
+    /* an Omron element range is not marked partial, keep going until we have the rest. */
+    if(rc == PLCTAG_STATUS_OK && tag->plc_type == AB_PLC_OMRON_NJNX && tag->offset > start_offset && tag->offset < tag_data_end(tag)) {
+        partial_data = 1;
+    }
+
     /* are we actually done? */
     if (rc == PLCTAG_STATUS_OK) {
         /* this particular read is done. */
         tag->read_in_progress = 0;
 
         /* skip if we are doing a pre-write read. */
-        if (!tag->pre_write_read && partial_data) {
+        if (!tag->pre_write_read && partial_data && (!tag->range_end || tag->offset < tag->range_end)) {
             /* call read start again to get the next piece */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            if(tag->first_read) {
+                /* a short read means the element size we had was wrong. */
+                if(!partial_data && tag->offset != tag_data_end(tag)) {
+                    forget_type_info(tag);
+                } else {
+                    remember_type_info(tag);
+                }
+            }
+
             tag->first_read = 0;
             tag->offset = 0;
 
@@ -1640,6 +2211,100 @@ static int check_read_status_connected(ab_tag_p tag)
 
 
 
+/*
+ * check_split_read_status_connected
+ *
+ * Wait for all the fragments of a split read to come back and then copy
+ * them into the tag in order.  If the PLC returned less than we asked for in
+ * a fragment, or there was more data than fit in one batch, start another
+ * batch from the first byte we do not have.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex locked!
+ */
+
+static int check_split_read_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int partial_data = 0;
+    int next_offset = tag->frag_offset[0];
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* all the fragments must be back before we touch the tag data. */
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        spin_block(&tag->frag_req[i]->lock) {
+            if(!tag->frag_req[i]->resp_received) {
+                rc = PLCTAG_STATUS_PENDING;
+                break;
+            }
+
+            if(tag->frag_req[i]->status != PLCTAG_STATUS_OK) {
+                rc = tag->frag_req[i]->status;
+
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        tag->offset = tag->frag_offset[i];
+
+        rc = decode_read_response_connected(tag, tag->frag_req[i], &partial_data);
+
+        /* track how far the data is contiguous. */
+        if(rc == PLCTAG_STATUS_OK && tag->frag_offset[i] <= next_offset && tag->offset > next_offset) {
+            next_offset = tag->offset;
+        }
+
+        tag->frag_req[i]->abort_request = 1;
+        tag->frag_req[i] = rc_dec(tag->frag_req[i]);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error received!");
+
+        /* clean up everything. */
+        ab_tag_abort(tag);
+
+        return rc;
+    }
+
+    tag->frag_count = 0;
+    tag->read_in_progress = 0;
+
+    if(next_offset < tag_data_end(tag)) {
+        /* go from the start of the first element we are missing. */
+        if(next_offset - (next_offset % tag->elem_size) <= tag->frag_offset[0]) {
+            pdebug(DEBUG_WARN, "No progress made reading fragments!");
+            ab_tag_abort(tag);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        tag->offset = next_offset - (next_offset % tag->elem_size);
+
+        pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the data from offset %d.", tag->offset);
+
+        rc = tag_read_start(tag);
+    } else {
+        /* done! */
+        tag->offset = 0;
+    }
+
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+        ab_tag_abort(tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
 /*
  * check_read_tag_list_status_connected
  *
@@ -1790,6 +2455,11 @@ static int check_read_tag_list_status_connected(ab_tag_p tag)
 
                 pdebug(DEBUG_DETAIL, "Next ID: %d", tag->next_id);
 
+                /* other tags on this session can use the ID instead of the name. */
+                if((data_end - current_entry_data) >= (ptrdiff_t)(sizeof(*current_entry) + le2h16(current_entry->string_len))) {
+                    remember_listed_symbol(tag, le2h32(current_entry->instance_id), current_entry_data + sizeof(*current_entry), le2h16(current_entry->string_len));
+                }
+
                 /* skip past to the next instance. */
                 current_entry_data += (sizeof(*current_entry) + le2h16(current_entry->string_len));
 
@@ -1969,10 +2639,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         if ((*data) >= AB_CIP_DATA_BIT && (*data) <= AB_CIP_DATA_STRINGI) {
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = 2;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            check_type_info(tag, data, 2);
 
             /* skip the type byte and zero length byte */
             data += 2;
@@ -1994,10 +2661,7 @@ static int check_read_status_unconnected(ab_tag_p tag)
             }
 
             /* copy the type info for later. */
-            if (tag->encoded_type_info_size == 0) {
-                tag->encoded_type_info_size = type_length;
-                mem_copy(tag->encoded_type_info, data, tag->encoded_type_info_size);
-            }
+            check_type_info(tag, data, type_length);
 
             data += type_length;
         } else {
@@ -2011,6 +2675,9 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
         /* copy the data into the tag and realloc if we need more space. */
         if(payload_size + tag->offset > tag->size) {
+            /* the element size we had, possibly from the cache, was wrong. */
+            forget_type_info(tag);
+
             tag->size = (int)payload_size + tag->offset;
             tag->elem_size = tag->size / tag->elem_count;
 
@@ -2054,13 +2721,26 @@ static int check_read_status_unconnected(ab_tag_p tag)
         /* this read is done. */
         tag->read_in_progress = 0;
 
-        /* skip if we are doing a pre-write read. */
-        if (!tag->pre_write_read && partial_data && tag->offset < tag->size) {
+        /*
+         * skip if we are doing a pre-write read or have reached the end of
+         * the range.  The tag size is not checked as the buffer only grows
+         * to the data received so far when the size is not known yet.
+         */
+        if (!tag->pre_write_read && partial_data && (!tag->range_end || tag->offset < tag->range_end)) {
             /* call read start again to get the next piece */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
             rc = tag_read_start(tag);
         } else {
             /* done! */
+            if(tag->first_read) {
+                /* a short read means the element size we had was wrong. */
+                if(!partial_data && tag->offset != tag_data_end(tag)) {
+                    forget_type_info(tag);
+                } else {
+                    remember_type_info(tag);
+                }
+            }
+
             tag->first_read = 0;
             tag->offset = 0;
 
@@ -2099,7 +2779,6 @@ static int check_read_status_unconnected(ab_tag_p tag)
 
 static int check_write_status_connected(ab_tag_p tag)
 {
-    eip_cip_co_resp* cip_resp;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW, "Starting.");
@@ -2149,38 +2828,7 @@ static int check_write_status_connected(ab_tag_p tag)
     }
 
     /* the request is ours exclusively. */
-
-    /* point to the data */
-    cip_resp = (eip_cip_co_resp*)(tag->req->data);
-
-    do {
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if (cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE | AB_EIP_CMD_CIP_OK)
-            && cip_resp->reply_service != (AB_EIP_CMD_CIP_RMW | AB_EIP_CMD_CIP_OK)) {
-            pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
-            pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
-            pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
-            rc = decode_cip_error_code((uint8_t *)&cip_resp->status);
-            break;
-        }
-    } while(0);
+    rc = decode_write_response_connected(tag->req);
 
     /* clean up the request. */
     tag->req->abort_request = 1;
@@ -2190,7 +2838,7 @@ static int check_write_status_connected(ab_tag_p tag)
     tag->write_in_progress = 0;
 
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        if(tag->offset < tag_data_end(tag)) {
 
             pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
             rc = tag_write_start(tag);
@@ -2213,6 +2861,119 @@ static int check_write_status_connected(ab_tag_p tag)
 
 
 
+/*
+ * check_split_write_status_connected
+ *
+ * The fragments are checked in order.  The first one that failed fails the
+ * whole write, the fragments still queued in the session are dropped and no
+ * further batches are started.  The PLC has already applied the fragments
+ * that succeeded, and with more than one request in flight possibly some
+ * after the failed one too.  Nothing is rolled back.
+ *
+ * This is not thread-safe!  It should be called with the tag mutex locked!
+ */
+
+static int check_split_write_status_connected(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        int resp_received = 0;
+
+        spin_block(&tag->frag_req[i]->lock) {
+            resp_received = tag->frag_req[i]->resp_received;
+
+            if(resp_received && tag->frag_req[i]->status != PLCTAG_STATUS_OK) {
+                rc = tag->frag_req[i]->status;
+
+                pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(!resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+        } else if(rc == PLCTAG_STATUS_OK) {
+            rc = decode_write_response_connected(tag->frag_req[i]);
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN,"Write failed!");
+
+        /* drops the fragments still queued. */
+        ab_tag_abort(tag);
+
+        return rc;
+    }
+
+    for(int i=0; i < tag->frag_count; i++) {
+        tag->frag_req[i]->abort_request = 1;
+        tag->frag_req[i] = rc_dec(tag->frag_req[i]);
+    }
+
+    tag->frag_count = 0;
+    tag->write_in_progress = 0;
+
+    if(tag->offset < tag_data_end(tag)) {
+        pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
+        rc = tag_write_start(tag);
+    } else {
+        tag->offset = 0;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * decode_write_response_connected
+ *
+ * Check the reply to one connected write request.
+ */
+
+static int decode_write_response_connected(ab_request_p req)
+{
+    eip_cip_co_resp* cip_resp = (eip_cip_co_resp*)(req->data);
+
+    if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (le2h32(cip_resp->encap_status) != AB_EIP_OK) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(cip_resp->encap_status));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if (cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE_FRAG | AB_EIP_CMD_CIP_OK)
+        && cip_resp->reply_service != (AB_EIP_CMD_CIP_WRITE | AB_EIP_CMD_CIP_OK)
+        && cip_resp->reply_service != (AB_EIP_CMD_CIP_RMW | AB_EIP_CMD_CIP_OK)) {
+        pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if (cip_resp->status != AB_CIP_STATUS_OK && cip_resp->status != AB_CIP_STATUS_FRAG) {
+        pdebug(DEBUG_WARN, "CIP write failed with status: 0x%x %s", cip_resp->status, decode_cip_error_short((uint8_t *)&cip_resp->status));
+        pdebug(DEBUG_INFO, decode_cip_error_long((uint8_t *)&cip_resp->status));
+        return decode_cip_error_code((uint8_t *)&cip_resp->status);
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
+
 static int check_write_status_unconnected(ab_tag_p tag)
 {
     eip_cip_uc_resp* cip_resp;
@@ -2270,7 +3031,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
     cip_resp = (eip_cip_uc_resp*)(tag->req->data);
 
     do {
-        if (le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        if (le2h16(cip_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
             pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
@@ -2307,7 +3068,7 @@ static int check_write_status_unconnected(ab_tag_p tag)
     tag->write_in_progress = 0;
 
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        if(tag->offset < tag_data_end(tag)) {
 
             pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
             rc = tag_write_start(tag);
@@ -2382,6 +3143,434 @@ int calculate_write_data_per_packet(ab_tag_p tag)
 
 
 
+/*
+ * tag_data_end
+ *
+ * Byte offset at which the current read or write is finished.
+ */
+
+int tag_data_end(ab_tag_p tag)
+{
+    return (tag->range_end ? tag->range_end : tag->size);
+}
+
+
+
+/*
+ * symbol_key
+ *
+ * Tags that are a plain controller tag or a program tag, with optional
+ * array indexes, can be addressed by symbol instance ID.  The key is the
+ * symbolic part of the encoded name with ASCII folded to lower case, as
+ * Logix names are not case sensitive.  scope_end is the offset of the
+ * tag's own symbolic segment, symbol_end is where the indexes start.
+ *
+ * Returns non-zero if the tag can use an instance ID.
+ */
+
+int symbol_key(ab_tag_p tag, uint8_t *key, int *key_len, int *scope_end, int *symbol_end)
+{
+    uint8_t *name = tag->encoded_name;
+    int size = tag->encoded_name_size;
+    int index = 1;
+    int last_segment = 1;
+    int segments = 0;
+
+    if(tag->plc_type != AB_PLC_LGX || tag->tag_list || !tag->use_connected_msg) {
+        return 0;
+    }
+
+    while(index + 1 < size && name[index] == 0x91) {
+        int seg_len = name[index + 1];
+
+        last_segment = index;
+        index += 2 + seg_len + (seg_len & 0x01);
+        segments++;
+    }
+
+    if(segments < 1 || segments > 2 || index > size) {
+        return 0;
+    }
+
+    /* the first of two segments must be the program. */
+    if(segments == 2 && (name[2] < 8 || str_cmp_i_n((const char *)&name[3], "Program:", 8) != 0)) {
+        return 0;
+    }
+
+    *scope_end = last_segment;
+    *symbol_end = index;
+
+    /* only numeric segments may follow. */
+    while(index < size) {
+        switch(name[index]) {
+            case 0x28: index += 2; break;
+            case 0x29: index += 4; break;
+            case 0x2A: index += 6; break;
+            default: return 0;
+        }
+    }
+
+    if(index != size) {
+        return 0;
+    }
+
+    *key_len = *symbol_end - 1;
+
+    for(index = 0; index < *key_len; index++) {
+        uint8_t c = name[index + 1];
+
+        key[index] = (uint8_t)((c >= 'A' && c <= 'Z') ? (c - 'A' + 'a') : c);
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * Type info is cached under the symbolic name, even when the tag is
+ * currently using a symbol instance ID.  The characters of the symbolic
+ * segments are folded to lower case as for symbol_key(), so that the same
+ * tag written in a different case finds the same entry.  Index segments
+ * are copied as they are.
+ */
+
+static void type_cache_key(ab_tag_p tag, uint8_t *key, int *key_len)
+{
+    uint8_t *name = tag->encoded_name;
+    int size = tag->encoded_name_size;
+    int index = 1;
+
+    if(tag->symbolic_name) {
+        name = tag->symbolic_name;
+        size = tag->symbolic_name_size;
+    }
+
+    mem_copy(key, name, size);
+    *key_len = size;
+
+    while(index + 1 < size) {
+        switch(name[index]) {
+            case 0x91:
+                for(int i = index + 2; i < index + 2 + name[index + 1] && i < size; i++) {
+                    key[i] = (uint8_t)((name[i] >= 'A' && name[i] <= 'Z') ? (name[i] - 'A' + 'a') : name[i]);
+                }
+
+                index += 2 + name[index + 1] + (name[index + 1] & 0x01);
+                break;
+
+            case 0x28: index += 2; break;
+            case 0x29: index += 4; break;
+            case 0x2A: index += 6; break;
+
+            /* anything else is left as it is. */
+            default: return;
+        }
+    }
+}
+
+
+
+/*
+ * remember_type_info
+ *
+ * Called when the first read of a tag completes.  Other tags for the same
+ * name on this session can then skip that read.
+ */
+
+void remember_type_info(ab_tag_p tag)
+{
+    uint8_t key[MAX_TAG_NAME];
+    int key_len = 0;
+
+    if(tag->tag_list || !tag->session || tag->encoded_type_info_size <= 0 || tag->elem_size <= 0) {
+        return;
+    }
+
+    type_cache_key(tag, key, &key_len);
+
+    session_type_info_put(tag->session, key, key_len, tag->encoded_type_info, tag->encoded_type_info_size, tag->elem_size);
+}
+
+
+
+/*
+ * check_type_info
+ *
+ * Take the type info from a read reply if the tag does not have any yet.
+ * If it has some, possibly from the cache, and the PLC disagrees, the
+ * cached entry is stale.  Drop it and use what the PLC sent.
+ */
+
+void check_type_info(ab_tag_p tag, uint8_t *type_info, int type_info_size)
+{
+    if(tag->encoded_type_info_size == type_info_size && mem_cmp(tag->encoded_type_info, tag->encoded_type_info_size, type_info, type_info_size) == 0) {
+        return;
+    }
+
+    if(tag->encoded_type_info_size) {
+        pdebug(DEBUG_INFO, "Read returned a different type than expected, dropping the cached type info.");
+        forget_type_info(tag);
+    }
+
+    tag->encoded_type_info_size = type_info_size;
+    mem_copy(tag->encoded_type_info, type_info, type_info_size);
+}
+
+
+
+/*
+ * forget_type_info
+ *
+ * Remove the cached type info for the tag's name from the session.
+ */
+
+void forget_type_info(ab_tag_p tag)
+{
+    uint8_t key[MAX_TAG_NAME];
+    int key_len = 0;
+
+    if(tag->tag_list || !tag->session) {
+        return;
+    }
+
+    type_cache_key(tag, key, &key_len);
+
+    session_type_info_remove(tag->session, key, key_len);
+}
+
+
+
+/*
+ * use_cached_type_info
+ *
+ * Set up the type info, element size and data buffer of a tag that has
+ * not been read yet from what an earlier tag with the same name found.
+ */
+
+int use_cached_type_info(ab_tag_p tag)
+{
+    uint8_t key[MAX_TAG_NAME];
+    int key_len = 0;
+    int type_info_size = MAX_TAG_TYPE_INFO;
+    int elem_size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(tag->tag_list || !tag->session || tag->encoded_type_info_size) {
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    type_cache_key(tag, key, &key_len);
+
+    rc = session_type_info_get(tag->session, key, key_len, tag->encoded_type_info, &type_info_size, &elem_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        return rc;
+    }
+
+    /* the buffer may already be there if the element type was given. */
+    if(!tag->data) {
+        tag->size = tag->elem_count * elem_size;
+        tag->data = (uint8_t*)mem_alloc(tag->size);
+
+        if(!tag->data) {
+            pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+            tag->size = 0;
+            return PLCTAG_ERR_NO_MEM;
+        }
+    } else if(tag->size != tag->elem_count * elem_size) {
+        pdebug(DEBUG_DETAIL, "Cached element size %d does not match this tag.", elem_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    tag->elem_size = elem_size;
+    tag->encoded_type_info_size = type_info_size;
+
+    pdebug(DEBUG_DETAIL, "Using cached type info for a %d byte element.", elem_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * use_symbol_instance
+ *
+ * If the session has seen this tag in a listing, swap the symbolic
+ * segment for a symbol class instance segment.  The name is kept so
+ * that we can go back to it if the ID turns out to be stale.  An ID
+ * learned before the session reconnected is always treated as stale.
+ */
+
+void use_symbol_instance(ab_tag_p tag)
+{
+    uint8_t key[MAX_TAG_NAME];
+    uint8_t path[MAX_TAG_NAME];
+    int key_len = 0;
+    int scope_end = 0;
+    int symbol_end = 0;
+    int path_size = 0;
+    uint32_t instance_id = 0;
+    int generation = 0;
+
+    if(!tag->session) {
+        return;
+    }
+
+    generation = session_cache_generation(tag->session);
+
+    if(tag->symbolic_name && tag->symbol_generation != generation) {
+        restore_symbolic_name(tag);
+    }
+
+    if(tag->symbolic_name || !tag->session->symbols) {
+        return;
+    }
+
+    if(!symbol_key(tag, key, &key_len, &scope_end, &symbol_end)) {
+        return;
+    }
+
+    if(session_symbol_get(tag->session, key, key_len, &instance_id) != PLCTAG_STATUS_OK) {
+        return;
+    }
+
+    path_size = scope_end + (instance_id <= 0xFFFF ? 6 : 8) + (tag->encoded_name_size - symbol_end);
+    if(path_size > MAX_TAG_NAME) {
+        return;
+    }
+
+    tag->symbolic_name = mem_alloc(tag->encoded_name_size);
+    if(!tag->symbolic_name) {
+        pdebug(DEBUG_WARN, "Unable to allocate memory for symbolic name!");
+        return;
+    }
+
+    tag->symbolic_name_size = tag->encoded_name_size;
+    tag->symbol_generation = generation;
+    mem_copy(tag->symbolic_name, tag->encoded_name, tag->encoded_name_size);
+
+    /* the program scope segment, if any, stays. */
+    mem_copy(path, tag->encoded_name, scope_end);
+    path_size = scope_end;
+
+    path[path_size++] = 0x20; /* class */
+    path[path_size++] = 0x6B; /* symbol class */
+
+    if(instance_id <= 0xFFFF) {
+        path[path_size++] = 0x25; /* 16-bit instance */
+        path[path_size++] = 0x00;
+        path[path_size++] = (uint8_t)(instance_id & 0xFF);
+        path[path_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+    } else {
+        path[path_size++] = 0x26; /* 32-bit instance */
+        path[path_size++] = 0x00;
+        path[path_size++] = (uint8_t)(instance_id & 0xFF);
+        path[path_size++] = (uint8_t)((instance_id >> 8) & 0xFF);
+        path[path_size++] = (uint8_t)((instance_id >> 16) & 0xFF);
+        path[path_size++] = (uint8_t)((instance_id >> 24) & 0xFF);
+    }
+
+    /* the array indexes. */
+    mem_copy(&path[path_size], &tag->encoded_name[symbol_end], tag->encoded_name_size - symbol_end);
+    path_size += tag->encoded_name_size - symbol_end;
+
+    path[0] = (uint8_t)((path_size - 1) / 2);
+
+    mem_copy(tag->encoded_name, path, path_size);
+    tag->encoded_name_size = path_size;
+
+    pdebug(DEBUG_DETAIL, "Using symbol instance %u, path shrank from %d to %d bytes.", (unsigned int)instance_id, tag->symbolic_name_size, path_size);
+}
+
+
+
+/*
+ * restore_symbolic_name
+ *
+ * Go back to the name and forget the instance ID.  Returns non-zero if
+ * the tag was using an instance ID.
+ */
+
+int restore_symbolic_name(ab_tag_p tag)
+{
+    uint8_t key[MAX_TAG_NAME];
+    int key_len = 0;
+    int scope_end = 0;
+    int symbol_end = 0;
+
+    if(!tag->symbolic_name) {
+        return 0;
+    }
+
+    pdebug(DEBUG_INFO, "Symbol instance ID rejected or stale, falling back to the tag name.");
+
+    mem_copy(tag->encoded_name, tag->symbolic_name, tag->symbolic_name_size);
+    tag->encoded_name_size = tag->symbolic_name_size;
+
+    mem_free(tag->symbolic_name);
+    tag->symbolic_name = NULL;
+    tag->symbolic_name_size = 0;
+
+    if(symbol_key(tag, key, &key_len, &scope_end, &symbol_end)) {
+        session_symbol_remove(tag->session, key, key_len);
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * remember_listed_symbol
+ *
+ * Build the key for a tag listing entry the same way symbol_key() does for a
+ * tag: the listing's program segment, if any, followed by the symbolic
+ * segment of the name.
+ */
+
+void remember_listed_symbol(ab_tag_p tag, uint32_t instance_id, uint8_t *name, int name_len)
+{
+    uint8_t key[MAX_TAG_NAME];
+    int key_len = 0;
+    int i;
+
+    if(tag->plc_type != AB_PLC_LGX || name_len <= 0 || name_len > 255) {
+        return;
+    }
+
+    /* a controller listing has no program segment. */
+    if(tag->encoded_name_size > 1) {
+        key_len = tag->encoded_name_size - 1;
+    }
+
+    if(key_len + 2 + name_len + 1 > MAX_TAG_NAME) {
+        return;
+    }
+
+    if(key_len > 0) {
+        mem_copy(key, &tag->encoded_name[1], key_len);
+    }
+
+    key[key_len++] = 0x91;
+    key[key_len++] = (uint8_t)name_len;
+    mem_copy(&key[key_len], name, name_len);
+    key_len += name_len;
+
+    if(name_len & 0x01) {
+        key[key_len++] = 0;
+    }
+
+    for(i = 0; i < key_len; i++) {
+        if(key[i] >= 'A' && key[i] <= 'Z') {
+            key[i] = (uint8_t)(key[i] - 'A' + 'a');
+        }
+    }
+
+    session_symbol_put(tag->session, key, key_len, instance_id);
+}
+
+
+
 int setup_tag_listing(ab_tag_p tag, const char *name)
 {
     char **tag_parts = NULL;
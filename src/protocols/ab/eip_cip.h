@@ -41,5 +41,11 @@ extern struct tag_vtable_t eip_cip_vtable;
 /* tag listing helpers */
 extern int setup_tag_listing(ab_tag_p tag, const char *name);
 
+/* set up a tag from type info learned by other tags on the session */
+extern int use_cached_type_info(ab_tag_p tag);
+
+/* name of an Omron array element, fails if the tag name cannot be stepped */
+extern int omron_range_name(ab_tag_p tag, int first_elem, uint8_t *name, int *name_size);
+
 
 #endif
@@ -0,0 +1,674 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <stdlib.h>
+#include <platform.h>
+#include <lib/libplctag.h>
+#include <lib/tag.h>
+#include <ab/defs.h>
+#include <ab/ab_common.h>
+#include <ab/tag.h>
+#include <ab/session.h>
+#include <ab/eip_cip_io.h>
+#include <ab/error_codes.h>
+#include <util/debug.h>
+
+
+/*
+ * A produced tag in a Logix PLC can be consumed over a class 1 connection.
+ * The Forward Open goes out through the session like any other request,
+ * then the PLC sends the tag data to us over UDP every RPI.  We send an
+ * empty heartbeat back every RPI to keep the connection alive.  There is
+ * no request and response per update.
+ *
+ * Each tag has its own UDP socket on a free local port.  The port is given
+ * to the PLC in a socket address item in the Forward Open.  The socket is
+ * polled from the tickler, so new data shows up as read completion events.
+ */
+
+#define IO_RETRY_MS (1000)
+
+/* the connection ID we pick for the data coming to us.  Tags on other threads share it. */
+static lock_t io_connection_id_lock = LOCK_INIT;
+static uint32_t io_connection_id = 0;
+
+
+static int io_read_start(ab_tag_p tag);
+static int io_tickler(ab_tag_p tag);
+static int io_write_start(ab_tag_p tag);
+static int io_conn_path(ab_tag_p tag, uint8_t *path);
+static int io_open_socket(ab_tag_p tag);
+static int build_forward_open_request(ab_tag_p tag);
+static int check_forward_open_status(ab_tag_p tag);
+static int build_forward_close_request(ab_tag_p tag);
+static int io_receive(ab_tag_p tag);
+static int io_send_heartbeat(ab_tag_p tag);
+static void io_disconnect(ab_tag_p tag);
+
+
+/* define the exported vtable for this tag type. */
+struct tag_vtable_t eip_cip_io_vtable = {
+    (tag_vtable_func)ab_tag_abort, /* shared */
+    (tag_vtable_func)io_read_start,
+    (tag_vtable_func)ab_tag_status, /* shared */
+    (tag_vtable_func)io_tickler,
+    (tag_vtable_func)io_write_start,
+
+    /* attribute accessors */
+    ab_get_int_attrib,
+    ab_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
+};
+
+
+
+/*
+ * eip_cip_io_close
+ *
+ * Called when the tag is destroyed.  The Forward Close is sent without
+ * waiting for the reply.  If it never gets out, the PLC times out the
+ * connection when the heartbeats stop.
+ */
+
+void eip_cip_io_close(ab_tag_p tag)
+{
+    pdebug(DEBUG_INFO, "Starting.");
+
+    ab_tag_abort(tag);
+
+    if(tag->io_connected && tag->session) {
+        build_forward_close_request(tag);
+    }
+
+    io_disconnect(tag);
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+
+/*
+ * The data is kept current by the connection, so a read only has to wait
+ * if the connection is not open yet.
+ */
+
+int io_read_start(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(tag->io_connected && tag->io_has_data) {
+        pdebug(DEBUG_DETAIL, "Connection is open, data is current.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->read_in_progress = 1;
+
+    if(!tag->io_connected && !tag->req) {
+        rc = build_forward_open_request(tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start Forward Open, %s!", plc_tag_decode_error(rc));
+            tag->read_in_progress = 0;
+            return rc;
+        }
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+int io_write_start(ab_tag_p tag)
+{
+    (void)tag;
+
+    pdebug(DEBUG_WARN, "Consumed tags cannot be written!");
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+
+int io_tickler(ab_tag_p tag)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int64_t now = time_ms();
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(tag->req) {
+        rc = check_forward_open_status(tag);
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            return rc;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            io_disconnect(tag);
+
+            tag->status = (int8_t)rc;
+            tag->io_retry_time = now + IO_RETRY_MS;
+
+            if(tag->read_in_progress) {
+                tag->read_in_progress = 0;
+                tag->read_complete = 1;
+            }
+
+            return rc;
+        }
+
+        /* the connection times out if nothing arrives from here. */
+        tag->io_last_data = now;
+        tag->io_next_heartbeat = now;
+    }
+
+    if(!tag->io_connected) {
+        /* reconnect after an error. */
+        if(tag->io_retry_time && tag->io_retry_time <= now) {
+            pdebug(DEBUG_DETAIL, "Trying to open the connection again.");
+
+            tag->io_retry_time = 0;
+
+            rc = build_forward_open_request(tag);
+            if(rc != PLCTAG_STATUS_OK) {
+                tag->status = (int8_t)rc;
+                tag->io_retry_time = now + IO_RETRY_MS;
+            }
+        }
+
+        return tag->status;
+    }
+
+    /* take in everything first so that a slow tickler does not look like a timeout. */
+    rc = io_receive(tag);
+
+    if(rc == PLCTAG_STATUS_OK && now - tag->io_last_data > tag->io_timeout_ms) {
+        pdebug(DEBUG_WARN, "No data for %dms!", (int)(now - tag->io_last_data));
+        rc = PLCTAG_ERR_TIMEOUT;
+    }
+
+    if(rc == PLCTAG_STATUS_OK && tag->io_next_heartbeat <= now) {
+        rc = io_send_heartbeat(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Lost the connection, %s!", plc_tag_decode_error(rc));
+
+        io_disconnect(tag);
+
+        tag->status = (int8_t)rc;
+        tag->io_retry_time = now + IO_RETRY_MS;
+        tag->read_in_progress = 0;
+        tag->read_complete = 1;
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * The connection path is the route to the PLC without the Message Router
+ * on the end, then the symbolic segment of the tag name.
+ */
+
+int io_conn_path(ab_tag_p tag, uint8_t *path)
+{
+    static uint8_t router_path[] = { 0x20, 0x02, 0x24, 0x01 };
+    int route_size = tag->session->conn_path_size;
+
+    if(route_size >= (int)sizeof(router_path)
+       && mem_cmp(tag->session->conn_path + route_size - (int)sizeof(router_path), (int)sizeof(router_path), router_path, (int)sizeof(router_path)) == 0) {
+        route_size -= (int)sizeof(router_path);
+    }
+
+    mem_copy(path, tag->session->conn_path, route_size);
+
+    /* skip the word count at the start of the encoded name. */
+    mem_copy(path + route_size, tag->encoded_name + 1, tag->encoded_name_size - 1);
+
+    return route_size + tag->encoded_name_size - 1;
+}
+
+
+
+int io_open_socket(ab_tag_p tag)
+{
+    char **server_port = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = socket_create(&tag->io_sock);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create socket!");
+        return rc;
+    }
+
+    /* the session host may have a port for the TCP connection on the end. */
+    server_port = str_split(tag->session->host, ":");
+    if(!server_port || !server_port[0]) {
+        pdebug(DEBUG_WARN, "Unable to get the PLC host from \"%s\"!", tag->session->host);
+
+        if(server_port) {
+            mem_free(server_port);
+        }
+
+        return PLCTAG_ERR_BAD_CONFIG;
+    }
+
+    rc = socket_connect_udp(tag->io_sock, server_port[0], AB_EIP_IO_PORT);
+
+    mem_free(server_port);
+
+    return rc;
+}
+
+
+
+int build_forward_open_request(ab_tag_p tag)
+{
+    eip_forward_open_request_t *fo = NULL;
+    eip_sockaddr_item_t *sockaddr = NULL;
+    uint8_t *data = NULL;
+    ab_request_p req = NULL;
+    uint32_t local_ip = 0;
+    int local_port = 0;
+    int path_size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    /* the socket has to be open to tell the PLC where to send. */
+    rc = io_open_socket(tag);
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = socket_get_local_addr(tag->io_sock, &local_ip, &local_port);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to open UDP socket, %s!", plc_tag_decode_error(rc));
+        io_disconnect(tag);
+        return rc;
+    }
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        io_disconnect(tag);
+        return rc;
+    }
+
+    fo = (eip_forward_open_request_t *)(req->data);
+
+    /* the connection path follows the fixed part. */
+    data = req->data + sizeof(*fo);
+    path_size = io_conn_path(tag, data);
+    data += path_size;
+
+    /* encap header parts, the session fills in the rest. */
+    fo->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    fo->router_timeout = h2le16(1);
+
+    /* CPF parts, the socket address item is after the Forward Open. */
+    fo->cpf_item_count = h2le16(3);
+    fo->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    fo->cpf_nai_item_length = h2le16(0);
+    fo->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    fo->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code)));
+
+    /* Connection Manager parts */
+    fo->cm_service_code = AB_EIP_CMD_FORWARD_OPEN;
+    fo->cm_req_path_size = 2;
+    fo->cm_req_path[0] = 0x20;
+    fo->cm_req_path[1] = 0x06;
+    fo->cm_req_path[2] = 0x24;
+    fo->cm_req_path[3] = 0x01;
+
+    /* Forward Open Params */
+    fo->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fo->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fo->orig_to_targ_conn_id = h2le32(0); /* the PLC picks this one. */
+    spin_block(&io_connection_id_lock) {
+        if(!io_connection_id) {
+            io_connection_id = (uint32_t)rand();
+        }
+        tag->io_orig_conn_id = ++io_connection_id;
+    }
+    fo->targ_to_orig_conn_id = h2le32(tag->io_orig_conn_id);
+    tag->io_conn_serial_number = (uint16_t)rand();
+    fo->conn_serial_number = h2le16(tag->io_conn_serial_number);
+    fo->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fo->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fo->conn_timeout_multiplier = AB_EIP_TIMEOUT_MULTIPLIER;
+
+    /* the heartbeat to the PLC is just the sequence count. */
+    fo->orig_to_targ_rpi = h2le32((uint32_t)tag->rpi_ms * 1000);
+    fo->orig_to_targ_conn_params = h2le16((uint16_t)(AB_EIP_IO_CONN_PARAM | sizeof(uint16_t)));
+    fo->targ_to_orig_rpi = h2le32((uint32_t)tag->rpi_ms * 1000);
+    fo->targ_to_orig_conn_params = h2le16((uint16_t)(AB_EIP_IO_CONN_PARAM | (tag->size + (int)sizeof(uint16_t))));
+
+    fo->transport_class = AB_EIP_TRANSPORT_CLASS_T1;
+    fo->path_size = (uint8_t)(path_size / 2);
+
+    /* where the PLC should send the data. */
+    sockaddr = (eip_sockaddr_item_t *)data;
+    mem_set(sockaddr, 0, (int)sizeof(*sockaddr));
+    sockaddr->item_type = h2le16(AB_EIP_ITEM_SOCKADDR_T2O);
+    sockaddr->item_length = h2le16((uint16_t)(sizeof(*sockaddr) - 4));
+    sockaddr->sin_family[1] = 2; /* AF_INET */
+    sockaddr->sin_port[0] = (uint8_t)((local_port >> 8) & 0xFF);
+    sockaddr->sin_port[1] = (uint8_t)(local_port & 0xFF);
+    sockaddr->sin_addr[0] = (uint8_t)((local_ip >> 24) & 0xFF);
+    sockaddr->sin_addr[1] = (uint8_t)((local_ip >> 16) & 0xFF);
+    sockaddr->sin_addr[2] = (uint8_t)((local_ip >> 8) & 0xFF);
+    sockaddr->sin_addr[3] = (uint8_t)(local_ip & 0xFF);
+    data += sizeof(*sockaddr);
+
+    req->request_size = (int)(data - req->data);
+    req->allow_packing = 0;
+
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add request to session! rc=%d", rc);
+        rc_dec(req);
+        io_disconnect(tag);
+        return rc;
+    }
+
+    tag->req = req;
+
+    pdebug(DEBUG_INFO, "Sent Forward Open for connection %x from UDP port %d.", tag->io_orig_conn_id, local_port);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int check_forward_open_status(ab_tag_p tag)
+{
+    eip_forward_open_response_t *fo_resp = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    int resp_size = 0;
+
+    /* request can be used by two threads at once. */
+    spin_block(&tag->req->lock) {
+        if(!tag->req->resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+            break;
+        }
+
+        if(tag->req->status != PLCTAG_STATUS_OK) {
+            rc = tag->req->status;
+            tag->req->abort_request = 1;
+
+            pdebug(DEBUG_WARN, "Session reported failure of request: %s.", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
+
+    /* the request is ours exclusively. */
+    fo_resp = (eip_forward_open_response_t *)(tag->req->data);
+    resp_size = (int)le2h16(fo_resp->encap_length) + (int)sizeof(eip_encap);
+
+    do {
+        if(rc != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(le2h16(fo_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
+            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(fo_resp->encap_command));
+            rc = PLCTAG_ERR_BAD_DATA;
+            break;
+        }
+
+        if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(fo_resp->encap_status));
+            rc = PLCTAG_ERR_REMOTE_ERR;
+            break;
+        }
+
+        if(fo_resp->general_status != AB_EIP_OK) {
+            pdebug(DEBUG_WARN, "Forward Open failed, %s (%s)!", decode_cip_error_short(&fo_resp->general_status), decode_cip_error_long(&fo_resp->general_status));
+            rc = decode_cip_error_code(&fo_resp->general_status);
+            break;
+        }
+
+        if(resp_size < (int)sizeof(*fo_resp) || le2h32(fo_resp->targ_to_orig_conn_id) != tag->io_orig_conn_id) {
+            pdebug(DEBUG_WARN, "Forward Open response is short or for another connection!");
+            rc = PLCTAG_ERR_BAD_REPLY;
+            break;
+        }
+
+        tag->io_targ_conn_id = le2h32(fo_resp->orig_to_targ_conn_id);
+
+        /* the PLC may not give us the RPI we asked for. */
+        if(le2h32(fo_resp->targ_to_orig_api) >= 1000) {
+            tag->rpi_ms = (int)(le2h32(fo_resp->targ_to_orig_api) / 1000);
+        }
+
+        /* the multiplier is a power of two from four. */
+        tag->io_timeout_ms = tag->rpi_ms * (4 << AB_EIP_TIMEOUT_MULTIPLIER);
+
+        tag->io_connected = 1;
+        tag->io_has_data = 0;
+
+        pdebug(DEBUG_INFO, "Forward Open succeeded, PLC connection ID %x, RPI %dms.", tag->io_targ_conn_id, tag->rpi_ms);
+    } while(0);
+
+    tag->req = rc_dec(tag->req);
+
+    return rc;
+}
+
+
+
+int build_forward_close_request(ab_tag_p tag)
+{
+    eip_forward_close_req_t *fc = NULL;
+    uint8_t *data = NULL;
+    ab_request_p req = NULL;
+    int path_size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = session_create_request(tag->session, tag->tag_id, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
+        return rc;
+    }
+
+    fc = (eip_forward_close_req_t *)(req->data);
+
+    data = req->data + sizeof(*fc);
+    path_size = io_conn_path(tag, data);
+    data += path_size;
+
+    fc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    fc->router_timeout = h2le16(1);
+
+    fc->cpf_item_count = h2le16(2);
+    fc->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+    fc->cpf_nai_item_length = h2le16(0);
+    fc->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+    fc->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&fc->cm_service_code)));
+
+    fc->cm_service_code = AB_EIP_CMD_FORWARD_CLOSE;
+    fc->cm_req_path_size = 2;
+    fc->cm_req_path[0] = 0x20;
+    fc->cm_req_path[1] = 0x06;
+    fc->cm_req_path[2] = 0x24;
+    fc->cm_req_path[3] = 0x01;
+
+    fc->secs_per_tick = AB_EIP_SECS_PER_TICK;
+    fc->timeout_ticks = AB_EIP_TIMEOUT_TICKS;
+    fc->conn_serial_number = h2le16(tag->io_conn_serial_number);
+    fc->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);
+    fc->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);
+    fc->path_size = (uint8_t)(path_size / 2);
+    fc->reserved = 0;
+
+    req->request_size = (int)(data - req->data);
+    req->allow_packing = 0;
+
+    /* the session keeps the request until it is sent, we do not wait. */
+    rc = session_add_request(tag->session, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to add request to session! rc=%d", rc);
+    }
+
+    rc_dec(req);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+
+/*
+ * Take in all the waiting packets.  Only the newest data is kept.
+ */
+
+int io_receive(ab_tag_p tag)
+{
+    uint8_t buf[sizeof(eip_io_packet_t) + AB_EIP_IO_MAX_SIZE];
+    eip_io_packet_t *pkt = (eip_io_packet_t *)buf;
+    int got_data = 0;
+    int rc = 0;
+
+    while((rc = socket_read(tag->io_sock, buf, (int)sizeof(buf))) > 0) {
+        int data_size = 0;
+        uint16_t seq = 0;
+
+        if(rc < (int)sizeof(*pkt)
+           || le2h16(pkt->cpf_item_count) != 2
+           || le2h16(pkt->cpf_sai_item_type) != AB_EIP_ITEM_SAI
+           || le2h16(pkt->cpf_cdi_item_type) != AB_EIP_ITEM_CDI
+           || le2h32(pkt->cpf_conn_id) != tag->io_orig_conn_id) {
+            pdebug(DEBUG_DETAIL, "Ignoring packet that is not for this connection.");
+            continue;
+        }
+
+        data_size = (int)le2h16(pkt->cpf_cdi_item_length) - (int)sizeof(pkt->cip_seq_count);
+        if(data_size != tag->size || (int)sizeof(*pkt) + data_size > rc) {
+            pdebug(DEBUG_WARN, "Got %d bytes of data but expected %d!", data_size, tag->size);
+            continue;
+        }
+
+        /* any packet keeps the connection alive. */
+        tag->io_last_data = time_ms();
+
+        /* the sequence count only changes with new data. */
+        seq = le2h16(pkt->cip_seq_count);
+        if(tag->io_has_data && (int16_t)(uint16_t)(seq - tag->io_cip_seq) <= 0) {
+            continue;
+        }
+
+        mem_copy(tag->data, buf + sizeof(*pkt), data_size);
+
+        tag->io_cip_seq = seq;
+        tag->io_has_data = 1;
+        got_data = 1;
+    }
+
+    if(rc < 0) {
+        pdebug(DEBUG_WARN, "Error reading UDP socket, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if(got_data) {
+        pdebug(DEBUG_DETAIL, "New data with sequence count %u.", (unsigned int)tag->io_cip_seq);
+
+        tag->status = PLCTAG_STATUS_OK;
+        tag->read_in_progress = 0;
+        tag->read_complete = 1;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int io_send_heartbeat(ab_tag_p tag)
+{
+    eip_io_packet_t pkt;
+    int64_t now = time_ms();
+    int rc = PLCTAG_STATUS_OK;
+
+    pkt.cpf_item_count = h2le16(2);
+    pkt.cpf_sai_item_type = h2le16(AB_EIP_ITEM_SAI);
+    pkt.cpf_sai_item_length = h2le16(8);
+    pkt.cpf_conn_id = h2le32(tag->io_targ_conn_id);
+    pkt.cpf_seq_num = h2le32(++tag->io_seq_num);
+    pkt.cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    pkt.cpf_cdi_item_length = h2le16((uint16_t)sizeof(pkt.cip_seq_count));
+    pkt.cip_seq_count = h2le16(0); /* never any new data from us. */
+
+    rc = socket_write(tag->io_sock, (uint8_t *)&pkt, (int)sizeof(pkt));
+    if(rc < 0 && rc != PLCTAG_ERR_NO_DATA) {
+        pdebug(DEBUG_WARN, "Unable to send heartbeat, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* stay on the RPI, but do not try to catch up. */
+    tag->io_next_heartbeat += tag->rpi_ms;
+    if(tag->io_next_heartbeat <= now) {
+        tag->io_next_heartbeat = now + tag->rpi_ms;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+void io_disconnect(ab_tag_p tag)
+{
+    if(tag->io_sock) {
+        socket_destroy(&tag->io_sock);
+        tag->io_sock = NULL;
+    }
+
+    tag->io_connected = 0;
+    tag->io_has_data = 0;
+}
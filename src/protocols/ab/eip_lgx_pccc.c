@@ -81,7 +81,11 @@ struct tag_vtable_t lgx_pccc_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
 };
 
 static int check_read_status(ab_tag_p tag);
@@ -322,6 +326,9 @@ int tag_read_start(ab_tag_p tag)
     //req->send_request = 1;
     req->allow_packing = tag->allow_packing;
 
+    /* the PCCC reply cannot be fragmented, so packing must leave room for all of it. */
+    req->reply_size = overhead + tag->size;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -688,6 +695,9 @@ int tag_write_start(ab_tag_p tag)
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
 
+    /* the data is in the request so the packing code can count it. */
+    req->allow_packing = tag->allow_packing;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
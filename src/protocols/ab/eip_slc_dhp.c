@@ -62,7 +62,11 @@ struct tag_vtable_t eip_slc_dhp_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
 };
 
 
@@ -304,7 +308,7 @@ int tag_read_start(ab_tag_p tag)
 
     /* DH+ Routing */
     pccc->dest_link = h2le16(0);
-    pccc->dest_node = h2le16(tag->session->dhp_dest);
+    pccc->dest_node = h2le16(tag->dhp_dest);
     pccc->src_link = h2le16(0);
     pccc->src_node = h2le16(0) /*h2le16(tag->dhp_src)*/;
 
@@ -439,7 +443,7 @@ int tag_write_start(ab_tag_p tag)
     
     /* DH+ Routing */
     pccc->dest_link = h2le16(0);
-    pccc->dest_node = h2le16(tag->session->dhp_dest);
+    pccc->dest_node = h2le16(tag->dhp_dest);
     pccc->src_link = h2le16(0);
     pccc->src_node = h2le16(0) /*h2le16(tag->dhp_src)*/;
 
@@ -56,12 +56,22 @@ struct tag_vtable_t slc_vtable = {
 
     /* data accessors */
     ab_get_int_attrib,
-    ab_set_int_attrib
+    ab_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
 };
 
 
+static int queue_read_chunks(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag, int byte_offset, int size, ab_request_p *req_out);
 static int check_read_status(ab_tag_p tag);
+static int decode_read_response(ab_tag_p tag, ab_request_p req, int byte_offset, int size);
+static int queue_write_chunks(ab_tag_p tag);
+static int build_write_request(ab_tag_p tag, int byte_offset, int size, ab_request_p *req_out);
 static int check_write_status(ab_tag_p tag);
+static int decode_write_response(ab_request_p req);
 
 
 
@@ -177,19 +187,13 @@ int tag_tickler(ab_tag_p tag)
 /*
  * tag_read_start
  *
- * Start a PCCC tag read (SLC).
+ * Start a PCCC tag read (SLC).  A tag larger than one reply is read in
+ * chunks of whole elements, which are queued together.
  */
 
 int tag_read_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    ab_request_p req;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
-    int overhead;
-    int data_per_packet;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
 
     pdebug(DEBUG_INFO,"Starting");
 
@@ -199,34 +203,66 @@ int tag_read_start(ab_tag_p tag)
     }
 
     tag->read_in_progress = 1;
+    tag->offset = 0;
+
+    rc = queue_read_chunks(tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start read, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-    /* how many packets will we need? How much overhead? */
-    //overhead = sizeof(pccc_resp) + 4 + tag->encoded_name_size; /* MAGIC 4 = fudge */
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * queue_read_chunks
+ *
+ * Queue up to MAX_FRAG_REQUESTS reads from the current offset.  The session
+ * sends them back to back.  Each chunk is as many whole elements as fit in
+ * a reply.
+ */
+
+static int queue_read_chunks(ab_tag_p tag)
+{
+    int overhead;
 
     /* calculate based on the response. */
-    overhead =   1      /* PCCC CMD */
+    overhead =   4      /* Execute PCCC reply header */
+                +7      /* requestor ID */
+                +1      /* PCCC CMD */
                 +1      /* PCCC status */
                 +2;     /* PCCC packet sequence number */
 
-    data_per_packet = session_get_max_payload(tag->session) - overhead;
+    /* the transfer size is one byte. */
+    return pccc_queue_chunks(tag, overhead, 255, build_read_request);
+}
 
-    if(data_per_packet <= 0) {
-        pdebug(DEBUG_WARN,"Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead, session_get_max_payload(tag->session));
-        tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
-    }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL,"Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!", tag->size, overhead, data_per_packet);
-        tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
-    }
+
+/*
+ * build_read_request
+ *
+ * Queue a typed read of size bytes starting at byte_offset in the tag.
+ */
+
+static int build_read_request(ab_tag_p tag, int byte_offset, int size, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint8_t *embed_start;
+    int name_size = 0;
 
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-        tag->read_in_progress = 0;
         return rc;
     }
 
@@ -254,14 +290,20 @@ int tag_read_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id);
     pccc->pccc_function = AB_EIP_SLC_RANGE_READ_FUNC;
-    pccc->pccc_transfer_size = (uint8_t)(tag->elem_size * tag->elem_count); /* size to read/write in bytes. */
+    pccc->pccc_transfer_size = (uint8_t)size; /* size to read/write in bytes. */
 
     /* point to the end of the struct */
     data = ((uint8_t *)pccc) + sizeof(pccc_req);
 
-    /* copy encoded tag name into the request */
-    mem_copy(data,tag->encoded_name,tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    /* copy encoded tag name into the request, moved on to the first element of this chunk. */
+    rc = pccc_offset_encoded_name(data, &name_size, tag->encoded_name, tag->encoded_name_size, 0, byte_offset / tag->elem_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode the address at offset %d!", byte_offset);
+        rc_dec(req);
+        return rc;
+    }
+
+    data += name_size;
 
     /*
      * after the embedded packet, we need to tell the message router
@@ -284,28 +326,24 @@ int tag_read_start(ab_tag_p tag)
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
-    /* mark it as ready to send */
-    //req->send_request = 1;
+    /* once the address is known to be good, the session can merge this with reads of nearby elements. */
+    if(tag->allow_packing && !tag->first_read && size == tag->size) {
+        req->pccc_elem_size = tag->elem_size;
+    }
 
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->read_in_progress = 0;
-
-        tag->req = rc_dec(req);
-
+        rc_dec(req);
         return rc;
     }
 
     /* save the request for later */
-    tag->req = req;
-//    tag->status = PLCTAG_STATUS_PENDING;
-
-    pdebug(DEBUG_INFO, "Done.");
+    *req_out = req;
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
@@ -315,22 +353,20 @@ int tag_read_start(ab_tag_p tag)
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * PCCC does not support fragments, so large tags are read in chunks that
+ * each address their own first element.  All the chunks must be back
+ * before we touch the tag data.
  */
 
 
 static int check_read_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
-    uint8_t *data;
-    uint8_t *data_end;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW,"Starting");
 
     /* is there a request in flight? */
-    if (!tag->req) {
+    if (!tag->frag_count) {
         tag->read_in_progress = 0;
         tag->offset = 0;
 
@@ -339,44 +375,69 @@ static int check_read_status(ab_tag_p tag)
         return PLCTAG_ERR_READ;
     }
 
-    /* request can be used by two threads at once. */
-    spin_block(&tag->req->lock) {
-        if(!tag->req->resp_received) {
-            rc = PLCTAG_STATUS_PENDING;
-            break;
-        }
-
-        /* check to see if it was an abort on the session side. */
-        if(tag->req->status != PLCTAG_STATUS_OK) {
-            rc = tag->req->status;
-            tag->req->abort_request = 1;
+    rc = pccc_check_chunks(tag, NULL);
 
-            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
+    }
 
-            tag->read_in_progress = 0;
-            tag->offset = 0;
+    /* the requests are ours exclusively. */
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        int end_offset = (i + 1 < tag->frag_count ? tag->frag_offset[i + 1] : tag->offset);
 
-            break;
-        }
+        rc = decode_read_response(tag, tag->frag_req[i], tag->frag_offset[i], end_offset - tag->frag_offset[i]);
     }
 
+    /* a tag whose read failed reads alone until it works again. */
+    tag->first_read = (rc == PLCTAG_STATUS_OK ? 0 : 1);
+
     if(rc != PLCTAG_STATUS_OK) {
-        if(rc_is_error(rc)) {
-            /* the request is dead, from session side. */
-            tag->req = rc_dec(tag->req);
-        }
+        /* clean up everything. */
+        ab_tag_abort(tag);
 
         return rc;
     }
 
-    /* the request is ours exclusively. */
+    /* clean up the requests */
+    pccc_release_chunks(tag);
+
+    if(tag->offset < tag->size) {
+        pdebug(DEBUG_DETAIL, "Read not complete, getting the data from offset %d.", tag->offset);
 
-    pccc = (pccc_resp*)(tag->req->data);
+        rc = queue_read_chunks(tag);
+
+        return (rc == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : rc);
+    }
+
+    tag->offset = 0;
+    tag->read_in_progress = 0;
+
+    pdebug(DEBUG_SPEW,"Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * decode_read_response
+ *
+ * Check the reply to one chunk and copy its data into the tag.
+ */
+
+static int decode_read_response(ab_tag_p tag, ab_request_p req, int byte_offset, int size)
+{
+    pccc_resp *pccc;
+    uint8_t *data;
+    uint8_t *data_end;
+    int rc = PLCTAG_STATUS_OK;
+
+    pccc = (pccc_resp*)(req->data);
 
     /* point to the start of the data */
     data = (uint8_t *)pccc + sizeof(*pccc);
 
-    data_end = (tag->req->data + le2h16(pccc->encap_length) + sizeof(eip_encap));
+    data_end = (req->data + le2h16(pccc->encap_length) + sizeof(eip_encap));
 
     /* fake exceptions */
     do {
@@ -405,31 +466,23 @@ static int check_read_status(ab_tag_p tag)
         }
 
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN,"Too much data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+        if((data_end - data) != size) {
+            if((int)(data_end - data) > size) {
+                pdebug(DEBUG_WARN,"Too much data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN,"Too little data received!  Expected %d bytes but got %d bytes!", tag->size, (int)(data_end - data));
+                pdebug(DEBUG_WARN,"Too little data received!  Expected %d bytes but got %d bytes!", size, (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
             break;
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + byte_offset, data, (int)(data_end - data));
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
-
-    tag->read_in_progress = 0;
-
-    pdebug(DEBUG_SPEW,"Done.");
-
     return rc;
 }
 
@@ -442,12 +495,6 @@ static int check_read_status(ab_tag_p tag)
 int tag_write_start(ab_tag_p tag)
 {
     int rc = PLCTAG_STATUS_OK;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    uint8_t *embed_start;
-    int overhead, data_per_packet;
-    ab_request_p req = NULL;
 
     pdebug(DEBUG_INFO,"Starting.");
 
@@ -457,34 +504,67 @@ int tag_write_start(ab_tag_p tag)
     }
 
     tag->write_in_progress = 1;
+    tag->offset = 0;
+
+    rc = queue_write_chunks(tag);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start write, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+
+/*
+ * queue_write_chunks
+ *
+ * Queue up to MAX_FRAG_REQUESTS writes from the current offset, each of as
+ * many whole elements as fit in a request.
+ */
+
+static int queue_write_chunks(ab_tag_p tag)
+{
+    int overhead;
 
     /* overhead comes from the request*/
-    overhead =    1  /* PCCC command */
+    overhead =   13 /* Execute PCCC service, path and requestor ID */
+                 +1  /* PCCC command */
                  +1  /* PCCC status */
                  +2  /* PCCC sequence number */
                  +1  /* PCCC function */
                  +1  /* request total transfer size in bytes. */
-                 + (tag->encoded_name_size);
+                 +(4 * 3);  /* encoded address, each part can take three bytes */
+
+    /* the transfer size is one byte. */
+    return pccc_queue_chunks(tag, overhead, 255, build_write_request);
+}
 
-    data_per_packet = session_get_max_payload(tag->session) - overhead;
 
-    if(data_per_packet <= 0) {
-        pdebug(DEBUG_WARN,"Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead, session_get_max_payload(tag->session));
-        tag->write_in_progress =0;
-        return PLCTAG_ERR_TOO_LARGE;
-    }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL,"Tag size is %d, write overhead is %d, and write data per packet is %d.", session_get_max_payload(tag->session), overhead, data_per_packet);
-        tag->write_in_progress =0;
-        return PLCTAG_ERR_TOO_LARGE;
-    }
+/*
+ * build_write_request
+ *
+ * Queue a typed write of size bytes of the tag data from byte_offset.
+ */
+
+static int build_write_request(ab_tag_p tag, int byte_offset, int size, ab_request_p *req_out)
+{
+    int rc = PLCTAG_STATUS_OK;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    uint8_t *embed_start;
+    ab_request_p req = NULL;
+    int name_size = 0;
 
     /* get a request buffer */
     rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN,"Unable to get new request.  rc=%d",rc);
-        tag->write_in_progress =0;
         return rc;
     }
 
@@ -496,13 +576,19 @@ int tag_write_start(ab_tag_p tag)
     /* point to the end of the struct */
     data = (req->data) + sizeof(pccc_req);
 
-    /* copy encoded tag name into the request */
-    mem_copy(data,tag->encoded_name,tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    /* copy encoded tag name into the request, moved on to the first element of this chunk. */
+    rc = pccc_offset_encoded_name(data, &name_size, tag->encoded_name, tag->encoded_name_size, 0, byte_offset / tag->elem_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to encode the address at offset %d!", byte_offset);
+        rc_dec(req);
+        return rc;
+    }
+
+    data += name_size;
 
     /* now copy the data to write */
-    mem_copy(data,tag->data,tag->size);
-    data += tag->size;
+    mem_copy(data, tag->data + byte_offset, size);
+    data += size;
 
     /* now fill in the rest of the structure. */
 
@@ -537,7 +623,7 @@ int tag_write_start(ab_tag_p tag)
     pccc->pccc_status = 0;  /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_SLC_RANGE_WRITE_FUNC;
-    pccc->pccc_transfer_size = (uint8_t)(tag->size);
+    pccc->pccc_transfer_size = (uint8_t)size;
 
     /* get ready to add the request to the queue for this session */
     req->request_size = (int)(data - (req->data));
@@ -547,27 +633,14 @@ int tag_write_start(ab_tag_p tag)
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
         req->abort_request = 1;
-        tag->write_in_progress =0;
-
-        tag->req = rc_dec(req);
-
+        rc_dec(req);
         return rc;
     }
 
-    /* the write is now pending */
-    tag->write_in_progress = 1;
-
     /* save the request for later */
-    tag->req = req;
-
-    /* save the request for later */
-    tag->req = req;
-
-//    tag->status = PLCTAG_STATUS_PENDING;
+    *req_out = req;
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
@@ -575,18 +648,18 @@ int tag_write_start(ab_tag_p tag)
 /*
  * check_write_status
  *
- * Fragments are not supported.
+ * The chunks are checked in order.  The first one that failed fails the
+ * whole write and the chunks still queued in the session are dropped.
+ * Chunks the PLC already took stay written, see plc_tag_write().
  */
 static int check_write_status(ab_tag_p tag)
 {
-    pccc_resp *pccc;
-//    uint8_t *data = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_SPEW,"Starting.");
 
     /* is there an outstanding request? */
-    if (!tag->req) {
+    if (!tag->frag_count) {
         tag->write_in_progress = 0;
         tag->offset = 0;
 
@@ -595,42 +668,53 @@ static int check_write_status(ab_tag_p tag)
         return PLCTAG_ERR_WRITE;
     }
 
-    /* request can be used by two threads at once. */
-    spin_block(&tag->req->lock) {
-        if(!tag->req->resp_received) {
-            rc = PLCTAG_STATUS_PENDING;
-            break;
-        }
+    rc = pccc_check_chunks(tag, decode_write_response);
 
-        /* check to see if it was an abort on the session side. */
-        if(tag->req->status != PLCTAG_STATUS_OK) {
-            rc = tag->req->status;
-            tag->req->abort_request = 1;
-
-            pdebug(DEBUG_WARN,"Session reported failure of request: %s.", plc_tag_decode_error(rc));
-
-            tag->write_in_progress = 0;
-            tag->offset = 0;
-
-            break;
-        }
+    if(rc == PLCTAG_STATUS_PENDING) {
+        return rc;
     }
 
     if(rc != PLCTAG_STATUS_OK) {
-        if(rc_is_error(rc)) {
-            /* the request is dead, from session side. */
-            tag->req = rc_dec(tag->req);
-        }
+        /* drops the chunks still queued. */
+        ab_tag_abort(tag);
 
         return rc;
     }
 
-    /* the request is ours exclusively. */
+    /* clean up the requests */
+    pccc_release_chunks(tag);
 
-    pccc = (pccc_resp*)(tag->req->data);
+    if(tag->offset < tag->size) {
+        pdebug(DEBUG_DETAIL, "Write not complete, writing the data from offset %d.", tag->offset);
 
-    /* point to the start of the data */
-//    data = (uint8_t *)pccc + sizeof(*pccc);
+        rc = queue_write_chunks(tag);
+
+        return (rc == PLCTAG_STATUS_OK ? PLCTAG_STATUS_PENDING : rc);
+    }
+
+    tag->offset = 0;
+    tag->write_in_progress = 0;
+
+    pdebug(DEBUG_SPEW,"Done.");
+
+    /* Success! */
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * decode_write_response
+ *
+ * Check the reply to one chunk of a write.
+ */
+
+static int decode_write_response(ab_request_p req)
+{
+    pccc_resp *pccc;
+    int rc = PLCTAG_STATUS_OK;
+
+    pccc = (pccc_resp*)(req->data);
 
     /* fake exception */
     do {
@@ -662,13 +746,5 @@ static int check_write_status(ab_tag_p tag)
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    tag->req->abort_request = 1;
-    tag->req = rc_dec(tag->req);
-    tag->write_in_progress = 0;
-
-    pdebug(DEBUG_SPEW,"Done.");
-
-    /* Success! */
     return rc;
 }
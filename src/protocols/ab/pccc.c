@@ -40,8 +40,11 @@
 #include <platform.h>
 #include <ab/ab_common.h>
 #include <ab/pccc.h>
+#include <ab/session.h>
 #include <ab/tag.h>
 #include <util/debug.h>
+#include <util/hash.h>
+#include <util/hashtable.h>
 
 
 
@@ -50,17 +53,136 @@ static int parse_pccc_file_type(const char **str, pccc_file_t *file_type);
 static int parse_pccc_file_num(const char **str, int *file_num);
 static int parse_pccc_elem_num(const char **str, int *elem_num);
 static int parse_pccc_subelem_num(const char **str, pccc_file_t file_type, int *subelem_num);
+static int parse_pccc_number(const char **str);
+static int addr_entry_free(hashtable_p table, int64_t key, void *data, void *context);
 static void encode_data(uint8_t *data, int *index, int val);
+static int decode_data(uint8_t *data, int data_size, int *index, int *val);
 static int encode_file_type(pccc_file_t file_type);
 
 
 
 
+#define PCCC_ADDR_CACHE_SIZE (1000)
+#define PCCC_ADDR_CACHE_MAX_ENTRIES (200000)
+
+/* the data-table file type prefixes.  Two character prefixes must come first. */
+static const struct {
+    const char *prefix;
+    pccc_file_t file_type;
+} pccc_file_types[] = {
+    { "BT", PCCC_FILE_BLOCK_TRANSFER },
+    { "MG", PCCC_FILE_MESSAGE },
+    { "PD", PCCC_FILE_PID },
+    { "SC", PCCC_FILE_SFC },
+    { "ST", PCCC_FILE_STRING },
+    { "A", PCCC_FILE_ASCII },
+    { "B", PCCC_FILE_BIT },
+    { "C", PCCC_FILE_COUNTER },
+    { "D", PCCC_FILE_BCD },
+    { "F", PCCC_FILE_FLOAT },
+    { "I", PCCC_FILE_INPUT },
+    { "L", PCCC_FILE_LONG_INT },
+    { "N", PCCC_FILE_INT },
+    { "O", PCCC_FILE_OUTPUT },
+    { "R", PCCC_FILE_CONTROL },
+    { "S", PCCC_FILE_STATUS },
+    { "T", PCCC_FILE_TIMER }
+};
+
+/* the named fields of structured data-table files. */
+static const struct {
+    pccc_file_t file_type;
+    const char *name;
+    int subelem_num;
+} pccc_fields[] = {
+    { PCCC_FILE_BLOCK_TRANSFER, "con", 0 },
+    { PCCC_FILE_BLOCK_TRANSFER, "rlen", 1 },
+    { PCCC_FILE_BLOCK_TRANSFER, "dlen", 2 },
+    { PCCC_FILE_BLOCK_TRANSFER, "df", 3 },
+    { PCCC_FILE_BLOCK_TRANSFER, "elem", 4 },
+    { PCCC_FILE_BLOCK_TRANSFER, "rgs", 5 },
+    { PCCC_FILE_COUNTER, "con", 0 },
+    { PCCC_FILE_COUNTER, "pre", 1 },
+    { PCCC_FILE_COUNTER, "acc", 2 },
+    { PCCC_FILE_TIMER, "con", 0 },
+    { PCCC_FILE_TIMER, "pre", 1 },
+    { PCCC_FILE_TIMER, "acc", 2 },
+    { PCCC_FILE_CONTROL, "con", 0 },
+    { PCCC_FILE_CONTROL, "len", 1 },
+    { PCCC_FILE_CONTROL, "pos", 2 },
+    { PCCC_FILE_PID, "con", 0 },
+    { PCCC_FILE_PID, "sp", 2 },
+    { PCCC_FILE_PID, "kp", 4 },
+    { PCCC_FILE_PID, "ki", 6 },
+    { PCCC_FILE_PID, "kd", 8 },
+    { PCCC_FILE_PID, "pv", 26 },
+    { PCCC_FILE_MESSAGE, "con", 0 },
+    { PCCC_FILE_MESSAGE, "err", 1 },
+    { PCCC_FILE_MESSAGE, "rlen", 2 },
+    { PCCC_FILE_MESSAGE, "dlen", 3 },
+    { PCCC_FILE_STRING, "len", 0 },
+    { PCCC_FILE_STRING, "data", 1 }
+};
+
+/* an entry in the parsed logical address cache. */
+struct addr_entry_t {
+    pccc_file_t file_type;
+    int file_num;
+    int elem_num;
+    int subelem_num;
+    int key_len;
+    char key[];
+};
+
+static mutex_p addr_cache_mutex = NULL;
+static hashtable_p addr_cache = NULL;
+
+
+
 /*
  * Public functions
  */
 
 
+/*
+ * Parsed logical addresses are cached by name.  Large configurations
+ * create the same tags over and over when they are reloaded, so the
+ * names only need to be parsed the first time.
+ */
+
+int pccc_startup(void)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    if((rc = mutex_create(&addr_cache_mutex)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create PCCC address cache mutex %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if((addr_cache = hashtable_create(PCCC_ADDR_CACHE_SIZE)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create PCCC address cache!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return rc;
+}
+
+
+void pccc_teardown(void)
+{
+    if(addr_cache) {
+        hashtable_on_each(addr_cache, addr_entry_free, NULL);
+        hashtable_destroy(addr_cache);
+        addr_cache = NULL;
+    }
+
+    if(addr_cache_mutex) {
+        mutex_destroy(&addr_cache_mutex);
+        addr_cache_mutex = NULL;
+    }
+}
+
+
 
 
 
@@ -282,6 +404,303 @@ int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const
 
 
 
+/*
+ * Copy an encoded PLC/5 or SLC logical address, moved on by elem_offset
+ * elements.  Large tags are read and written in chunks this way.  The
+ * PLC/5 encoding starts with the level flags, then file and element.  The
+ * SLC encoding is file, file type, element and sub-element.
+ */
+
+int pccc_offset_encoded_name(uint8_t *data, int *size, uint8_t *encoded_name, int encoded_name_size, int is_plc5, int elem_offset)
+{
+    int index = 0;
+    int level = 0;
+    int elem_level = (is_plc5 ? 1 : 2);
+    int val = 0;
+
+    *size = 0;
+
+    if(is_plc5) {
+        data[0] = encoded_name[0];
+        *size = 1;
+        index = 1;
+    }
+
+    while(index < encoded_name_size) {
+        if(decode_data(encoded_name, encoded_name_size, &index, &val) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Badly encoded PCCC logical address!");
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(level == elem_level) {
+            val += elem_offset;
+
+            if(val > 0xFFFF) {
+                pdebug(DEBUG_WARN, "Element %d is out of range!", val);
+                return PLCTAG_ERR_OUT_OF_BOUNDS;
+            }
+        }
+
+        encode_data(data, size, val);
+        level++;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Decode a PLC/5 or SLC typed read command so that reads of nearby elements
+ * in the same data file can be merged.  The command starts with the PCCC
+ * command byte.  Only reads of whole elements from the start of an element
+ * are accepted.  The file type is zero for PLC/5 reads as the PLC/5 address
+ * does not include it.
+ */
+
+int pccc_decode_typed_read(uint8_t *cmd, int cmd_size, int *file_num, int *file_type, int *elem_num, int *num_bytes)
+{
+    int index = 0;
+    int subelem_num = 0;
+    uint8_t level_byte = 0;
+
+    if(cmd_size < 6 || cmd[0] != AB_EIP_PCCC_TYPED_CMD) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    switch(cmd[4]) {
+    case AB_EIP_SLC_RANGE_READ_FUNC:
+        /* size in bytes, then file, file type, element and sub-element. */
+        *num_bytes = cmd[5];
+        index = 6;
+
+        if(decode_data(cmd, cmd_size, &index, file_num) != PLCTAG_STATUS_OK
+           || decode_data(cmd, cmd_size, &index, file_type) != PLCTAG_STATUS_OK
+           || decode_data(cmd, cmd_size, &index, elem_num) != PLCTAG_STATUS_OK
+           || decode_data(cmd, cmd_size, &index, &subelem_num) != PLCTAG_STATUS_OK) {
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(subelem_num != 0 || index != cmd_size) {
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        return PLCTAG_STATUS_OK;
+        break;
+
+    case AB_EIP_PLC5_RANGE_READ_FUNC:
+        /* offset and size in words, then the level encoded address, then the size in bytes. */
+        if(cmd_size < 11 || cmd[5] != 0 || cmd[6] != 0) {
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        index = 9;
+        level_byte = cmd[index];
+        index++;
+
+        /* file and element only, no sub-element. */
+        if(level_byte != 0x06) {
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        if(decode_data(cmd, cmd_size, &index, file_num) != PLCTAG_STATUS_OK
+           || decode_data(cmd, cmd_size, &index, elem_num) != PLCTAG_STATUS_OK) {
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(index + 1 != cmd_size) {
+            return PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        *file_type = 0;
+        *num_bytes = cmd[index];
+
+        return PLCTAG_STATUS_OK;
+        break;
+
+    default:
+        return PLCTAG_ERR_UNSUPPORTED;
+        break;
+    }
+}
+
+
+
+/*
+ * Rewrite a typed read command decoded by pccc_decode_typed_read() to
+ * read num_bytes starting at another element of the same file.  The
+ * new size of the command is returned in cmd_size.
+ */
+
+int pccc_encode_typed_read(uint8_t *cmd, int cmd_capacity, int *cmd_size, int file_num, int file_type, int elem_num, int num_bytes)
+{
+    int index = 0;
+
+    /* each address part can take up to three bytes. */
+    if(cmd_capacity < 9 + 1 + (3 * 4) + 1 || num_bytes > 255) {
+        pdebug(DEBUG_WARN, "Not enough space to encode a %d byte read!", num_bytes);
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    switch(cmd[4]) {
+    case AB_EIP_SLC_RANGE_READ_FUNC:
+        cmd[5] = (uint8_t)num_bytes;
+        index = 6;
+
+        encode_data(cmd, &index, file_num);
+        encode_data(cmd, &index, file_type);
+        encode_data(cmd, &index, elem_num);
+        encode_data(cmd, &index, 0);
+        break;
+
+    case AB_EIP_PLC5_RANGE_READ_FUNC:
+        cmd[5] = 0;
+        cmd[6] = 0;
+        cmd[7] = (uint8_t)((num_bytes / 2) & 0xFF);
+        cmd[8] = (uint8_t)(((num_bytes / 2) >> 8) & 0xFF);
+        index = 9;
+
+        cmd[index] = 0x06;
+        index++;
+
+        encode_data(cmd, &index, file_num);
+        encode_data(cmd, &index, elem_num);
+
+        cmd[index] = (uint8_t)num_bytes;
+        index++;
+        break;
+
+    default:
+        pdebug(DEBUG_WARN, "Unsupported PCCC function %x!", cmd[4]);
+        return PLCTAG_ERR_UNSUPPORTED;
+        break;
+    }
+
+    *cmd_size = index;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * pccc_queue_chunks
+ *
+ * Queue up to MAX_FRAG_REQUESTS chunks from the tag's current offset.  Each
+ * chunk is as many whole elements as fit in what the packet overhead leaves
+ * of the session payload, and no more than max_chunk_size bytes.  The
+ * session sends the chunks back to back, up to the max_requests_in_flight
+ * window.
+ */
+
+int pccc_queue_chunks(ab_tag_p tag, int overhead, int max_chunk_size, pccc_build_chunk_func build_chunk)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int chunk_size = 0;
+
+    chunk_size = session_get_max_payload(tag->session) - overhead;
+
+    if(chunk_size > max_chunk_size) {
+        chunk_size = max_chunk_size;
+    }
+
+    chunk_size -= chunk_size % tag->elem_size;
+
+    if(chunk_size <= 0) {
+        pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, leaves no room for a %d byte element!", overhead, tag->elem_size);
+        ab_tag_abort(tag);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    tag->frag_count = 0;
+
+    while(tag->offset < tag->size && tag->frag_count < MAX_FRAG_REQUESTS) {
+        int size = tag->size - tag->offset;
+
+        if(size > chunk_size) {
+            size = chunk_size;
+        }
+
+        rc = build_chunk(tag, tag->offset, size, &tag->frag_req[tag->frag_count]);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build request at offset %d!", tag->offset);
+            ab_tag_abort(tag);
+            return rc;
+        }
+
+        tag->frag_offset[tag->frag_count] = tag->offset;
+        tag->frag_count++;
+
+        tag->offset += size;
+    }
+
+    pdebug(DEBUG_DETAIL, "Queued %d requests, up to offset %d of %d.", tag->frag_count, tag->offset, tag->size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * pccc_check_chunks
+ *
+ * Check the queued chunks in order.  Returns PLCTAG_STATUS_PENDING while a
+ * chunk has no reply, or the error of the first chunk that failed.  Chunks
+ * after a failed one may still be queued or in flight.  ab_tag_abort()
+ * drops them, but any that already reached the PLC have been applied.  If
+ * check_chunk is not NULL, it is called on each reply as it is reached.
+ */
+
+int pccc_check_chunks(ab_tag_p tag, pccc_check_chunk_func check_chunk)
+{
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i=0; i < tag->frag_count && rc == PLCTAG_STATUS_OK; i++) {
+        int resp_received = 0;
+
+        /* requests can be used by two threads at once. */
+        spin_block(&tag->frag_req[i]->lock) {
+            resp_received = tag->frag_req[i]->resp_received;
+
+            /* check to see if it was an abort on the session side. */
+            if(resp_received && tag->frag_req[i]->status != PLCTAG_STATUS_OK) {
+                rc = tag->frag_req[i]->status;
+
+                pdebug(DEBUG_WARN, "Session reported failure of request: %s.", plc_tag_decode_error(rc));
+            }
+        }
+
+        if(!resp_received) {
+            rc = PLCTAG_STATUS_PENDING;
+        } else if(rc == PLCTAG_STATUS_OK && check_chunk) {
+            rc = check_chunk(tag->frag_req[i]);
+        }
+    }
+
+    return rc;
+}
+
+
+
+/*
+ * pccc_release_chunks
+ *
+ * Let go of the requests for chunks that have all completed.
+ */
+
+void pccc_release_chunks(ab_tag_p tag)
+{
+    for(int i=0; i < tag->frag_count; i++) {
+        tag->frag_req[i]->abort_request = 1;
+        tag->frag_req[i] = rc_dec(tag->frag_req[i]);
+    }
+
+    tag->frag_count = 0;
+}
+
+
+
+
 
 
 
@@ -661,9 +1080,31 @@ static int parse_pccc_logical_address(const char *name, pccc_file_t *file_type,
 {
     int rc = PLCTAG_STATUS_OK;
     const char *p = name;
+    int key_len = str_length(name);
+    int64_t hash_key = (int64_t)hash((uint8_t *)name, (size_t)(unsigned int)key_len, 0);
+    struct addr_entry_t *entry = NULL;
+    int found = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
+    if(addr_cache_mutex) {
+        critical_block(addr_cache_mutex) {
+            entry = hashtable_get(addr_cache, hash_key);
+            if(entry && entry->key_len == key_len && mem_cmp(entry->key, key_len, (void *)name, key_len) == 0) {
+                *file_type = entry->file_type;
+                *file_num = entry->file_num;
+                *elem_num = entry->elem_num;
+                *subelem_num = entry->subelem_num;
+                found = 1;
+            }
+        }
+    }
+
+    if(found) {
+        pdebug(DEBUG_DETAIL, "Found %s in the address cache.", name);
+        return PLCTAG_STATUS_OK;
+    }
+
     do {
         if((rc = parse_pccc_file_type(&p, file_type)) != PLCTAG_STATUS_OK) {
             pdebug(DEBUG_WARN, "Unable to parse PCCC-style tag for data-table type! Error %s!", plc_tag_decode_error(rc));
@@ -686,168 +1127,72 @@ static int parse_pccc_logical_address(const char *name, pccc_file_t *file_type,
         }
     } while(0);
 
-    pdebug(DEBUG_DETAIL, "Starting.");
-
-    return rc;
-}
-
-
+    /* only good addresses are cached.  A slot taken by another name is left alone. */
+    if(rc == PLCTAG_STATUS_OK && addr_cache_mutex) {
+        critical_block(addr_cache_mutex) {
+            if(hashtable_entries(addr_cache) >= PCCC_ADDR_CACHE_MAX_ENTRIES || hashtable_get(addr_cache, hash_key)) {
+                break;
+            }
 
-int parse_pccc_file_type(const char **str, pccc_file_t *file_type)
-{
-    int rc = PLCTAG_STATUS_OK;
+            entry = mem_alloc((int)sizeof(*entry) + key_len);
+            if(!entry) {
+                pdebug(DEBUG_WARN, "Unable to allocate address cache entry!");
+                break;
+            }
 
-    switch((*str)[0]) {
-    case 'A':
-    case 'a': /* ASCII */
-        *file_type = PCCC_FILE_ASCII;
-        (*str)++;
-        break;
+            entry->file_type = *file_type;
+            entry->file_num = *file_num;
+            entry->elem_num = *elem_num;
+            entry->subelem_num = *subelem_num;
+            entry->key_len = key_len;
+            mem_copy(entry->key, (void *)name, key_len);
 
-    case 'B':
-    case 'b': /* Bit or block transfer */
-        if(isdigit((*str)[1])) {
-            /* Bit */
-            *file_type = PCCC_FILE_BIT;
-            (*str)++;
-            break;
-        } else {
-            if((*str)[1] == 'T' || (*str)[1] == 't') {
-                /* block transfer */
-                *file_type = PCCC_FILE_BLOCK_TRANSFER;
-                (*str) += 2;  /* skip past both characters */
-            } else {
-                *file_type = PCCC_FILE_UNKNOWN;
-                pdebug(DEBUG_WARN, "Bad format or unsupported logical address, expected B or BT!");
-                rc = PLCTAG_ERR_BAD_PARAM;
+            if(hashtable_put(addr_cache, hash_key, entry) != PLCTAG_STATUS_OK) {
+                mem_free(entry);
             }
         }
+    }
 
-        break;
+    pdebug(DEBUG_DETAIL, "Done.");
 
-    case 'C':
-    case 'c': /* Counter */
-        *file_type = PCCC_FILE_COUNTER;
-        (*str)++;
-        break;
+    return rc;
+}
 
-    case 'D':
-    case 'd': /* BCD number */
-        *file_type = PCCC_FILE_BCD;
-        (*str)++;
-        break;
 
-    case 'F':
-    case 'f': /* Floating point Number */
-        *file_type = PCCC_FILE_FLOAT;
-        (*str)++;
-        break;
 
-    case 'I':
-    case 'i': /* Input */
-        *file_type = PCCC_FILE_INPUT;
-        (*str)++;
-        break;
+int parse_pccc_file_type(const char **str, pccc_file_t *file_type)
+{
+    const char *p = *str;
 
-    case 'L':
-    case 'l':
-        *file_type = PCCC_FILE_LONG_INT;
-        (*str)++;
-        break;
+    for(size_t i=0; i < sizeof(pccc_file_types)/sizeof(pccc_file_types[0]); i++) {
+        const char *prefix = pccc_file_types[i].prefix;
 
-    case 'M':
-    case 'm': /* Message */
-        if((*str)[1] == 'G' || (*str)[1] == 'g') {
-            *file_type = PCCC_FILE_MESSAGE;
-            (*str) += 2;  /* skip past both characters */
-        } else {
-            *file_type = PCCC_FILE_UNKNOWN;
-            pdebug(DEBUG_WARN, "Bad format or unsupported logical address, expected MG!");
-            rc = PLCTAG_ERR_BAD_PARAM;
+        if(toupper((unsigned char)p[0]) != prefix[0]) {
+            continue;
         }
 
-        break;
-
-    case 'N':
-    case 'n': /* INT */
-        *file_type = PCCC_FILE_INT;
-        (*str)++;
-        break;
-
-    case 'O':
-    case 'o': /* Output */
-        *file_type = PCCC_FILE_OUTPUT;
-        (*str)++;
-        break;
-
-    case 'P':
-    case 'p': /* PID */
-        if((*str)[1] == 'D' || (*str)[1] == 'd') {
-            *file_type = PCCC_FILE_PID;
-            (*str) += 2;  /* skip past both characters */
-        } else {
-            *file_type = PCCC_FILE_UNKNOWN;
-            pdebug(DEBUG_WARN, "Bad format or unsupported logical address, expected PD!");
-            rc = PLCTAG_ERR_BAD_PARAM;
+        if(prefix[1] && toupper((unsigned char)p[1]) != prefix[1]) {
+            continue;
         }
 
-        break;
-
-    case 'R':
-    case 'r': /* Control */
-        *file_type = PCCC_FILE_CONTROL;
-        (*str)++;
-        break;
-
-    case 'S':
-    case 's': /* Status, SFC or String */
-        if(isdigit((*str)[1])) {
-            /* Status */
-            *file_type = PCCC_FILE_STATUS;
-            (*str)++;
-            break;
-        } else {
-            if((*str)[1] == 'C' || (*str)[1] == 'c') {
-                /* SFC */
-                *file_type = PCCC_FILE_SFC;
-                (*str) += 2;  /* skip past both characters */
-            } else if((*str)[1] == 'T' || (*str)[1] == 't') {
-                /* String */
-                *file_type = PCCC_FILE_STRING;
-                (*str) += 2;  /* skip past both characters */
-            } else {
-                *file_type = PCCC_FILE_UNKNOWN;
-                pdebug(DEBUG_WARN, "Bad format or unsupported logical address, expected string, SFC or status!");
-                rc = PLCTAG_ERR_BAD_PARAM;
-            }
-        }
+        *file_type = pccc_file_types[i].file_type;
+        *str += (prefix[1] ? 2 : 1);
 
-        break;
-
-    case 'T':
-    case 't': /* Timer */
-        *file_type = PCCC_FILE_TIMER;
-        (*str)++;
-        break;
+        pdebug(DEBUG_DETAIL, "Done.");
 
-    default:
-        pdebug(DEBUG_WARN, "Bad format or unsupported logical address %s!", *str);
-        *file_type = PCCC_FILE_UNKNOWN;
-        rc = PLCTAG_ERR_BAD_PARAM;
-        break;
+        return PLCTAG_STATUS_OK;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_WARN, "Bad format or unsupported logical address %s!", *str);
+    *file_type = PCCC_FILE_UNKNOWN;
 
-    return rc;
+    return PLCTAG_ERR_BAD_PARAM;
 }
 
 
 
 int parse_pccc_file_num(const char **str, int *file_num)
 {
-    int tmp = 0;
-
     pdebug(DEBUG_DETAIL,"Starting.");
 
     if(!str || !*str || !isdigit(**str)) {
@@ -855,13 +1200,7 @@ int parse_pccc_file_num(const char **str, int *file_num)
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    while(**str && isdigit(**str) && tmp < 65535) {
-        tmp *= 10;
-        tmp += (int)((**str) - '0');
-        (*str)++;
-    }
-
-    *file_num = tmp;
+    *file_num = parse_pccc_number(str);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -872,8 +1211,6 @@ int parse_pccc_file_num(const char **str, int *file_num)
 
 int parse_pccc_elem_num(const char **str, int *elem_num)
 {
-    int tmp = 0;
-
     pdebug(DEBUG_DETAIL,"Starting.");
 
     if(!str || !*str || **str != ':') {
@@ -884,13 +1221,7 @@ int parse_pccc_elem_num(const char **str, int *elem_num)
     /* step past the : character */
     (*str)++;
 
-    while(**str && isdigit(**str) && tmp < 65535) {
-        tmp *= 10;
-        tmp += (int)((**str) - '0');
-        (*str)++;
-    }
-
-    *elem_num = tmp;
+    *elem_num = parse_pccc_number(str);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -901,8 +1232,6 @@ int parse_pccc_elem_num(const char **str, int *elem_num)
 
 int parse_pccc_subelem_num(const char **str, pccc_file_t file_type, int *subelem_num)
 {
-    int tmp = 0;
-
     pdebug(DEBUG_DETAIL,"Starting.");
 
     if(!str || !*str) {
@@ -939,14 +1268,7 @@ int parse_pccc_subelem_num(const char **str, pccc_file_t file_type, int *subelem
         /* step past the / character */
         (*str)++;
 
-        /* FIXME - we do this a lot, should be a small routine. */
-        while(**str && isdigit(**str) && tmp < 65535) {
-            tmp *= 10;
-            tmp += (int)((**str) - '0');
-            (*str)++;
-        }
-
-        *subelem_num = tmp;
+        *subelem_num = parse_pccc_number(str);
 
         pdebug(DEBUG_DETAIL, "Done.");
 
@@ -958,112 +1280,44 @@ int parse_pccc_subelem_num(const char **str, pccc_file_t file_type, int *subelem
         (*str)++;
 
         /* this depends on the data-table file type. */
-        switch(file_type) {
-        case PCCC_FILE_BLOCK_TRANSFER:
-            if(str_cmp_i(*str,"con") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"rlen") == 0) {
-                *subelem_num = 1;
-            } else if(str_cmp_i(*str,"dlen") == 0) {
-                *subelem_num = 2;
-            } else if(str_cmp_i(*str,"df") == 0) {
-                *subelem_num = 3;
-            } else if(str_cmp_i(*str,"elem") == 0) {
-                *subelem_num = 4;
-            } else if(str_cmp_i(*str,"rgs") == 0) {
-                *subelem_num = 5;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported block transfer mnemonic!");
-                return PLCTAG_ERR_BAD_PARAM;
-            }
+        for(size_t i=0; i < sizeof(pccc_fields)/sizeof(pccc_fields[0]); i++) {
+            if(pccc_fields[i].file_type == file_type && str_cmp_i(*str, pccc_fields[i].name) == 0) {
+                *subelem_num = pccc_fields[i].subelem_num;
 
-            break;
+                pdebug(DEBUG_DETAIL, "Done.");
 
-        case PCCC_FILE_COUNTER:
-        case PCCC_FILE_TIMER:
-            if(str_cmp_i(*str,"con") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"pre") == 0) {
-                *subelem_num = 1;
-            } else if(str_cmp_i(*str,"acc") == 0) {
-                *subelem_num = 2;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported %s mnemonic!", (file_type == PCCC_FILE_COUNTER ? "counter" : "timer"));
-                return PLCTAG_ERR_BAD_PARAM;
-            }
-
-            break;
-
-        case PCCC_FILE_CONTROL:
-            if(str_cmp_i(*str,"con") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"len") == 0) {
-                *subelem_num = 1;
-            } else if(str_cmp_i(*str,"pos") == 0) {
-                *subelem_num = 2;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported control mnemonic!");
-                return PLCTAG_ERR_BAD_PARAM;
+                return PLCTAG_STATUS_OK;
             }
+        }
 
-            break;
+        pdebug(DEBUG_WARN, "Unsupported mnemonic %s!", *str);
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+}
 
-        case PCCC_FILE_PID:
-            if(str_cmp_i(*str,"con") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"sp") == 0) {
-                *subelem_num = 2;
-            } else if(str_cmp_i(*str,"kp") == 0) {
-                *subelem_num = 4;
-            } else if(str_cmp_i(*str,"ki") == 0) {
-                *subelem_num = 6;
-            } else if(str_cmp_i(*str,"kd") == 0) {
-                *subelem_num = 8;
-            } else if(str_cmp_i(*str,"pv") == 0) {
-                *subelem_num = 26;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported PID mnemonic!");
-                return PLCTAG_ERR_BAD_PARAM;
-            }
 
-            break;
 
-        case PCCC_FILE_MESSAGE:
-            if(str_cmp_i(*str,"con") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"err") == 0) {
-                *subelem_num = 1;
-            } else if(str_cmp_i(*str,"rlen") == 0) {
-                *subelem_num = 2;
-            } else if(str_cmp_i(*str,"dlen") == 0) {
-                *subelem_num = 3;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported message mnemonic!");
-                return PLCTAG_ERR_BAD_PARAM;
-            }
+int parse_pccc_number(const char **str)
+{
+    int tmp = 0;
 
-            break;
+    while(**str && isdigit((unsigned char)**str) && tmp < 65535) {
+        tmp *= 10;
+        tmp += (int)((**str) - '0');
+        (*str)++;
+    }
 
-        case PCCC_FILE_STRING:
-            if(str_cmp_i(*str,"len") == 0) {
-                *subelem_num = 0;
-            } else if(str_cmp_i(*str,"data") == 0) {
-                *subelem_num = 1;
-            } else {
-                pdebug(DEBUG_WARN,"Unsupported string mnemonic!");
-                return PLCTAG_ERR_BAD_PARAM;
-            }
+    return tmp;
+}
 
-            break;
 
-        default:
-            pdebug(DEBUG_WARN, "Unsupported mnemonic %s!", *str);
-            return PLCTAG_ERR_BAD_PARAM;
-            break;
-        }
-    }
+int addr_entry_free(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    mem_free(data);
 
     return PLCTAG_STATUS_OK;
 }
@@ -1086,6 +1340,30 @@ void encode_data(uint8_t *data, int *index, int val)
 
 
 
+int decode_data(uint8_t *data, int data_size, int *index, int *val)
+{
+    if(*index >= data_size) {
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    if(data[*index] != 0xff) {
+        *val = data[*index];
+        *index = *index + 1;
+    } else {
+        if(*index + 3 > data_size) {
+            return PLCTAG_ERR_TOO_SMALL;
+        }
+
+        *val = data[*index + 1] + (data[*index + 2] << 8);
+        *index = *index + 3;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+
 int encode_file_type(pccc_file_t file_type)
 {
     switch(file_type) {
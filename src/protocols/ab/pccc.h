@@ -39,6 +39,7 @@
 #include <lib/libplctag.h>
 #include <lib/tag.h>
 #include <platform.h>
+#include <ab/ab_common.h>
 
 
 typedef enum { PCCC_FILE_UNKNOWN, PCCC_FILE_ASCII, PCCC_FILE_BIT, PCCC_FILE_BLOCK_TRANSFER, PCCC_FILE_COUNTER,
@@ -46,14 +47,29 @@ typedef enum { PCCC_FILE_UNKNOWN, PCCC_FILE_ASCII, PCCC_FILE_BIT, PCCC_FILE_BLOC
                PCCC_FILE_PID, PCCC_FILE_CONTROL, PCCC_FILE_STATUS, PCCC_FILE_SFC, PCCC_FILE_STRING, PCCC_FILE_TIMER
              } pccc_file_t;
 
+extern int pccc_startup(void);
+extern void pccc_teardown(void);
+
 extern int plc5_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
 extern int slc_encode_tag_name(uint8_t *data, int *size, pccc_file_t *file_type, const char *name, int max_tag_name_size);
+extern int pccc_offset_encoded_name(uint8_t *data, int *size, uint8_t *encoded_name, int encoded_name_size, int is_plc5, int elem_offset);
 extern uint8_t pccc_calculate_bcc(uint8_t *data,int size);
 extern uint16_t pccc_calculate_crc16(uint8_t *data, int size);
 extern const char *pccc_decode_error(uint8_t *error_ptr);
 extern uint8_t *pccc_decode_dt_byte(uint8_t *data,int data_size, int *pccc_res_type, int *pccc_res_length);
 extern int pccc_encode_dt_byte(uint8_t *data,int buf_size, uint32_t data_type, uint32_t data_size);
 
+extern int pccc_decode_typed_read(uint8_t *cmd, int cmd_size, int *file_num, int *file_type, int *elem_num, int *num_bytes);
+extern int pccc_encode_typed_read(uint8_t *cmd, int cmd_capacity, int *cmd_size, int file_num, int file_type, int elem_num, int num_bytes);
+
+/* large PLC/5 and SLC tags are read and written in chunks of whole elements. */
+typedef int (*pccc_build_chunk_func)(ab_tag_p tag, int byte_offset, int size, ab_request_p *req);
+typedef int (*pccc_check_chunk_func)(ab_request_p req);
+
+extern int pccc_queue_chunks(ab_tag_p tag, int overhead, int max_chunk_size, pccc_build_chunk_func build_chunk);
+extern int pccc_check_chunks(ab_tag_p tag, pccc_check_chunk_func check_chunk);
+extern void pccc_release_chunks(ab_tag_p tag);
+
 
 
 #endif
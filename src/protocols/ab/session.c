@@ -36,8 +36,10 @@
 #include <ab/cip.h>
 #include <ab/defs.h>
 #include <ab/error_codes.h>
+#include <ab/pccc.h>
 #include <ab/session.h>
 #include <util/debug.h>
+#include <util/hash.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -61,12 +63,29 @@
 
 /*
  * Number of milliseconds to wait to try to set up the session again
- * after a failure.
+ * after the first failure.  This backs off on further failures.
  */
 #define RETRY_WAIT_MS (5000)
 
 #define SESSION_DISCONNECT_TIMEOUT (5000)
 
+#define SESSION_SYMBOL_TABLE_SIZE (100)
+
+/* an entry in the symbol instance cache. */
+struct symbol_entry_t {
+    uint32_t instance_id;
+    int key_len;
+    uint8_t key[];
+};
+
+/* an entry in the type info cache.  The type info follows the key. */
+struct type_info_entry_t {
+    int elem_size;
+    int type_info_size;
+    int key_len;
+    uint8_t key[];
+};
+
 
 
 static ab_session_p session_create_unsafe(const char *host, const char *path, plc_type_t plc_type, int *use_connected_msg);
@@ -74,8 +93,8 @@ static int session_init(ab_session_p session);
 //static int get_plc_type(attr attribs);
 static int add_session_unsafe(ab_session_p n);
 static int remove_session_unsafe(ab_session_p n);
-static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path);
-static int session_match_valid(const char *host, const char *path, ab_session_p session);
+static ab_session_p find_session_by_host_unsafe(const char *gateway, const char *path, plc_type_t plc_type, uint8_t *conn_path, uint8_t conn_path_size, uint16_t dhp_dest);
+static int session_match_valid(const char *host, const char *path, plc_type_t plc_type, uint8_t *conn_path, uint8_t conn_path_size, uint16_t dhp_dest, ab_session_p session);
 static int session_add_request_unsafe(ab_session_p sess, ab_request_p req);
 static int session_open_socket(ab_session_p session);
 static void session_destroy(void *session);
@@ -84,16 +103,32 @@ static int session_close_socket(ab_session_p session);
 static int session_unregister(ab_session_p session);
 static THREAD_FUNC(session_handler);
 static int purge_aborted_requests_unsafe(ab_session_p session);
+static int fail_requests_unsafe(ab_session_p session, int status);
 static int process_requests(ab_session_p session);
 //static int check_packing(ab_session_p session, ab_request_p request);
 static int get_payload_size(ab_request_p request);
+static int requests_can_pack(ab_request_p first, ab_request_p next);
+static uint8_t *request_cip_payload(ab_request_p request, int *payload_size);
+static int rmw_mask_offset(uint8_t *payload, int payload_size);
+static int merge_rmw_requests(ab_request_p *requests, int num_requests, ab_request_p *packed, int *reply_index);
+static uint8_t *request_pccc_command(ab_request_p request, int *cmd_size);
+static int bundle_pccc_reads_unsafe(ab_session_p session, ab_request_p *requests);
+static int merge_pccc_reads(ab_request_p *requests, int num_requests, int *reply_offset, int *reply_size);
 static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
+static int pipeline_requests_unsafe(ab_session_p session, ab_request_p *requests);
+static int send_pipelined_requests(ab_session_p session, ab_request_p *requests, int num_requests);
+static int pack_requests_unconnected(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
 static int recv_eip_response(ab_session_p session, int timeout);
-static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
+static int unpack_responses(ab_session_p session, ab_request_p *requests, int num_requests, int *reply_index, int num_replies);
+static int deliver_response(ab_session_p session, ab_request_p request, uint8_t *reply, int reply_len, int prefix_size);
+static int unpack_pccc_reads(ab_session_p session, ab_request_p *requests, int num_requests, int *reply_offset, int *reply_size);
 // static int perform_forward_open(ab_session_p session);
 static int perform_forward_close(ab_session_p session);
+static int session_keepalive(ab_session_p session);
+static int cache_entry_free(hashtable_p table, int64_t key, void *data, void *context);
+static void flush_caches_unsafe(ab_session_p session);
 // static int try_forward_open_ex(ab_session_p session, int *max_payload_size_guess);
 // static int try_forward_open(ab_session_p session);
 // static int send_forward_open_req(ab_session_p session);
@@ -226,15 +261,49 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     int rc = PLCTAG_STATUS_OK;
     int auto_disconnect_enabled = 0;
     int auto_disconnect_timeout_ms = INT_MAX;
+    int keepalive_ms = 0;
+    int max_requests_in_flight = 0;
+    uint8_t *conn_path = NULL;
+    uint8_t conn_path_size = 0;
+    uint16_t dhp_dest = 0;
 
     pdebug(DEBUG_DETAIL, "Starting");
 
+    /*
+     * encode the path up front.  Tags on different DH+ nodes behind the
+     * same bridge channel have the same connection path and only differ
+     * in the destination node, which goes in each request.
+     */
+    rc = cip_encode_path(session_path, &use_connected_msg, plc_type, &conn_path, &conn_path_size, &dhp_dest);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Unable to convert path links strings to binary path!");
+        *tag_session = AB_SESSION_NULL;
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    /* the tag needs to know which DH+ node it is talking to. */
+    attr_set_int(attribs, "dhp_dest", dhp_dest);
+
     auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
     if(auto_disconnect_timeout_ms != INT_MAX) {
         pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
         auto_disconnect_enabled = 1;
     }
 
+    keepalive_ms = attr_get_int(attribs, "keepalive_ms", 0);
+    if(keepalive_ms < 0) {
+        pdebug(DEBUG_WARN, "keepalive_ms must not be negative, not using keep-alive.");
+        keepalive_ms = 0;
+    } else if(keepalive_ms > 0) {
+        pdebug(DEBUG_DETAIL, "Setting keep-alive every %dms.", keepalive_ms);
+    }
+
+    max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", SESSION_DEFAULT_REQUESTS_IN_FLIGHT);
+    if(max_requests_in_flight < 1 || max_requests_in_flight > SESSION_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d, using %d.", SESSION_MAX_REQUESTS_IN_FLIGHT, SESSION_DEFAULT_REQUESTS_IN_FLIGHT);
+        max_requests_in_flight = SESSION_DEFAULT_REQUESTS_IN_FLIGHT;
+    }
+
     // if(plc_type == AB_PLC_PLC5 && str_length(session_path) > 0) {
     //     /* this means it is DH+ */
     //     use_connected_msg = 1;
@@ -244,7 +313,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
     critical_block(session_mutex) {
         /* if we are to share sessions, then look for an existing one. */
         if (shared_session) {
-            session = find_session_by_host_unsafe(session_gw, session_path);
+            session = find_session_by_host_unsafe(session_gw, session_path, plc_type, conn_path, conn_path_size, dhp_dest);
         } else {
             /* no sharing, create a new one */
             session = AB_SESSION_NULL;
@@ -260,6 +329,10 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
             } else {
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                session->keepalive_ms = keepalive_ms;
+                session->max_requests_in_flight = max_requests_in_flight;
+
+                backoff_init(&session->retry, attribs, RETRY_WAIT_MS);
 
                 new_session = 1;
             }
@@ -274,10 +347,24 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
             }
 
+            /* keep-alive period also only goes down. */
+            if(keepalive_ms > 0 && (session->keepalive_ms == 0 || session->keepalive_ms > keepalive_ms)) {
+                session->keepalive_ms = keepalive_ms;
+            }
+
+            /* the send window only goes up. */
+            if(session->max_requests_in_flight < max_requests_in_flight) {
+                session->max_requests_in_flight = max_requests_in_flight;
+            }
+
             pdebug(DEBUG_DETAIL, "Reusing existing session.");
         }
     }
 
+    if(conn_path) {
+        mem_free(conn_path);
+    }
+
     /*
      * do this OUTSIDE the mutex in order to let other threads not block if
      * the session creation process blocks.
@@ -304,6 +391,102 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs)
 
 
 
+/*
+ * session_hold
+ *
+ * Take over the caller's reference to the session and keep it until
+ * session_release() or until the library shuts down, so that the session
+ * stays open with no tags.
+ */
+void session_hold(ab_session_p session)
+{
+    int already_held = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "Called with null session!");
+        return;
+    }
+
+    critical_block(session_mutex) {
+        already_held = session->held;
+        session->held = 1;
+    }
+
+    /* only one reference is held per session. */
+    if(already_held) {
+        rc_dec(session);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+
+/*
+ * session_release
+ *
+ * Drop the reference taken by session_hold() for the session that a tag
+ * with these attributes would use.  The session closes as soon as the
+ * last tag using it is gone.  Nothing is created if there is no session.
+ */
+int session_release(attr attribs)
+{
+    const char *session_gw = attr_get_str(attribs, "gateway", "");
+    const char *session_path = attr_get_str(attribs, "path", "");
+    int use_connected_msg = attr_get_int(attribs, "use_connected_msg", 0);
+    plc_type_t plc_type = get_plc_type(attribs);
+    ab_session_p session = AB_SESSION_NULL;
+    int was_held = 0;
+    uint8_t *conn_path = NULL;
+    uint8_t conn_path_size = 0;
+    uint16_t dhp_dest = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    rc = cip_encode_path(session_path, &use_connected_msg, plc_type, &conn_path, &conn_path_size, &dhp_dest);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Unable to convert path links strings to binary path!");
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
+    critical_block(session_mutex) {
+        session = find_session_by_host_unsafe(session_gw, session_path, plc_type, conn_path, conn_path_size, dhp_dest);
+        if(session) {
+            was_held = session->held;
+            session->held = 0;
+        }
+    }
+
+    if(conn_path) {
+        mem_free(conn_path);
+    }
+
+    if(!session) {
+        pdebug(DEBUG_WARN, "No session found for these attributes.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* drop the reference from the search. */
+    rc_dec(session);
+
+    if(!was_held) {
+        pdebug(DEBUG_WARN, "Session was not held.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* drop the held reference. */
+    rc_dec(session);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 
 int add_session_unsafe(ab_session_p session)
 {
@@ -382,7 +565,7 @@ int remove_session(ab_session_p s)
 }
 
 
-int session_match_valid(const char *host, const char *path, ab_session_p session)
+int session_match_valid(const char *host, const char *path, plc_type_t plc_type, uint8_t *conn_path, uint8_t conn_path_size, uint16_t dhp_dest, ab_session_p session)
 {
     if(!session) {
         return 0;
@@ -407,6 +590,22 @@ int session_match_valid(const char *host, const char *path, ab_session_p session
         return 0;
     }
 
+    /*
+     * DH+ nodes behind the same bridge channel share the connection,
+     * the destination node is set per request.
+     */
+    if(dhp_dest && session->dhp_dest) {
+        if(plc_type != session->plc_type || conn_path_size != session->conn_path_size) {
+            return 0;
+        }
+
+        if(conn_path_size > 0 && mem_cmp(conn_path, conn_path_size, session->conn_path, session->conn_path_size)) {
+            return 0;
+        }
+
+        return 1;
+    }
+
     if(str_cmp_i(path, session->path)) {
         return 0;
     }
@@ -415,7 +614,7 @@ int session_match_valid(const char *host, const char *path, ab_session_p session
 }
 
 
-ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
+ab_session_p find_session_by_host_unsafe(const char *host, const char *path, plc_type_t plc_type, uint8_t *conn_path, uint8_t conn_path_size, uint16_t dhp_dest)
 {
     for(int i=0; i < vector_length(sessions); i++) {
         ab_session_p session = vector_get(sessions, i);
@@ -423,7 +622,7 @@ ab_session_p find_session_by_host_unsafe(const char *host, const char *path)
         /* is this session in the process of destruction? */
         session = rc_inc(session);
         if(session) {
-            if(session_match_valid(host, path, session)) {
+            if(session_match_valid(host, path, plc_type, conn_path, conn_path_size, dhp_dest, session)) {
                 return session;
             }
 
@@ -834,6 +1033,8 @@ void session_destroy(void *session_arg)
         }
     }
 
+    flush_caches_unsafe(session);
+
     /* we are done with the mutex, finally destroy it. */
     pdebug(DEBUG_DETAIL, "Destroying session mutex.");
     if(session->mutex) {
@@ -974,6 +1175,7 @@ THREAD_FUNC(session_handler)
     int64_t timeout_time = 0;
     int64_t auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
     int auto_disconnect = 0;
+    int64_t keepalive_time = 0;
 
 
     pdebug(DEBUG_INFO, "Starting thread for session %p", session);
@@ -1007,6 +1209,17 @@ THREAD_FUNC(session_handler)
                 auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
                 //}
 
+                keepalive_time = time_ms() + session->keepalive_ms;
+
+                /*
+                 * the PLC may have been downloaded to while we were not
+                 * connected.  Symbol instance IDs and types could now
+                 * belong to other tags.
+                 */
+                critical_block(session->mutex) {
+                    flush_caches_unsafe(session);
+                }
+
                 state = SESSION_REGISTER;
             }
             break;
@@ -1068,11 +1281,15 @@ THREAD_FUNC(session_handler)
 
             idle = 1;
 
+            /* we are connected, so the last attempt worked. */
+            backoff_reset(&session->retry);
+
             /* if there is work to do, make sure we do not disconnect. */
             pdebug(DEBUG_SPEW,"Critical block.");
             critical_block(session->mutex) {
                 if(vector_length(session->requests) > 0) {
                     auto_disconnect_time = time_ms() + SESSION_DISCONNECT_TIMEOUT;
+                    keepalive_time = time_ms() + session->keepalive_ms;
                 }
             }
 
@@ -1086,9 +1303,24 @@ THREAD_FUNC(session_handler)
                 }
             }
 
-            /* check if we should disconnect */
+            /* nothing has gone out for a while, poke the PLC so that it keeps the connection. */
+            if(idle && session->keepalive_ms > 0 && keepalive_time < time_ms()) {
+                if((rc = session_keepalive(session)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Keep-alive failed %s!", plc_tag_decode_error(rc));
+                    idle = 0;
+                    if(session->use_connected_msg) {
+                        state = SESSION_DISCONNECT;
+                    } else {
+                        state = SESSION_UNREGISTER;
+                    }
+                }
+
+                keepalive_time = time_ms() + session->keepalive_ms;
+            }
+
+            /* check if we should disconnect, but not if we are keeping the connection alive. */
             //if(session->auto_disconnect_enabled) {
-            if(auto_disconnect_time < time_ms()) {
+            if(session->keepalive_ms == 0 && auto_disconnect_time < time_ms()) {
                 pdebug(DEBUG_DETAIL, "Disconnecting due to inactivity.");
 
                 auto_disconnect = 1;
@@ -1145,8 +1377,7 @@ THREAD_FUNC(session_handler)
             /* set up timer for retry. */
             idle = 0;
 
-            /* FIXME - make this a tag attribute. */
-            timeout_time = time_ms() + RETRY_WAIT_MS;
+            timeout_time = time_ms() + backoff_fail(&session->retry);
 
             /* start waiting. */
             state = SESSION_WAIT_RETRY;
@@ -1159,6 +1390,13 @@ THREAD_FUNC(session_handler)
             /* make us sleep on each iteration. */
             idle = 1;
 
+            /* with the breaker open, nobody should wait for us. */
+            if(backoff_breaker_open(&session->retry)) {
+                critical_block(session->mutex) {
+                    fail_requests_unsafe(session, PLCTAG_ERR_BAD_CONNECTION);
+                }
+            }
+
             if(timeout_time < time_ms()) {
                 pdebug(DEBUG_DETAIL, "Transitioning to SESSION_OPEN_SOCKET.");
                 state = SESSION_OPEN_SOCKET;
@@ -1184,6 +1422,14 @@ THREAD_FUNC(session_handler)
                 }
             }
 
+            /* keep-alive was turned on after we disconnected. */
+            if(state == SESSION_WAIT_RECONNECT && session->keepalive_ms > 0) {
+                pdebug(DEBUG_DETAIL, "Keep-alive is enabled, reopening connection to PLC.");
+
+                idle = 0;
+                state = SESSION_OPEN_SOCKET;
+            }
+
             break;
 
 
@@ -1271,13 +1517,61 @@ int purge_aborted_requests_unsafe(ab_session_p session)
 }
 
 
+
+/*
+ * This must be called with the session mutex held!
+ */
+int fail_requests_unsafe(ab_session_p session, int status)
+{
+    int fail_count = 0;
+    ab_request_p request = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    while(vector_length(session->requests) > 0) {
+        request = vector_remove(session->requests, 0);
+
+        if(request) {
+            fail_count++;
+
+            debug_set_tag_id(request->tag_id);
+
+            request->status = status;
+            request->request_size = 0;
+            request->resp_received = 1;
+
+            /* release our hold on it. */
+            request = rc_dec(request);
+        }
+    }
+
+    debug_set_tag_id(0);
+
+    if(fail_count > 0) {
+        pdebug(DEBUG_DETAIL, "Failed %d queued requests with %s.", fail_count, plc_tag_decode_error(status));
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return fail_count;
+}
+
+
 int process_requests(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
     ab_request_p request = NULL;
     ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
     int num_bundled_requests = 0;
+    ab_request_p packed_requests[MAX_REQUESTS] = {NULL};
+    int reply_index[MAX_REQUESTS] = {0};
+    int reply_offset[MAX_REQUESTS] = {0};
+    int reply_size[MAX_REQUESTS] = {0};
+    int num_packed_requests = 0;
+    int merged_pccc_reads = 0;
+    int pipelined = 0;
     int remaining_space = 0;
+    int remaining_reply_space = 0;
 
     debug_set_tag_id(0);
 
@@ -1306,27 +1600,57 @@ int process_requests(ab_session_p session)
 
             /* how much space do we have to work with. */
             remaining_space = session->max_payload_size - (int)sizeof(cip_multi_req_header);
+            remaining_reply_space = session->max_payload_size - (int)sizeof(cip_multi_resp_header);
 
             if(vector_length(session->requests)) {
-                do {
-                    request = vector_get(session->requests, 0);
+                request = vector_get(session->requests, 0);
 
-                    remaining_space = remaining_space - get_payload_size(request);
-
-                    /*
-                     * If we have a non-packable request, only queue it if it is the first one.
-                     * If the request is packable, keep queuing as long as there is space.
-                     */
-
-                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
-                        //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
-                        bundled_requests[num_bundled_requests] = request;
-                        num_bundled_requests++;
+                /* UCMM is limited to a small packet whatever the connection allows. */
+                if(le2h16(((eip_encap *)(request->data))->encap_command) == AB_EIP_UNCONNECTED_SEND && session->max_payload_size > MAX_CIP_MSG_SIZE) {
+                    remaining_space = MAX_CIP_MSG_SIZE - (int)sizeof(cip_multi_req_header);
+                    remaining_reply_space = MAX_CIP_MSG_SIZE - (int)sizeof(cip_multi_resp_header);
+                }
 
-                        /* remove it from the queue. */
-                        vector_remove(session->requests, 0);
+                if(request->pccc_elem_size > 0) {
+                    /* typed PCCC reads cannot be packed, but reads of nearby elements can be merged. */
+                    num_bundled_requests = bundle_pccc_reads_unsafe(session, bundled_requests);
+                } else {
+                    do {
+                        request = vector_get(session->requests, 0);
+
+                        /* connected and unconnected requests cannot share a packet. */
+                        if(num_bundled_requests > 0 && !requests_can_pack(bundled_requests[0], request)) {
+                            break;
+                        }
+
+                        remaining_space = remaining_space - get_payload_size(request);
+
+                        /* some replies cannot be cut short by the PLC, so they must fit too. */
+                        if(request->reply_size > 0) {
+                            remaining_reply_space = remaining_reply_space - (request->reply_size + (int)sizeof(uint16_le));
+                        }
+
+                        /*
+                         * If we have a non-packable request, only queue it if it is the first one.
+                         * If the request is packable, keep queuing as long as there is space.
+                         */
+
+                        if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0 && remaining_reply_space >= 0)) {
+                            //pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1, remaining_space);
+                            bundled_requests[num_bundled_requests] = request;
+                            num_bundled_requests++;
+
+                            /* remove it from the queue. */
+                            vector_remove(session->requests, 0);
+                        }
+                    } while(vector_length(session->requests) && remaining_space > 0 && remaining_reply_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+
+                    /* requests that need a packet of their own can go out back to back. */
+                    if(num_bundled_requests == 1 && !bundled_requests[0]->allow_packing && session->max_requests_in_flight > 1) {
+                        num_bundled_requests = pipeline_requests_unsafe(session, bundled_requests);
+                        pipelined = (num_bundled_requests > 1);
                     }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS && request->allow_packing);
+                }
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
@@ -1340,77 +1664,86 @@ int process_requests(ab_session_p session)
 
         pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
 
-        do {
-            /* copy and pack the requests into the session buffer. */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
+        if(pipelined) {
+            rc = send_pipelined_requests(session, bundled_requests, num_bundled_requests);
+        } else {
+            if(num_bundled_requests > 1 && bundled_requests[0]->pccc_elem_size > 0) {
+                /* the first PCCC read is changed to cover all of them. */
+                num_packed_requests = merge_pccc_reads(bundled_requests, num_bundled_requests, reply_offset, reply_size);
+                packed_requests[0] = bundled_requests[0];
+                merged_pccc_reads = 1;
+            } else {
+                /* bit writes to the same word go out as one service. */
+                num_packed_requests = merge_rmw_requests(bundled_requests, num_bundled_requests, packed_requests, reply_index);
             }
 
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+            do {
+                /* copy and pack the requests into the session buffer. */
+                rc = pack_requests(session, packed_requests, num_packed_requests);
+                if(rc != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
+                    break;
+                }
 
-            /* send the request */
-            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
-                break;
-            }
+                /* fill in all the necessary parts to the request. */
+                if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+                    break;
+                }
 
-            /* wait for the response */
-            if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
-                break;
-            }
+                /* send the request */
+                if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+                    break;
+                }
 
-            /*
-             * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
-             */
-            if(num_bundled_requests > 1) {
-                if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-                    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
-                } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
-                    eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
-                    pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
+                /* wait for the response */
+                if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+                    break;
                 }
-            }
 
-            /* copy the results back out. Every request gets a copy. */
-            for(int i=0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
+                /*
+                 * check the CIP status, but only if this is a bundled
+                 * response.   If it is a singleton, then we pass the
+                 * status back to the tag.
+                 */
+                if(num_packed_requests > 1) {
+                    if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+                        eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
+                        pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
+
+                        /* punt if we got an overall error or it is not a partial/bundled error. */
+                        if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                            rc = decode_cip_error_code(&(resp->status));
+                            pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                            break;
+                        }
+                    } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+                        eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
+                        pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)", le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
+
+                        /* punt if we got an overall error or it is not a partial/bundled error. */
+                        if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
+                            rc = decode_cip_error_code(&(resp->status));
+                            pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
+                            break;
+                        }
+                    }
+                }
 
-                rc = unpack_response(session, bundled_requests[i], i);
+                /* copy the results back out. Every request gets a copy, merged requests share one. */
+                if(merged_pccc_reads) {
+                    rc = unpack_pccc_reads(session, bundled_requests, num_bundled_requests, reply_offset, reply_size);
+                } else {
+                    rc = unpack_responses(session, bundled_requests, num_bundled_requests, reply_index, num_packed_requests);
+                }
                 if(rc != PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_WARN, "Unable to unpack response!");
                     break;
                 }
-
-                /* release our reference */
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
-            }
-
-            rc = PLCTAG_STATUS_OK;
-        } while(0);
+            } while(0);
+        }
 
         /* problem? clean up the pending requests and dump everything. */
         if(rc != PLCTAG_STATUS_OK) {
@@ -1433,155 +1766,758 @@ int process_requests(ab_session_p session)
 }
 
 
-int unpack_response(ab_session_p session, ab_request_p request, int sub_packet)
+/*
+ * pipeline_requests_unsafe
+ *
+ * The first request needs a packet to itself.  Take any more requests
+ * like it from the front of the queue, up to the session's window, so
+ * that they can all be sent before waiting for the first reply.
+ *
+ * Must be called with the session mutex held.
+ */
+
+int pipeline_requests_unsafe(ab_session_p session, ab_request_p *requests)
 {
-    int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(session->data);
-    eip_cip_co_resp *unpacked_resp = NULL;
-    uint8_t *pkt_start = NULL;
-    uint8_t *pkt_end = NULL;
-    int new_eip_len = 0;
+    int num_requests = 1;
 
-    pdebug(DEBUG_INFO, "Starting.");
+    while(num_requests < session->max_requests_in_flight && vector_length(session->requests)) {
+        ab_request_p request = vector_get(session->requests, 0);
 
-    /* clear out the request data. */
-    mem_set(request->data, 0, request->request_capacity);
+        if(request->allow_packing || request->pccc_elem_size > 0) {
+            break;
+        }
 
-    /* change what we do depending on the type. */
-    if(packed_resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
-        /* copy the data back into the request buffer. */
-        new_eip_len = (int)session->data_size;
-        pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", new_eip_len);
+        requests[num_requests] = request;
+        num_requests++;
 
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
+        vector_remove(session->requests, 0);
+    }
 
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
+    pdebug(DEBUG_DETAIL, "Sending %d requests back to back.", num_requests);
 
-            critical_block(session->mutex) {
-                request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
-            }
+    return num_requests;
+}
 
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len, request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
 
-            rc = session_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
-            }
-        }
 
-        mem_copy(request->data, session->data, new_eip_len);
-    } else {
-        cip_multi_resp_header *multi = (cip_multi_resp_header *)(&packed_resp->reply_service);
-        uint16_t total_responses = le2h16(multi->request_count);
-        int pkt_len = 0;
+/*
+ * send_pipelined_requests
+ *
+ * Send each request in its own packet without waiting in between, then
+ * collect the replies.  Connected replies are matched on the connection
+ * sequence number and unconnected replies on the sender context, so the
+ * PLC does not have to answer in order.  Each request is released once it
+ * has its response.
+ */
+
+int send_pipelined_requests(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    int rc = PLCTAG_STATUS_OK;
+    uint64_t seq_ids[SESSION_MAX_REQUESTS_IN_FLIGHT] = {0};
+    int reply_index[1] = {0};
+    int num_sent = 0;
+    int num_replies = 0;
 
-        /* this is a packed response. */
-        pdebug(DEBUG_INFO, "Got multiple response packet, subpacket %d", sub_packet);
+    pdebug(DEBUG_INFO, "Starting.");
 
-        pdebug(DEBUG_INFO, "Our result offset is %d bytes.", (int)le2h16(multi->request_offsets[sub_packet]));
+    for(num_sent = 0; num_sent < num_requests; num_sent++) {
+        rc = pack_requests(session, &requests[num_sent], 1);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error while packing request %d, %s!", num_sent, plc_tag_decode_error(rc));
+            return rc;
+        }
 
-        pkt_start = ((uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet]));
+        if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to prepare request %d, %s!", num_sent, plc_tag_decode_error(rc));
+            return rc;
+        }
 
-        /* calculate the end of the data. */
-        if((sub_packet + 1) < total_responses) {
-            /* not the last response */
-            pkt_end = (uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet + 1]);
+        if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+            seq_ids[num_sent] = session->conn_seq_num;
         } else {
-            pkt_end = (session->data + le2h16(packed_resp->encap_length) + sizeof(eip_encap));
+            seq_ids[num_sent] = session->session_seq_id;
         }
 
-        pkt_len = (int)(pkt_end - pkt_start);
+        if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error sending packet %d, %s!", num_sent, plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
 
-        /* replace the request buffer if it is not big enough. */
-        new_eip_len = pkt_len + (int)sizeof(eip_cip_co_generic_response);
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
+    while(num_replies < num_requests) {
+        uint64_t resp_seq_id = 0;
+        int index = 0;
 
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
+        if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error receiving response %d of %d, %s!", num_replies + 1, num_requests, plc_tag_decode_error(rc));
+            return rc;
+        }
 
-            critical_block(session->mutex) {
-                request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
+        if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
+            if(session->data_size < sizeof(eip_cip_co_resp)) {
+                pdebug(DEBUG_WARN, "Connected response of %d bytes is too short!", (int)session->data_size);
+                return PLCTAG_ERR_BAD_REPLY;
             }
 
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len, request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
+            resp_seq_id = le2h16(((eip_cip_co_resp *)(session->data))->cpf_conn_seq_num);
+        } else {
+            resp_seq_id = session->resp_seq_id;
+        }
 
-            rc = session_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
+        for(index = 0; index < num_requests; index++) {
+            if(requests[index] && seq_ids[index] == resp_seq_id) {
+                break;
             }
         }
 
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
-
-        /* copy the header down */
-        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
-
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                                      /* start of the packet */
-
-        /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
-
-        /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
-    }
+        if(index >= num_requests) {
+            pdebug(DEBUG_WARN, "Got a response with sequence ID %" PRIu64 " that does not match any request in flight!", resp_seq_id);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
 
-    pdebug(DEBUG_INFO, "Unpacked packet:");
-    pdebug_dump_bytes(DEBUG_INFO, request->data, new_eip_len);
+        rc = unpack_responses(session, &requests[index], 1, reply_index, 1);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to unpack response to request %d!", index);
+            return rc;
+        }
 
-    /* notify the reading thread that the request is ready */
-    spin_block(&request->lock) {
-        request->status = PLCTAG_STATUS_OK;
-        request->request_size = new_eip_len;
-        request->resp_received = 1;
+        num_replies++;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
 
 
 
-int get_payload_size(ab_request_p request)
+/*
+ * unpack_responses
+ *
+ * Split the reply into one response per request.  The offset table of a
+ * Multiple Service Packet reply is checked in one pass before anything is
+ * handed out, so a bad reply fails every request instead of some of them
+ * getting garbage.  Each request is released once it has its response.
+ */
+
+int unpack_responses(ab_session_p session, ab_request_p *requests, int num_requests, int *reply_index, int num_replies)
 {
-    int request_data_size = 0;
-    eip_encap *header = (eip_encap *)(request->data);
-    eip_cip_co_req *co_req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+    eip_encap *packed_encap = (eip_encap *)(session->data);
+    uint8_t *reply_service = NULL;
+    uint8_t *packet_end = session->data + session->data_size;
+    uint8_t *reply_start[MAX_REQUESTS] = {NULL};
+    int reply_len[MAX_REQUESTS] = {0};
+    int prefix_size = 0;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    pdebug(DEBUG_INFO, "Starting.");
 
-    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
-        co_req = (eip_cip_co_req *)(request->data);
-        /* get length of new request */
-        request_data_size = le2h16(co_req->cpf_cdi_item_length)
-                            - 2  /* for connection sequence ID */
-                            + 2  /* for multipacket offset */
-                            ;
+    /* the CIP reply follows a different CPF header for connected and unconnected packets. */
+    if(le2h16(packed_encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        reply_service = &((eip_cip_uc_resp *)(session->data))->reply_service;
     } else {
-        pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", le2h16(header->encap_command));
-        request_data_size = INT_MAX;
+        reply_service = &((eip_cip_co_resp *)(session->data))->reply_service;
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    prefix_size = (int)(reply_service - session->data);
 
-    return request_data_size;
-}
+    if(*reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
+        /* a single reply goes unchanged to every request. */
+        pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", (int)session->data_size);
 
+        for(int i=0; i < num_replies; i++) {
+            reply_start[i] = session->data;
+            reply_len[i] = (int)session->data_size;
+        }
+
+        prefix_size = 0;
+    } else {
+        cip_multi_resp_header *multi = (cip_multi_resp_header *)reply_service;
+        uint8_t *offset_base = (uint8_t *)(&multi->request_count);
+        uint8_t *table_end = NULL;
+        uint8_t *last_end = packet_end;
+
+        /* the encapsulation length may be shorter than what was read. */
+        if(session->data + le2h16(packed_encap->encap_length) + sizeof(eip_encap) < packet_end) {
+            last_end = session->data + le2h16(packed_encap->encap_length) + sizeof(eip_encap);
+        }
+
+        table_end = (uint8_t *)(&multi->request_offsets[0]);
+        if(table_end > last_end || le2h16(multi->request_count) != num_replies) {
+            pdebug(DEBUG_WARN, "Got %d responses for %d requests!", (table_end > last_end ? -1 : (int)le2h16(multi->request_count)), num_replies);
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        table_end = (uint8_t *)(&multi->request_offsets[num_replies]);
+        if(table_end > last_end) {
+            pdebug(DEBUG_WARN, "Response offset table runs past the end of the packet!");
+            return PLCTAG_ERR_BAD_REPLY;
+        }
+
+        /* each reply runs up to the start of the next one. */
+        for(int i = num_replies - 1; i >= 0; i--) {
+            uint8_t *start = offset_base + le2h16(multi->request_offsets[i]);
+
+            if(start < table_end || start > last_end) {
+                pdebug(DEBUG_WARN, "Response %d offset %d is outside the packet!", i, (int)le2h16(multi->request_offsets[i]));
+                return PLCTAG_ERR_BAD_REPLY;
+            }
+
+            reply_start[i] = start;
+            reply_len[i] = (int)(last_end - start);
+            last_end = start;
+        }
+    }
+
+    for(int i=0; i < num_requests; i++) {
+        int sub_packet = reply_index[i];
+
+        debug_set_tag_id(requests[i]->tag_id);
+
+        pdebug(DEBUG_DETAIL, "Response %d of %d bytes.", sub_packet, reply_len[sub_packet]);
+
+        rc = deliver_response(session, requests[i], reply_start[sub_packet], reply_len[sub_packet], prefix_size);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to deliver response %d!", sub_packet);
+            return rc;
+        }
+
+        /* release our reference */
+        requests[i] = rc_dec(requests[i]);
+    }
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * deliver_response
+ *
+ * Give a request its response.  With a prefix, that much of the start of
+ * the packet is copied in front of the reply and the EIP and CPF lengths
+ * fixed up so the tag sees a normal single reply.
+ */
+
+int deliver_response(ab_session_p session, ab_request_p request, uint8_t *reply, int reply_len, int prefix_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    int new_eip_len = prefix_size + reply_len;
+
+    /* the room left for this reply when packing must have been enough. */
+    if(prefix_size > 0 && request->reply_size > 0 && reply_len > request->reply_size) {
+        pdebug(DEBUG_WARN, "Packed reply is %d bytes, more than the %d bytes expected!", reply_len, request->reply_size);
+    }
+
+    /* replace the request buffer if it is not big enough. */
+    if(new_eip_len > request->request_capacity) {
+        int request_capacity = 0;
+
+        pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
+
+        critical_block(session->mutex) {
+            request_capacity = (int)(session->max_payload_size + EIP_CIP_PREFIX_SIZE);
+        }
+
+        /* make sure it will fit. */
+        if(new_eip_len > request_capacity) {
+            pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len, request_capacity);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        rc = session_request_increase_buffer(request, request_capacity);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
+            return rc;
+        }
+    }
+
+    if(prefix_size > 0) {
+        /* copy the header down, then the reply after it. */
+        mem_copy(request->data, session->data, prefix_size);
+        mem_copy(request->data + prefix_size, reply, reply_len);
+
+        /* stitch up the packet sizes. */
+        if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+            eip_cip_uc_resp *unpacked_resp = (eip_cip_uc_resp *)(request->data);
+
+            unpacked_resp->cpf_udi_item_length = h2le16((uint16_t)(new_eip_len - (int)(&unpacked_resp->reply_service - request->data)));
+            unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+        } else {
+            eip_cip_co_resp *unpacked_resp = (eip_cip_co_resp *)(request->data);
+
+            unpacked_resp->cpf_cdi_item_length = h2le16((uint16_t)(reply_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
+            unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (int)sizeof(eip_encap)));
+        }
+    } else {
+        mem_copy(request->data, reply, reply_len);
+    }
+
+    /* clear out whatever is left of the old request. */
+    if(new_eip_len < request->request_capacity) {
+        mem_set(request->data + new_eip_len, 0, request->request_capacity - new_eip_len);
+    }
+
+    pdebug(DEBUG_SPEW, "Unpacked packet:");
+    pdebug_dump_bytes(DEBUG_SPEW, request->data, new_eip_len);
+
+    /* notify the reading thread that the request is ready */
+    spin_block(&request->lock) {
+        request->status = PLCTAG_STATUS_OK;
+        request->request_size = new_eip_len;
+        request->resp_received = 1;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * unpack_pccc_reads
+ *
+ * Give each merged PCCC read its part of the data, behind a copy of the
+ * PCCC reply header.  If the merged read failed, every request gets the
+ * whole reply so that each tag sees the error.
+ */
+
+int unpack_pccc_reads(ab_session_p session, ab_request_p *requests, int num_requests, int *reply_offset, int *reply_size)
+{
+    int rc = PLCTAG_STATUS_OK;
+    pccc_resp *resp = (pccc_resp *)(session->data);
+    int prefix_size = (int)sizeof(pccc_resp);
+    int data_size = 0;
+    int reply_ok = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if((int)session->data_size >= prefix_size
+       && le2h16(resp->encap_command) == AB_EIP_UNCONNECTED_SEND
+       && le2h32(resp->encap_status) == AB_EIP_OK
+       && resp->general_status == AB_EIP_OK
+       && resp->pccc_status == AB_EIP_OK) {
+        data_size = (int)le2h16(resp->encap_length) + (int)sizeof(eip_encap) - prefix_size;
+
+        if(data_size > (int)session->data_size - prefix_size) {
+            data_size = (int)session->data_size - prefix_size;
+        }
+
+        reply_ok = 1;
+    } else {
+        pdebug(DEBUG_INFO, "Merged PCCC read failed, passing the error to all %d requests.", num_requests);
+    }
+
+    for(int i=0; i < num_requests; i++) {
+        debug_set_tag_id(requests[i]->tag_id);
+
+        if(reply_ok && reply_offset[i] + reply_size[i] <= data_size) {
+            pdebug(DEBUG_DETAIL, "Request gets %d bytes at offset %d of the merged read.", reply_size[i], reply_offset[i]);
+            rc = deliver_response(session, requests[i], session->data + prefix_size + reply_offset[i], reply_size[i], prefix_size);
+        } else {
+            rc = deliver_response(session, requests[i], session->data, (int)session->data_size, 0);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to deliver response to request %d!", i);
+            return rc;
+        }
+
+        /* release our reference */
+        requests[i] = rc_dec(requests[i]);
+    }
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int get_payload_size(ab_request_p request)
+{
+    int request_data_size = 0;
+    eip_encap *header = (eip_encap *)(request->data);
+    eip_cip_co_req *co_req = NULL;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
+        co_req = (eip_cip_co_req *)(request->data);
+        /* get length of new request */
+        request_data_size = le2h16(co_req->cpf_cdi_item_length)
+                            - 2  /* for connection sequence ID */
+                            + 2  /* for multipacket offset */
+                            ;
+    } else if(le2h16(header->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(request->data);
+
+        /* only the embedded request is packed, the routing is shared. */
+        request_data_size = le2h16(uc_req->uc_cmd_length)
+                            + 2  /* for multipacket offset */
+                            ;
+    } else {
+        pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", le2h16(header->encap_command));
+        request_data_size = INT_MAX;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return request_data_size;
+}
+
+
+
+
+/*
+ * Requests can only go in the same packet if they are the same kind of
+ * EIP packet.  Unconnected requests carry their own route so that has to
+ * match as well.
+ */
+
+int requests_can_pack(ab_request_p first, ab_request_p next)
+{
+    eip_cip_uc_req *first_req = (eip_cip_uc_req *)(first->data);
+    eip_cip_uc_req *next_req = (eip_cip_uc_req *)(next->data);
+    int first_route_start = 0;
+    int next_route_start = 0;
+
+    if(le2h16(first_req->encap_command) != le2h16(next_req->encap_command)) {
+        return 0;
+    }
+
+    if(le2h16(first_req->encap_command) != AB_EIP_UNCONNECTED_SEND) {
+        return 1;
+    }
+
+    first_route_start = (int)sizeof(eip_cip_uc_req) + le2h16(first_req->uc_cmd_length);
+    next_route_start = (int)sizeof(eip_cip_uc_req) + le2h16(next_req->uc_cmd_length);
+
+    if((first->request_size - first_route_start) != (next->request_size - next_route_start)) {
+        return 0;
+    }
+
+    return mem_cmp(first->data + first_route_start, first->request_size - first_route_start,
+                   next->data + next_route_start, next->request_size - next_route_start) == 0;
+}
+
+
+
+/*
+ * Find the CIP service inside a connected or unconnected request.
+ */
+
+uint8_t *request_cip_payload(ab_request_p request, int *payload_size)
+{
+    eip_encap *header = (eip_encap *)(request->data);
+
+    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
+        eip_cip_co_req *co_req = (eip_cip_co_req *)(request->data);
+
+        *payload_size = (int)le2h16(co_req->cpf_cdi_item_length) - (int)sizeof(co_req->cpf_conn_seq_num);
+
+        return (uint8_t *)(&co_req->cpf_conn_seq_num) + sizeof(co_req->cpf_conn_seq_num);
+    } else {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(request->data);
+
+        *payload_size = (int)le2h16(uc_req->uc_cmd_length);
+
+        return request->data + sizeof(eip_cip_uc_req);
+    }
+}
+
+
+
+/*
+ * If the service is a Read-Modify-Write, return the offset of the OR mask,
+ * otherwise zero.  The format is:
+ *
+ * uint8_t service
+ * uint8_t path size in words
+ * path
+ * uint16_t mask size
+ * OR mask
+ * AND mask
+ */
+
+int rmw_mask_offset(uint8_t *payload, int payload_size)
+{
+    int mask_offset = 0;
+    int mask_size = 0;
+
+    if(payload_size < 4 || payload[0] != AB_EIP_CMD_CIP_RMW) {
+        return 0;
+    }
+
+    mask_offset = 2 + (payload[1] * 2) + 2;
+    if(mask_offset > payload_size) {
+        return 0;
+    }
+
+    mask_size = payload[mask_offset - 2] + (payload[mask_offset - 1] << 8);
+    if(mask_offset + (mask_size * 2) != payload_size) {
+        return 0;
+    }
+
+    return mask_offset;
+}
+
+
+
+/*
+ * Merge Read-Modify-Write requests for the same word into the first one
+ * of them, so setting many bits in one DINT takes one service.  Each
+ * request gets the index of the packed request whose reply it shares.
+ *
+ * Only runs of RMW requests are merged.  Moving a bit change ahead of a
+ * read or write of the same data would change what that request sees.
+ *
+ * Returns the number of packed requests.
+ */
+
+int merge_rmw_requests(ab_request_p *requests, int num_requests, ab_request_p *packed, int *reply_index)
+{
+    int num_packed = 0;
+    int first_candidate = 0;
+
+    for(int i=0; i < num_requests; i++) {
+        uint8_t *payload = NULL;
+        int payload_size = 0;
+        int mask_offset = 0;
+        int target = -1;
+
+        payload = request_cip_payload(requests[i], &payload_size);
+        mask_offset = rmw_mask_offset(payload, payload_size);
+
+        if(mask_offset) {
+            for(int j=first_candidate; j < num_packed && target < 0; j++) {
+                uint8_t *target_payload = NULL;
+                int target_size = 0;
+
+                target_payload = request_cip_payload(packed[j], &target_size);
+
+                /* same service, path and mask size. */
+                if(target_size == payload_size && mem_cmp(target_payload, mask_offset, payload, mask_offset) == 0) {
+                    target = j;
+                }
+            }
+        } else {
+            /* nothing can be merged past this request. */
+            first_candidate = num_packed + 1;
+        }
+
+        if(target >= 0) {
+            uint8_t *target_payload = NULL;
+            int target_size = 0;
+            int mask_size = (payload_size - mask_offset) / 2;
+
+            target_payload = request_cip_payload(packed[target], &target_size);
+
+            /* bits changed by the later request win. */
+            for(int k=0; k < mask_size; k++) {
+                uint8_t *or_mask = target_payload + mask_offset;
+                uint8_t *and_mask = or_mask + mask_size;
+                uint8_t new_or = payload[mask_offset + k];
+                uint8_t new_and = payload[mask_offset + mask_size + k];
+
+                or_mask[k] = (uint8_t)((or_mask[k] & new_and) | new_or);
+                and_mask[k] = (uint8_t)((and_mask[k] & new_and) | new_or);
+            }
+
+            pdebug(DEBUG_DETAIL, "Merged bit write from tag %d into request %d.", requests[i]->tag_id, target);
+
+            reply_index[i] = target;
+        } else {
+            packed[num_packed] = requests[i];
+            reply_index[i] = num_packed;
+            num_packed++;
+        }
+    }
+
+    return num_packed;
+}
+
+
+
+/*
+ * Find the PCCC command inside an Execute PCCC request sent directly to
+ * the PLC, or NULL if the request is something else.
+ */
+
+uint8_t *request_pccc_command(ab_request_p request, int *cmd_size)
+{
+    eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(request->data);
+    uint8_t *service = &uc_req->cm_service_code;
+    int service_size = (int)le2h16(uc_req->cpf_udi_item_length);
+    int header_size = 0;
+
+    if(le2h16(uc_req->encap_command) != AB_EIP_UNCONNECTED_SEND || service_size < 2 || service[0] != AB_EIP_CMD_PCCC_EXECUTE) {
+        return NULL;
+    }
+
+    /* service, path size and path, then the requestor ID which starts with its own size. */
+    header_size = 2 + (service[1] * 2);
+    if(header_size >= service_size) {
+        return NULL;
+    }
+
+    header_size += service[header_size];
+    if(header_size >= service_size || (int)(service - request->data) + service_size > request->request_size) {
+        return NULL;
+    }
+
+    *cmd_size = service_size - header_size;
+
+    return service + header_size;
+}
+
+
+
+/*
+ * Take the PCCC read at the front of the queue and any reads right behind
+ * it of nearby elements in the same data file, as long as all of them fit
+ * in one typed read.  Stops at the first request that does not fit so that
+ * nothing is reordered.
+ *
+ * Returns the number of requests taken off the queue.
+ */
+
+int bundle_pccc_reads_unsafe(ab_session_p session, ab_request_p *requests)
+{
+    ab_request_p request = vector_get(session->requests, 0);
+    int num_requests = 0;
+    int elem_size = request->pccc_elem_size;
+    int max_bytes = 0;
+    uint8_t *cmd = NULL;
+    int cmd_size = 0;
+    int file_num = 0;
+    int file_type = 0;
+    int start_elem = 0;
+    int end_elem = 0;
+    int num_bytes = 0;
+
+    /* the first request always goes. */
+    requests[num_requests] = request;
+    num_requests++;
+    vector_remove(session->requests, 0);
+
+    cmd = request_pccc_command(request, &cmd_size);
+    if(!cmd || pccc_decode_typed_read(cmd, cmd_size, &file_num, &file_type, &start_elem, &num_bytes) != PLCTAG_STATUS_OK || num_bytes % elem_size) {
+        return num_requests;
+    }
+
+    end_elem = start_elem + (num_bytes / elem_size);
+
+    /* the reply has the Execute PCCC header, requestor ID and PCCC header before the data. */
+    max_bytes = session->max_payload_size - (4 + 7 + 4);
+    if(max_bytes > 255) {
+        max_bytes = 255;
+    }
+
+    while(vector_length(session->requests) && num_requests < MAX_REQUESTS) {
+        int next_file_num = 0;
+        int next_file_type = 0;
+        int next_elem = 0;
+        int new_start = start_elem;
+        int new_end = end_elem;
+
+        request = vector_get(session->requests, 0);
+
+        if(request->pccc_elem_size != elem_size) {
+            break;
+        }
+
+        cmd = request_pccc_command(request, &cmd_size);
+        if(!cmd || pccc_decode_typed_read(cmd, cmd_size, &next_file_num, &next_file_type, &next_elem, &num_bytes) != PLCTAG_STATUS_OK) {
+            break;
+        }
+
+        if(next_file_num != file_num || next_file_type != file_type || num_bytes % elem_size) {
+            break;
+        }
+
+        if(next_elem < new_start) {
+            new_start = next_elem;
+        }
+
+        if(next_elem + (num_bytes / elem_size) > new_end) {
+            new_end = next_elem + (num_bytes / elem_size);
+        }
+
+        if((new_end - new_start) * elem_size > max_bytes) {
+            break;
+        }
+
+        start_elem = new_start;
+        end_elem = new_end;
+
+        requests[num_requests] = request;
+        num_requests++;
+        vector_remove(session->requests, 0);
+    }
+
+    if(num_requests > 1) {
+        pdebug(DEBUG_DETAIL, "Merging %d PCCC reads of elements %d to %d of file %d.", num_requests, start_elem, end_elem - 1, file_num);
+    }
+
+    return num_requests;
+}
+
+
+
+/*
+ * Change the first of a bundle of PCCC reads to read all the elements any
+ * of them want.  Each request gets the offset and size of its data within
+ * the merged reply.
+ *
+ * Returns the number of packed requests, always one.
+ */
+
+int merge_pccc_reads(ab_request_p *requests, int num_requests, int *reply_offset, int *reply_size)
+{
+    uint8_t *cmd = NULL;
+    int cmd_size = 0;
+    int new_cmd_size = 0;
+    int file_num = 0;
+    int file_type = 0;
+    int elem_num[MAX_REQUESTS] = {0};
+    int start_elem = INT_MAX;
+    int end_elem = 0;
+    int elem_size = requests[0]->pccc_elem_size;
+
+    for(int i=0; i < num_requests; i++) {
+        cmd = request_pccc_command(requests[i], &cmd_size);
+        pccc_decode_typed_read(cmd, cmd_size, &file_num, &file_type, &elem_num[i], &reply_size[i]);
+
+        if(elem_num[i] < start_elem) {
+            start_elem = elem_num[i];
+        }
+
+        if(elem_num[i] + (reply_size[i] / elem_size) > end_elem) {
+            end_elem = elem_num[i] + (reply_size[i] / elem_size);
+        }
+    }
+
+    for(int i=0; i < num_requests; i++) {
+        reply_offset[i] = (elem_num[i] - start_elem) * elem_size;
+    }
+
+    /* the new address is never longer as the start element is no larger. */
+    cmd = request_pccc_command(requests[0], &cmd_size);
+    if(pccc_encode_typed_read(cmd, requests[0]->request_capacity - (int)(cmd - requests[0]->data), &new_cmd_size, file_num, file_type, start_elem, (end_elem - start_elem) * elem_size) == PLCTAG_STATUS_OK) {
+        eip_cip_uc_req *uc_req = (eip_cip_uc_req *)(requests[0]->data);
+
+        uc_req->cpf_udi_item_length = h2le16((uint16_t)(le2h16(uc_req->cpf_udi_item_length) - cmd_size + new_cmd_size));
+        requests[0]->request_size = requests[0]->request_size - cmd_size + new_cmd_size;
+    }
+
+    return 1;
+}
 
 
 
@@ -1615,6 +2551,10 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
         return PLCTAG_STATUS_OK;
     }
 
+    if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
+        return pack_requests_unconnected(session, requests, num_requests);
+    }
+
     /* set up multi-packet header. */
 
     header_size = (int)(sizeof(cip_multi_req_header)
@@ -1695,6 +2635,83 @@ int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests
 
 
 
+/*
+ * Unconnected requests are packed inside one Unconnected Send.  The
+ * Multiple Service Packet becomes the embedded message and the route
+ * from the first request follows it.
+ */
+
+int pack_requests_unconnected(ab_session_p session, ab_request_p *requests, int num_requests)
+{
+    eip_cip_uc_req *packed_req = (eip_cip_uc_req *)(session->data);
+    eip_cip_uc_req *first_req = (eip_cip_uc_req *)(requests[0]->data);
+    cip_multi_req_header *multi_header = NULL;
+    uint8_t *embed_start = NULL;
+    uint8_t *data = NULL;
+    uint8_t *route = NULL;
+    int route_len = 0;
+    int current_offset = 0;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    route = requests[0]->data + sizeof(eip_cip_uc_req) + le2h16(first_req->uc_cmd_length);
+    route_len = requests[0]->request_size - (int)(route - requests[0]->data);
+
+    /* the fixed part of the header was copied from the first request. */
+    embed_start = session->data + sizeof(eip_cip_uc_req);
+
+    multi_header = (cip_multi_req_header *)embed_start;
+    multi_header->service_code = AB_EIP_CMD_CIP_MULTI;
+    multi_header->req_path_size = 0x02; /* length of path in words */
+    multi_header->req_path[0] = 0x20; /* Class */
+    multi_header->req_path[1] = 0x02; /* MR */
+    multi_header->req_path[2] = 0x24; /* Instance */
+    multi_header->req_path[3] = 0x01; /* #1 */
+    multi_header->request_count = h2le16((uint16_t)num_requests);
+
+    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
+    data = embed_start + sizeof(cip_multi_req_header) + (sizeof(uint16_le) * (size_t)num_requests);
+
+    for(int i=0; i < num_requests; i++) {
+        eip_cip_uc_req *new_req = (eip_cip_uc_req *)(requests[i]->data);
+        int pkt_len = le2h16(new_req->uc_cmd_length);
+
+        debug_set_tag_id(requests[i]->tag_id);
+
+        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
+
+        multi_header->request_offsets[i] = h2le16((uint16_t)current_offset);
+
+        mem_copy(data, requests[i]->data + sizeof(eip_cip_uc_req), pkt_len);
+
+        data += pkt_len;
+        current_offset += pkt_len;
+    }
+
+    debug_set_tag_id(0);
+
+    packed_req->uc_cmd_length = h2le16((uint16_t)(data - embed_start));
+
+    /* the route must start on a word boundary. */
+    if((data - embed_start) & 0x01) {
+        *data = 0;
+        data++;
+    }
+
+    mem_copy(data, route, route_len);
+    data += route_len;
+
+    packed_req->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&packed_req->cm_service_code)));
+
+    session->data_size = (uint32_t)(data - session->data);
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int prepare_request(ab_session_p session)
 {
     eip_encap *encap = NULL;
@@ -1935,6 +2952,89 @@ int perform_forward_close(ab_session_p session)
 
 
 
+/*
+ * session_keepalive
+ *
+ * Queue a Get Attribute Single for the vendor ID of the Identity object.
+ * Over a CIP connection this goes to the target, otherwise it goes to the
+ * gateway.  We do not care about the answer, even an error reply, only that
+ * one comes back.  That is traffic enough to stop either end from timing
+ * out the TCP session or the CIP connection.
+ *
+ * The request goes through the queue like any tag request, so the session
+ * thread never waits on it.  Nothing holds it but the session, so it is
+ * dropped once the reply is in.  A transport error is handled the same way
+ * as for any other request.
+ */
+
+int session_keepalive(ab_session_p session)
+{
+    static const uint8_t identity_vendor_req[] = { 0x0E, 0x03, 0x20, 0x01, 0x24, 0x01, 0x30, 0x01 };
+    ab_request_p request = NULL;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if((rc = session_create_request(session, 0, &request)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create keep-alive request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    if(session->use_connected_msg) {
+        eip_cip_co_req *req = (eip_cip_co_req *)(request->data);
+
+        mem_set(req, 0, (int)sizeof(*req));
+
+        data = (uint8_t *)(&req->cpf_conn_seq_num) + sizeof(req->cpf_conn_seq_num);
+        mem_copy(data, (uint8_t *)identity_vendor_req, (int)sizeof(identity_vendor_req));
+        data += sizeof(identity_vendor_req);
+
+        req->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+        req->router_timeout = h2le16(1);
+        req->cpf_item_count = h2le16(2);
+        req->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+        req->cpf_cai_item_length = h2le16(4);
+        req->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+        req->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&req->cpf_conn_seq_num)));
+    } else {
+        eip_cip_uc_req *req = (eip_cip_uc_req *)(request->data);
+
+        mem_set(req, 0, (int)sizeof(*req));
+
+        /* no Unconnected Send wrapper, the gateway handles this itself. */
+        data = (uint8_t *)(&req->cm_service_code);
+        mem_copy(data, (uint8_t *)identity_vendor_req, (int)sizeof(identity_vendor_req));
+        data += sizeof(identity_vendor_req);
+
+        req->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+        req->router_timeout = h2le16(1);
+        req->cpf_item_count = h2le16(2);
+        req->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI);
+        req->cpf_nai_item_length = h2le16(0);
+        req->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI);
+        req->cpf_udi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&req->cm_service_code)));
+    }
+
+    request->request_size = (int)(data - request->data);
+
+    /* without the wrapper this cannot share a packet with tag requests. */
+    request->allow_packing = 0;
+
+    if((rc = session_add_request(session, request)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue keep-alive request, %s!", plc_tag_decode_error(rc));
+    }
+
+    /* the session has its own reference if the request was queued. */
+    rc_dec(request);
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
+
+
+
 int send_forward_open_request(ab_session_p session)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -2320,6 +3420,269 @@ int recv_forward_close_resp(ab_session_p session)
 
 
 
+/*
+ * Symbol instance cache.
+ *
+ * Tag listings tell us the symbol instance ID of every tag they return.
+ * Tags on the same session use that to address the tag by instance
+ * rather than by name.  The key is the encoded symbolic path, as built
+ * by the caller.  The hash is only used to find the slot, the key bytes
+ * are always compared because using the wrong ID would touch the
+ * wrong tag.
+ */
+
+int session_symbol_put(ab_session_p session, uint8_t *key, int key_len, uint32_t instance_id)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct symbol_entry_t *entry = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(session->mutex) {
+        if(!session->symbols) {
+            session->symbols = hashtable_create(SESSION_SYMBOL_TABLE_SIZE);
+            if(!session->symbols) {
+                pdebug(DEBUG_WARN, "Unable to allocate symbol table!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        entry = hashtable_get(session->symbols, hash_key);
+        if(entry) {
+            if(entry->key_len == key_len && mem_cmp(entry->key, key_len, key, key_len) == 0) {
+                entry->instance_id = instance_id;
+            } else {
+                pdebug(DEBUG_DETAIL, "Hash collision, not caching symbol instance %u.", (unsigned int)instance_id);
+            }
+
+            break;
+        }
+
+        entry = mem_alloc((int)sizeof(*entry) + key_len);
+        if(!entry) {
+            pdebug(DEBUG_WARN, "Unable to allocate symbol entry!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        entry->instance_id = instance_id;
+        entry->key_len = key_len;
+        mem_copy(entry->key, key, key_len);
+
+        rc = hashtable_put(session->symbols, hash_key, entry);
+        if(rc != PLCTAG_STATUS_OK) {
+            mem_free(entry);
+        }
+    }
+
+    return rc;
+}
+
+
+int session_symbol_get(ab_session_p session, uint8_t *key, int key_len, uint32_t *instance_id)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct symbol_entry_t *entry = NULL;
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    critical_block(session->mutex) {
+        if(session->symbols) {
+            entry = hashtable_get(session->symbols, hash_key);
+            if(entry && entry->key_len == key_len && mem_cmp(entry->key, key_len, key, key_len) == 0) {
+                *instance_id = entry->instance_id;
+                rc = PLCTAG_STATUS_OK;
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+void session_symbol_remove(ab_session_p session, uint8_t *key, int key_len)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct symbol_entry_t *entry = NULL;
+
+    critical_block(session->mutex) {
+        if(session->symbols) {
+            entry = hashtable_get(session->symbols, hash_key);
+            if(entry && entry->key_len == key_len && mem_cmp(entry->key, key_len, key, key_len) == 0) {
+                hashtable_remove(session->symbols, hash_key);
+            } else {
+                entry = NULL;
+            }
+        }
+    }
+
+    if(entry) {
+        mem_free(entry);
+    }
+}
+
+
+/*
+ * Remember the type of a tag so that other tags with the same name do not
+ * need to read it first.  A later read of the same name replaces the entry.
+ */
+
+int session_type_info_put(ab_session_p session, uint8_t *key, int key_len, uint8_t *type_info, int type_info_size, int elem_size)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct type_info_entry_t *entry = NULL;
+    struct type_info_entry_t *old_entry = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    entry = mem_alloc((int)sizeof(*entry) + key_len + type_info_size);
+    if(!entry) {
+        pdebug(DEBUG_WARN, "Unable to allocate type info entry!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    entry->elem_size = elem_size;
+    entry->type_info_size = type_info_size;
+    entry->key_len = key_len;
+    mem_copy(entry->key, key, key_len);
+    mem_copy(entry->key + key_len, type_info, type_info_size);
+
+    critical_block(session->mutex) {
+        if(!session->type_infos) {
+            session->type_infos = hashtable_create(SESSION_SYMBOL_TABLE_SIZE);
+            if(!session->type_infos) {
+                pdebug(DEBUG_WARN, "Unable to allocate type info table!");
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+        }
+
+        old_entry = hashtable_get(session->type_infos, hash_key);
+        if(old_entry) {
+            if(old_entry->key_len != key_len || mem_cmp(old_entry->key, key_len, key, key_len) != 0) {
+                pdebug(DEBUG_DETAIL, "Hash collision, not caching type info.");
+                old_entry = NULL;
+                rc = PLCTAG_ERR_DUPLICATE;
+                break;
+            }
+
+            hashtable_remove(session->type_infos, hash_key);
+        }
+
+        rc = hashtable_put(session->type_infos, hash_key, entry);
+    }
+
+    if(old_entry) {
+        cache_entry_free(NULL, hash_key, old_entry, NULL);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        cache_entry_free(NULL, hash_key, entry, NULL);
+    }
+
+    return rc;
+}
+
+
+int session_type_info_get(ab_session_p session, uint8_t *key, int key_len, uint8_t *type_info, int *type_info_size, int *elem_size)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct type_info_entry_t *entry = NULL;
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    critical_block(session->mutex) {
+        if(session->type_infos) {
+            entry = hashtable_get(session->type_infos, hash_key);
+            if(entry && entry->key_len == key_len && mem_cmp(entry->key, key_len, key, key_len) == 0) {
+                if(entry->type_info_size > *type_info_size) {
+                    rc = PLCTAG_ERR_TOO_LARGE;
+                    break;
+                }
+
+                mem_copy(type_info, entry->key + key_len, entry->type_info_size);
+                *type_info_size = entry->type_info_size;
+                *elem_size = entry->elem_size;
+                rc = PLCTAG_STATUS_OK;
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+void session_type_info_remove(ab_session_p session, uint8_t *key, int key_len)
+{
+    int64_t hash_key = (int64_t)hash(key, (size_t)(unsigned int)key_len, 0);
+    struct type_info_entry_t *entry = NULL;
+
+    critical_block(session->mutex) {
+        if(session->type_infos) {
+            entry = hashtable_get(session->type_infos, hash_key);
+            if(entry && entry->key_len == key_len && mem_cmp(entry->key, key_len, key, key_len) == 0) {
+                hashtable_remove(session->type_infos, hash_key);
+            } else {
+                entry = NULL;
+            }
+        }
+    }
+
+    if(entry) {
+        cache_entry_free(NULL, hash_key, entry, NULL);
+    }
+}
+
+
+/*
+ * Tags that switched to a symbol instance ID check the generation to
+ * find out that the ID may be stale.
+ */
+
+int session_cache_generation(ab_session_p session)
+{
+    int generation = 0;
+
+    critical_block(session->mutex) {
+        generation = session->cache_generation;
+    }
+
+    return generation;
+}
+
+
+void flush_caches_unsafe(ab_session_p session)
+{
+    if(session->symbols) {
+        hashtable_on_each(session->symbols, cache_entry_free, NULL);
+        hashtable_destroy(session->symbols);
+        session->symbols = NULL;
+    }
+
+    if(session->type_infos) {
+        hashtable_on_each(session->type_infos, cache_entry_free, NULL);
+        hashtable_destroy(session->type_infos);
+        session->type_infos = NULL;
+    }
+
+    session->cache_generation++;
+}
+
+
+/*
+ * Entries in both caches are a single allocation.
+ */
+
+int cache_entry_free(hashtable_p table, int64_t key, void *data, void *context)
+{
+    (void)table;
+    (void)key;
+    (void)context;
+
+    mem_free(data);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int session_create_request(ab_session_p session, int tag_id, ab_request_p *req)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -36,6 +36,8 @@
 
 #include <ab/ab_common.h>
 #include <ab/defs.h>
+#include <util/backoff.h>
+#include <util/hashtable.h>
 #include <util/rc.h>
 #include <util/vector.h>
 
@@ -43,6 +45,9 @@
 
 #define SESSION_DEFAULT_TIMEOUT (2000)
 
+#define SESSION_DEFAULT_REQUESTS_IN_FLIGHT (1)
+#define SESSION_MAX_REQUESTS_IN_FLIGHT (16)
+
 #define MAX_PACKET_SIZE_EX  (44 + 4002)
 
 #define SESSION_MIN_REQUESTS    (10)
@@ -74,7 +79,7 @@ struct ab_session_t {
     uint16_t max_payload_size;
     uint8_t *conn_path;
     uint8_t conn_path_size;
-    uint16_t dhp_dest;
+    uint16_t dhp_dest;  /* non-zero for a DH+ bridge, tags keep their own node. */
 
     /* registration info */
     uint32_t session_handle;
@@ -101,6 +106,27 @@ struct ab_session_t {
     /* disconnect handling */
     int auto_disconnect_enabled;
     int auto_disconnect_timeout_ms;
+
+    /* keep-alive handling, zero if not used. */
+    int keepalive_ms;
+
+    /* how many packets can be sent before waiting for the replies. */
+    int max_requests_in_flight;
+
+    /* reconnect pacing and breaker. */
+    backoff_t retry;
+
+    /* symbol instance IDs learned from tag listings, keyed by encoded name. */
+    hashtable_p symbols;
+
+    /* tag type info learned from reads, keyed by encoded name. */
+    hashtable_p type_infos;
+
+    /* bumped when the caches above are flushed on a new connection. */
+    int cache_generation;
+
+    /* set if the library holds a reference from a prewarm. */
+    int held;
 };
 
 struct ab_request_t {
@@ -120,6 +146,12 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
+    /* element size of a PCCC typed read that can be merged with reads of nearby elements, zero if not. */
+    int pccc_elem_size;
+
+    /* most bytes the reply to a packable request can take in a packed reply, zero if the PLC limits it. */
+    int reply_size;
+
     /* time stamp for debugging output */
     int64_t time_sent;
 
@@ -138,8 +170,17 @@ extern int session_startup();
 extern void session_teardown();
 
 extern int session_find_or_create(ab_session_p *session, attr attribs);
+extern void session_hold(ab_session_p session);
+extern int session_release(attr attribs);
 extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
+extern int session_symbol_put(ab_session_p session, uint8_t *key, int key_len, uint32_t instance_id);
+extern int session_symbol_get(ab_session_p session, uint8_t *key, int key_len, uint32_t *instance_id);
+extern void session_symbol_remove(ab_session_p session, uint8_t *key, int key_len);
+extern int session_type_info_put(ab_session_p session, uint8_t *key, int key_len, uint8_t *type_info, int type_info_size, int elem_size);
+extern int session_type_info_get(ab_session_p session, uint8_t *key, int key_len, uint8_t *type_info, int *type_info_size, int *elem_size);
+extern void session_type_info_remove(ab_session_p session, uint8_t *key, int key_len);
+extern int session_cache_generation(ab_session_p session);
 
 #endif
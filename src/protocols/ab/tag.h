@@ -38,6 +38,7 @@
 #define MAX_TAG_NAME        (260)
 #define MAX_TAG_TYPE_INFO   (64)
 #define MAX_CONN_PATH       (260)   /* 256 plus padding. */
+#define MAX_FRAG_REQUESTS   (16)
 
 /* they are used in some of these includes */
 #include <lib/libplctag.h>
@@ -79,6 +80,11 @@ struct ab_tag_t {
     uint8_t encoded_name[MAX_TAG_NAME];
     int encoded_name_size;
 
+    /* the symbolic name, saved while encoded_name holds a symbol instance path. */
+    uint8_t *symbolic_name;
+    int symbolic_name_size;
+    int symbol_generation;
+
 //    const char *read_group;
 
     /* storage for the encoded type. */
@@ -107,8 +113,43 @@ struct ab_tag_t {
     ab_request_p req;
     int offset;
 
+    /* fragments of a large read that are in flight together. */
+    ab_request_p frag_req[MAX_FRAG_REQUESTS];
+    int frag_offset[MAX_FRAG_REQUESTS];
+    int frag_count;
+    int frag_size;  /* most data the PLC has returned in one fragment. */
+
+    /* set while reading one element of an Omron array to find the element size. */
+    int size_probe;
+
+    /* byte range for partial reads and writes, range_end is zero if not in use. */
+    int range_start;
+    int range_end;
+
+    /* bits to change in the first element with Read-Modify-Write, both zero for a normal write. */
+    uint64_t write_set_mask;
+    uint64_t write_clear_mask;
+
     int allow_packing;
 
+    /* DH+ node the requests go to when the session is to a DH+ bridge. */
+    uint16_t dhp_dest;
+
+    /* class 1 connection to a produced tag, rpi_ms is zero if not used. */
+    int rpi_ms;
+    sock_p io_sock;
+    int io_connected;
+    int io_has_data;
+    uint32_t io_orig_conn_id;   /* ours, for the data sent to us. */
+    uint32_t io_targ_conn_id;   /* the PLC's, for our heartbeats. */
+    uint16_t io_conn_serial_number;
+    uint16_t io_cip_seq;
+    uint32_t io_seq_num;
+    int io_timeout_ms;
+    int64_t io_last_data;
+    int64_t io_next_heartbeat;
+    int64_t io_retry_time;
+
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
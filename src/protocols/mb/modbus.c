@@ -38,6 +38,7 @@
 #include <lib/libplctag.h>
 #include <mb/modbus.h>
 #include <util/attr.h>
+#include <util/backoff.h>
 #include <util/debug.h>
 #include <util/rc.h>
 
@@ -46,12 +47,24 @@
 #define PLC_SOCKET_ERR_DELAY (5000)
 #define MODBUS_DEFAULT_PORT (502)
 #define PLC_READ_DATA_LEN (300)
-#define PLC_WRITE_DATA_LEN (300)
 #define MODBUS_MBAP_SIZE (6)
 #define MAX_MODBUS_REQUEST_PAYLOAD (246)
 #define MAX_MODBUS_RESPONSE_PAYLOAD (250)
 #define MAX_MODBUS_PDU_PAYLOAD (253)  /* everything after the server address */
 #define MODBUS_INACTIVITY_TIMEOUT (5000)
+#define MODBUS_MAX_REQUEST_SIZE (MODBUS_MBAP_SIZE + 7 + MAX_MODBUS_REQUEST_PAYLOAD)
+#define MODBUS_DEFAULT_REQUESTS_IN_FLIGHT (1)
+#define MODBUS_MAX_REQUESTS_IN_FLIGHT (16)
+#define PLC_WRITE_DATA_LEN (MODBUS_MAX_REQUESTS_IN_FLIGHT * MODBUS_MAX_REQUEST_SIZE)
+#define MAX_MODBUS_READ_REGISTERS (MAX_MODBUS_RESPONSE_PAYLOAD / 2)
+#define MAX_MODBUS_READ_WRITE_REGISTERS (121)  /* write part of FC23. */
+
+/* Modbus RTU serial line defaults, the spec default is 19200 baud, 8 data bits, even parity. */
+#define MODBUS_RTU_DEFAULT_BAUD_RATE (19200)
+#define MODBUS_RTU_DEFAULT_RESPONSE_TIMEOUT (1000)
+#define MODBUS_RTU_TURNAROUND_DELAY (100)  /* quiet time after a broadcast. */
+#define MODBUS_RTU_CRC_SIZE (2)
+#define MODBUS_RTU_MAX_FRAME_SIZE (256)
 
 struct modbus_plc_t {
     struct modbus_plc_t *next;
@@ -59,20 +72,66 @@ struct modbus_plc_t {
     /* keep a list of tags for this PLC. */
     struct modbus_tag_t *tags;
 
-    /* hostname/ip and possibly port of the server. */
+    /*
+     * The API side puts tags with a read, write or abort to do on the ready
+     * queue.  The handler thread moves them to its active list and keeps them
+     * there until they are idle again, so idle tags cost nothing.
+     */
+    lock_t ready_lock;
+    struct modbus_tag_t *ready_tags;
+    struct modbus_tag_t *active_tags;
+
+    /* hostname/ip and possibly port of the server, or the serial device. */
     char *server;
     sock_p sock;
     uint8_t server_id;
 
+    /*
+     * Modbus RTU over a serial line.  The bus has one master so only one
+     * request is sent at a time.  Each tag has its own server (unit) ID so
+     * tags for all the devices on the line share this PLC.
+     */
+    int is_rtu;
+    serial_port_p serial;
+    int baud_rate;
+    int data_bits;
+    int stop_bits;
+    int parity;
+    int char_bits;              /* bits on the line per character. */
+    int frame_gap_ms;           /* at least 3.5 character times between frames. */
+    int response_timeout_ms;
+    int64_t rtu_quiet_until;    /* do not send before this time. */
+    int64_t rtu_response_deadline;  /* zero when no response is expected. */
+    uint16_t rtu_seq_id;        /* transaction ID of the request on the line. */
+    uint8_t rtu_server_id;
+    uint8_t rtu_function;
+    int rtu_read_len;           /* raw frame bytes received after the MBAP header space. */
+    int rtu_frame_len;
+    int rtu_frame_offset;
+    uint8_t rtu_frame[MODBUS_RTU_MAX_FRAME_SIZE];
+
     /* State */
     struct {
         unsigned int terminate:1;
         unsigned int response_ready:1;
+        unsigned int response_shared:1;
         unsigned int request_ready:1;
-        unsigned int request_in_flight:1;
     } flags;
     uint16_t seq_id;
 
+    /*
+     * Modbus/TCP matches responses to requests by transaction ID, so
+     * several requests can be outstanding at once.
+     */
+    int requests_in_flight;
+    int max_requests_in_flight;
+
+    /* unused registers allowed between tags whose reads are merged. */
+    int max_read_gap;
+
+    /* send a pending write and read of holding registers together with FC23. */
+    int use_read_write_multiple;
+
     /* thread related state */
     thread_p handler_thread;
     mutex_p mutex;
@@ -80,6 +139,9 @@ struct modbus_plc_t {
     /* comms timeout/disconnect. */
     int64_t inactivity_timeout_ms;
 
+    /* reconnect pacing and breaker. */
+    backoff_t retry;
+
     /* data */
     int read_data_len;
     uint8_t read_data[PLC_READ_DATA_LEN];
@@ -99,7 +161,8 @@ typedef enum { MB_CMD_READ_COIL_MULTI = 0x01,
                MB_CMD_WRITE_COIL_SINGLE = 0x05,
                MB_CMD_WRITE_HOLDING_REGISTER_SINGLE = 0x06,
                MB_CMD_WRITE_COIL_MULTI = 0x0F,
-               MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10
+               MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10,
+               MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI = 0x17
              } modbug_cmd_t;
 
 struct modbus_tag_t {
@@ -109,10 +172,19 @@ struct modbus_tag_t {
     /* next one in the list for this PLC */
     struct modbus_tag_t *next;
 
+    /* links for the PLC's ready queue and active list. */
+    struct modbus_tag_t *ready_next;
+    struct modbus_tag_t *active_next;
+    int on_ready_queue;     /* protected by the PLC's ready_lock. */
+    int on_active_list;     /* protected by the PLC's mutex. */
+
     /* register type. */
     modbus_reg_type_t reg_type;
     uint16_t reg_base;
 
+    /* server (unit) ID of the device. */
+    uint8_t server_id;
+
     /* the PLC we are using */
     modbus_plc_p plc;
 
@@ -122,11 +194,17 @@ struct modbus_tag_t {
         unsigned int _read:1;
         unsigned int _write:1;
         unsigned int _busy:1;
+        unsigned int _merged:1;
+        unsigned int _can_merge:1;
     } flags;
     uint16_t request_num;
     uint16_t seq_id;
     lock_t tag_lock;
 
+    /* reads of nearby registers and writes of adjacent ones can share one request. */
+    int allow_packing;
+    int resp_offset;    /* where our data starts in a shared response. */
+
     /* data for the tag. */
     int elem_count;
     int elem_size;
@@ -153,17 +231,36 @@ static void modbus_tag_destructor(void *tag_arg);
 static void modbus_plc_destructor(void *plc_arg);
 static THREAD_FUNC(modbus_plc_handler);
 static int connect_plc(modbus_plc_p plc);
+static void disconnect_plc(modbus_plc_p plc);
+static int open_serial_plc(modbus_plc_p plc);
 static int read_packet(modbus_plc_p plc);
 static int write_packet(modbus_plc_p plc);
+static int read_rtu_packet(modbus_plc_p plc);
+static int write_rtu_packet(modbus_plc_p plc);
+static int rtu_frame_size(uint8_t *frame, int len);
+static void rtu_finish_response(modbus_plc_p plc, int pdu_size);
+static uint16_t rtu_crc16(uint8_t *data, int size);
 static int process_tag(modbus_tag_p tag, modbus_plc_p plc);
+static void queue_tag(modbus_tag_p tag);
+static void take_ready_tags(modbus_plc_p plc);
+static int can_queue_request(modbus_plc_p plc);
+static void drop_requests_in_flight(modbus_plc_p plc);
+static void fail_pending_tags(modbus_plc_p plc, int status);
 static int check_read_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_read_request(modbus_plc_p plc, modbus_tag_p tag);
+static int tag_can_merge_read(modbus_tag_p tag);
+static int merge_read_requests(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count);
+static int tag_can_merge_write(modbus_tag_p tag);
+static int write_is_blocked(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int first, int end);
+static int merge_write_requests(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count);
+static void copy_write_data(modbus_tag_p tag, uint8_t *payload, int first);
+static int pair_read_request(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *read_base, int *read_count);
+static void check_read_write_multiple_support(modbus_plc_p plc);
 static int check_write_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_write_request(modbus_plc_p plc, modbus_tag_p tag);
 static int translate_modbus_error(uint8_t err_code);
 
 static int tag_get_abort_flag(modbus_tag_p tag);
-static int tag_set_abort_flag(modbus_tag_p tag, int new_val);
 
 static int tag_get_read_flag(modbus_tag_p tag);
 static int tag_set_read_flag(modbus_tag_p tag, int new_val);
@@ -197,7 +294,11 @@ struct tag_vtable_t modbus_vtable = {
 
     /* data accessors */
     mb_get_int_attrib,
-    mb_set_int_attrib
+    mb_set_int_attrib,
+
+    /* partial access and masked writes not supported */
+    NULL,
+    NULL
 };
 
 
@@ -226,9 +327,16 @@ plc_tag_p mb_tag_create(attr attribs)
             tag->plc->tags = tag;
         }
 
-        /* trigger a read to get the initial value of the tag. */
-        tag->read_in_flight = 1;
-        tag->flags._read = 1;
+        /*
+         * trigger a read to get the initial value of the tag.  Nothing answers
+         * on the RTU broadcast address so those tags can only be written.
+         */
+        if(!(tag->plc->is_rtu && tag->server_id == 0)) {
+            tag->read_in_flight = 1;
+            tag->flags._read = 1;
+
+            queue_tag(tag);
+        }
     } else {
         pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
         tag->status = (int8_t)rc;
@@ -307,9 +415,11 @@ int create_tag_object(attr attribs, modbus_tag_p *tag)
     /* set the various size/element fields. */
     (*tag)->reg_base = (uint16_t)(unsigned int)reg_base;
     (*tag)->reg_type = reg_type;
+    (*tag)->server_id = (uint8_t)(unsigned int)attr_get_int(attribs, "path", 0);
     (*tag)->elem_count = elem_count;
     (*tag)->elem_size = reg_size;
     (*tag)->size = data_size;
+    (*tag)->allow_packing = attr_get_int(attribs, "allow_packing", 1);
 
     /* set up the vtable */
     (*tag)->vtable = &modbus_vtable;
@@ -491,6 +601,37 @@ void modbus_tag_destructor(void *tag_arg)
             } else {
                 pdebug(DEBUG_WARN, "Tag not found on PLC list!");
             }
+
+            /* the handler must not see the tag again. */
+            if(tag->on_active_list) {
+                tag_walker = &(tag->plc->active_tags);
+
+                while(*tag_walker && *tag_walker != tag) {
+                    tag_walker = &((*tag_walker)->active_next);
+                }
+
+                if(*tag_walker) {
+                    *tag_walker = tag->active_next;
+                }
+
+                tag->on_active_list = 0;
+            }
+
+            spin_block(&tag->plc->ready_lock) {
+                if(tag->on_ready_queue) {
+                    tag_walker = &(tag->plc->ready_tags);
+
+                    while(*tag_walker && *tag_walker != tag) {
+                        tag_walker = &((*tag_walker)->ready_next);
+                    }
+
+                    if(*tag_walker) {
+                        *tag_walker = tag->ready_next;
+                    }
+
+                    tag->on_ready_queue = 0;
+                }
+            }
         }
 
         pdebug(DEBUG_DETAIL, "Releasing the reference to the PLC.");
@@ -516,22 +657,34 @@ void modbus_tag_destructor(void *tag_arg)
 int find_or_create_plc(attr attribs, modbus_plc_p *plc)
 {
     const char *server = attr_get_str(attribs, "gateway", NULL);
+    const char *protocol = attr_get_str(attribs, "protocol", "modbus-tcp");
     int server_id = attr_get_int(attribs, "path", -1);
+    int is_rtu = (str_cmp_i(protocol, "modbus-rtu") == 0 || str_cmp_i(protocol, "modbus_rtu") == 0);
     int is_new = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    if(!server || str_length(server) == 0) {
+        pdebug(DEBUG_WARN, "Gateway attribute missing or empty!");
+        return PLCTAG_ERR_BAD_GATEWAY;
+    }
+
     if(server_id < 0 || server_id > 255) {
         pdebug(DEBUG_WARN, "Server ID, %d, out of bounds or missing!", server_id);
         return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
-    /* see if we can find a matching server. */
+    /*
+     * see if we can find a matching server.  All the devices on a serial
+     * line share it so the server ID only counts for Modbus/TCP.
+     */
     critical_block(mb_mutex) {
         modbus_plc_p *walker = &plcs;
 
-        while(*walker && (*walker)->server_id == (uint8_t)(unsigned int)server_id && str_cmp_i(server, (*walker)->server) != 0) {
+        while(*walker && ((*walker)->is_rtu != is_rtu
+                          || str_cmp_i(server, (*walker)->server) != 0
+                          || (!is_rtu && (*walker)->server_id != (uint8_t)(unsigned int)server_id))) {
             walker = &((*walker)->next);
         }
 
@@ -553,6 +706,7 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
                 } else {
                     /* link up the list. */
                     (*plc)->server_id = (uint8_t)(unsigned int)server_id;
+                    (*plc)->is_rtu = is_rtu;
                     (*plc)->next = plcs;
                     plcs = *plc;
                 }
@@ -571,7 +725,71 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc)
             /* we want to stay connected initially */
             (*plc)->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
 
-            rc = thread_create(&((*plc)->handler_thread), modbus_plc_handler, 32768, (void *)(*plc));
+            backoff_init(&((*plc)->retry), attribs, PLC_SOCKET_ERR_DELAY);
+
+            /* how many requests can be waiting for a response at once. */
+            (*plc)->max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", MODBUS_DEFAULT_REQUESTS_IN_FLIGHT);
+            if((*plc)->max_requests_in_flight < 1 || (*plc)->max_requests_in_flight > MODBUS_MAX_REQUESTS_IN_FLIGHT) {
+                pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d, using %d.", MODBUS_MAX_REQUESTS_IN_FLIGHT, MODBUS_DEFAULT_REQUESTS_IN_FLIGHT);
+                (*plc)->max_requests_in_flight = MODBUS_DEFAULT_REQUESTS_IN_FLIGHT;
+            }
+
+            /* by default only reads of adjacent or overlapping registers are merged. */
+            (*plc)->max_read_gap = attr_get_int(attribs, "max_read_gap", 0);
+            if((*plc)->max_read_gap < 0 || (*plc)->max_read_gap >= MAX_MODBUS_READ_REGISTERS) {
+                pdebug(DEBUG_WARN, "max_read_gap must be between 0 and %d, using 0.", MAX_MODBUS_READ_REGISTERS - 1);
+                (*plc)->max_read_gap = 0;
+            }
+
+            /* off by default as not every device has FC23. */
+            (*plc)->use_read_write_multiple = attr_get_int(attribs, "use_read_write_multiple", 0);
+
+            /* the first tag on a serial line sets up the line. */
+            if((*plc)->is_rtu) {
+                const char *parity = attr_get_str(attribs, "parity", "even");
+
+                if((*plc)->max_requests_in_flight != 1) {
+                    pdebug(DEBUG_WARN, "Only one request at a time can be sent on a Modbus RTU line.");
+                    (*plc)->max_requests_in_flight = 1;
+                }
+
+                (*plc)->baud_rate = attr_get_int(attribs, "baud_rate", MODBUS_RTU_DEFAULT_BAUD_RATE);
+                (*plc)->data_bits = attr_get_int(attribs, "data_bits", 8);
+                (*plc)->stop_bits = attr_get_int(attribs, "stop_bits", 1);
+                (*plc)->response_timeout_ms = attr_get_int(attribs, "response_timeout_ms", MODBUS_RTU_DEFAULT_RESPONSE_TIMEOUT);
+
+                if(str_cmp_i(parity, "none") == 0) {
+                    (*plc)->parity = 0;
+                } else if(str_cmp_i(parity, "odd") == 0) {
+                    (*plc)->parity = 1;
+                } else if(str_cmp_i(parity, "even") == 0) {
+                    (*plc)->parity = 2;
+                } else {
+                    pdebug(DEBUG_WARN, "Parity must be none, odd or even, not \"%s\"!", parity);
+                    rc = PLCTAG_ERR_BAD_PARAM;
+                }
+
+                if((*plc)->baud_rate <= 0 || (*plc)->response_timeout_ms <= 0) {
+                    pdebug(DEBUG_WARN, "The baud rate and response timeout must be positive!");
+                    rc = PLCTAG_ERR_BAD_PARAM;
+                }
+
+                if(rc == PLCTAG_STATUS_OK) {
+                    (*plc)->char_bits = 1 + (*plc)->data_bits + ((*plc)->parity ? 1 : 0) + (*plc)->stop_bits;
+
+                    /* above 19200 baud the spec fixes the gap at 1.75ms. */
+                    if((*plc)->baud_rate > 19200) {
+                        (*plc)->frame_gap_ms = 2;
+                    } else {
+                        (*plc)->frame_gap_ms = ((3500 * (*plc)->char_bits) + (*plc)->baud_rate - 1) / (*plc)->baud_rate;
+                    }
+                }
+            }
+
+            if(rc == PLCTAG_STATUS_OK) {
+                rc = thread_create(&((*plc)->handler_thread), modbus_plc_handler, 32768, (void *)(*plc));
+            }
+
             if(rc != PLCTAG_STATUS_OK) {
                 pdebug(DEBUG_WARN, "Unable to create new handler thread, error %s!", plc_tag_decode_error(rc));
             } else {
@@ -638,10 +856,7 @@ void modbus_plc_destructor(void *plc_arg)
         plc->mutex = NULL;
     }
 
-    if(plc->sock) {
-        socket_destroy(&plc->sock);
-        plc->sock = NULL;
-    }
+    disconnect_plc(plc);
 
     if(plc->server) {
         mem_free(plc->server);
@@ -676,20 +891,22 @@ THREAD_FUNC(modbus_plc_handler)
         if(err_delay < time_ms()) {
             do {
                 /* connect if we are still active and the socket is not there. */
-                if(!plc->sock && plc->inactivity_timeout_ms > time_ms()) {
+                if(!plc->sock && !plc->serial && plc->inactivity_timeout_ms > time_ms()) {
                     /* socket must not be open! */
                     rc = connect_plc(plc);
                     if(rc != PLCTAG_STATUS_OK) {
-                        err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
+                        err_delay = time_ms() + backoff_fail(&plc->retry);
                         break;
                     }
+
+                    backoff_reset(&plc->retry);
                 }
 
                 /* read packet */
                 rc = read_packet(plc);
                 if(rc != PLCTAG_STATUS_OK) {
                     /* problem, punt! */
-                    err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
+                    err_delay = time_ms() + backoff_fail(&plc->retry);
                     break;
                 }
 
@@ -701,30 +918,22 @@ THREAD_FUNC(modbus_plc_handler)
                 rc = write_packet(plc);
                 if(rc != PLCTAG_STATUS_OK) {
                     /* oops! */
-                    err_delay = time_ms() + PLC_SOCKET_ERR_DELAY;
+                    err_delay = time_ms() + backoff_fail(&plc->retry);
                     break;
                 }
 
                 /* check the inactivity timeout. */
-                if(plc->inactivity_timeout_ms <= time_ms() && plc->sock) {
-                    pdebug(DEBUG_DETAIL, "Shutting down socket due to inactivity.");
-                    /* shut down the socket. */
-                    socket_close(plc->sock);
-                    socket_destroy(&plc->sock);
-                    plc->sock = NULL;
+                if(plc->inactivity_timeout_ms <= time_ms() && (plc->sock || plc->serial)) {
+                    pdebug(DEBUG_DETAIL, "Shutting down connection due to inactivity.");
+                    disconnect_plc(plc);
 
                     /*
-                     * if we had a request that was sent, but there was no response yet,
-                     * then we need to clean up the state.   We are never going to get that
-                     * response.
-                     *
-                     * If there is a request ready to send, then keep it in the buffer until
-                     * we reconnect.
+                     * if we had requests that were sent, but there was no response yet,
+                     * then we need to clean up the state.   We are never going to get those
+                     * responses.  The tags send them again after we reconnect.
                      */
 
-                    if(plc->flags.request_in_flight && !plc->flags.request_ready) {
-                        plc->flags.request_in_flight = 0;
-                    }
+                    drop_requests_in_flight(plc);
 
                     /* we do not want to break here as the tags might have aborts to process. */
                 }
@@ -742,10 +951,16 @@ THREAD_FUNC(modbus_plc_handler)
 
                 if(rc_inc(plc)) {
                     critical_block(plc->mutex) {
-                        modbus_tag_p *tag_walker = &(plc->tags);
+                        modbus_tag_p *tag_walker = NULL;
+
+                        /* pick up the tags that have something new to do. */
+                        take_ready_tags(plc);
+
+                        tag_walker = &(plc->active_tags);
 
                         while(*tag_walker) {
                             modbus_tag_p tag = rc_inc(*tag_walker);
+                            int idle = 0;
 
                             /* the tag might be in the destructor. */
                             if(tag) {
@@ -760,11 +975,24 @@ THREAD_FUNC(modbus_plc_handler)
 
                                 debug_set_tag_id(0);
 
+                                spin_block(&tag->tag_lock) {
+                                    idle = !(tag->flags._read || tag->flags._write || tag->flags._abort);
+                                }
+
                                 /* release reference. */
                                 tag = rc_dec(tag);
                             }
 
-                            tag_walker = &((*tag_walker)->next);
+                            /* nothing more to do until the tag is queued again. */
+                            if(idle) {
+                                modbus_tag_p done = *tag_walker;
+
+                                *tag_walker = done->active_next;
+                                done->active_next = NULL;
+                                done->on_active_list = 0;
+                            } else {
+                                tag_walker = &((*tag_walker)->active_next);
+                            }
                         }
                     }
 
@@ -773,14 +1001,26 @@ THREAD_FUNC(modbus_plc_handler)
                 }
             } while(0);
 
+            /*
+             * A merged read response is left in the buffer until every tag
+             * that shares it has taken its part.
+             */
             if(plc->flags.response_ready) {
-                pdebug(DEBUG_WARN, "Response still pending after full tag pass.  Clearing buffer.");
+                if(!plc->flags.response_shared) {
+                    pdebug(DEBUG_WARN, "Response still pending after full tag pass.  Clearing buffer.");
+                }
 
                 plc->flags.response_ready = 0;
+                plc->flags.response_shared = 0;
                 plc->read_data_len = 0;
             }
         } else {
             keep_going = 0;
+
+            /* with the breaker open, do not make the tags wait for us. */
+            if(backoff_breaker_open(&plc->retry)) {
+                fail_pending_tags(plc, PLCTAG_ERR_BAD_CONNECTION);
+            }
         }
 
         if(!keep_going) {
@@ -804,6 +1044,10 @@ int connect_plc(modbus_plc_p plc)
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
+    if(plc->is_rtu) {
+        return open_serial_plc(plc);
+    }
+
     server_port = str_split(plc->server, ":");
     if(!server_port) {
         pdebug(DEBUG_WARN, "Unable to split server and port string!");
@@ -870,6 +1114,54 @@ int connect_plc(modbus_plc_p plc)
 
 
 
+void disconnect_plc(modbus_plc_p plc)
+{
+    if(plc->sock) {
+        socket_close(plc->sock);
+        socket_destroy(&plc->sock);
+        plc->sock = NULL;
+    }
+
+    if(plc->serial) {
+        plc_lib_close_serial_port(plc->serial);
+        plc->serial = NULL;
+    }
+
+    /* anything on the serial line is lost. */
+    plc->rtu_response_deadline = 0;
+    plc->rtu_read_len = 0;
+    plc->rtu_frame_len = 0;
+    plc->rtu_frame_offset = 0;
+}
+
+
+
+int open_serial_plc(modbus_plc_p plc)
+{
+    pdebug(DEBUG_DETAIL, "Opening serial port %s at %d baud, %d data bits, %d stop bits and parity %d.", plc->server, plc->baud_rate, plc->data_bits, plc->stop_bits, plc->parity);
+
+    plc->serial = plc_lib_open_serial_port(plc->server, plc->baud_rate, plc->data_bits, plc->stop_bits, plc->parity);
+    if(!plc->serial) {
+        pdebug(DEBUG_WARN, "Unable to open serial port %s!", plc->server);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    plc->rtu_quiet_until = time_ms() + plc->frame_gap_ms;
+    plc->rtu_response_deadline = 0;
+    plc->rtu_read_len = 0;
+    plc->rtu_frame_len = 0;
+    plc->rtu_frame_offset = 0;
+
+    /* we just opened the port, keep it open for a few seconds. */
+    plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
 int read_packet(modbus_plc_p plc)
 {
     int rc = 1;
@@ -877,6 +1169,10 @@ int read_packet(modbus_plc_p plc)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(plc->is_rtu) {
+        return read_rtu_packet(plc);
+    }
+
     /* socket could be closed due to inactivity. */
     if(!plc->sock) {
         pdebug(DEBUG_SPEW, "Socket is closed or missing.");
@@ -918,8 +1214,10 @@ int read_packet(modbus_plc_p plc)
             pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
             plc->flags.response_ready = 1;
 
-            /* regardless of what request this is, there is nothing in flight. */
-            plc->flags.request_in_flight = 0;
+            /* regardless of what request this is, one less is in flight. */
+            if(plc->requests_in_flight > 0) {
+                plc->requests_in_flight--;
+            }
         }
 
         rc = PLCTAG_STATUS_OK;
@@ -944,6 +1242,10 @@ int write_packet(modbus_plc_p plc)
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(plc->is_rtu) {
+        return write_rtu_packet(plc);
+    }
+
     /* if we have some data in the buffer, keep the connection open. */
     if(plc->write_data_len > 0) {
         plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
@@ -991,6 +1293,316 @@ int write_packet(modbus_plc_p plc)
     return rc;
 }
 
+/*
+ * Modbus RTU
+ *
+ * The requests are built in the Modbus/TCP format like always.  On the way
+ * out the MBAP header is dropped and a CRC is added.  On the way in the
+ * raw frame is read in just after the space for the MBAP header, and then
+ * the header is filled in with the transaction ID of the request that is on
+ * the line.  That way the tags see the same responses as with Modbus/TCP.
+ *
+ * Frames are found by their length, which comes from the function code, and
+ * checked with the CRC.  Timing between characters is not checked as USB
+ * serial adapters often deliver a frame in pieces.
+ */
+
+int read_rtu_packet(modbus_plc_p plc)
+{
+    uint8_t *frame = plc->read_data + MODBUS_MBAP_SIZE;
+    int frame_size = 0;
+    int rc = 1;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* port could be closed due to inactivity. */
+    if(!plc->serial) {
+        pdebug(DEBUG_SPEW, "Serial port is closed.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* a response might not have been picked up yet. */
+    if(plc->flags.response_ready) {
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* get as much of the frame as there is. */
+    while(rc > 0) {
+        frame_size = rtu_frame_size(frame, plc->rtu_read_len);
+
+        if(frame_size < 0) {
+            pdebug(DEBUG_WARN, "Unknown function code %u, throwing away the data.", (unsigned int)frame[1]);
+            pdebug_dump_bytes(DEBUG_DETAIL, frame, plc->rtu_read_len);
+            plc->rtu_read_len = 0;
+            continue;
+        }
+
+        if(plc->rtu_read_len >= frame_size) {
+            break;
+        }
+
+        rc = plc_lib_serial_port_read(plc->serial, frame + plc->rtu_read_len, frame_size - plc->rtu_read_len);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, reading serial port!", plc_tag_decode_error(rc));
+            return PLCTAG_ERR_READ;
+        }
+
+        if(rc > 0) {
+            plc->rtu_read_len += rc;
+
+            /* the line is busy. */
+            plc->rtu_quiet_until = time_ms() + plc->frame_gap_ms;
+            plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms();
+        }
+    }
+
+    if(frame_size > 0 && plc->rtu_read_len == frame_size) {
+        uint16_t crc = rtu_crc16(frame, frame_size - MODBUS_RTU_CRC_SIZE);
+
+        pdebug(DEBUG_DETAIL, "Received full frame.");
+        pdebug_dump_bytes(DEBUG_DETAIL, frame, frame_size);
+
+        plc->rtu_read_len = 0;
+
+        if(frame[frame_size - 2] != (uint8_t)(crc & 0xFF) || frame[frame_size - 1] != (uint8_t)(crc >> 8)) {
+            pdebug(DEBUG_WARN, "Bad CRC, dropping frame.");
+        } else if(!plc->rtu_response_deadline) {
+            pdebug(DEBUG_WARN, "Not waiting for a response, dropping frame.");
+        } else if(frame[0] != plc->rtu_server_id || (frame[1] & 0x7F) != plc->rtu_function) {
+            pdebug(DEBUG_WARN, "Frame from server %u with function %u does not match request, dropping it.", (unsigned int)frame[0], (unsigned int)frame[1]);
+        } else {
+            /* the PDU is already in place after the server ID. */
+            rtu_finish_response(plc, frame_size - 1 - MODBUS_RTU_CRC_SIZE);
+        }
+    }
+
+    /* nobody answered. */
+    if(!plc->flags.response_ready && plc->rtu_response_deadline && plc->rtu_response_deadline < time_ms()) {
+        pdebug(DEBUG_WARN, "Server %u did not respond in time!", (unsigned int)plc->rtu_server_id);
+
+        plc->rtu_read_len = 0;
+
+        /* report it the way a gateway would, as an exception from the server. */
+        plc->read_data[MODBUS_MBAP_SIZE] = plc->rtu_server_id;
+        plc->read_data[MODBUS_MBAP_SIZE + 1] = (uint8_t)(plc->rtu_function | 0x80);
+        plc->read_data[MODBUS_MBAP_SIZE + 2] = 0x0B;
+        rtu_finish_response(plc, 2);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+int write_rtu_packet(modbus_plc_p plc)
+{
+    int64_t now = time_ms();
+    int rc = 1;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!plc->serial) {
+        pdebug(DEBUG_SPEW, "Serial port is closed.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(!plc->rtu_frame_len) {
+        int pdu_size = plc->write_data_len - MODBUS_MBAP_SIZE;
+
+        /* one request at a time on the line and only when the line is quiet. */
+        if(!plc->flags.request_ready || plc->rtu_response_deadline || plc->flags.response_ready || now < plc->rtu_quiet_until) {
+            pdebug(DEBUG_SPEW, "Done. Nothing to do or line busy.");
+            return PLCTAG_STATUS_OK;
+        }
+
+        if(pdu_size <= 1 || pdu_size + MODBUS_RTU_CRC_SIZE > MODBUS_RTU_MAX_FRAME_SIZE) {
+            pdebug(DEBUG_WARN, "Request of %d bytes will not fit in an RTU frame!", pdu_size);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        /* whatever came in before now is noise. */
+        plc->rtu_read_len = 0;
+
+        plc->rtu_seq_id = (uint16_t)((plc->write_data[0] << 8) + plc->write_data[1]);
+        plc->rtu_server_id = plc->write_data[MODBUS_MBAP_SIZE];
+        plc->rtu_function = plc->write_data[MODBUS_MBAP_SIZE + 1];
+
+        mem_copy(plc->rtu_frame, plc->write_data + MODBUS_MBAP_SIZE, pdu_size);
+        plc->rtu_frame_len = pdu_size;
+
+        {
+            uint16_t crc = rtu_crc16(plc->rtu_frame, plc->rtu_frame_len);
+            plc->rtu_frame[plc->rtu_frame_len] = (uint8_t)(crc & 0xFF); plc->rtu_frame_len++;
+            plc->rtu_frame[plc->rtu_frame_len] = (uint8_t)(crc >> 8); plc->rtu_frame_len++;
+        }
+
+        plc->rtu_frame_offset = 0;
+
+        /* the request has moved out of the buffer. */
+        plc->flags.request_ready = 0;
+        plc->write_data_len = 0;
+        plc->write_data_offset = 0;
+    }
+
+    while(rc > 0 && plc->rtu_frame_offset < plc->rtu_frame_len) {
+        rc = plc_lib_serial_port_write(plc->serial, plc->rtu_frame + plc->rtu_frame_offset, plc->rtu_frame_len - plc->rtu_frame_offset);
+        if(rc < 0) {
+            pdebug(DEBUG_WARN, "Error, %s, writing to serial port!", plc_tag_decode_error(rc));
+            return PLCTAG_ERR_WRITE;
+        }
+
+        plc->rtu_frame_offset += rc;
+    }
+
+    if(plc->rtu_frame_offset == plc->rtu_frame_len) {
+        /* time for the frame to get onto the line. */
+        int send_ms = ((plc->rtu_frame_len * plc->char_bits * 1000) + plc->baud_rate - 1) / plc->baud_rate;
+
+        pdebug(DEBUG_DETAIL, "Full frame written.");
+        pdebug_dump_bytes(DEBUG_DETAIL, plc->rtu_frame, plc->rtu_frame_len);
+
+        plc->rtu_frame_len = 0;
+        plc->rtu_frame_offset = 0;
+        plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + now;
+
+        if(plc->rtu_server_id == 0) {
+            /* nobody answers a broadcast, so we make up the response now. */
+            plc->read_data[MODBUS_MBAP_SIZE] = 0;
+
+            switch(plc->rtu_function) {
+                case MB_CMD_WRITE_COIL_SINGLE:
+                case MB_CMD_WRITE_HOLDING_REGISTER_SINGLE:
+                case MB_CMD_WRITE_COIL_MULTI:
+                case MB_CMD_WRITE_HOLDING_REGISTER_MULTI:
+                    /* the response echos the address and count or value. */
+                    mem_copy(plc->read_data + MODBUS_MBAP_SIZE + 1, plc->rtu_frame + 1, 5);
+                    rtu_finish_response(plc, 5);
+                    break;
+
+                default:
+                    pdebug(DEBUG_WARN, "Only writes can be sent to the broadcast address!");
+                    plc->read_data[MODBUS_MBAP_SIZE + 1] = (uint8_t)(plc->rtu_function | 0x80);
+                    plc->read_data[MODBUS_MBAP_SIZE + 2] = 0x01;
+                    rtu_finish_response(plc, 2);
+                    break;
+            }
+
+            /* give the servers time to act on it. */
+            plc->rtu_quiet_until = now + send_ms + MODBUS_RTU_TURNAROUND_DELAY;
+        } else {
+            plc->rtu_response_deadline = now + send_ms + plc->response_timeout_ms;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+
+/*
+ * Work out the full size of an RTU frame, including the CRC, from the
+ * function code.  If there are not enough bytes yet to tell, return how
+ * many bytes are needed to tell.  Returns -1 for function codes we never
+ * send.
+ */
+
+int rtu_frame_size(uint8_t *frame, int len)
+{
+    if(len < 2) {
+        return 2;
+    }
+
+    /* exception responses have one byte of exception code. */
+    if(frame[1] & 0x80) {
+        return 3 + MODBUS_RTU_CRC_SIZE;
+    }
+
+    switch(frame[1]) {
+        case MB_CMD_READ_COIL_MULTI:
+        case MB_CMD_READ_DISCRETE_INPUT_MULTI:
+        case MB_CMD_READ_HOLDING_REGISTER_MULTI:
+        case MB_CMD_READ_INPUT_REGISTER_MULTI:
+        case MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI:
+            /* server ID, function, byte count and the data. */
+            if(len < 3) {
+                return 3;
+            }
+
+            return 3 + frame[2] + MODBUS_RTU_CRC_SIZE;
+
+        case MB_CMD_WRITE_COIL_SINGLE:
+        case MB_CMD_WRITE_HOLDING_REGISTER_SINGLE:
+        case MB_CMD_WRITE_COIL_MULTI:
+        case MB_CMD_WRITE_HOLDING_REGISTER_MULTI:
+            /* server ID, function, address and value or count. */
+            return 6 + MODBUS_RTU_CRC_SIZE;
+
+        default:
+            return -1;
+    }
+}
+
+
+
+/*
+ * The server ID and PDU are in the read buffer after the MBAP header space.
+ * Fill in the header to match the request and hand it to the tags.
+ */
+
+void rtu_finish_response(modbus_plc_p plc, int pdu_size)
+{
+    int packet_size = pdu_size + 1;
+
+    plc->read_data[0] = (uint8_t)(plc->rtu_seq_id >> 8);
+    plc->read_data[1] = (uint8_t)(plc->rtu_seq_id & 0xFF);
+    plc->read_data[2] = 0;
+    plc->read_data[3] = 0;
+    plc->read_data[4] = (uint8_t)((packet_size >> 8) & 0xFF);
+    plc->read_data[5] = (uint8_t)(packet_size & 0xFF);
+    plc->read_data_len = MODBUS_MBAP_SIZE + packet_size;
+
+    plc->rtu_response_deadline = 0;
+    plc->flags.response_ready = 1;
+
+    if(plc->requests_in_flight > 0) {
+        plc->requests_in_flight--;
+    }
+}
+
+
+
+/*
+ * Modbus uses the same CRC-16 polynomial as DF1 in pccc.c, but starts
+ * from 0xFFFF instead of zero.
+ */
+
+uint16_t rtu_crc16(uint8_t *data, int size)
+{
+    uint16_t crc = 0xFFFF;
+    int i;
+    int bit;
+
+    for(i = 0; i < size; i++) {
+        crc = (uint16_t)(crc ^ data[i]);
+
+        for(bit = 0; bit < 8; bit++) {
+            if(crc & 0x0001) {
+                crc = (uint16_t)((crc >> 1) ^ 0xA001);
+            } else {
+                crc = (uint16_t)(crc >> 1);
+            }
+        }
+    }
+
+    return crc;
+}
+
+
+
 /*
  * This is called in the context of the PLC thread.
  *
@@ -1026,10 +1638,12 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
             tag->flags._read = 0;
             tag->flags._write = 0;
             tag->flags._busy = 0;
+            tag->flags._merged = 0;
             tag->flags._abort = 0;
         }
 
         tag->seq_id = 0;
+        tag->resp_offset = 0;
     }
 
     if(tag_get_write_flag(tag)) {
@@ -1049,7 +1663,7 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
             }
         } else {
             /* we have a write request to do and nothing is in flight. */
-            if(! plc->flags.request_ready && !plc->flags.request_in_flight) {
+            if(can_queue_request(plc)) {
                 rc = create_write_request(plc, tag);
             } else {
                 pdebug(DEBUG_SPEW, "No buffer space for a response.");
@@ -1077,7 +1691,7 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
             }
         } else {
             /* we have a write request to do an nothing is in flight. */
-            if(!plc->flags.request_ready && !plc->flags.request_in_flight) {
+            if(can_queue_request(plc)) {
                 rc = create_read_request(plc, tag);
             } else {
                 pdebug(DEBUG_SPEW, "No buffer space for a response.");
@@ -1096,18 +1710,226 @@ int process_tag(modbus_tag_p tag, modbus_plc_p plc)
 }
 
 
-/* Read response.
- *    Byte  Meaning
- *      0    High byte of request sequence ID.
- *      1    Low byte of request sequence ID.
- *      2    High byte of the protocol version identifier (zero).
- *      3    Low byte of the protocol version identifier (zero).
- *      4    High byte of the message length.
- *      5    Low byte of the message length.
- *      6    Device address.
- *      7    Function code.
- *      8    First byte of the result.
- *      ...  up to 253 bytes of payload.
+
+/*
+ * Put a tag on its PLC's ready queue so that the handler thread will look
+ * at it.  Called from the API side after setting the read, write or abort
+ * flag.
+ */
+
+void queue_tag(modbus_tag_p tag)
+{
+    modbus_plc_p plc = tag->plc;
+
+    if(!plc) {
+        return;
+    }
+
+    spin_block(&plc->ready_lock) {
+        if(!tag->on_ready_queue) {
+            tag->ready_next = plc->ready_tags;
+            plc->ready_tags = tag;
+            tag->on_ready_queue = 1;
+        }
+    }
+}
+
+
+
+/*
+ * Move the ready queue onto the end of the active list, oldest first so
+ * that tags get their turn in order.  Called with the PLC mutex held.
+ */
+
+void take_ready_tags(modbus_plc_p plc)
+{
+    modbus_tag_p ready = NULL;
+    modbus_tag_p reversed = NULL;
+    modbus_tag_p *tail = &(plc->active_tags);
+
+    spin_block(&plc->ready_lock) {
+        ready = plc->ready_tags;
+        plc->ready_tags = NULL;
+
+        /* the queue is pushed at the front so reverse it. */
+        while(ready) {
+            modbus_tag_p tag = ready;
+
+            ready = tag->ready_next;
+            tag->ready_next = reversed;
+            tag->on_ready_queue = 0;
+            reversed = tag;
+        }
+    }
+
+    if(!reversed) {
+        return;
+    }
+
+    while(*tail) {
+        tail = &((*tail)->active_next);
+    }
+
+    while(reversed) {
+        modbus_tag_p tag = reversed;
+
+        reversed = tag->ready_next;
+        tag->ready_next = NULL;
+
+        /* it may still be active from an earlier operation. */
+        if(!tag->on_active_list) {
+            tag->on_active_list = 1;
+            tag->active_next = NULL;
+            *tail = tag;
+            tail = &(tag->active_next);
+        }
+    }
+}
+
+
+
+/*
+ * Another request can be queued if the window is not full and there is
+ * room for it behind whatever is still being written out.
+ */
+
+int can_queue_request(modbus_plc_p plc)
+{
+    if(plc->requests_in_flight >= plc->max_requests_in_flight) {
+        return 0;
+    }
+
+    return (plc->write_data_len + MODBUS_MAX_REQUEST_SIZE <= PLC_WRITE_DATA_LEN);
+}
+
+
+
+/*
+ * drop_requests_in_flight
+ *
+ * The connection is gone so no responses are coming.  Throw away anything
+ * not yet sent and put the waiting tags back to sending their requests.
+ * Called from the handler thread without the PLC mutex held.
+ */
+
+void drop_requests_in_flight(modbus_plc_p plc)
+{
+    modbus_tag_p tag = NULL;
+
+    if(plc->requests_in_flight == 0) {
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Dropping %d requests in flight.", plc->requests_in_flight);
+
+    plc->flags.request_ready = 0;
+    plc->requests_in_flight = 0;
+    plc->write_data_len = 0;
+    plc->write_data_offset = 0;
+
+    critical_block(plc->mutex) {
+        for(tag = plc->active_tags; tag; tag = tag->active_next) {
+            spin_block(&tag->tag_lock) {
+                if(tag->flags._busy) {
+                    tag->flags._busy = 0;
+                    tag->flags._merged = 0;
+                    tag->seq_id = 0;
+                    tag->resp_offset = 0;
+
+                    /* a write chunk counts as done when it is queued. */
+                    if(tag->flags._write && tag->request_num > 0) {
+                        tag->request_num--;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+
+/*
+ * fail_pending_tags
+ *
+ * Give every tag waiting on a read or write the passed error and drop
+ * any request still sitting in the PLC buffers.  The same locking dance
+ * as the tag pass in the handler is needed here.
+ */
+
+void fail_pending_tags(modbus_plc_p plc, int status)
+{
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(rc_inc(plc)) {
+        critical_block(plc->mutex) {
+            modbus_tag_p *tag_walker = NULL;
+            int fail_count = 0;
+
+            /* tags that were just queued are pending too. */
+            take_ready_tags(plc);
+
+            tag_walker = &(plc->active_tags);
+
+            while(*tag_walker) {
+                modbus_tag_p tag = rc_inc(*tag_walker);
+
+                if(tag) {
+                    int pending = 0;
+
+                    spin_block(&tag->tag_lock) {
+                        if(tag->flags._read || tag->flags._write) {
+                            pending = 1;
+
+                            tag->flags._read = 0;
+                            tag->flags._write = 0;
+                            tag->flags._busy = 0;
+                            tag->flags._merged = 0;
+                        }
+                    }
+
+                    if(pending) {
+                        tag->seq_id = 0;
+                        tag->resp_offset = 0;
+                        tag->status = (int8_t)status;
+                        fail_count++;
+                    }
+
+                    tag = rc_dec(tag);
+                }
+
+                tag_walker = &((*tag_walker)->active_next);
+            }
+
+            if(fail_count > 0) {
+                pdebug(DEBUG_DETAIL, "Failed %d pending tags with %s.", fail_count, plc_tag_decode_error(status));
+
+                /* nobody is waiting for these any more. */
+                plc->flags.request_ready = 0;
+                plc->requests_in_flight = 0;
+                plc->write_data_len = 0;
+                plc->write_data_offset = 0;
+            }
+        }
+
+        rc_dec(plc);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
+/* Read response.
+ *    Byte  Meaning
+ *      0    High byte of request sequence ID.
+ *      1    Low byte of request sequence ID.
+ *      2    High byte of the protocol version identifier (zero).
+ *      3    Low byte of the protocol version identifier (zero).
+ *      4    High byte of the message length.
+ *      5    Low byte of the message length.
+ *      6    Device address.
+ *      7    Function code.
+ *      8    First byte of the result.
+ *      ...  up to 253 bytes of payload.
  */
 
 
@@ -1116,31 +1938,51 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
     int rc = PLCTAG_STATUS_OK;
     uint16_t seq_id = (uint16_t)((uint16_t)plc->read_data[1] +(uint16_t)(plc->read_data[0] << 8));
     int partial_read = 0;
+    int merged = 0;
+    int retry_alone = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        spin_block(&tag->tag_lock) {
+            merged = tag->flags._merged;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got read response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
+
+            check_read_write_multiple_support(plc);
+
+            /* any of the tags sharing the request could be the cause. */
+            retry_alone = merged;
         } else {
             int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
             int register_offset = (tag->request_num * registers_per_request);
             int byte_offset = (register_offset * tag->elem_size) / 8;
             uint8_t payload_size = plc->read_data[8];
-            int copy_size = ((tag->size - byte_offset) < payload_size ? (tag->size - byte_offset) : payload_size);
+            int copy_size = ((tag->size - byte_offset) < (payload_size - tag->resp_offset) ? (tag->size - byte_offset) : (payload_size - tag->resp_offset));
 
             /* no error. So copy the data. */
             pdebug(DEBUG_INFO, "Got read response %u of length %d with payload of size %d.", (int)(unsigned int)seq_id, plc->read_data_len, payload_size);
             pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
             pdebug(DEBUG_DETAIL, "register_offset = %d", register_offset);
             pdebug(DEBUG_DETAIL, "byte_offset = %d", byte_offset);
+            pdebug(DEBUG_DETAIL, "resp_offset = %d", tag->resp_offset);
             pdebug(DEBUG_DETAIL, "copy_size = %d", copy_size);
 
-            mem_copy(tag->data + byte_offset, &plc->read_data[9], copy_size);
+            if(merged && copy_size < tag->size) {
+                pdebug(DEBUG_WARN, "Merged read response is too short for this tag!");
+                copy_size = 0;
+                retry_alone = 1;
+            }
+
+            if(copy_size > 0) {
+                mem_copy(tag->data + byte_offset, &plc->read_data[9 + tag->resp_offset], copy_size);
+            }
 
             /* are we done? */
             if(tag->size > (byte_offset + copy_size)) {
@@ -1156,19 +1998,41 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag)
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        /*
+         * either way, clean up the PLC buffer.  A merged response is
+         * cleared after the tag pass so the other tags can find it.
+         */
+        if(merged) {
+            plc->flags.response_shared = 1;
+        } else {
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+        }
 
         /* clean up tag*/
-        if(!partial_read) {
+        if(retry_alone) {
+            pdebug(DEBUG_DETAIL, "Merged read failed, reading the tag by itself.");
+
+            spin_block(&tag->tag_lock) {
+                tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._can_merge = 0;
+                tag->seq_id = 0;
+                tag->resp_offset = 0;
+            }
+
+            rc = PLCTAG_STATUS_OK;
+        } else if(!partial_read) {
             spin_block(&tag->tag_lock) {
                 tag->flags._read = 0;
                 tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._can_merge = (rc == PLCTAG_STATUS_OK);
                 tag->seq_id = 0;
                 tag->read_complete = 1;
                 tag->status = (int8_t)rc;
                 tag->request_num = 0;
+                tag->resp_offset = 0;
             }
         } else {
             /*
@@ -1201,6 +2065,7 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
     int base_register = tag->reg_base + (tag->request_num * registers_per_request);
     int register_count = tag->elem_count - (tag->request_num * registers_per_request);
+    int request_start = plc->write_data_len;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1214,6 +2079,15 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
+    /* pick up other tags reading registers near ours. */
+    if(tag_can_merge_read(tag)) {
+        spin_block(&tag->tag_lock) {
+            tag->seq_id = seq_id;
+        }
+
+        merge_read_requests(plc, tag, &base_register, &register_count);
+    }
+
     pdebug(DEBUG_INFO, "preparing read request for %d registers (of %d total) from base register %d.", register_count, tag->elem_count, base_register);
 
     /* build the read request.
@@ -1230,10 +2104,10 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
      *      9    Low byte of the first register address.
      *     10    High byte of the register count.
      *     11    Low byte of the register count.
+     *
+     * The request goes after any others still waiting to be written.
      */
 
-    plc->write_data_len = 0;
-
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 0) & 0xFF); plc->write_data_len++;
@@ -1247,28 +2121,29 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 6; plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
 
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_READ_COIL_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_COIL_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_DISCRETE_INPUT:
-            plc->write_data[7] = MB_CMD_READ_DISCRETE_INPUT_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_DISCRETE_INPUT_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_HOLDING_REGISTER_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_INPUT_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_INPUT_REGISTER_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_INPUT_REGISTER_MULTI; plc->write_data_len++;
             break;
 
         default:
             pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
+            plc->write_data_len = request_start;
             return PLCTAG_ERR_UNSUPPORTED;
             break;
     }
@@ -1289,7 +2164,7 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
 
     /* FIXME - could this ever be hoisted above the barrier above? */
     plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
+    plc->requests_in_flight++;
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1298,6 +2173,126 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag)
 
 
 
+/*
+ * A tag can share a read request with other tags if it reads registers in
+ * one request and has read correctly on its own before.  After a failed
+ * merged read, a tag goes back to reading alone until it succeeds so that
+ * one bad address does not keep failing its neighbours.
+ */
+
+int tag_can_merge_read(modbus_tag_p tag)
+{
+    int res = 0;
+
+    if(!tag->allow_packing) {
+        return 0;
+    }
+
+    if(tag->reg_type != MB_REG_HOLDING_REGISTER && tag->reg_type != MB_REG_INPUT_REGISTER) {
+        return 0;
+    }
+
+    if(tag->elem_count > MAX_MODBUS_READ_REGISTERS) {
+        return 0;
+    }
+
+    spin_block(&tag->tag_lock) {
+        res = (tag->flags._can_merge && tag->flags._read && !tag->flags._busy && !tag->flags._write && !tag->flags._abort && tag->request_num == 0);
+    }
+
+    return res;
+}
+
+
+
+/*
+ * merge_read_requests
+ *
+ * Grow the register range of the passed tag's read to cover other pending
+ * reads of the same register type that are adjacent, overlap or are within
+ * max_read_gap registers, while the whole range fits in one response.  The
+ * tags that are taken in share the request's sequence ID and are marked busy.
+ * Each one copies its own part out of the response.
+ *
+ * This is called with the PLC mutex held so the tag list cannot change.
+ */
+
+int merge_read_requests(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count)
+{
+    int first = *base_register;
+    int end = *base_register + *register_count;
+    int merged_count = 1;
+    int found = 0;
+    modbus_tag_p other = NULL;
+
+    do {
+        found = 0;
+
+        for(other = plc->active_tags; other; other = other->active_next) {
+            int other_first = 0;
+            int other_end = 0;
+            int new_first = 0;
+            int new_end = 0;
+
+            if(other == tag || other->reg_type != tag->reg_type || other->server_id != tag->server_id) {
+                continue;
+            }
+
+            /* the tag might be in the destructor. */
+            if(!rc_inc(other)) {
+                continue;
+            }
+
+            other_first = other->reg_base;
+            other_end = other->reg_base + other->elem_count;
+            new_first = (other_first < first ? other_first : first);
+            new_end = (other_end > end ? other_end : end);
+
+            if(other_first <= end + plc->max_read_gap
+               && other_end + plc->max_read_gap >= first
+               && (new_end - new_first) <= MAX_MODBUS_READ_REGISTERS
+               && tag_can_merge_read(other)) {
+                pdebug(DEBUG_DETAIL, "Merging read of tag %d into request %u.", other->tag_id, (unsigned int)tag->seq_id);
+
+                spin_block(&other->tag_lock) {
+                    other->flags._busy = 1;
+                    other->flags._merged = 1;
+                    other->seq_id = tag->seq_id;
+                }
+
+                first = new_first;
+                end = new_end;
+                merged_count++;
+                found = 1;
+            }
+
+            rc_dec(other);
+        }
+    } while(found);
+
+    if(merged_count > 1) {
+        pdebug(DEBUG_INFO, "Merged %d tag reads into one request for %d registers from base register %d.", merged_count, end - first, first);
+
+        spin_block(&tag->tag_lock) {
+            tag->flags._merged = 1;
+        }
+
+        /* tell each tag where its data is in the response. */
+        for(other = plc->active_tags; other; other = other->active_next) {
+            if(other->seq_id == tag->seq_id && other->reg_type == tag->reg_type && other->server_id == tag->server_id && tag_get_read_flag(other)) {
+                other->resp_offset = ((other->reg_base - first) * other->elem_size) / 8;
+            }
+        }
+
+        *base_register = first;
+        *register_count = end - first;
+    }
+
+    return merged_count;
+}
+
+
+
 
 /* Write response.
  *    Byte  Meaning
@@ -1320,16 +2315,27 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
     int rc = PLCTAG_STATUS_OK;
     uint16_t seq_id = (uint16_t)((uint16_t)plc->read_data[1] + (uint16_t)(plc->read_data[0] << 8));
     int partial_write = 0;
+    int merged = 0;
+    int retry_alone = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
     if(seq_id == tag->seq_id) {
         uint8_t has_error = plc->read_data[7] & (uint8_t)0x80;
 
+        spin_block(&tag->tag_lock) {
+            merged = tag->flags._merged;
+        }
+
         if(has_error) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got write response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id, plc_tag_decode_error(rc), plc->read_data_len);
+
+            check_read_write_multiple_support(plc);
+
+            /* any of the tags sharing the request could be the cause. */
+            retry_alone = merged;
         } else {
             int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
             int register_offset = (tag->request_num * registers_per_request);
@@ -1354,15 +2360,36 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag)
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        /*
+         * either way, clean up the PLC buffer.  A merged response is
+         * cleared after the tag pass so the other tags can find it.
+         */
+        if(merged) {
+            plc->flags.response_shared = 1;
+        } else {
+            plc->read_data_len = 0;
+            plc->flags.response_ready = 0;
+        }
 
         /* clean up tag*/
-        if(!partial_write) {
+        if(retry_alone) {
+            pdebug(DEBUG_DETAIL, "Merged write failed, writing the tag by itself.");
+
+            spin_block(&tag->tag_lock) {
+                tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._can_merge = 0;
+                tag->seq_id = 0;
+                tag->request_num = 0;
+            }
+
+            rc = PLCTAG_STATUS_OK;
+        } else if(!partial_write) {
             spin_block(&tag->tag_lock) {
                 tag->flags._write = 0;
                 tag->flags._busy = 0;
+                tag->flags._merged = 0;
+                tag->flags._can_merge = (rc == PLCTAG_STATUS_OK);
                 tag->seq_id = 0;
                 tag->request_num = 0;
                 tag->write_complete = 1;
@@ -1419,6 +2446,12 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     int register_offset = (tag->request_num * registers_per_request);
     int byte_offset = (register_offset * tag->elem_size) / 8;
     int request_payload_size = 0;
+    int request_start = plc->write_data_len;
+    int merged_count = 1;
+    int can_merge = tag_can_merge_write(tag);
+    int paired = 0;
+    int read_base = 0;
+    int read_count = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1434,14 +2467,32 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
         register_count = registers_per_request;
     }
 
+    /* pick up other tags writing the registers or coils right next to ours. */
+    if(can_merge) {
+        spin_block(&tag->tag_lock) {
+            tag->seq_id = seq_id;
+        }
+
+        merged_count = merge_write_requests(plc, tag, &base_register, &register_count);
+    }
+
+    /* a pending read of holding registers can go in the same FC23 request. */
+    if(can_merge && plc->use_read_write_multiple && tag->reg_type == MB_REG_HOLDING_REGISTER && register_count <= MAX_MODBUS_READ_WRITE_REGISTERS) {
+        paired = pair_read_request(plc, tag, seq_id, &read_base, &read_count);
+
+        if(paired) {
+            spin_block(&tag->tag_lock) {
+                tag->flags._merged = 1;
+            }
+        }
+    }
+
     /* how many bytes, rounded up to the nearest byte. */
     request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
 
     pdebug(DEBUG_INFO, "preparing write request for %d registers (of %d total) from base register %d of payload size %d in bytes.", register_count, tag->elem_count, base_register, request_payload_size);
 
-    /* FIXME - remove this when we figure out how to push multiple requests. */
-    plc->write_data_len = 0;
-
+    /* the request goes after any others still waiting to be written. */
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF); plc->write_data_len++;
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 0) & 0xFF); plc->write_data_len++;
@@ -1450,35 +2501,48 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
     plc->write_data[plc->write_data_len] = 0; plc->write_data_len++;
 
-    /* request packet length */
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 8) & 0xFF); plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + 7) >> 0) & 0xFF); plc->write_data_len++;
+    /* request packet length, FC23 has four more bytes for the read range. */
+    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + (paired ? 11 : 7)) >> 8) & 0xFF); plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = (uint8_t)(((request_payload_size + (paired ? 11 : 7)) >> 0) & 0xFF); plc->write_data_len++;
 
     /* device address */
-    plc->write_data[plc->write_data_len] = plc->server_id; plc->write_data_len++;
+    plc->write_data[plc->write_data_len] = tag->server_id; plc->write_data_len++;
 
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_WRITE_COIL_MULTI; plc->write_data_len++;
+            plc->write_data[plc->write_data_len] = MB_CMD_WRITE_COIL_MULTI; plc->write_data_len++;
             break;
 
         case MB_REG_DISCRETE_INPUT:
             pdebug(DEBUG_WARN, "You cannot write a discrete input!");
+            plc->write_data_len = request_start;
             return PLCTAG_ERR_UNSUPPORTED;
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+            if(paired) {
+                plc->write_data[plc->write_data_len] = MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+
+                /* the read range comes first. */
+                plc->write_data[plc->write_data_len] = (uint8_t)((read_base >> 8) & 0xFF); plc->write_data_len++;
+                plc->write_data[plc->write_data_len] = (uint8_t)((read_base >> 0) & 0xFF); plc->write_data_len++;
+                plc->write_data[plc->write_data_len] = (uint8_t)((read_count >> 8) & 0xFF); plc->write_data_len++;
+                plc->write_data[plc->write_data_len] = (uint8_t)((read_count >> 0) & 0xFF); plc->write_data_len++;
+            } else {
+                plc->write_data[plc->write_data_len] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI; plc->write_data_len++;
+            }
             break;
 
         case MB_REG_INPUT_REGISTER:
             pdebug(DEBUG_WARN, "You cannot write an analog input!");
+            plc->write_data_len = request_start;
             return PLCTAG_ERR_UNSUPPORTED;
             break;
 
         default:
             pdebug(DEBUG_WARN, "Unsupported register type %d!", tag->reg_type);
+            plc->write_data_len = request_start;
             return PLCTAG_ERR_UNSUPPORTED;
             break;
     }
@@ -1495,7 +2559,21 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(request_payload_size); plc->write_data_len++;
 
     /* copy the tag data. */
-    mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    if(merged_count > 1) {
+        modbus_tag_p other = NULL;
+
+        /* each tag fills in its own part. */
+        mem_set(&plc->write_data[plc->write_data_len], 0, request_payload_size);
+
+        for(other = plc->active_tags; other; other = other->active_next) {
+            if(other->seq_id == seq_id && other->reg_type == tag->reg_type && other->server_id == tag->server_id && tag_get_write_flag(other)) {
+                copy_write_data(other, &plc->write_data[plc->write_data_len], base_register);
+            }
+        }
+    } else {
+        mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    }
+
     plc->write_data_len += request_payload_size;
 
     /* ready to go. */
@@ -1506,7 +2584,7 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
     }
 
     plc->flags.request_ready = 1;
-    plc->flags.request_in_flight = 1;
+    plc->requests_in_flight++;
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1515,6 +2593,249 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag)
 
 
 
+/*
+ * A tag can share a write request with other tags if it writes holding
+ * registers or coils in one request.  Like reads, a tag that failed in a
+ * merged write goes back to writing alone until it succeeds.
+ */
+
+int tag_can_merge_write(modbus_tag_p tag)
+{
+    int res = 0;
+
+    if(!tag->allow_packing) {
+        return 0;
+    }
+
+    if(tag->reg_type != MB_REG_HOLDING_REGISTER && tag->reg_type != MB_REG_COIL) {
+        return 0;
+    }
+
+    if(tag->elem_count > (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size) {
+        return 0;
+    }
+
+    spin_block(&tag->tag_lock) {
+        res = (tag->flags._can_merge && tag->flags._write && !tag->flags._busy && !tag->flags._abort && tag->request_num == 0);
+    }
+
+    return res;
+}
+
+
+
+/*
+ * A write must not be sent ahead of an older write to any of the same
+ * registers that has not been sent yet.  Writes already on the wire went
+ * out first and stay first.  The tags already merged into the new request
+ * have its sequence ID and do not count.
+ */
+
+int write_is_blocked(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int first, int end)
+{
+    modbus_tag_p other = NULL;
+
+    for(other = plc->active_tags; other; other = other->active_next) {
+        int pending = 0;
+
+        if(other == tag || other->seq_id == seq_id || other->reg_type != tag->reg_type || other->server_id != tag->server_id) {
+            continue;
+        }
+
+        spin_block(&other->tag_lock) {
+            pending = (other->flags._write && !other->flags._busy);
+        }
+
+        if(pending && other->reg_base < end && other->reg_base + other->elem_count > first) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+
+/*
+ * merge_write_requests
+ *
+ * Grow the range of the passed tag's write to take in other pending writes
+ * of the same register type and server that start right after it or end
+ * right before it, as long as the whole range fits in one FC15 or FC16
+ * request.  Only exactly adjacent writes are merged, there is no data to
+ * fill a gap with.  The tags taken in share the request's sequence ID and
+ * are marked busy.  Each gets the status of the shared response.
+ *
+ * This is called with the PLC mutex held so the active list cannot change.
+ */
+
+int merge_write_requests(modbus_plc_p plc, modbus_tag_p tag, int *base_register, int *register_count)
+{
+    int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
+    int first = *base_register;
+    int end = *base_register + *register_count;
+    int merged_count = 1;
+    int found = 0;
+    modbus_tag_p other = NULL;
+
+    do {
+        found = 0;
+
+        for(other = plc->active_tags; other; other = other->active_next) {
+            int other_first = 0;
+            int other_end = 0;
+
+            if(other == tag || other->reg_type != tag->reg_type || other->server_id != tag->server_id) {
+                continue;
+            }
+
+            /* the tag might be in the destructor. */
+            if(!rc_inc(other)) {
+                continue;
+            }
+
+            other_first = other->reg_base;
+            other_end = other->reg_base + other->elem_count;
+
+            if((other_first == end || other_end == first)
+               && ((other_end > end ? other_end : end) - (other_first < first ? other_first : first)) <= registers_per_request
+               && tag_can_merge_write(other)
+               && !write_is_blocked(plc, other, tag->seq_id, other_first, other_end)) {
+                pdebug(DEBUG_DETAIL, "Merging write of tag %d into request %u.", other->tag_id, (unsigned int)tag->seq_id);
+
+                spin_block(&other->tag_lock) {
+                    other->flags._busy = 1;
+                    other->flags._merged = 1;
+                    other->seq_id = tag->seq_id;
+                    other->request_num++;
+                }
+
+                first = (other_first < first ? other_first : first);
+                end = (other_end > end ? other_end : end);
+                merged_count++;
+                found = 1;
+            }
+
+            rc_dec(other);
+        }
+    } while(found);
+
+    if(merged_count > 1) {
+        pdebug(DEBUG_INFO, "Merged %d tag writes into one request for %d registers from base register %d.", merged_count, end - first, first);
+
+        spin_block(&tag->tag_lock) {
+            tag->flags._merged = 1;
+        }
+
+        *base_register = first;
+        *register_count = end - first;
+    }
+
+    return merged_count;
+}
+
+
+
+/* put a tag's data in its place in a merged write request. */
+
+void copy_write_data(modbus_tag_p tag, uint8_t *payload, int first)
+{
+    int offset = tag->reg_base - first;
+    int i;
+
+    if(tag->elem_size == 16) {
+        mem_copy(payload + (offset * 2), tag->data, tag->size);
+        return;
+    }
+
+    /* coils are packed as bits so they might not be byte aligned. */
+    for(i = 0; i < tag->elem_count; i++) {
+        int bit = offset + i;
+
+        if(tag->data[i / 8] & (1 << (i % 8))) {
+            payload[bit / 8] = (uint8_t)(payload[bit / 8] | (1 << (bit % 8)));
+        }
+    }
+}
+
+
+
+/*
+ * pair_read_request
+ *
+ * Find the oldest pending read of holding registers on the same server as
+ * the passed write tag and make it part of the write's request, along with
+ * any reads merged into it.  FC23 does the write first and then the read,
+ * so a status read started after a command write sees the result.  The read
+ * tags share the request's sequence ID and take their data from the response
+ * the same way as for a merged FC03 read.
+ *
+ * This is called with the PLC mutex held so the active list cannot change.
+ */
+
+int pair_read_request(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *read_base, int *read_count)
+{
+    modbus_tag_p read_tag = NULL;
+    modbus_tag_p other = NULL;
+
+    for(other = plc->active_tags; other && !read_tag; other = other->active_next) {
+        if(other == tag || other->reg_type != MB_REG_HOLDING_REGISTER || other->server_id != tag->server_id) {
+            continue;
+        }
+
+        /* the tag might be in the destructor. */
+        if(!rc_inc(other)) {
+            continue;
+        }
+
+        if(tag_can_merge_read(other)) {
+            read_tag = other;
+        }
+
+        rc_dec(other);
+    }
+
+    if(!read_tag) {
+        return 0;
+    }
+
+    pdebug(DEBUG_DETAIL, "Pairing read of tag %d with write of tag %d in request %u.", read_tag->tag_id, tag->tag_id, (unsigned int)seq_id);
+
+    *read_base = read_tag->reg_base;
+    *read_count = read_tag->elem_count;
+
+    spin_block(&read_tag->tag_lock) {
+        read_tag->seq_id = seq_id;
+    }
+
+    merge_read_requests(plc, read_tag, read_base, read_count);
+
+    /* the response is shared with the write even if no other reads were merged. */
+    spin_block(&read_tag->tag_lock) {
+        read_tag->flags._busy = 1;
+        read_tag->flags._merged = 1;
+    }
+
+    return 1;
+}
+
+
+
+/*
+ * Stop using FC23 if the device says it does not know it.  The tags that
+ * shared the request go back to sending their own requests.
+ */
+
+void check_read_write_multiple_support(modbus_plc_p plc)
+{
+    if(plc->read_data[7] == (MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI | 0x80) && plc->read_data[8] == 0x01 && plc->use_read_write_multiple) {
+        pdebug(DEBUG_WARN, "The device does not support FC23, turning it off.");
+        plc->use_read_write_multiple = 0;
+    }
+}
+
+
+
 int translate_modbus_error(uint8_t err_code)
 {
     int rc = PLCTAG_STATUS_OK;
@@ -1560,6 +2881,16 @@ int translate_modbus_error(uint8_t err_code)
             rc = PLCTAG_ERR_REMOTE_ERR;
             break;
 
+        case 0x0A:
+            pdebug(DEBUG_WARN, "The gateway could not find a path to the target device!");
+            rc = PLCTAG_ERR_BAD_GATEWAY;
+            break;
+
+        case 0x0B:
+            pdebug(DEBUG_WARN, "The target device failed to respond!");
+            rc = PLCTAG_ERR_TIMEOUT;
+            break;
+
         default:
             pdebug(DEBUG_WARN, "Unknown error response %u received!", (int)(unsigned int)(err_code));
             rc = PLCTAG_ERR_UNSUPPORTED;
@@ -1630,18 +2961,6 @@ int tag_get_abort_flag(modbus_tag_p tag)
     return res;
 }
 
-int tag_set_abort_flag(modbus_tag_p tag, int new_val)
-{
-    int old_val = 0;
-
-    spin_block(&tag->tag_lock) {
-        old_val = tag->flags._abort;
-        tag->flags._abort = ((new_val) ? 1 : 0);
-    }
-
-    return old_val;
-}
-
 
 int tag_get_read_flag(modbus_tag_p tag)
 {
@@ -1725,13 +3044,28 @@ int tag_get_busy_flag(modbus_tag_p tag)
 int mb_abort(plc_tag_p p_tag)
 {
     modbus_tag_p tag = (modbus_tag_p)p_tag;
+    int pending = 0;
 
     if(!tag) {
         pdebug(DEBUG_WARN, "Null tag pointer!");
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    tag_set_abort_flag(tag, 1);
+    /*
+     * the tag layer aborts after any failed operation.  If the operation
+     * already finished there is nothing to abort and setting the flag would
+     * make the next operation busy until the PLC thread cleared it.
+     */
+    spin_block(&tag->tag_lock) {
+        if(tag->flags._read || tag->flags._write) {
+            tag->flags._abort = 1;
+            pending = 1;
+        }
+    }
+
+    if(pending) {
+        queue_tag(tag);
+    }
 
     return PLCTAG_STATUS_OK;
 }
@@ -1765,6 +3099,7 @@ int mb_read_start(plc_tag_p p_tag)
 
     tag->status = PLCTAG_STATUS_OK;
     tag_set_read_flag(tag, 1);
+    queue_tag(tag);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1846,6 +3181,7 @@ int mb_write_start(plc_tag_p p_tag)
 
     tag_set_write_flag(tag, 1);
     tag->status = PLCTAG_STATUS_OK;
+    queue_tag(tag);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -61,8 +61,10 @@ struct tag_vtable_t system_tag_vtable = {
     /* data accessors */
 
     /* get_int_attrib */ NULL,
-    /* set_int_attrib */ NULL
+    /* set_int_attrib */ NULL,
 
+    /* set_range */ NULL,
+    /* set_write_mask */ NULL
 };
 
 
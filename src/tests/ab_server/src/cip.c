@@ -34,7 +34,9 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cip.h"
+#include "cip_io.h"
 #include "eip.h"
 #include "pccc.h"
 #include "plc.h"
@@ -46,7 +48,7 @@
 const uint8_t CIP_MULTI[] = { 0x0A, 0x02, 0x20, 0x02, 0x24, 0x01 };
 const uint8_t CIP_READ[] = { 0x4C };
 const uint8_t CIP_WRITE[] = { 0x4D };
-const uint8_t CIP_RMW[] = { 0x4E, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_RMW[] = { 0x4E };
 const uint8_t CIP_READ_FRAG[] = { 0x52 };
 const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 
@@ -56,8 +58,9 @@ const uint8_t CIP_WRITE_FRAG[] = { 0x53 };
 const uint8_t CIP_PCCC_EXECUTE[] = { 0x4B, 0x02, 0x20, 0x67, 0x24, 0x01, 0x07, 0x3d, 0xf3, 0x45, 0x43, 0x50, 0x21 };
 const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_FORWARD_OPEN[] = { 0x54, 0x02, 0x20, 0x06, 0x24, 0x01 };
-const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
+const uint8_t CIP_LIST_TAGS[] = { 0x55 };
 const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
+const uint8_t CIP_UNCONNECTED_SEND[] = { 0x52, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
 /* path to match. */
 // uint8_t LOGIX_CONN_PATH[] = { 0x03, 0x00, 0x00, 0x20, 0x02, 0x24, 0x01 };
@@ -73,10 +76,30 @@ const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 #define CIP_ERR_0x01            ((uint8_t)0x01)
 #define CIP_ERR_FRAG            ((uint8_t)0x06)
 #define CIP_ERR_UNSUPPORTED     ((uint8_t)0x08)
+#define CIP_ERR_EMBEDDED        ((uint8_t)0x1E)
 #define CIP_ERR_EXTENDED        ((uint8_t)0xff)
 
 #define CIP_ERR_EX_TOO_LONG     ((uint16_t)0x2105)
 
+/* a handy structure to hold all the parameters we need to receive in a Forward Open request. */
+typedef struct {
+    uint8_t secs_per_tick;                  /* seconds per tick */
+    uint8_t timeout_ticks;                  /* timeout = srd_secs_per_tick * src_timeout_ticks */
+    uint32_t server_conn_id;                /* 0, returned by server in reply. */
+    uint32_t client_conn_id;                /* sent by client. */
+    uint16_t conn_serial_number;            /* client connection ID/serial number */
+    uint16_t orig_vendor_id;                /* client unique vendor ID */
+    uint32_t orig_serial_number;            /* client unique serial number */
+    uint8_t conn_timeout_multiplier;        /* timeout = mult * RPI */
+    uint8_t reserved[3];                    /* reserved, set to 0 */
+    uint32_t client_to_server_rpi;          /* us to target RPI - Request Packet Interval in microseconds */
+    uint32_t client_to_server_conn_params;  /* some sort of identifier of what kind of PLC we are??? */
+    uint32_t server_to_client_rpi;          /* target to us RPI, in microseconds */
+    uint32_t server_to_client_conn_params;       /* some sort of identifier of what kind of PLC the target is ??? */
+    uint8_t transport_class;                /* ALWAYS 0xA3, server transport, class 3, application trigger */
+    slice_s path;                           /* connection path. */
+} forward_open_s;
+
 typedef struct {
     uint8_t service_code;   /* why is the operation code _before_ the path? */
     uint8_t path_size;      /* size in 16-bit words of the path */
@@ -84,9 +107,14 @@ typedef struct {
 } cip_header_s;
 
 static slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_io_forward_open(slice_s input, slice_s output, plc_s *plc, forward_open_s *fo_req, size_t offset);
 static slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc);
 static slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_rmw_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_list_tags_request(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_unconnected_send(slice_s input, slice_s output, plc_s *plc);
+static slice_s handle_multi_request(slice_s input, slice_s output, plc_s *plc);
 
 static bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *start_read_offset);
 static slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error);
@@ -97,8 +125,12 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
     info("Got packet:");
     slice_dump(input);
 
-    /* match the prefix and dispatch. */
-    if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
+    /* match the prefix and dispatch.  Unconnected Send must be checked before fragmented read. */
+    if(slice_match_bytes(input, CIP_UNCONNECTED_SEND, sizeof(CIP_UNCONNECTED_SEND))) {
+        return handle_unconnected_send(input, output, plc);
+    } else if(plc->plc_type == PLC_CONTROL_LOGIX && slice_match_bytes(input, CIP_MULTI, sizeof(CIP_MULTI))) {
+        return handle_multi_request(input, output, plc);
+    } else if(slice_match_bytes(input, CIP_READ, sizeof(CIP_READ))) {
         return handle_read_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_READ_FRAG, sizeof(CIP_READ_FRAG))) {
         return handle_read_request(input, output, plc);
@@ -112,32 +144,125 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc)
         return handle_forward_open(input, output, plc);
     } else if(slice_match_bytes(input, CIP_FORWARD_CLOSE, sizeof(CIP_FORWARD_CLOSE))) {
         return handle_forward_close(input, output, plc);
+    } else if(plc->plc_type == PLC_CONTROL_LOGIX && slice_match_bytes(input, CIP_RMW, sizeof(CIP_RMW))) {
+        /* must come after Forward Close, which uses the same service code. */
+        return handle_rmw_request(input, output, plc);
     } else if(slice_match_bytes(input, CIP_PCCC_EXECUTE, sizeof(CIP_PCCC_EXECUTE))) {
         return dispatch_pccc_request(input, output, plc);
+    } else if(plc->plc_type == PLC_CONTROL_LOGIX && slice_match_bytes(input, CIP_LIST_TAGS, sizeof(CIP_LIST_TAGS))) {
+        return handle_list_tags_request(input, output, plc);
     } else {
             return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | (uint8_t)CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
     }
 }
 
 
-/* a handy structure to hold all the parameters we need to receive in a Forward Open request. */
-typedef struct {
-    uint8_t secs_per_tick;                  /* seconds per tick */
-    uint8_t timeout_ticks;                  /* timeout = srd_secs_per_tick * src_timeout_ticks */
-    uint32_t server_conn_id;                /* 0, returned by server in reply. */
-    uint32_t client_conn_id;                /* sent by client. */
-    uint16_t conn_serial_number;            /* client connection ID/serial number */
-    uint16_t orig_vendor_id;                /* client unique vendor ID */
-    uint32_t orig_serial_number;            /* client unique serial number */
-    uint8_t conn_timeout_multiplier;        /* timeout = mult * RPI */
-    uint8_t reserved[3];                    /* reserved, set to 0 */
-    uint32_t client_to_server_rpi;          /* us to target RPI - Request Packet Interval in microseconds */
-    uint32_t client_to_server_conn_params;  /* some sort of identifier of what kind of PLC we are??? */
-    uint32_t server_to_client_rpi;          /* target to us RPI, in microseconds */
-    uint32_t server_to_client_conn_params;       /* some sort of identifier of what kind of PLC the target is ??? */
-    uint8_t transport_class;                /* ALWAYS 0xA3, server transport, class 3, application trigger */
-    slice_s path;                           /* connection path. */
-} forward_open_s;
+/*
+ * Unconnected Send to the Connection Manager.  The embedded request is
+ * handled as if it arrived directly and its reply is the reply.  The
+ * route after it is not checked.
+ *
+ *  0x52 0x02 0x20 0x06 0x24 0x01 <secs per tick> <timeout ticks> <embedded length 16-bit> <embedded request> ...
+ */
+
+slice_s handle_unconnected_send(slice_s input, slice_s output, plc_s *plc)
+{
+    size_t offset = sizeof(CIP_UNCONNECTED_SEND) + 2;
+    uint16_t embedded_len = slice_get_uint16_le(input, offset);
+
+    offset += 2;
+
+    if(offset + embedded_len > slice_len(input)) {
+        info("Embedded request is longer than the Unconnected Send!");
+        return make_cip_error(output, (uint8_t)(CIP_UNCONNECTED_SEND[0] | CIP_DONE), CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    return cip_dispatch_request(slice_from_slice(input, offset, embedded_len), output, plc);
+}
+
+
+
+/*
+ * Multiple Service Packet.  Each embedded request is dispatched in turn
+ * and the replies are packed with offsets the same way.  The reply is
+ * built in the same buffer as the request, so work from a copy.
+ *
+ *  0x0A 0x02 0x20 0x02 0x24 0x01 <count 16-bit> <offsets 16-bit>... <requests>...
+ */
+
+slice_s handle_multi_request(slice_s request, slice_s output, plc_s *plc)
+{
+    size_t base = sizeof(CIP_MULTI);
+    uint16_t count = slice_get_uint16_le(request, base);
+    size_t out_offset = 0;
+    bool any_error = false;
+    uint8_t *request_copy = NULL;
+    slice_s input;
+    slice_s result;
+
+    if(count == 0 || base + 2 + ((size_t)count * 2) > slice_len(request)) {
+        info("Bad request count %u in Multiple Service Packet!", (unsigned int)count);
+        return make_cip_error(output, (uint8_t)(CIP_MULTI[0] | CIP_DONE), CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    request_copy = malloc(slice_len(request));
+    if(!request_copy) {
+        info("Unable to allocate memory for request copy!");
+        return make_cip_error(output, (uint8_t)(CIP_MULTI[0] | CIP_DONE), CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    memcpy(request_copy, request.data, slice_len(request));
+    input = slice_make(request_copy, (ssize_t)slice_len(request));
+
+    slice_set_uint8(output, 0, (uint8_t)(CIP_MULTI[0] | CIP_DONE));
+    slice_set_uint8(output, 1, 0);
+    slice_set_uint8(output, 2, CIP_OK);
+    slice_set_uint8(output, 3, 0);
+    slice_set_uint16_le(output, 4, count);
+
+    /* offsets in the reply are from the count, like the request. */
+    out_offset = 4 + 2 + ((size_t)count * 2);
+
+    for(uint16_t i=0; i < count; i++) {
+        size_t start = base + slice_get_uint16_le(input, base + 2 + ((size_t)i * 2));
+        size_t end = (i + 1 < count) ? base + slice_get_uint16_le(input, base + 2 + ((size_t)(i + 1) * 2)) : slice_len(input);
+
+        if(start >= end || end > slice_len(input)) {
+            info("Bad offset for request %u in Multiple Service Packet!", (unsigned int)i);
+            free(request_copy);
+            return make_cip_error(output, (uint8_t)(CIP_MULTI[0] | CIP_DONE), CIP_ERR_UNSUPPORTED, false, 0);
+        }
+
+        slice_set_uint16_le(output, 6 + ((size_t)i * 2), (uint16_t)(out_offset - 4));
+
+        result = cip_dispatch_request(slice_from_slice(input, start, end - start),
+                                      slice_from_slice(output, out_offset, slice_len(output) - out_offset),
+                                      plc);
+
+        if(slice_has_err(result)) {
+            free(request_copy);
+            return result;
+        }
+
+        /* a partial read is not an error. */
+        if(slice_get_uint8(result, 2) != CIP_OK && slice_get_uint8(result, 2) != CIP_ERR_FRAG) {
+            any_error = true;
+        }
+
+        out_offset += slice_len(result);
+    }
+
+    free(request_copy);
+
+    if(any_error) {
+        slice_set_uint8(output, 2, CIP_ERR_EMBEDDED);
+    }
+
+    return slice_from_slice(output, 0, out_offset);
+}
+
+
+
 
 /* the minimal Forward Open with no path */
 #define CIP_FORWARD_OPEN_MIN_SIZE   (48)
@@ -194,6 +319,11 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
         return make_cip_error(output, (uint8_t)(slice_get_uint8(input, 0) | CIP_DONE), (uint8_t)CIP_ERR_UNSUPPORTED, false, (uint16_t)0);
     }
 
+    /* class 1 connections produce a tag over UDP. */
+    if((fo_req.transport_class & 0x0F) == 1) {
+        return handle_io_forward_open(input, output, plc, &fo_req, offset);
+    }
+
     /* build the path to match. */
     conn_path = slice_from_slice(input, offset, slice_len(input));
 
@@ -258,6 +388,84 @@ slice_s handle_forward_open(slice_s input, slice_s output, plc_s *plc)
 }
 
 
+/*
+ * A class 1 Forward Open has the port and slot of the PLC then the
+ * symbolic segment of the tag to produce as the connection path.  The
+ * data size includes the 16-bit sequence count.
+ */
+
+slice_s handle_io_forward_open(slice_s input, slice_s output, plc_s *plc, forward_open_s *fo_req, size_t offset)
+{
+    uint8_t fo_cmd = slice_get_uint8(input, 0);
+    uint32_t size_mask = ((fo_cmd == CIP_FORWARD_OPEN[0]) ? 0x1FF : 0x0FFF);
+    size_t path_len = (size_t)slice_get_uint8(input, offset) * 2;
+    slice_s path = slice_from_slice(input, offset + ((offset & 0x01) ? 1 : 2), path_len);
+    tag_def_s *tag = NULL;
+    size_t start_offset = 0;
+    io_conn_s *conn = NULL;
+
+    if(plc->plc_type != PLC_CONTROL_LOGIX || slice_len(path) != path_len || path_len < 4 || !slice_match_bytes(path, plc->path, 2)) {
+        info("Class 1 connection path does not match this PLC!");
+        return make_cip_error(output, fo_cmd, CIP_ERR_0x01, true, (uint16_t)0x0315);
+    }
+
+    if(!process_tag_segment(plc, slice_from_slice(path, 2, path_len - 2), &tag, &start_offset) || !tag || start_offset != 0) {
+        info("Class 1 connection must be to a whole tag!");
+        return make_cip_error(output, fo_cmd, CIP_ERR_0x01, true, (uint16_t)0x0315);
+    }
+
+    if((fo_req->server_to_client_conn_params & size_mask) != (uint32_t)(tag->elem_size * tag->elem_count) + 2) {
+        info("Class 1 connection size %u does not match tag %s size %zu plus 2!", (unsigned int)(fo_req->server_to_client_conn_params & size_mask), tag->name, tag->elem_size * tag->elem_count);
+        return make_cip_error(output, fo_cmd, CIP_ERR_0x01, true, (uint16_t)0x0109);
+    }
+
+    if(fo_req->server_to_client_rpi < 1000 || fo_req->client_to_server_rpi < 1000) {
+        info("RPI must be at least one millisecond!");
+        return make_cip_error(output, fo_cmd, CIP_ERR_0x01, true, (uint16_t)0x0111);
+    }
+
+    conn = cip_io_add(plc);
+    if(!conn) {
+        return make_cip_error(output, fo_cmd, CIP_ERR_0x01, true, (uint16_t)0x0113);
+    }
+
+    conn->tag = tag;
+    conn->server_conn_id = (uint32_t)rand();
+    conn->client_conn_id = fo_req->client_conn_id;
+    conn->conn_serial_number = fo_req->conn_serial_number;
+    conn->orig_vendor_id = fo_req->orig_vendor_id;
+    conn->orig_serial_number = fo_req->orig_serial_number;
+    conn->rpi_ms = fo_req->server_to_client_rpi / 1000;
+    conn->timeout_ms = (fo_req->client_to_server_rpi / 1000) * ((uint32_t)4 << (fo_req->conn_timeout_multiplier & 0x07));
+
+    /* without a socket address item, the heartbeats tell us where to send. */
+    conn->client_ip = plc->t2o_ip;
+    conn->client_port = plc->t2o_port;
+
+    info("Producing tag %s every %ums on connection %x.", tag->name, conn->rpi_ms, conn->client_conn_id);
+
+    offset = 0;
+    slice_set_uint8(output, offset, (uint8_t)(fo_cmd | CIP_DONE)); offset++;
+    slice_set_uint8(output, offset, 0); offset++; /* padding/reserved. */
+    slice_set_uint8(output, offset, 0); offset++; /* no error. */
+    slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
+
+    slice_set_uint32_le(output, offset, conn->server_conn_id); offset += 4;
+    slice_set_uint32_le(output, offset, conn->client_conn_id); offset += 4;
+    slice_set_uint16_le(output, offset, conn->conn_serial_number); offset += 2;
+    slice_set_uint16_le(output, offset, conn->orig_vendor_id); offset += 2;
+    slice_set_uint32_le(output, offset, conn->orig_serial_number); offset += 4;
+    slice_set_uint32_le(output, offset, fo_req->client_to_server_rpi); offset += 4;
+    slice_set_uint32_le(output, offset, fo_req->server_to_client_rpi); offset += 4;
+
+    /* no application reply. */
+    slice_set_uint8(output, offset, 0); offset++;
+    slice_set_uint8(output, offset, 0); offset++;
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
 /* Forward Close request. */
 typedef struct {
     uint8_t secs_per_tick;          /* seconds per tick */
@@ -302,6 +510,25 @@ slice_s handle_forward_close(slice_s input, slice_s output, plc_s *plc)
         return make_cip_error(output, slice_get_uint8(input, 0) | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
     }
 
+    /* class 1 connections have their own path and serial number. */
+    if(cip_io_remove(plc, fc_req.client_connection_serial_number, fc_req.client_vendor_id, fc_req.client_serial_number)) {
+        offset = 0;
+        slice_set_uint8(output, offset, slice_get_uint8(input, 0) | CIP_DONE); offset++;
+        slice_set_uint8(output, offset, 0); offset++; /* padding/reserved. */
+        slice_set_uint8(output, offset, 0); offset++; /* no error. */
+        slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
+
+        slice_set_uint16_le(output, offset, fc_req.client_connection_serial_number); offset += 2;
+        slice_set_uint16_le(output, offset, fc_req.client_vendor_id); offset += 2;
+        slice_set_uint32_le(output, offset, fc_req.client_serial_number); offset += 4;
+
+        /* no application reply. */
+        slice_set_uint8(output, offset, 0); offset++;
+        slice_set_uint8(output, offset, 0); offset++;
+
+        return slice_from_slice(output, 0, offset);
+    }
+
     /*
      * why does Rockwell do this?   The path here is _NOT_ a byte-for-byte copy of the path
      * that was used to open the connection.  This one is padded with a zero byte after the path
@@ -405,7 +632,13 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
     element_count = slice_get_uint16_le(input, offset); offset += 2;
 
     if(plc->plc_type == PLC_OMRON) {
-        if(element_count != 1) {
+        uint8_t name_len = slice_get_uint8(input, 3);
+        bool has_index = ((size_t)(tag_segment_size * 2) > (size_t)(2 + name_len + (name_len & 0x01)));
+
+        /* a range starting at an element can have any count, the whole tag must be read with a count of 1. */
+        if(has_index) {
+            info("Omron read of %d elements starting at byte %zu.", element_count, read_start_offset);
+        } else if(element_count != 1) {
             info("Omron PLC requires element count to be 1, found %d!", element_count);
             return make_cip_error(output, read_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
         } else {
@@ -483,7 +716,7 @@ slice_s handle_read_request(slice_s input, slice_s output, plc_s *plc)
 
     /* FIXME - use memcpy */
     for(size_t i=0; i < amount_to_copy; i++) {
-        slice_set_uint8(output, offset + i, tag->data[byte_offset + i]);
+        slice_set_uint8(output, offset + i, tag->data[read_start_offset + byte_offset + i]);
     }
 
     offset += amount_to_copy;
@@ -567,7 +800,7 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("total_request_size = %d", total_request_size);
 
     /* check the amount */
-    if(byte_offset + total_request_size > tag_data_length) {
+    if(write_start_offset + byte_offset + total_request_size > tag_data_length) {
         info("request tries to write too much data!");
         return make_cip_error(output, write_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
     }
@@ -576,7 +809,7 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
     info("byte_offset = %d", byte_offset);
     info("offset = %d", offset);
     info("total_request_size = %d", total_request_size);
-    memcpy(&tag->data[byte_offset], slice_get_bytes(input, offset), total_request_size);
+    memcpy(&tag->data[write_start_offset + byte_offset], slice_get_bytes(input, offset), total_request_size);
 
     /* start making the response. */
     offset = 0;
@@ -592,9 +825,155 @@ slice_s handle_write_request(slice_s input, slice_s output, plc_s *plc)
 
 
 
+/*
+ * Read-Modify-Write of one element.  The OR mask sets bits and the AND
+ * mask clears them.
+ *
+ *  0x4E <path size> <tag path> <mask size 16-bit> <OR mask> <AND mask>
+ */
+
+slice_s handle_rmw_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t rmw_cmd = slice_get_uint8(input, 0);
+    uint8_t tag_segment_size = 0;
+    size_t data_offset = 0;
+    size_t offset = 0;
+    tag_def_s *tag = NULL;
+    uint16_t mask_size = 0;
+
+    if(slice_len(input) < 4) {
+        info("Insufficient data in the CIP RMW request!");
+        return make_cip_error(output, rmw_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    offset = 1;
+    tag_segment_size = slice_get_uint8(input, offset); offset++;
+
+    if(slice_len(input) < offset + (size_t)(tag_segment_size * 2) + 2) {
+        info("Request does not have enough space for the mask size!");
+        return make_cip_error(output, rmw_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(!process_tag_segment(plc, slice_from_slice(input, offset, (size_t)(tag_segment_size * 2)), &tag, &data_offset)) {
+        return make_cip_error(output, rmw_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    offset += (size_t)(tag_segment_size * 2);
+
+    mask_size = slice_get_uint16_le(input, offset); offset += 2;
+
+    if(slice_len(input) != offset + (size_t)(mask_size * 2)) {
+        info("Request masks do not match the mask size %d!", mask_size);
+        return make_cip_error(output, rmw_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(mask_size == 0 || mask_size > tag->elem_size || data_offset + mask_size > (size_t)(tag->elem_count * tag->elem_size)) {
+        info("Mask size %d does not fit the tag!", mask_size);
+        return make_cip_error(output, rmw_cmd | CIP_DONE, CIP_ERR_EXTENDED, true, CIP_ERR_EX_TOO_LONG);
+    }
+
+    info("Applying masks of %d bytes at offset %d.", mask_size, data_offset);
+
+    for(size_t i=0; i < mask_size; i++) {
+        uint8_t or_mask = slice_get_uint8(input, offset + i);
+        uint8_t and_mask = slice_get_uint8(input, offset + mask_size + i);
+
+        tag->data[data_offset + i] = (uint8_t)((tag->data[data_offset + i] | or_mask) & and_mask);
+    }
+
+    /* start making the response. */
+    offset = 0;
+    slice_set_uint8(output, offset, rmw_cmd | CIP_DONE); offset++;
+    slice_set_uint8(output, offset, 0); offset++; /* padding/reserved. */
+    slice_set_uint8(output, offset, CIP_OK); offset++; /* no error. */
+    slice_set_uint8(output, offset, 0); offset++; /* no extra error fields. */
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+
+
+
+/*
+ * Tag listing.  The request path ends with the symbol class and the first
+ * instance to return.  Each entry is:
+ *
+ *  instance ID (32-bit), type (16-bit), element size (16-bit),
+ *  dimensions (3x 32-bit), name length (16-bit), name bytes.
+ *
+ * Instance IDs are the tag's position in the list, starting at 1.
+ */
+
+slice_s handle_list_tags_request(slice_s input, slice_s output, plc_s *plc)
+{
+    uint8_t list_cmd = slice_get_uint8(input, 0);
+    uint8_t path_size = slice_get_uint8(input, 1);
+    size_t path_end = (size_t)(2 + (path_size * 2));
+    uint32_t first_id = 0;
+    uint32_t instance_id = 1;
+    size_t offset = 0;
+    bool need_frag = false;
+    tag_def_s *tag = plc->tags;
+
+    /* only controller scope, 20 6B 25 00 <id> */
+    if(path_size != 3 || slice_len(input) < path_end || slice_get_uint8(input, 2) != 0x20 || slice_get_uint8(input, 3) != 0x6B || slice_get_uint8(input, 4) != 0x25) {
+        info("Unsupported tag listing path!");
+        return make_cip_error(output, list_cmd | CIP_DONE, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    first_id = slice_get_uint16_le(input, 6);
+
+    slice_set_uint8(output, offset, list_cmd | CIP_DONE); offset++;
+    slice_set_uint8(output, offset, 0); offset++;
+    slice_set_uint8(output, offset, CIP_OK); offset++;
+    slice_set_uint8(output, offset, 0); offset++;
+
+    for(; tag; tag = tag->next_tag, instance_id++) {
+        size_t name_len = strlen(tag->name);
+        size_t entry_size = 4 + 2 + 2 + 12 + 2 + name_len;
+
+        if(instance_id < first_id) {
+            continue;
+        }
+
+        if(offset + entry_size > slice_len(output)) {
+            need_frag = true;
+            break;
+        }
+
+        slice_set_uint32_le(output, offset, instance_id); offset += 4;
+        slice_set_uint16_le(output, offset, tag->tag_type); offset += 2;
+        slice_set_uint16_le(output, offset, (uint16_t)tag->elem_size); offset += 2;
+
+        for(size_t i=0; i < 3; i++) {
+            slice_set_uint32_le(output, offset, (uint32_t)tag->dimensions[i]); offset += 4;
+        }
+
+        slice_set_uint16_le(output, offset, (uint16_t)name_len); offset += 2;
+
+        for(size_t i=0; i < name_len; i++) {
+            slice_set_uint8(output, offset + i, (uint8_t)tag->name[i]);
+        }
+
+        offset += name_len;
+    }
+
+    if(need_frag) {
+        slice_set_uint8(output, 2, CIP_ERR_FRAG);
+    }
+
+    return slice_from_slice(output, 0, offset);
+}
+
+
+
+
 /*
  * we should see:
  *  0x91 <name len> <name bytes> (<numeric segment>){0-3}
+ * or
+ *  0x20 0x6B 0x25 0x00 <instance 16-bit> (<numeric segment>){0-3}
  *
  * find the tag name, then check the numeric segments, if any, against the
  * tag dimensions.
@@ -609,32 +988,59 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
     size_t dimensions[3] = { 0, 0, 0};
     size_t dimension_index = 0;
 
-    if(symbolic_marker != CIP_SYMBOLIC_SEGMENT_MARKER)  {
+    /* a symbol class instance, the instance ID is the tag's position in the list, starting at 1. */
+    if(symbolic_marker == 0x20 && slice_get_uint8(input, 1) == 0x6B) {
+        uint32_t instance_id = 0;
+
+        if(slice_get_uint8(input, 2) == 0x25) {
+            instance_id = slice_get_uint16_le(input, 4);
+            offset = 6;
+        } else if(slice_get_uint8(input, 2) == 0x26) {
+            instance_id = slice_get_uint32_le(input, 4);
+            offset = 8;
+        } else {
+            info("Unsupported symbol instance segment type %x!", slice_get_uint8(input, 2));
+            return false;
+        }
+
+        *tag = plc->tags;
+
+        for(uint32_t i = 1; *tag && i < instance_id; i++) {
+            *tag = (*tag)->next_tag;
+        }
+
+        if(instance_id == 0 || !*tag) {
+            info("Symbol instance %u not found!", (unsigned int)instance_id);
+            return false;
+        }
+
+        info("Found tag %s by instance %u", (*tag)->name, (unsigned int)instance_id);
+    } else if(symbolic_marker != CIP_SYMBOLIC_SEGMENT_MARKER)  {
         info("Expected symbolic segment but found %x!", symbolic_marker);
         return false;
-    }
+    } else {
+        /* get and check the length of the symbolic name part. */
+        name_len = slice_get_uint8(input, offset); offset++;
+        if(name_len >= slice_len(input)) {
+            info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
+            return false;
+        }
 
-    /* get and check the length of the symbolic name part. */
-    name_len = slice_get_uint8(input, offset); offset++;
-    if(name_len >= slice_len(input)) {
-        info("Insufficient space in symbolic segment for name.   Needed %d bytes but only had %d bytes!", name_len, slice_len(input)-1);
-        return false;
-    }
+        /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
+        offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
 
-    /* bump the offset.   Must be 16-bit aligned, so pad if needed. */
-    offset += (size_t)(name_len + ((name_len & 0x01) ? 1 : 0));
+        /* try to find the tag. */
+        tag_name = slice_from_slice(input, 2, name_len);
+        *tag = plc->tags;
 
-    /* try to find the tag. */
-    tag_name = slice_from_slice(input, 2, name_len);
-    *tag = plc->tags;
+        while(*tag) {
+            if(slice_match_string(tag_name, (*tag)->name)) {
+                info("Found tag %s", (*tag)->name);
+                break;
+            }
 
-    while(*tag) {
-        if(slice_match_string(tag_name, (*tag)->name)) {
-            info("Found tag %s", (*tag)->name);
-            break;
+            (*tag) = (*tag)->next_tag;
         }
-
-        (*tag) = (*tag)->next_tag;
     }
 
     if(*tag) {
@@ -707,7 +1113,7 @@ bool process_tag_segment(plc_s *plc, slice_s input, tag_def_s **tag, size_t *sta
             *start_read_offset = 0;
         }
     } else {
-        info("Tag %.*s not found!", slice_len(tag_name), (const char *)(tag_name.data));
+        info("Tag %.*s not found!", (int)name_len, (const char *)(input.data + 2));
         return false;
     }
 
@@ -0,0 +1,211 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "cip_io.h"
+#include "slice.h"
+#include "socket.h"
+#include "utils.h"
+
+/*
+ * Class 1 connections produce a tag to the client over UDP at the RPI.
+ * The client sends heartbeats back to us at its own RPI and we drop
+ * the connection if they stop.
+ */
+
+#define CIP_IO_PORT "2222"
+#define CIP_IO_ITEM_SAI ((uint16_t)0x8002) /* sequenced address item */
+#define CIP_IO_ITEM_CDI ((uint16_t)0x00B1) /* connected data item */
+#define CIP_IO_HEADER_SIZE (20)            /* items, sequence count included. */
+#define CIP_IO_BUF_SIZE (600)
+
+static void receive_heartbeats(plc_s *plc, int64_t now);
+static void send_data(plc_s *plc, io_conn_s *conn);
+
+
+io_conn_s *cip_io_add(plc_s *plc)
+{
+    for(int i = 0; i < MAX_IO_CONNS; i++) {
+        io_conn_s *conn = &plc->io_conns[i];
+
+        if(!conn->active) {
+            if(plc->io_sock < 0) {
+                plc->io_sock = socket_udp_open(CIP_IO_PORT);
+
+                if(plc->io_sock < 0) {
+                    info("Unable to open UDP socket for class 1 connections!");
+                    return NULL;
+                }
+            }
+
+            memset(conn, 0, sizeof(*conn));
+            conn->active = true;
+            conn->next_send_ms = util_time_ms();
+            conn->last_heartbeat_ms = conn->next_send_ms;
+
+            return conn;
+        }
+    }
+
+    info("No free class 1 connections!");
+
+    return NULL;
+}
+
+
+bool cip_io_remove(plc_s *plc, uint16_t conn_serial_number, uint16_t orig_vendor_id, uint32_t orig_serial_number)
+{
+    for(int i = 0; i < MAX_IO_CONNS; i++) {
+        io_conn_s *conn = &plc->io_conns[i];
+
+        if(conn->active &&
+           conn->conn_serial_number == conn_serial_number &&
+           conn->orig_vendor_id == orig_vendor_id &&
+           conn->orig_serial_number == orig_serial_number) {
+            info("Closing class 1 connection %x.", conn->client_conn_id);
+            conn->active = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+void cip_io_tick(plc_s *plc)
+{
+    int64_t now = util_time_ms();
+
+    if(plc->io_sock < 0) {
+        return;
+    }
+
+    receive_heartbeats(plc, now);
+
+    for(int i = 0; i < MAX_IO_CONNS; i++) {
+        io_conn_s *conn = &plc->io_conns[i];
+
+        if(!conn->active) {
+            continue;
+        }
+
+        if(now - conn->last_heartbeat_ms > (int64_t)conn->timeout_ms) {
+            info("Class 1 connection %x timed out.", conn->client_conn_id);
+            conn->active = false;
+            continue;
+        }
+
+        if(conn->client_ip && now >= conn->next_send_ms) {
+            send_data(plc, conn);
+
+            /* do not try to catch up if we fell behind. */
+            conn->next_send_ms += conn->rpi_ms;
+            if(conn->next_send_ms < now) {
+                conn->next_send_ms = now + conn->rpi_ms;
+            }
+        }
+    }
+}
+
+
+
+void receive_heartbeats(plc_s *plc, int64_t now)
+{
+    uint8_t buf[CIP_IO_BUF_SIZE];
+    slice_s packet;
+    uint32_t from_ip = 0;
+    uint16_t from_port = 0;
+
+    do {
+        packet = socket_udp_read(plc->io_sock, slice_make(buf, (ssize_t)sizeof(buf)), &from_ip, &from_port);
+
+        if(slice_has_err(packet) || slice_len(packet) < 10) {
+            break;
+        }
+
+        if(slice_get_uint16_le(packet, 2) != CIP_IO_ITEM_SAI || slice_get_uint16_le(packet, 4) != 8) {
+            info("Unexpected class 1 packet:");
+            slice_dump(packet);
+            continue;
+        }
+
+        for(int i = 0; i < MAX_IO_CONNS; i++) {
+            io_conn_s *conn = &plc->io_conns[i];
+
+            if(conn->active && conn->server_conn_id == slice_get_uint32_le(packet, 6)) {
+                conn->last_heartbeat_ms = now;
+
+                /* the client did not tell us where to send the data, so answer where it came from. */
+                if(!conn->client_ip) {
+                    conn->client_ip = from_ip;
+                    conn->client_port = from_port;
+                }
+
+                break;
+            }
+        }
+    } while(1);
+}
+
+
+void send_data(plc_s *plc, io_conn_s *conn)
+{
+    uint8_t buf[CIP_IO_BUF_SIZE];
+    slice_s packet = slice_make(buf, (ssize_t)sizeof(buf));
+    size_t data_size = conn->tag->elem_size * conn->tag->elem_count;
+    size_t offset = 0;
+
+    if(data_size + CIP_IO_HEADER_SIZE > sizeof(buf)) {
+        return;
+    }
+
+    conn->seq_num++;
+    conn->cip_seq++;
+
+    slice_set_uint16_le(packet, offset, 2); offset += 2; /* two items. */
+    slice_set_uint16_le(packet, offset, CIP_IO_ITEM_SAI); offset += 2;
+    slice_set_uint16_le(packet, offset, 8); offset += 2;
+    slice_set_uint32_le(packet, offset, conn->client_conn_id); offset += 4;
+    slice_set_uint32_le(packet, offset, conn->seq_num); offset += 4;
+    slice_set_uint16_le(packet, offset, CIP_IO_ITEM_CDI); offset += 2;
+    slice_set_uint16_le(packet, offset, (uint16_t)(data_size + 2)); offset += 2;
+    slice_set_uint16_le(packet, offset, conn->cip_seq); offset += 2;
+
+    memcpy(&buf[offset], conn->tag->data, data_size); offset += data_size;
+
+    if(socket_udp_write(plc->io_sock, slice_from_slice(packet, 0, offset), conn->client_ip, conn->client_port) < 0) {
+        info("Unable to send class 1 data for connection %x!", conn->client_conn_id);
+    }
+}
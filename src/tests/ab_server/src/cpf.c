@@ -41,6 +41,9 @@
 #define CPF_ITEM_CAI ((uint16_t)0x00A1) /* connected address item */
 #define CPF_ITEM_CDI ((uint16_t)0x00B1) /* connected data item */
 #define CPF_ITEM_UDI ((uint16_t)0x00B2) /* Unconnected data item */
+#define CPF_ITEM_SOCKADDR_T2O ((uint16_t)0x8001) /* T->O socket address item */
+
+#define CPF_SOCKADDR_ITEM_SIZE (20)
 
 
 typedef struct {
@@ -75,6 +78,7 @@ slice_s handle_cpf_unconnected(slice_s input, slice_s output, plc_s *plc)
 {
     slice_s result;
     cpf_uc_header_s header;
+    size_t extra_items_size = 0;
 
     info("handle_cpf_unconnected(): got packet:");
     slice_dump(input);
@@ -90,8 +94,10 @@ slice_s handle_cpf_unconnected(slice_s input, slice_s output, plc_s *plc)
     header.router_timeout = slice_get_uint16_le(input, 4);
     header.item_count = slice_get_uint16_le(input, 6);
 
-    /* sanity check the number of items. */
-    if(header.item_count != (uint16_t)2) {
+    /* sanity check the number of items.  A class 1 Forward Open can add a socket address item. */
+    if(header.item_count == (uint16_t)3) {
+        extra_items_size = CPF_SOCKADDR_ITEM_SIZE;
+    } else if(header.item_count != (uint16_t)2) {
         info("Unsupported unconnected CPF packet, expected two items but found %u!", header.item_count);
         return slice_make_err(EIP_ERR_BAD_REQUEST);
     }
@@ -117,13 +123,27 @@ slice_s handle_cpf_unconnected(slice_s input, slice_s output, plc_s *plc)
         return slice_make_err(EIP_ERR_BAD_REQUEST);
     }
 
-    if(header.item_data_length != (slice_len(input) - CPF_UCONN_HEADER_SIZE)) {
-        info("CPF unconnected payload length, %d, does not match passed length, %d!", (slice_len(input) - CPF_UCONN_HEADER_SIZE - 2), header.item_data_length);
+    if((size_t)header.item_data_length + extra_items_size != (slice_len(input) - CPF_UCONN_HEADER_SIZE)) {
+        info("CPF unconnected payload length, %d, does not match passed length, %d!", (slice_len(input) - CPF_UCONN_HEADER_SIZE - extra_items_size), header.item_data_length);
         return slice_make_err(EIP_ERR_BAD_REQUEST);
     }
 
+    if(extra_items_size) {
+        slice_s sockaddr = slice_from_slice(input, (size_t)CPF_UCONN_HEADER_SIZE + header.item_data_length, CPF_SOCKADDR_ITEM_SIZE);
+        uint8_t *sin = slice_get_bytes(sockaddr, 4);
+
+        if(slice_get_uint16_le(sockaddr, 0) != CPF_ITEM_SOCKADDR_T2O || slice_get_uint16_le(sockaddr, 2) != (uint16_t)16 || !sin) {
+            info("Expected T->O socket address item but found %x!", slice_get_uint16_le(sockaddr, 0));
+            return slice_make_err(EIP_ERR_BAD_REQUEST);
+        }
+
+        /* the socket address fields are big-endian. */
+        plc->t2o_port = (uint16_t)(((uint16_t)sin[2] << 8) | (uint16_t)sin[3]);
+        plc->t2o_ip = ((uint32_t)sin[4] << 24) | ((uint32_t)sin[5] << 16) | ((uint32_t)sin[6] << 8) | (uint32_t)sin[7];
+    }
+
     /* dispatch and handle the result. */
-    result = cip_dispatch_request(slice_from_slice(input, (size_t)CPF_UCONN_HEADER_SIZE, (size_t)((uint16_t)slice_len(input) - CPF_UCONN_HEADER_SIZE)),
+    result = cip_dispatch_request(slice_from_slice(input, (size_t)CPF_UCONN_HEADER_SIZE, (size_t)header.item_data_length),
                                 slice_from_slice(output, (size_t)CPF_UCONN_HEADER_SIZE, (size_t)((uint16_t)slice_len(output) - CPF_UCONN_HEADER_SIZE)),
                                 plc);
 
@@ -141,6 +161,10 @@ slice_s handle_cpf_unconnected(slice_s input, slice_s output, plc_s *plc)
         result = slice_from_slice(output, (size_t)0, (size_t)(slice_len(result) + (ssize_t)CPF_UCONN_HEADER_SIZE));
     }
 
+    /* the socket address only applies to this request. */
+    plc->t2o_ip = 0;
+    plc->t2o_port = 0;
+
     /* errors are pass through. */
 
     return result;
@@ -214,13 +238,15 @@ slice_s handle_cpf_connected(slice_s input, slice_s output, plc_s *plc)
 
     if(!slice_has_err(result)) {
         /* build outbound header. */
-        slice_set_uint16_le(output, 0, 2); /* two items. */
-        slice_set_uint16_le(output, 2, CPF_ITEM_CAI); /* connected address type. */
-        slice_set_uint16_le(output, 4, 4); /* connection ID is 4 bytes. */
-        slice_set_uint32_le(output, 6, plc->client_connection_id);
-        slice_set_uint16_le(output, 10, CPF_ITEM_CDI); /* connected data type */
-        slice_set_uint16_le(output, 12, (uint16_t)(slice_len(result) + 2)); /* result from CIP processing downstream.  Plus 2 bytes for sequence number. */
-        slice_set_uint16_le(output, 14, plc->client_connection_seq);
+        slice_set_uint32_le(output, 0, header.interface_handle);
+        slice_set_uint16_le(output, 4, header.router_timeout);
+        slice_set_uint16_le(output, 6, 2); /* two items. */
+        slice_set_uint16_le(output, 8, CPF_ITEM_CAI); /* connected address type. */
+        slice_set_uint16_le(output, 10, 4); /* connection ID is 4 bytes. */
+        slice_set_uint32_le(output, 12, plc->client_connection_id);
+        slice_set_uint16_le(output, 16, CPF_ITEM_CDI); /* connected data type */
+        slice_set_uint16_le(output, 18, (uint16_t)(slice_len(result) + 2)); /* result from CIP processing downstream.  Plus 2 bytes for sequence number. */
+        slice_set_uint16_le(output, 20, header.conn_seq); /* the reply has the sequence number of the request. */
 
         /* create a new slice with the CPF header and the response packet in it. */
         result = slice_from_slice(output, (size_t)0, (size_t)(slice_len(result) + CPF_CONN_HEADER_SIZE));
@@ -99,8 +99,9 @@ slice_s eip_dispatch_request(slice_s input, slice_s raw_output, plc_s *plc)
             break;
 
         case EIP_UNCONNECTED_SEND:
+            /* a Forward Open from an earlier client must not make unconnected replies bigger. */
             response = handle_cpf_unconnected(slice_from_slice(input, EIP_HEADER_SIZE, slice_len(input) - EIP_HEADER_SIZE),
-                                              slice_from_slice(output, EIP_HEADER_SIZE, slice_len(output) - EIP_HEADER_SIZE),
+                                              slice_from_slice(output, EIP_HEADER_SIZE, (slice_len(output) < plc->unconnected_max_packet ? slice_len(output) : plc->unconnected_max_packet) - EIP_HEADER_SIZE),
                                               plc);
             break;
 
@@ -48,18 +48,23 @@
 #include <strings.h>
 #endif
 
+#include "cip_io.h"
 #include "eip.h"
 #include "plc.h"
 #include "slice.h"
 #include "tcp_server.h"
 #include "utils.h"
 
+/* PCCC PLCs limit the message itself, the EIP and unconnected CPF headers come on top. */
+#define PCCC_PACKET_HEADERS (24 + 16)
+
 static void usage(void);
 static void process_args(int argc, const char **argv, plc_s *plc);
 static void parse_path(const char *path, plc_s *plc);
 static void parse_pccc_tag(const char *tag, plc_s *plc);
 static void parse_cip_tag(const char *tag, plc_s *plc);
-static slice_s request_handler(slice_s input, slice_s output, void *plc);
+static slice_s request_handler(slice_s input, slice_s output, size_t *used, void *plc);
+static void tick_handler(void *plc);
 
 
 #ifdef IS_WINDOWS
@@ -157,14 +162,17 @@ int main(int argc, const char **argv)
 
     /* clear out context to make sure we do not get gremlins */
     memset(&plc, 0, sizeof(plc));
+    plc.io_sock = -1;
 
     /* set the random seed. */
     srand((unsigned int)time(NULL));
 
     process_args(argc, argv, &plc);
 
+    plc.unconnected_max_packet = plc.server_to_client_max_packet;
+
     /* open a server connection and listen on the right port. */
-    server = tcp_server_create("0.0.0.0", "44818", server_buf, request_handler, &plc);
+    server = tcp_server_create("0.0.0.0", "44818", server_buf, request_handler, tick_handler, &plc);
 
     tcp_server_start(server, &done);
 
@@ -282,8 +290,8 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->path[2] = (uint8_t)0x24; 
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = 244 + PCCC_PACKET_HEADERS;
+                plc->server_to_client_max_packet = 244 + PCCC_PACKET_HEADERS;
                 needs_path = false;
                 has_plc = true;
             } else if(str_cmp_i(&(argv[i][6]), "SLC500") == 0) {
@@ -294,8 +302,8 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->path[2] = (uint8_t)0x24; 
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = 244 + PCCC_PACKET_HEADERS;
+                plc->server_to_client_max_packet = 244 + PCCC_PACKET_HEADERS;
                 needs_path = false;
                 has_plc = true;
             } else if(str_cmp_i(&(argv[i][6]), "Micrologix") == 0) {
@@ -306,8 +314,8 @@ void process_args(int argc, const char **argv, plc_s *plc)
                 plc->path[2] = (uint8_t)0x24; 
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = 244 + PCCC_PACKET_HEADERS;
+                plc->server_to_client_max_packet = 244 + PCCC_PACKET_HEADERS;
                 needs_path = false;
                 has_plc = true;
             } else {
@@ -697,17 +705,30 @@ void parse_cip_tag(const char *tag_str, plc_s *plc)
  * request type handler.
  */
 
-slice_s request_handler(slice_s input, slice_s output, void *plc)
+slice_s request_handler(slice_s input, slice_s output, size_t *used, void *plc)
 {
     /* check to see if we have a full packet. */
     if(slice_len(input) >= EIP_HEADER_SIZE) {
         uint16_t eip_len = slice_get_uint16_le(input, 2);
 
         if(slice_len(input) >= (size_t)(EIP_HEADER_SIZE + eip_len)) {
-            return eip_dispatch_request(input, output, (plc_s *)plc);
+            /* the client may have sent more packets behind this one. */
+            *used = (size_t)(EIP_HEADER_SIZE + eip_len);
+
+            return eip_dispatch_request(slice_from_slice(input, 0, *used), output, (plc_s *)plc);
         }
     }
 
     /* we do not have a complete packet, get more data. */
     return slice_make_err(TCP_SERVER_INCOMPLETE);
 }
+
+
+/*
+ * Called between requests to produce data on class 1 connections.
+ */
+
+void tick_handler(void *plc)
+{
+    cip_io_tick((plc_s *)plc);
+}
@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -70,6 +71,27 @@ struct tag_def_s {
 
 typedef struct tag_def_s tag_def_s;
 
+/* a class 1 connection producing a tag over UDP. */
+#define MAX_IO_CONNS (16)
+
+typedef struct {
+    bool active;
+    struct tag_def_s *tag;
+    uint32_t server_conn_id;                /* heartbeats from the client use this. */
+    uint32_t client_conn_id;                /* the data we send uses this. */
+    uint16_t conn_serial_number;
+    uint16_t orig_vendor_id;
+    uint32_t orig_serial_number;
+    uint32_t rpi_ms;
+    uint32_t timeout_ms;
+    uint32_t client_ip;                     /* zero until known. */
+    uint16_t client_port;
+    uint32_t seq_num;
+    uint16_t cip_seq;
+    int64_t next_send_ms;
+    int64_t last_heartbeat_ms;
+} io_conn_s;
+
 typedef enum {
     PLC_CONTROL_LOGIX,
     PLC_MICRO800,
@@ -101,6 +123,17 @@ typedef struct {
     uint32_t client_to_server_max_packet;
     uint32_t server_to_client_max_packet;
 
+    /* the size before any Forward Open, unconnected replies never get bigger. */
+    uint32_t unconnected_max_packet;
+
+    /* class 1 connections, the UDP socket is opened on first use. */
+    int io_sock;
+    io_conn_s io_conns[MAX_IO_CONNS];
+
+    /* T->O socket address from the CPF of the current request, port is zero if none. */
+    uint32_t t2o_ip;
+    uint16_t t2o_port;
+
     /* PCCC info */
     uint16_t pccc_seq_id;
 
@@ -39,8 +39,10 @@
 #else
     #include <arpa/inet.h>
     #include <errno.h>
+    #include <fcntl.h>
     #include <netdb.h>
     #include <netinet/in.h>
+    #include <netinet/tcp.h>
     #include <sys/socket.h>
     #include <sys/time.h>
     #include <sys/types.h>
@@ -243,7 +245,15 @@ int socket_accept(int sock)
     if (num_accept_ready > 0) {
         info("Ready to accept on %d sockets.", num_accept_ready);
         if (FD_ISSET(sock, &accept_fd_set)) {
-            return (int)accept(sock, NULL, NULL);
+            int client_sock = (int)accept(sock, NULL, NULL);
+            int sock_opt = 1;
+
+            /* clients can send several requests at once, do not hold back the replies. */
+            if(client_sock >= 0 && setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&sock_opt, sizeof(sock_opt))) {
+                info("WARN: Unable to set TCP_NODELAY on the client socket.");
+            }
+
+            return client_sock;
         }
     } else if (num_accept_ready < 0) {
         info("Error selecting the listen socket!");
@@ -323,3 +333,132 @@ int socket_write(int sock, slice_s out_buf)
     return (int)(unsigned int)total_bytes_written;
 }
 
+
+
+/* wait up to the timeout for data or a close on the socket. */
+bool socket_can_read(int sock, int timeout_ms)
+{
+    fd_set read_fd_set;
+    TIMEVAL timeout;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    FD_ZERO(&read_fd_set);
+    FD_SET(sock, &read_fd_set);
+
+    /* an error counts as readable so the read will see it. */
+    return (select(sock+1, &read_fd_set, NULL, NULL, &timeout) != 0);
+}
+
+
+
+/* open a non-blocking UDP socket bound to the port on all interfaces. */
+int socket_udp_open(const char *port)
+{
+    struct sockaddr_in addr;
+    int sock;
+    int port_num = atoi(port);
+
+    sock = (int)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(sock < 0) {
+        info("ERROR: Unable to create UDP socket!");
+        return SOCKET_ERR_CREATE;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port_num);
+
+    if(bind(sock, (struct sockaddr *)&addr, (socklen_t)sizeof(addr)) < 0) {
+        info("ERROR: Unable to bind UDP socket to port %s!", port);
+        socket_close(sock);
+        return SOCKET_ERR_BIND;
+    }
+
+#ifdef IS_WINDOWS
+    {
+        u_long non_blocking = 1;
+
+        if(ioctlsocket(sock, FIONBIO, &non_blocking)) {
+            info("ERROR: Unable to set UDP socket to non-blocking!");
+            socket_close(sock);
+            return SOCKET_ERR_SETOPT;
+        }
+    }
+#else
+    if(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+        info("ERROR: Unable to set UDP socket to non-blocking!");
+        socket_close(sock);
+        return SOCKET_ERR_SETOPT;
+    }
+#endif
+
+    return sock;
+}
+
+
+
+/* read one datagram if there is one.  The address and port are in host byte order. */
+slice_s socket_udp_read(int sock, slice_s in_buf, uint32_t *from_ip, uint16_t *from_port)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = (socklen_t)sizeof(addr);
+    int rc;
+
+    memset(&addr, 0, sizeof(addr));
+
+#ifdef IS_WINDOWS
+    rc = (int)recvfrom(sock, (char *)in_buf.data, (int)in_buf.len, 0, (struct sockaddr *)&addr, &addr_len);
+#else
+    rc = (int)recvfrom(sock, (char *)in_buf.data, (size_t)in_buf.len, 0, (struct sockaddr *)&addr, &addr_len);
+#endif
+
+    if(rc < 0) {
+#ifdef IS_WINDOWS
+        rc = WSAGetLastError();
+        if(rc == WSAEWOULDBLOCK || rc == WSAECONNRESET) {
+#else
+        rc = errno;
+        if(rc == EAGAIN || rc == EWOULDBLOCK || rc == ECONNREFUSED) {
+#endif
+            rc = 0;
+        } else {
+            info("UDP socket read error rc=%d.\n", rc);
+            rc = SOCKET_ERR_READ;
+        }
+    } else {
+        *from_ip = ntohl(addr.sin_addr.s_addr);
+        *from_port = ntohs(addr.sin_port);
+    }
+
+    return ((rc>=0) ? slice_from_slice(in_buf, 0, (size_t)(unsigned int)rc) : slice_make_err(rc));
+}
+
+
+
+/* send one datagram.  The address and port are in host byte order. */
+int socket_udp_write(int sock, slice_s out_buf, uint32_t to_ip, uint16_t to_port)
+{
+    struct sockaddr_in addr;
+    int rc;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(to_ip);
+    addr.sin_port = htons(to_port);
+
+#ifdef IS_WINDOWS
+    rc = (int)sendto(sock, (char *)out_buf.data, (int)out_buf.len, 0, (struct sockaddr *)&addr, (int)sizeof(addr));
+#else
+    rc = (int)sendto(sock, (char *)out_buf.data, (size_t)out_buf.len, 0, (struct sockaddr *)&addr, (socklen_t)sizeof(addr));
+#endif
+
+    if(rc < 0) {
+        info("UDP socket write error.");
+        return SOCKET_ERR_WRITE;
+    }
+
+    return rc;
+}
@@ -33,6 +33,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "slice.h"
 
 typedef enum {
@@ -54,4 +56,9 @@ extern void socket_close(int sock);
 extern int socket_accept(int sock);
 extern slice_s socket_read(int sock, slice_s in_buf);
 extern int socket_write(int sock, slice_s out_buf);
+extern bool socket_can_read(int sock, int timeout_ms);
+
+extern int socket_udp_open(const char *port);
+extern slice_s socket_udp_read(int sock, slice_s in_buf, uint32_t *from_ip, uint16_t *from_port);
+extern int socket_udp_write(int sock, slice_s out_buf, uint32_t to_ip, uint16_t to_port);
 
@@ -36,6 +36,7 @@
 #include <limits.h>
 #include <stdlib.h>
 #include "slice.h"
+#include <string.h>
 #include "socket.h"
 #include "tcp_server.h"
 #include "utils.h"
@@ -43,12 +44,14 @@
 struct tcp_server {
     int sock_fd;
     slice_s buffer;
-    slice_s (*handler)(slice_s input, slice_s output, void *context);
+    slice_s input;
+    slice_s (*handler)(slice_s input, slice_s output, size_t *used, void *context);
+    void (*tick)(void *context);
     void *context;
 };
 
 
-tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context)
+tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffer, slice_s (*handler)(slice_s input, slice_s output, size_t *used, void *context), void (*tick)(void *context), void *context)
 {
     tcp_server_p server = calloc(1, sizeof(*server));
 
@@ -60,7 +63,14 @@ tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffe
         }
 
         server->buffer = buffer;
+
+        /* the reply is built in the buffer, so requests that arrived behind the current one are kept here. */
+        server->input = slice_make(calloc(1, slice_len(buffer)), (ssize_t)slice_len(buffer));
+        if(!server->input.data) {
+            error("ERROR: Unable to allocate input buffer!");
+        }
         server->handler = handler;
+        server->tick = tick;
         server->context = context;
     }
 
@@ -70,16 +80,21 @@ tcp_server_p tcp_server_create(const char *host, const char *port, slice_s buffe
 void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
 {
     int client_fd;
-    bool done = false;
 
     info("Waiting for new client connection.");
 
     do {
+        if(server->tick) {
+            server->tick(server->context);
+        }
+
         client_fd = socket_accept(server->sock_fd);
 
         if(client_fd >= 0) {
-            slice_s tmp_input = server->buffer;
+            slice_s tmp_input;
             slice_s tmp_output;
+            size_t input_len = 0;
+            size_t used = 0;
             int rc;
 
             info("Got new client connection, going into processing loop.");
@@ -87,17 +102,38 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
             do {
                 rc = TCP_SERVER_PROCESSED;
 
-                /* get an incoming packet or a partial packet. */
-                tmp_input = socket_read(client_fd, tmp_input);
+                /* the client can send more than one request without waiting, only read when nothing is left. */
+                if(input_len == 0) {
+                    /* keep periodic work going while the client is quiet. */
+                    if(server->tick) {
+                        server->tick(server->context);
 
-                if((rc = slice_has_err(tmp_input))) {
-                    info("WARN: error response reading socket! error %d", rc);
-                    rc = TCP_SERVER_DONE;
-                    break;
+                        if(!socket_can_read(client_fd, 1)) {
+                            continue;
+                        }
+                    }
+
+                    /* get an incoming packet or a partial packet. */
+                    tmp_input = socket_read(client_fd, server->input);
+
+                    if(slice_has_err(tmp_input)) {
+                        info("WARN: error response reading socket! error %d", slice_get_err(tmp_input));
+                        rc = TCP_SERVER_DONE;
+                        break;
+                    }
+
+                    input_len = slice_len(tmp_input);
                 }
 
-                /* try to process the packet. */
-                tmp_output = server->handler(tmp_input, server->buffer, server->context);
+                /* try to process the first packet. */
+                used = 0;
+                tmp_output = server->handler(slice_from_slice(server->input, 0, input_len), server->buffer, &used, server->context);
+
+                /* move up anything after the packet that was used. */
+                if(used > 0 && used <= input_len) {
+                    memmove(server->input.data, server->input.data + used, input_len - used);
+                    input_len -= used;
+                }
 
                 /* check the response. */
                 if(!slice_has_err(tmp_output)) {
@@ -110,19 +146,33 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
                         rc = TCP_SERVER_DONE;
                         break;
                     } else {
-                        /* all good. Reset the buffers etc. */
-                        tmp_input = server->buffer;
+                        /* all good. */
                         rc = TCP_SERVER_PROCESSED;
                     }
                 } else {
                     /* there was some sort of error or exceptional condition. */
-                    switch((rc = slice_get_err(tmp_input))) {
+                    switch((rc = slice_get_err(tmp_output))) {
                         case TCP_SERVER_DONE:
-                            done = true;
+                            /* the client is finished, wait for the next one. */
                             break;
 
                         case TCP_SERVER_INCOMPLETE:
-                            tmp_input = slice_from_slice(server->buffer, slice_len(tmp_input), slice_len(server->buffer) - slice_len(tmp_input));
+                            if(input_len >= slice_len(server->input)) {
+                                info("WARN: Packet is larger than the input buffer!");
+                                rc = TCP_SERVER_DONE;
+                                break;
+                            }
+
+                            /* get the rest of the packet after what we have. */
+                            tmp_input = socket_read(client_fd, slice_from_slice(server->input, input_len, slice_len(server->input) - input_len));
+
+                            if(slice_has_err(tmp_input)) {
+                                info("WARN: error response reading socket! error %d", slice_get_err(tmp_input));
+                                rc = TCP_SERVER_DONE;
+                                break;
+                            }
+
+                            input_len += slice_len(tmp_input);
                             break;
 
                         case TCP_SERVER_PROCESSED:
@@ -130,7 +180,7 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
 
                         case TCP_SERVER_UNSUPPORTED:
                             info("WARN: Unsupported packet!");
-                            slice_dump(tmp_input);
+                            slice_dump(slice_from_slice(server->input, 0, input_len));
                             break;
 
                         default:
@@ -149,7 +199,7 @@ void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate)
 
         /* wait a bit to give back the CPU. */
         util_sleep_ms(1);
-    } while(!done && !*terminate);
+    } while(!*terminate);
 }
 
 
@@ -161,6 +211,10 @@ void tcp_server_destroy(tcp_server_p server)
             socket_close(server->sock_fd);
             server->sock_fd = INT_MIN;
         }
+
+        if(server->input.data) {
+            free(server->input.data);
+        }
         free(server);
     }
 }
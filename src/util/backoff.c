@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <limits.h>
+#include <stdlib.h>
+#include <lib/libplctag.h>
+#include <platform.h>
+#include <util/backoff.h>
+#include <util/debug.h>
+
+
+#define BACKOFF_DEFAULT_MAX_MS (60000)
+#define BACKOFF_DEFAULT_BREAKER_THRESHOLD (3)
+
+
+/*
+ * backoff_init
+ *
+ * Set up from the retry_min_ms, retry_max_ms and breaker_threshold attributes.
+ */
+
+void backoff_init(backoff_t *backoff, attr attribs, int default_min_ms)
+{
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    backoff->min_ms = attr_get_int(attribs, "retry_min_ms", default_min_ms);
+    if(backoff->min_ms <= 0) {
+        pdebug(DEBUG_WARN, "retry_min_ms must be positive, using %dms.", default_min_ms);
+        backoff->min_ms = default_min_ms;
+    }
+
+    backoff->max_ms = attr_get_int(attribs, "retry_max_ms", BACKOFF_DEFAULT_MAX_MS);
+    if(backoff->max_ms < backoff->min_ms) {
+        pdebug(DEBUG_WARN, "retry_max_ms must not be less than retry_min_ms, using %dms.", backoff->min_ms);
+        backoff->max_ms = backoff->min_ms;
+    }
+
+    backoff->breaker_threshold = attr_get_int(attribs, "breaker_threshold", BACKOFF_DEFAULT_BREAKER_THRESHOLD);
+    if(backoff->breaker_threshold < 0) {
+        pdebug(DEBUG_WARN, "breaker_threshold must not be negative, disabling the breaker.");
+        backoff->breaker_threshold = 0;
+    }
+
+    backoff->failures = 0;
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+
+/*
+ * backoff_fail
+ *
+ * Count a failure and return the number of milliseconds to wait before
+ * trying again.
+ */
+
+int backoff_fail(backoff_t *backoff)
+{
+    int delay = backoff->min_ms;
+
+    if(backoff->failures < INT_MAX) {
+        backoff->failures++;
+    }
+
+    /* double for each failure after the first, without overflowing. */
+    for(int i=1; i < backoff->failures && delay < backoff->max_ms; i++) {
+        delay = (delay > backoff->max_ms/2 ? backoff->max_ms : delay * 2);
+    }
+
+    if(delay > backoff->max_ms) {
+        delay = backoff->max_ms;
+    }
+
+    /* jitter, somewhere in the top half. */
+    delay = delay - (int)((unsigned int)rand() % (unsigned int)(delay/2 + 1));
+
+    pdebug(DEBUG_DETAIL, "Failure %d, waiting %dms before retrying.", backoff->failures, delay);
+
+    if(backoff_breaker_open(backoff)) {
+        pdebug(DEBUG_INFO, "Breaker is open after %d failures.", backoff->failures);
+    }
+
+    return delay;
+}
+
+
+
+void backoff_reset(backoff_t *backoff)
+{
+    if(backoff->failures) {
+        pdebug(DEBUG_DETAIL, "Connected after %d failures.", backoff->failures);
+    }
+
+    backoff->failures = 0;
+}
+
+
+
+int backoff_breaker_open(backoff_t *backoff)
+{
+    return (backoff->breaker_threshold > 0 && backoff->failures >= backoff->breaker_threshold);
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright (C) 2020 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#pragma once
+
+#include <util/attr.h>
+
+/*
+ * Reconnect pacing shared by the protocols.
+ *
+ * Each failure doubles the wait, from min_ms up to max_ms, and the
+ * actual wait is picked at random from the upper half of that so that
+ * many connections that failed together do not retry together.
+ *
+ * After breaker_threshold failures in a row the breaker is open and
+ * queued requests should be failed instead of left to time out.  The
+ * next connection attempt after the wait is the trial; success closes
+ * the breaker again.  A threshold of zero means never open.
+ */
+
+typedef struct {
+    int min_ms;
+    int max_ms;
+    int breaker_threshold;
+    int failures;
+} backoff_t;
+
+extern void backoff_init(backoff_t *backoff, attr attribs, int default_min_ms);
+extern int backoff_fail(backoff_t *backoff);
+extern void backoff_reset(backoff_t *backoff);
+extern int backoff_breaker_open(backoff_t *backoff);